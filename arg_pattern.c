@@ -0,0 +1,558 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arg_pattern.h"
+#include "cmd_main.h"
+
+#pragma warning (disable: 5045)
+
+/*
+* <MATCH /regex/> and <GLOB pattern> arguments are compiled once, when their command is
+* registered: the pattern is parsed into a Thompson NFA which the subset construction turns
+* into a DFA table, so validating a token is one table lookup per byte with no backtracking
+* and no allocation
+*
+* regexes support literals, '.', [classes] (with ranges and '^' negation), the \d \w \s \D \W \S
+* escapes, (groups), '|', and the '*' '+' '?' {m} {m,} {m,n} quantifiers; a leading '^' and a
+* trailing '$' are allowed, the whole token has to match anyway
+* globs support '*', '?', [classes] (negated by '!' or '^') and '\' escapes
+*/
+
+#define SET_HAS(set, byte) ((set)[(byte) >> 3] & (1 << ((byte) & 7)))
+#define SET_ADD(set, byte) ((set)[(byte) >> 3] |= (uchar)(1 << ((byte) & 7)))
+
+pattern_frag_t pattern_alt(pattern_parser_t *p);
+
+// Marks a pattern as invalid, returns a fragment to hand back to the caller
+pattern_frag_t pattern_fail(pattern_parser_t *p) {
+    p->ok = false;
+    return (pattern_frag_t) { -1, -1 };
+}
+
+// Adds a state to the NFA, returns its index (-1 if the pattern is invalid or too large)
+int pattern_state_new(pattern_parser_t *p, bool is_set) {
+    if (!p->ok)
+        return -1;
+    if (p->count == PATTERN_MAX_NFA) {
+        pattern_fail(p);
+        return -1;
+    }
+    if (p->count == p->size) {
+        uint size = p->size ? 2 * p->size : 64;
+        pattern_state_t *states = realloc(p->states, size * sizeof(pattern_state_t));
+
+        if (!states) {
+            pattern_fail(p);
+            return -1;
+        }
+        p->states = states;
+        p->size = size;
+    }
+
+    pattern_state_t *state = &p->states[p->count];
+    memset(state->set, 0, sizeof(state->set));
+    state->out[0] = state->out[1] = -1;
+    state->is_set = is_set;
+    return (int)p->count++;
+}
+
+// Makes a fragment consuming one byte of set
+pattern_frag_t pattern_frag_set(pattern_parser_t *p, const uchar *set) {
+    int start = pattern_state_new(p, true), end = pattern_state_new(p, false);
+
+    if (!p->ok)
+        return pattern_fail(p);
+    memcpy(p->states[start].set, set, sizeof(p->states[start].set));
+    p->states[start].out[0] = end;
+    return (pattern_frag_t) { start, end };
+}
+
+// Makes a fragment matching the empty string
+pattern_frag_t pattern_frag_empty(pattern_parser_t *p) {
+    int state = pattern_state_new(p, false);
+
+    return p->ok ? (pattern_frag_t) { state, state } : pattern_fail(p);
+}
+
+// Makes a fragment matching a then b
+pattern_frag_t pattern_frag_concat(pattern_parser_t *p, pattern_frag_t a, pattern_frag_t b) {
+    if (!p->ok)
+        return pattern_fail(p);
+    p->states[a.end].out[0] = b.start;
+    return (pattern_frag_t) { a.start, b.end };
+}
+
+// Makes a fragment matching a or b
+pattern_frag_t pattern_frag_alt(pattern_parser_t *p, pattern_frag_t a, pattern_frag_t b) {
+    int start = pattern_state_new(p, false), end = pattern_state_new(p, false);
+
+    if (!p->ok)
+        return pattern_fail(p);
+    p->states[start].out[0] = a.start;
+    p->states[start].out[1] = b.start;
+    p->states[a.end].out[0] = end;
+    p->states[b.end].out[0] = end;
+    return (pattern_frag_t) { start, end };
+}
+
+/*
+* Repeats a fragment
+*
+* p    - the parser
+* a    - the fragment
+* skip - whether a may be skipped altogether
+* loop - whether a may be repeated
+*
+* returns - the fragment matching a*, a+ or a?
+*/
+pattern_frag_t pattern_frag_repeat(pattern_parser_t *p, pattern_frag_t a, bool skip, bool loop) {
+    int start = skip ? pattern_state_new(p, false) : a.start, end = pattern_state_new(p, false);
+
+    if (!p->ok)
+        return pattern_fail(p);
+    if (skip) {
+        p->states[start].out[0] = a.start;
+        p->states[start].out[1] = end;
+    }
+    p->states[a.end].out[0] = end;
+    if (loop) {
+        p->states[a.end].out[0] = a.start;
+        p->states[a.end].out[1] = end;
+    }
+    return (pattern_frag_t) { start, end };
+}
+
+// Fills set with the bytes of a \d \w \s class escape (or their negations), returns false for other escapes
+bool pattern_escape_set(char c, uchar *set) {
+    const char lower = c | 0x20;
+
+    if (lower != 'd' && lower != 'w' && lower != 's')
+        return false;
+    memset(set, 0, 32);
+    for (uint byte = 1; byte < 256; ++byte) {
+        bool in = lower == 'd' ? byte >= '0' && byte <= '9'
+            : lower == 's' ? byte == ' ' || (byte >= '\t' && byte <= '\r')
+            : (byte >= '0' && byte <= '9') || ((byte | 0x20) >= 'a' && (byte | 0x20) <= 'z') || byte == '_';
+
+        if (in != (c != lower))
+            SET_ADD(set, byte);
+    }
+    return true;
+}
+
+// Parses a [class] whose '[' was already read
+pattern_frag_t pattern_class(pattern_parser_t *p) {
+    uchar set[32] = { 0 };
+    bool negate = false;
+
+    if (p->pos < p->end && (*p->pos == '^' || (p->glob && *p->pos == '!'))) {
+        negate = true;
+        p->pos++;
+    }
+    for (bool first = true; p->pos < p->end && (first || *p->pos != ']'); first = false) {
+        uchar low = (uchar)*p->pos++, high;
+
+        if (low == '\\') {
+            if (p->pos == p->end)
+                return pattern_fail(p);
+            if (!p->glob) {
+                uchar escaped[32];
+
+                if (pattern_escape_set(*p->pos, escaped)) {
+                    for (uint i = 0; i < 32; ++i)
+                        set[i] |= escaped[i];
+                    p->pos++;
+                    continue;
+                }
+            }
+            low = (uchar)*p->pos++;
+        }
+        high = low;
+        if (p->end - p->pos >= 2 && p->pos[0] == '-' && p->pos[1] != ']') {
+            high = (uchar)p->pos[1];
+            p->pos += 2;
+            if (high == '\\') {
+                if (p->pos == p->end)
+                    return pattern_fail(p);
+                high = (uchar)*p->pos++;
+            }
+            if (high < low)
+                return pattern_fail(p);
+        }
+        for (uint byte = low; byte <= high; ++byte)
+            SET_ADD(set, byte);
+    }
+    if (p->pos == p->end)
+        return pattern_fail(p);
+    p->pos++;
+
+    if (negate) {
+        for (uint i = 0; i < 32; ++i)
+            set[i] = (uchar)~set[i];
+    }
+    set[0] &= 0xFE;   // tokens never contain NUL
+    return pattern_frag_set(p, set);
+}
+
+// Makes a fragment matching any byte
+pattern_frag_t pattern_any(pattern_parser_t *p) {
+    uchar set[32];
+
+    memset(set, 0xFF, sizeof(set));
+    set[0] = 0xFE;
+    return pattern_frag_set(p, set);
+}
+
+// Makes a fragment matching one byte
+pattern_frag_t pattern_literal(pattern_parser_t *p, uchar byte) {
+    uchar set[32] = { 0 };
+
+    if (!byte)
+        return pattern_fail(p);
+    SET_ADD(set, byte);
+    return pattern_frag_set(p, set);
+}
+
+// Parses a regex atom: a literal, '.', an escape, a class or a group
+pattern_frag_t pattern_atom(pattern_parser_t *p) {
+    const char c = *p->pos++;
+    pattern_frag_t ret;
+    uchar set[32];
+
+    switch (c) {
+    case '(':
+        if (++p->depth > PATTERN_MAX_DEPTH)
+            return pattern_fail(p);
+        ret = pattern_alt(p);
+        p->depth--;
+        if (p->pos == p->end || *p->pos != ')')
+            return pattern_fail(p);
+        p->pos++;
+        return ret;
+    case '[':
+        return pattern_class(p);
+    case '.':
+        return pattern_any(p);
+    case '\\':
+        if (p->pos == p->end)
+            return pattern_fail(p);
+        if (pattern_escape_set(*p->pos, set)) {
+            p->pos++;
+            return pattern_frag_set(p, set);
+        }
+        return pattern_literal(p, (uchar)*p->pos++);
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+        return pattern_fail(p);   // nothing to repeat
+    default:
+        return pattern_literal(p, (uchar)c);
+    }
+}
+
+// Reads a number of a {m,n} quantifier, returns -1 if there is none
+int pattern_number(pattern_parser_t *p) {
+    int ret = -1;
+
+    while (p->pos < p->end && *p->pos >= '0' && *p->pos <= '9' && ret <= PATTERN_MAX_REPEAT)
+        ret = (ret < 0 ? 0 : 10 * ret) + (*p->pos++ - '0');
+    return ret;
+}
+
+// Parses an atom and its quantifier, if any
+pattern_frag_t pattern_repeat(pattern_parser_t *p) {
+    const char *atom_start = p->pos;
+    pattern_frag_t ret = pattern_atom(p);
+    int min, max;
+
+    if (!p->ok || p->pos == p->end)
+        return ret;
+    switch (*p->pos) {
+    case '*':
+        p->pos++;
+        return pattern_frag_repeat(p, ret, true, true);
+    case '+':
+        p->pos++;
+        return pattern_frag_repeat(p, ret, false, true);
+    case '?':
+        p->pos++;
+        return pattern_frag_repeat(p, ret, true, false);
+    case '{':
+        break;
+    default:
+        return ret;
+    }
+
+    p->pos++;
+    min = max = pattern_number(p);
+    if (p->pos < p->end && *p->pos == ',') {
+        p->pos++;
+        max = pattern_number(p);
+    }
+    else if (min < 0)
+        return pattern_fail(p);
+    if (p->pos == p->end || *p->pos != '}' || min < 0 || min > PATTERN_MAX_REPEAT
+        || max > PATTERN_MAX_REPEAT || (max >= 0 && max < min))
+        return pattern_fail(p);
+    const char *resume = ++p->pos;
+
+    // the atom is parsed again for each further copy, a{2,4} becomes aaa?a? and a{2,} becomes aaa*
+    pattern_frag_t copy = ret;
+    ret = pattern_frag_empty(p);
+    for (int i = 0; p->ok && (max < 0 ? i <= min : i < max); ++i) {
+        if (i) {
+            p->pos = atom_start;
+            copy = pattern_atom(p);
+        }
+        if (i >= min)
+            copy = pattern_frag_repeat(p, copy, true, max < 0);
+        ret = pattern_frag_concat(p, ret, copy);
+    }
+    p->pos = resume;
+    return ret;
+}
+
+// Parses a regex branch: the atoms up to the next '|' or ')'
+pattern_frag_t pattern_concat(pattern_parser_t *p) {
+    pattern_frag_t ret = pattern_frag_empty(p);
+
+    while (p->ok && p->pos < p->end && *p->pos != '|' && *p->pos != ')')
+        ret = pattern_frag_concat(p, ret, pattern_repeat(p));
+    return ret;
+}
+
+// Parses a regex alternation of branches
+pattern_frag_t pattern_alt(pattern_parser_t *p) {
+    pattern_frag_t ret = pattern_concat(p);
+
+    while (p->ok && p->pos < p->end && *p->pos == '|') {
+        p->pos++;
+        ret = pattern_frag_alt(p, ret, pattern_concat(p));
+    }
+    return ret;
+}
+
+// Parses a glob
+pattern_frag_t pattern_glob(pattern_parser_t *p) {
+    pattern_frag_t ret = pattern_frag_empty(p);
+
+    while (p->ok && p->pos < p->end) {
+        const char c = *p->pos++;
+        pattern_frag_t next;
+
+        if (c == '*')
+            next = pattern_frag_repeat(p, pattern_any(p), true, true);
+        else if (c == '?')
+            next = pattern_any(p);
+        else if (c == '[')
+            next = pattern_class(p);
+        else if (c == '\\' && p->pos < p->end)
+            next = pattern_literal(p, (uchar)*p->pos++);
+        else
+            next = pattern_literal(p, (uchar)c);
+        ret = pattern_frag_concat(p, ret, next);
+    }
+    return ret;
+}
+
+// Adds the states reachable without consuming a byte to a set of NFA states
+void pattern_closure(const pattern_parser_t *p, ullong *set, int *stack) {
+    uint top = 0;
+
+    for (uint i = 0; i < p->count; ++i) {
+        if (set[i / 64] >> (i % 64) & 1)
+            stack[top++] = (int)i;
+    }
+    while (top) {
+        const pattern_state_t *state = &p->states[stack[--top]];
+
+        for (uint i = 0; i < 2 && !state->is_set; ++i) {
+            const int out = state->out[i];
+
+            if (out >= 0 && !(set[out / 64] >> (out % 64) & 1)) {
+                set[out / 64] |= 1ull << (out % 64);
+                stack[top++] = out;
+            }
+        }
+    }
+}
+
+// Splits the bytes into the classes no byte set of the NFA tells apart, returns the class count
+uint pattern_classes(const pattern_parser_t *p, uchar *classes) {
+    uint count = 1;
+
+    memset(classes, 0, 256);
+    for (uint i = 0; i < p->count && count < 256; ++i) {
+        short split[512];
+        uint next = 0;
+
+        if (!p->states[i].is_set)
+            continue;
+        memset(split, -1, sizeof(split));
+        for (uint byte = 0; byte < 256; ++byte) {
+            const uint key = 2u * classes[byte] + !!SET_HAS(p->states[i].set, byte);
+
+            if (split[key] < 0)
+                split[key] = (short)next++;
+            classes[byte] = (uchar)split[key];
+        }
+        count = next;
+    }
+    return count;
+}
+
+/*
+* Turns a parsed NFA into a DFA by the subset construction
+*
+* p      - the parser holding the NFA
+* start  - the NFA's start state
+* accept - the NFA's accepting state
+*
+* returns - the DFA (NULL if out of memory or with more than PATTERN_MAX_DFA states)
+*/
+arg_dfa_t *pattern_subsets(const pattern_parser_t *p, int start, int accept) {
+    const uint words = (p->count + 63) / 64;
+    arg_dfa_t *dfa = calloc(1, sizeof(arg_dfa_t));
+    ullong *sets = NULL, *next_set = calloc(words, sizeof(ullong));
+    int *stack = malloc(p->count * sizeof(int));
+    uchar reps[256];
+    uint size = 0;
+    bool ok = dfa && next_set && stack;
+
+    if (ok) {
+        dfa->class_cnt = pattern_classes(p, dfa->classes);
+        for (uint byte = 256; byte-- > 0;)
+            reps[dfa->classes[byte]] = (uchar)byte;
+    }
+
+    // state 0 is the empty set of NFA states, the dead state
+    for (uint i = 0; ok && i <= dfa->state_cnt; ++i) {
+        const ullong *set = i ? sets + (size_t)(i - 1) * words : NULL;
+
+        for (uint cls = 0; ok && cls < dfa->class_cnt && i; ++cls) {
+            uint found;
+
+            memset(next_set, 0, words * sizeof(ullong));
+            for (uint j = 0; j < p->count; ++j) {
+                const pattern_state_t *state = &p->states[j];
+
+                if (!set[j / 64]) {
+                    j |= 63;
+                    continue;
+                }
+                if ((set[j / 64] >> (j % 64) & 1) && state->is_set && SET_HAS(state->set, reps[cls]))
+                    next_set[state->out[0] / 64] |= 1ull << (state->out[0] % 64);
+            }
+            pattern_closure(p, next_set, stack);
+
+            for (found = 0; found < dfa->state_cnt; ++found) {
+                if (!memcmp(sets + (size_t)found * words, next_set, words * sizeof(ullong)))
+                    break;
+            }
+            // a set that is still empty after the closure is the dead state
+            bool empty = true;
+            for (uint j = 0; j < words && empty; ++j)
+                empty = !next_set[j];
+            dfa->next[(size_t)i * dfa->class_cnt + cls] = empty ? 0 : (ushort)(found + 1);
+            if (empty || found < dfa->state_cnt)
+                continue;
+
+            ok = dfa->state_cnt + 1 < PATTERN_MAX_DFA;
+            if (ok && dfa->state_cnt == size) {
+                size *= 2;
+                ullong *new_sets = realloc(sets, (size_t)size * words * sizeof(ullong));
+                ushort *new_next = realloc(dfa->next, (size_t)(size + 1) * dfa->class_cnt * sizeof(ushort));
+
+                sets = new_sets ? new_sets : sets;
+                dfa->next = new_next ? new_next : dfa->next;
+                ok = new_sets && new_next;
+                set = sets + (size_t)(i - 1) * words;
+            }
+            if (ok)
+                memcpy(sets + (size_t)dfa->state_cnt++ * words, next_set, words * sizeof(ullong));
+        }
+
+        // the start state is the closure of the NFA's start
+        if (ok && !i) {
+            size = 16;
+            sets = calloc((size_t)size * words, sizeof(ullong));
+            dfa->next = calloc((size_t)(size + 1) * dfa->class_cnt, sizeof(ushort));
+            ok = sets && dfa->next;
+            if (ok) {
+                sets[start / 64] |= 1ull << (start % 64);
+                pattern_closure(p, sets, stack);
+                dfa->state_cnt = 1;
+            }
+        }
+    }
+
+    if (ok) {
+        dfa->state_cnt++;
+        dfa->accept = calloc(dfa->state_cnt, sizeof(bool));
+        ok = dfa->accept != NULL;
+        for (uint i = 1; ok && i < dfa->state_cnt; ++i)
+            dfa->accept[i] = sets[(size_t)(i - 1) * words + accept / 64] >> (accept % 64) & 1;
+    }
+    free(sets);
+    free(next_set);
+    free(stack);
+    if (!ok) {
+        arg_dfa_destroy(dfa);
+        return NULL;
+    }
+    return dfa;
+}
+
+/*
+* Compiles a pattern into a DFA matching whole tokens
+*
+* pattern - the regex (without the slashes) or glob
+* glob    - whether pattern is a glob
+*
+* returns - the DFA (NULL if the pattern is invalid or too complex), free with arg_dfa_destroy()
+*/
+arg_dfa_t *arg_dfa_make(const char *pattern, bool glob) {
+    pattern_parser_t p = { .pos = pattern, .end = pattern + strlen(pattern), .glob = glob, .ok = true };
+    pattern_frag_t frag;
+    arg_dfa_t *ret = NULL;
+
+    if (!glob && p.pos < p.end && *p.pos == '^')
+        p.pos++;
+    if (!glob && p.end - p.pos >= 2 && p.end[-1] == '$' && p.end[-2] != '\\')
+        p.end--;
+    frag = glob ? pattern_glob(&p) : pattern_alt(&p);
+    if (p.ok && p.pos == p.end)
+        ret = pattern_subsets(&p, frag.start, frag.end);
+    else {
+        DEBUG_ONLY(printf("[WARN] Invalid or too complex pattern \"%s\"\n", pattern););
+    }
+
+    free(p.states);
+    return ret;
+}
+
+/*
+* Checks whether a DFA matches a whole string, in one pass over it
+*
+* dfa - the DFA
+* str - the string
+*
+* returns - whether str matches
+*/
+bool arg_dfa_match(const arg_dfa_t *dfa, const char *str) {
+    uint state = 1;
+
+    for (const uchar *byte = (const uchar *)str; *byte && state; ++byte)
+        state = dfa->next[(size_t)state * dfa->class_cnt + dfa->classes[*byte]];
+    return dfa->accept[state];
+}
+
+// Frees a DFA made by arg_dfa_make()
+void arg_dfa_destroy(arg_dfa_t *dfa) {
+    if (!dfa)
+        return;
+
+    free(dfa->next);
+    free(dfa->accept);
+    free(dfa);
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "typedefs.h"
+
+// bounds that keep compiling a pattern cheap, longer or more complex patterns are refused
+#define PATTERN_MAX_NFA 4096
+#define PATTERN_MAX_DFA 1024
+#define PATTERN_MAX_REPEAT 255
+#define PATTERN_MAX_DEPTH 32
+
+arg_dfa_t *arg_dfa_make(const char *pattern, bool glob);
+bool arg_dfa_match(const arg_dfa_t *dfa, const char *str);
+void arg_dfa_destroy(arg_dfa_t *dfa);
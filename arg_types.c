@@ -0,0 +1,711 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "arg_types.h"
+#include "arg_pattern.h"
+#include "struct_funcs.h"
+#include "cmd_main.h"
+
+#pragma warning (disable: 5045)
+
+/*
+* Checks if 8 bytes loaded into an integer are all ASCII digits
+* All 8 bytes are checked at once (SWAR - SIMD within a register)
+* 
+* chunk - the 8 bytes, loaded in little-endian order
+* 
+* returns - whether every byte is in the range '0'-'9'
+*/
+bool is_8_digits(ullong chunk) {
+    return (((chunk & 0xF0F0F0F0F0F0F0F0ULL)
+        | (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+}
+
+/*
+* Converts 8 ASCII digits loaded into an integer to their value
+* Uses 3 multiplications instead of 8 multiply-adds
+* 
+* chunk - the 8 digits, loaded in little-endian order (first digit in the lowest byte)
+* 
+* returns - the value of the 8-digit decimal number
+*/
+uint parse_8_digits(ullong chunk) {
+    const ullong mask = 0x000000FF000000FFULL;
+    const ullong mul1 = 100 + (1000000ULL << 32);
+    const ullong mul2 = 1 + (10000ULL << 32);
+
+    chunk -= 0x3030303030303030ULL;
+    // combine neighbouring digits into 2-digit numbers
+    chunk = (chunk * 10) + (chunk >> 8);
+    // combine the 2-digit numbers into the final value
+    chunk = (((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32;
+
+    return (uint)chunk;
+}
+
+/*
+* Parses a whole token as an unsigned decimal number
+* Digits are converted 8 at a time, the rest one by one
+* Unlike sscanf(), trailing characters make the whole token invalid
+* 
+* str - the NUL-terminated token
+* dst - pointer to where the value is to be stored
+* 
+* returns - whether the token is a valid number that fits in an ullong
+*/
+bool parse_ullong(const char *str, ullong *dst) {
+    const size_t len = strlen(str);
+    ullong ret = 0, chunk;
+    size_t i = 0;
+
+    // 20 digits is the maximum for a 64-bit value
+    if (len == 0 || len > 20)
+        return false;
+
+    // at most 2 chunks, 16 digits always fit in 64 bits
+    // (the loads are byte-order dependent, all targets of this code are little-endian)
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&chunk, str + i, sizeof(chunk));
+        if (!is_8_digits(chunk))
+            return false;
+        ret = ret * 100000000ULL + parse_8_digits(chunk);
+    }
+    for (; i < len; ++i) {
+        const uint digit = (uint)(uchar)str[i] - '0';
+
+        if (digit > 9 || ret > (ULLONG_MAX - digit) / 10)
+            return false;
+        ret = ret * 10 + digit;
+    }
+
+    *dst = ret;
+    return true;
+}
+
+/*
+* Parses a whole token as a signed decimal number
+* 
+* str - the NUL-terminated token, optionally starting with '-' or '+'
+* dst - pointer to where the value is to be stored
+* 
+* returns - whether the token is a valid number that fits in an llong
+*/
+bool parse_llong(const char *str, llong *dst) {
+    const bool negative = (str[0] == '-');
+    ullong value;
+
+    if (!parse_ullong(str + (negative || str[0] == '+'), &value))
+        return false;
+    if (value > (ullong)LLONG_MAX + negative)
+        return false;
+
+    *dst = negative ? (llong)(0 - value) : (llong)value;
+    return true;
+}
+
+/*
+* Parses tokens into a contiguous array of a list-type argument's element type
+* Empty tokens (left by repeated spaces) are skipped
+* 
+* node   - syntax node of the list argument, such as <INT...>
+* tokens - the tokens to parse
+* count  - number of tokens
+* dst    - pointer to the list to fill, its data has to be free()'d by the caller
+* 
+* returns - count on success, otherwise the index of the first invalid token (dst is left empty then)
+*/
+uint arg_list_parse(const arg_node_t *node, const char *const *tokens, uint count, arg_list_t *dst) {
+    uchar *data = count ? malloc((size_t)count * node->elem_size) : NULL;
+    uint parsed = 0;
+
+    dst->data = NULL;
+    dst->count = 0;
+    if (count && !data)
+        return 0;
+
+    for (uint i = 0; i < count; ++i) {
+        uchar *elem = data + (size_t)parsed * node->elem_size;
+        bool valid;
+
+        if (tokens[i][0] == '\0')
+            continue;
+
+        if (node->kind == ARG_INT_LIST) {
+            llong value;
+
+            valid = parse_llong(tokens[i], &value);
+            if (node->elem_size == sizeof(int)) {
+                const int narrow = (int)value;
+
+                valid = valid && value >= INT_MIN && value <= INT_MAX;
+                memcpy(elem, &narrow, sizeof(narrow));
+            }
+            else
+                memcpy(elem, &value, sizeof(value));
+        }
+        else {
+            ullong value;
+
+            valid = parse_ullong(tokens[i], &value);
+            if (node->elem_size == sizeof(uint)) {
+                const uint narrow = (uint)value;
+
+                valid = valid && value <= UINT_MAX;
+                memcpy(elem, &narrow, sizeof(narrow));
+            }
+            else
+                memcpy(elem, &value, sizeof(value));
+        }
+
+        if (!valid) {
+            free(data);
+            return i;
+        }
+        ++parsed;
+    }
+
+    dst->data = data;
+    dst->count = parsed;
+    return count;
+}
+
+/*
+* Helper function of parse_double() and parse_float()
+* Splits a decimal token into its significant digits and a power of ten
+* 
+* str      - the NUL-terminated token
+* mantissa - pointer to where the significant digits are to be stored
+* exp10    - pointer to where the decimal exponent is to be stored
+* negative - pointer to where the sign is to be stored
+* 
+* returns - whether the token is a plain decimal number with at most 19 significant digits
+*           (anything else has to be handled by the C library)
+*/
+bool decimal_split(const char *str, ullong *mantissa, int *exp10, bool *negative) {
+    const char *p = str;
+    uint digits = 0;
+    int exponent = 0;
+    ullong value = 0;
+
+    *negative = (*p == '-');
+    if (*p == '-' || *p == '+')
+        ++p;
+
+    const char *start = p;
+
+    // leading zeros are not significant
+    while (*p == '0')
+        ++p;
+    for (; (uint)(uchar)*p - '0' <= 9; ++p, ++digits)
+        value = value * 10 + (uint)(*p - '0');
+    if (*p == '.') {
+        ++p;
+        if (digits == 0) {
+            for (; *p == '0'; ++p)
+                --exponent;
+        }
+        for (; (uint)(uchar)*p - '0' <= 9; ++p, ++digits, --exponent)
+            value = value * 10 + (uint)(*p - '0');
+    }
+    // no digits at all (the single '.' case) or more than fit in 64 bits
+    if (p == start || (p == start + 1 && *start == '.') || digits > 19)
+        return false;
+
+    if (*p == 'e' || *p == 'E') {
+        const bool exp_negative = (p[1] == '-');
+        int exp_value = 0;
+
+        p += 1 + (p[1] == '-' || p[1] == '+');
+        if ((uint)(uchar)*p - '0' > 9)
+            return false;
+        for (; (uint)(uchar)*p - '0' <= 9; ++p) {
+            if (exp_value < 10000)
+                exp_value = exp_value * 10 + (*p - '0');
+        }
+        exponent += exp_negative ? -exp_value : exp_value;
+    }
+    if (*p != '\0')
+        return false;
+
+    *mantissa = value;
+    *exp10 = exponent;
+    return true;
+}
+
+/*
+* Parses a whole token as a double
+* Most realistic inputs (up to 15 significant digits, moderate exponents) are converted
+* with a single exact multiplication or division (Clinger's fast path), which gives
+* a correctly rounded result; everything else falls back to strtod()
+* 
+* str - the NUL-terminated token
+* dst - pointer to where the value is to be stored
+* 
+* returns - whether the whole token is a valid floating-point number
+*/
+bool parse_double(const char *str, double *dst) {
+    // every power of ten up to 1e22 is exactly representable as a double
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    ullong mantissa;
+    int exp10;
+    bool negative;
+
+    if (decimal_split(str, &mantissa, &exp10, &negative) && mantissa <= (1ULL << 53)) {
+        // move exponent into the mantissa while it stays exact, e.g. 5e25 = 5000e22
+        while (exp10 > 22 && mantissa <= (1ULL << 53) / 10) {
+            mantissa *= 10;
+            --exp10;
+        }
+        if (exp10 >= -22 && exp10 <= 22) {
+            double value = (double)mantissa;
+
+            value = exp10 < 0 ? value / pow10[-exp10] : value * pow10[exp10];
+            *dst = negative ? -value : value;
+            return true;
+        }
+    }
+
+    char *end;
+    const double value = strtod(str, &end);
+
+    if (end == str || *end != '\0')
+        return false;
+    *dst = value;
+    return true;
+}
+
+/*
+* Parses a whole token as a float
+* Like parse_double(), but with float arithmetic, so that the result
+* isn't rounded twice; falls back to strtof()
+* 
+* str - the NUL-terminated token
+* dst - pointer to where the value is to be stored
+* 
+* returns - whether the whole token is a valid floating-point number
+*/
+bool parse_float(const char *str, float *dst) {
+    // every power of ten up to 1e10 is exactly representable as a float
+    static const float pow10[] = {
+        1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f,
+    };
+    ullong mantissa;
+    int exp10;
+    bool negative;
+
+    if (decimal_split(str, &mantissa, &exp10, &negative) && mantissa <= (1ULL << 24)
+        && exp10 >= -10 && exp10 <= 10) {
+        float value = (float)mantissa;
+
+        value = exp10 < 0 ? value / pow10[-exp10] : value * pow10[exp10];
+        *dst = negative ? -value : value;
+        return true;
+    }
+
+    char *end;
+    const float value = strtof(str, &end);
+
+    if (end == str || *end != '\0')
+        return false;
+    *dst = value;
+    return true;
+}
+
+/*
+* Hashes a string for the perfect hash of an <ENUM> argument
+* 
+* str  - the string to be hashed
+* seed - selects one of the family of hash functions
+* 
+* returns - calculated hash value
+*/
+uint enum_hash(const char *str, uint seed) {
+    uint hash = 0x811C9DC5u ^ (seed * 0x9E3779B9u);
+
+    for (; *str; ++str) {
+        hash ^= (uchar)*str;
+        hash *= 0x01000193u;
+    }
+    // final mixing, so that nearby seeds give unrelated values
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+
+    return hash;
+}
+
+/*
+* Builds a minimal perfect hash of the words allowed by an <ENUM> argument
+* (the "hash and displace" scheme: words are grouped into buckets by one hash,
+* then a seed is searched for every bucket that moves all of its words into free slots)
+* 
+* words - the words separated by '|', such as "on|off"
+* 
+* returns - pointer to the heap-allocated hash (NULL if a word is empty or repeated)
+*/
+arg_enum_t *arg_enum_make(const char *words) {
+    tokenized_str_t tok_str = tok_str_make(words, '|');
+    const uint count = tok_str.parts.count;
+    arg_enum_t *ret = calloc(1, sizeof(arg_enum_t));
+    uint *home = calloc(count, sizeof(uint));           // first-level bucket of each word
+    uint *bucket_size = calloc(count, sizeof(uint));
+    uint *members = calloc(count, sizeof(uint));        // words of the bucket being placed
+    uint *slots = calloc(count, sizeof(uint));          // and the slots they were given
+    bool *taken = calloc(count, sizeof(bool));
+    uint max_size = 0, free_slot = 0;
+    bool valid = ret && home && bucket_size && members && slots && taken && tok_str.str;
+
+    if (valid) {
+        ret->count = count;
+        ret->words = calloc(count, sizeof(char *));
+        ret->values = calloc(count, sizeof(uint));
+        ret->buckets = calloc(count, sizeof(int));
+        valid = ret->words && ret->values && ret->buckets;
+    }
+
+    for (uint i = 0; valid && i < count; ++i) {
+        const char *word = tok_str_get(&tok_str, i);
+
+        valid = (word[0] != '\0');
+        for (uint j = 0; valid && j < i; ++j)
+            valid = !str_eq(word, tok_str_get(&tok_str, j));
+
+        home[i] = enum_hash(word, 0) % count;
+        if (++bucket_size[home[i]] > max_size)
+            max_size = bucket_size[home[i]];
+    }
+
+    // place the largest buckets first, while most slots are still free
+    for (uint size = max_size; valid && size > 0; --size) {
+        for (uint bucket = 0; valid && bucket < count; ++bucket) {
+            uint member_cnt = 0;
+
+            if (bucket_size[bucket] != size)
+                continue;
+            for (uint i = 0; i < count; ++i) {
+                if (home[i] == bucket)
+                    members[member_cnt++] = i;
+            }
+
+            if (size == 1) {
+                // a single word can go straight into any free slot
+                while (taken[free_slot])
+                    ++free_slot;
+                slots[0] = free_slot;
+                ret->buckets[bucket] = -(int)free_slot - 1;
+            }
+            else {
+                uint seed = 1, placed = 0;
+
+                for (; placed < size && seed < ENUM_MAX_SEED; ++seed) {
+                    for (placed = 0; placed < size; ++placed) {
+                        const uint slot = enum_hash(tok_str_get(&tok_str, members[placed]), seed) % count;
+                        bool clash = taken[slot];
+
+                        for (uint k = 0; k < placed && !clash; ++k)
+                            clash = (slots[k] == slot);
+                        if (clash)
+                            break;
+                        slots[placed] = slot;
+                    }
+                }
+                valid = (placed == size);
+                ret->buckets[bucket] = (int)seed - 1;
+            }
+
+            for (uint k = 0; valid && k < size; ++k) {
+                taken[slots[k]] = true;
+                ret->words[slots[k]] = _strdup(tok_str_get(&tok_str, members[k]));
+                ret->values[slots[k]] = members[k];
+            }
+        }
+    }
+
+    free(home);
+    free(bucket_size);
+    free(members);
+    free(slots);
+    free(taken);
+    tok_str_destroy(&tok_str);
+    if (!valid) {
+        arg_enum_destroy(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+/*
+* Looks a token up in the perfect hash of an <ENUM> argument
+* Takes two hash calculations and a single string comparison
+* 
+* enm   - the perfect hash built by arg_enum_make()
+* token - the token to look up
+* 
+* returns - index of the word in the <ENUM> declaration (-1 if the token is not one of the words)
+*/
+int arg_enum_find(const arg_enum_t *enm, const char *token) {
+    const int bucket = enm->buckets[enum_hash(token, 0) % enm->count];
+    const uint slot = bucket < 0 ? (uint)(-bucket - 1) : enum_hash(token, (uint)bucket) % enm->count;
+
+    return str_eq(enm->words[slot], token) ? (int)enm->values[slot] : -1;
+}
+
+/*
+* Frees all memory allocated by arg_enum_make()
+* 
+* enm - the perfect hash to be deleted
+*/
+void arg_enum_destroy(arg_enum_t *enm) {
+    if (!enm)
+        return;
+
+    for (uint i = 0; enm->words && i < enm->count; ++i)
+        free(enm->words[i]);
+    free(enm->words);
+    free(enm->values);
+    free(enm->buckets);
+    free(enm);
+}
+
+/*
+* Parses a single token as a value of a given argument type
+* 
+* node  - syntax node of the argument
+* token - the token to parse
+* dst   - pointer to where the raw value is to be stored (at least 512 bytes for <STRING>)
+* 
+* returns - whether the token is a valid value of the argument's type
+*/
+bool arg_token_parse(const arg_node_t *node, const char *token, void *dst) {
+    switch (node->kind) {
+    case ARG_FLOAT:
+        return parse_float(token, (float *)dst);
+    case ARG_DOUBLE:
+        return parse_double(token, (double *)dst);
+    case ARG_ENUM: {
+        const int value = arg_enum_find((const arg_enum_t *)node->extra, token);
+
+        if (value < 0)
+            return false;
+        *(uint *)dst = (uint)value;
+        return true;
+    }
+    default:
+        // (with how it's written now, sscanf_s() doesn't work here since the argument
+        // might be a string, in which case another parameter (buffer size) is needed)
+        return sscanf(token, node->format, dst) > 0;
+    }
+}
+
+// Helper function of arg_constraint_make()
+// Reads the "min=N max=N" bounds of a <STRING> length
+bool constraint_length_parse(arg_constraint_t *constraint, const char *params) {
+    tokenized_str_t tok_str = tok_str_make(params, ' ');
+    ullong min = 0, max = ULLONG_MAX;
+    bool valid = tok_str.str != NULL;
+
+    for (uint i = 0; valid && i < tok_str.parts.count; ++i) {
+        const char *param = tok_str_get(&tok_str, i);
+
+        if (strncmp(param, "min=", 4) == 0)
+            valid = parse_ullong(param + 4, &min);
+        else if (strncmp(param, "max=", 4) == 0)
+            valid = parse_ullong(param + 4, &max);
+        else
+            valid = false;
+    }
+    tok_str_destroy(&tok_str);
+
+    constraint->check = CHECK_LENGTH;
+    constraint->min = min;
+    constraint->span = max - min;
+    return valid && min <= max;
+}
+
+// Helper function of arg_constraint_make()
+// Reads the "min..max" bounds of a numeric type, either of them can be left out
+bool constraint_range_parse(arg_constraint_t *constraint, const arg_node_t *node, const char *params) {
+    const char *dots = strstr(params, "..");
+    const char last = node->format[strlen(node->format) - 1];
+    const bool integer = node->format[0] == '%' && (last == 'd' || last == 'u');
+    char lower[32];
+
+    if (!dots || (size_t)(dots - params) >= sizeof(lower) || strchr(params, ' '))
+        return false;
+    memcpy(lower, params, (size_t)(dots - params));
+    lower[dots - params] = '\0';
+
+    const char *upper = dots + 2;
+
+    constraint->size = arg_kind_is_list(node->kind) ? node->elem_size : node->size;
+    if (node->kind == ARG_FLOAT || node->kind == ARG_DOUBLE) {
+        constraint->check = CHECK_REAL;
+        constraint->real_min = -HUGE_VAL;
+        constraint->real_max = HUGE_VAL;
+        return (!lower[0] || parse_double(lower, &constraint->real_min))
+            && (!upper[0] || parse_double(upper, &constraint->real_max))
+            && constraint->real_min <= constraint->real_max;
+    }
+    if (node->kind == ARG_INT_LIST || (node->kind == ARG_SCANF && integer && last == 'd')) {
+        const llong type_max = constraint->size >= sizeof(llong) ? LLONG_MAX : (1LL << (8 * constraint->size - 1)) - 1;
+        llong min = -type_max - 1, max = type_max;
+        const bool valid = (!lower[0] || parse_llong(lower, &min)) && (!upper[0] || parse_llong(upper, &max));
+
+        constraint->check = CHECK_SIGNED;
+        constraint->min = (ullong)min;
+        constraint->span = (ullong)max - (ullong)min;
+        return valid && min >= -type_max - 1 && max <= type_max && min <= max;
+    }
+    if (node->kind == ARG_UINT_LIST || (node->kind == ARG_SCANF && integer)) {
+        const ullong type_max = constraint->size >= sizeof(ullong) ? ULLONG_MAX : (1ULL << (8 * constraint->size)) - 1;
+        ullong min = 0, max = type_max;
+        const bool valid = (!lower[0] || parse_ullong(lower, &min)) && (!upper[0] || parse_ullong(upper, &max));
+
+        constraint->check = CHECK_UNSIGNED;
+        constraint->min = min;
+        constraint->span = max - min;
+        return valid && max <= type_max && min <= max;
+    }
+
+    // <CHAR>, <PTR> and the like have no bounds
+    return false;
+}
+
+// Helper function of arg_constraint_make()
+// Compiles the "/regex/" of a <MATCH> or the pattern of a <GLOB> into a DFA
+bool constraint_pattern_parse(arg_constraint_t *constraint, const char *params, bool glob) {
+    const size_t len = strlen(params);
+
+    constraint->check = CHECK_PATTERN;
+    if (glob) {
+        constraint->dfa = arg_dfa_make(params, true);
+        return constraint->dfa != NULL;
+    }
+    if (len < 2 || params[0] != '/' || params[len - 1] != '/')
+        return false;
+
+    char *regex = _strdup(params + 1);
+    if (!regex)
+        return false;
+    regex[len - 2] = '\0';
+    constraint->dfa = arg_dfa_make(regex, false);
+    free(regex);
+    return constraint->dfa != NULL;
+}
+
+/*
+* Builds the constraint of an argument type with bounds, such as <INT 0..100>,
+* <DOUBLE -1..1>, <UINT... ..9> or <STRING min=1 max=64>,
+* or with a pattern, such as <MATCH /[a-z]+/> or <GLOB *.txt>
+* Bounds are inclusive; they have to fit the type and the lower one can't be above the upper one
+* Patterns are compiled to a DFA here, so that checking a token never backtracks or allocates
+* 
+* node   - the plain node of the argument's type, such as <INT>
+* params - the bounds or pattern, such as "0..100"
+* 
+* returns - pointer to the heap-allocated constraint (NULL if the type can't have
+*           bounds or they are invalid), free it with arg_constraint_destroy()
+*/
+arg_constraint_t *arg_constraint_make(const arg_node_t *node, const char *params) {
+    arg_constraint_t *ret = calloc(1, sizeof(arg_constraint_t));
+
+    if (!ret)
+        return NULL;
+
+    const bool valid = str_eq(node->key, "<MATCH>") || str_eq(node->key, "<GLOB>")
+        ? constraint_pattern_parse(ret, params, node->key[1] == 'G')
+        : node->kind == ARG_STRING
+        ? constraint_length_parse(ret, params)
+        : constraint_range_parse(ret, node, params);
+
+    if (!valid) {
+        arg_constraint_destroy(ret);
+        return NULL;
+    }
+    atomic_init(&ret->rejected, 0);
+    return ret;
+}
+
+// Frees a constraint made by arg_constraint_make()
+void arg_constraint_destroy(arg_constraint_t *constraint) {
+    if (!constraint)
+        return;
+
+    arg_dfa_destroy(constraint->dfa);
+    free(constraint);
+}
+
+// Loads an integer value of a constraint's size, sign- or zero-extended to 64 bits
+ullong constraint_load(const arg_constraint_t *constraint, const void *value) {
+    if (constraint->check == CHECK_SIGNED) {
+        switch (constraint->size) {
+        case 1: { signed char v; memcpy(&v, value, 1); return (ullong)(llong)v; }
+        case 2: { short v; memcpy(&v, value, 2); return (ullong)(llong)v; }
+        case 4: { int v; memcpy(&v, value, 4); return (ullong)(llong)v; }
+        default: { llong v; memcpy(&v, value, 8); return (ullong)v; }
+        }
+    }
+    switch (constraint->size) {
+    case 1: return *(const uchar *)value;
+    case 2: { ushort v; memcpy(&v, value, 2); return v; }
+    case 4: { uint v; memcpy(&v, value, 4); return v; }
+    default: { ullong v; memcpy(&v, value, 8); return v; }
+    }
+}
+
+/*
+* Checks a parsed value against the constraint of its argument
+* 
+* constraint - the constraint made by arg_constraint_make()
+* value      - pointer to the value as arg_token_parse() stored it
+*              (the characters themselves for <STRING>)
+* 
+* returns - whether the value is within the bounds
+*/
+bool arg_constraint_check(const arg_constraint_t *constraint, const void *value) {
+    switch (constraint->check) {
+    case CHECK_LENGTH:
+        return strlen((const char *)value) - constraint->min <= constraint->span;
+    case CHECK_PATTERN:
+        return arg_dfa_match(constraint->dfa, (const char *)value);
+    case CHECK_REAL: {
+        double real;
+
+        if (constraint->size == sizeof(float)) {
+            float narrow;
+            memcpy(&narrow, value, sizeof(narrow));
+            real = narrow;
+        }
+        else
+            memcpy(&real, value, sizeof(real));
+        // NaN fails both comparisons
+        return real >= constraint->real_min && real <= constraint->real_max;
+    }
+    default:
+        return constraint_load(constraint, value) - constraint->min <= constraint->span;
+    }
+}
+
+/*
+* Checks all elements of a list argument against its constraint
+* 
+* constraint - the constraint made by arg_constraint_make()
+* list       - the list as arg_list_parse() made it
+* 
+* returns - index of the first element out of bounds (list->count if there is none)
+*/
+uint arg_constraint_check_list(const arg_constraint_t *constraint, const arg_list_t *list) {
+    const uchar *elem = list->data;
+
+    for (uint i = 0; i < list->count; ++i, elem += constraint->size)
+        if (constraint_load(constraint, elem) - constraint->min > constraint->span)
+            return i;
+
+    return list->count;
+}
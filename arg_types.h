@@ -0,0 +1,22 @@
+#pragma once
+#include "typedefs.h"
+
+#define ENUM_MAX_SEED (1u << 20)
+
+#define arg_kind_is_list(kind) ((kind) == ARG_INT_LIST || (kind) == ARG_UINT_LIST)
+
+bool parse_ullong(const char *str, ullong *dst);
+bool parse_llong(const char *str, llong *dst);
+bool parse_double(const char *str, double *dst);
+bool parse_float(const char *str, float *dst);
+arg_enum_t *arg_enum_make(const char *words);
+int arg_enum_find(const arg_enum_t *enm, const char *token);
+void arg_enum_destroy(arg_enum_t *enm);
+
+bool arg_token_parse(const arg_node_t *node, const char *token, void *dst);
+uint arg_list_parse(const arg_node_t *node, const char *const *tokens, uint count, arg_list_t *dst);
+
+arg_constraint_t *arg_constraint_make(const arg_node_t *node, const char *params);
+bool arg_constraint_check(const arg_constraint_t *constraint, const void *value);
+uint arg_constraint_check_list(const arg_constraint_t *constraint, const arg_list_t *list);
+void arg_constraint_destroy(arg_constraint_t *constraint);
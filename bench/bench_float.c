@@ -0,0 +1,135 @@
+/*
+* Throughput of parse_double() and parse_float() against strtod() and strtof()
+* Inputs are a mix of prices, measurements, integers, scientific notation
+* and long mantissas which need the slow path; every result is also checked
+* against the C library, a mismatch means parse_* isn't correctly rounded
+*
+* Build from the repository root with DEBUG and TRACE disabled in cmd_main.h:
+*   cc -std=c11 -O2 -I. *.c bench/bench_float.c -o bench_float -lpthread -lm
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arg_types.h"
+#include "sync_funcs.h"
+
+#pragma warning (disable: 5045 4996)
+
+#define BENCH_FLOAT_COUNT 2000000
+#define BENCH_FLOAT_LEN 32
+
+// xorshift, the inputs are the same on every run
+ullong bench_rand(ullong *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/*
+* Writes one random input token
+*
+* dst   - buffer of BENCH_FLOAT_LEN characters
+* state - random generator state
+*/
+void bench_float_input(char *dst, ullong *state) {
+    const ullong r = bench_rand(state);
+    const uint n = (uint)(r >> 8);
+
+    switch (r % 5) {
+    case 0: // price
+        snprintf(dst, BENCH_FLOAT_LEN, "%u.%02u", n % 10000, n % 100);
+        break;
+    case 1: // measurement
+        snprintf(dst, BENCH_FLOAT_LEN, "%s%u.%04u", (n & 1) ? "-" : "", n % 1000, (n >> 4) % 10000);
+        break;
+    case 2: // integer
+        snprintf(dst, BENCH_FLOAT_LEN, "%u", n % 1000000);
+        break;
+    case 3: // scientific notation
+        snprintf(dst, BENCH_FLOAT_LEN, "%u.%03ue%d", n % 10, (n >> 4) % 1000, (int)((n >> 16) % 41) - 20);
+        break;
+    default: // more significant digits than the fast path handles
+        snprintf(dst, BENCH_FLOAT_LEN, "%.19g", (double)(r >> 11) / (double)(1ULL << (n % 40)));
+        break;
+    }
+}
+
+/*
+* Times one parser over all inputs
+*
+* inputs - BENCH_FLOAT_COUNT tokens of BENCH_FLOAT_LEN characters
+* kind   - 0: parse_double(), 1: strtod(), 2: parse_float(), 3: strtof()
+* sink   - receives the sum of the results, so the calls aren't optimized out
+*
+* returns - elapsed nanoseconds
+*/
+ullong bench_float_run(const char *inputs, uint kind, double *sink) {
+    double total = 0;
+    const ullong start = time_now_ns();
+
+    for (uint i = 0; i < BENCH_FLOAT_COUNT; ++i) {
+        const char *str = inputs + (size_t)i * BENCH_FLOAT_LEN;
+        double d = 0;
+        float f = 0;
+
+        switch (kind) {
+        case 0: parse_double(str, &d); break;
+        case 1: d = strtod(str, NULL); break;
+        case 2: parse_float(str, &f); d = f; break;
+        default: d = strtof(str, NULL); break;
+        }
+        total += d;
+    }
+
+    *sink += total;
+    return time_now_ns() - start;
+}
+
+// Counts the inputs on which parse_double()/parse_float() disagree with the C library
+uint bench_float_mismatches(const char *inputs, bool single) {
+    uint ret = 0;
+
+    for (uint i = 0; i < BENCH_FLOAT_COUNT; ++i) {
+        const char *str = inputs + (size_t)i * BENCH_FLOAT_LEN;
+        double d;
+        float f;
+
+        if (single ? (!parse_float(str, &f) || memcmp(&f, &(float){ strtof(str, NULL) }, sizeof(f)))
+            : (!parse_double(str, &d) || memcmp(&d, &(double){ strtod(str, NULL) }, sizeof(d)))) {
+            if (ret++ < 5)
+                fprintf(stderr, "mismatch on '%s'\n", str);
+        }
+    }
+
+    return ret;
+}
+
+int main(void) {
+    static const char *labels[] = { "parse_double", "strtod", "parse_float", "strtof" };
+    char *inputs = malloc((size_t)BENCH_FLOAT_COUNT * BENCH_FLOAT_LEN);
+    ullong state = 0x9E3779B97F4A7C15ULL;
+    ullong elapsed[4];
+    double sink = 0;
+
+    if (!inputs)
+        return 1;
+    for (uint i = 0; i < BENCH_FLOAT_COUNT; ++i)
+        bench_float_input(inputs + (size_t)i * BENCH_FLOAT_LEN, &state);
+
+    // warm-up, then the measured runs
+    bench_float_run(inputs, 0, &sink);
+    for (uint kind = 0; kind < 4; ++kind)
+        elapsed[kind] = bench_float_run(inputs, kind, &sink);
+
+    printf("%u inputs\n", BENCH_FLOAT_COUNT);
+    for (uint kind = 0; kind < 4; ++kind)
+        printf("%-14s %8.1f ns/op %8.1f M/s\n", labels[kind], (double)elapsed[kind] / BENCH_FLOAT_COUNT,
+            BENCH_FLOAT_COUNT * 1e3 / (double)elapsed[kind]);
+    printf("speedup: double %.2fx, float %.2fx\n", (double)elapsed[1] / (double)elapsed[0], (double)elapsed[3] / (double)elapsed[2]);
+    printf("mismatches: double %u, float %u\n", bench_float_mismatches(inputs, false), bench_float_mismatches(inputs, true));
+    printf("(checksum %g)\n", sink);
+
+    free(inputs);
+    return 0;
+}
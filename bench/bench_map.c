@@ -0,0 +1,146 @@
+/*
+* Insert latency of the command hashmap while it grows from 1 to BENCH_MAP_COUNT entries
+* Every cmd_map_add() call is timed on its own, the mean and max latency
+* are reported for every power of two range of the map size, separately for
+* plain inserts, inserts which started a resize and inserts which finished
+* a migration (these free the old table); percentiles of all inserts follow
+*
+* Build from the repository root with DEBUG and TRACE disabled in cmd_main.h:
+*   cc -std=c11 -O2 -I. *.c bench/bench_map.c -o bench_map -lpthread -lm
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "struct_funcs.h"
+#include "sync_funcs.h"
+
+#pragma warning (disable: 5045)
+
+#define BENCH_MAP_COUNT 1000000
+
+typedef struct bench_range_t {
+    ullong max_ns;
+    ullong total_ns;
+    ullong resize_max_ns;
+    ullong finish_max_ns;
+    uint count;
+    uint resizes;
+} bench_range_t;
+
+// worst latency of every kind of insert over the whole run
+typedef struct bench_worst_t {
+    ullong plain_ns;
+    ullong resize_ns;
+    ullong finish_ns;
+} bench_worst_t;
+
+// index of the power of two range containing n (n > 0)
+uint bench_range_index(uint n) {
+    uint index = 0;
+
+    while (n >>= 1)
+        index++;
+
+    return index;
+}
+
+/*
+* Fills a map with BENCH_MAP_COUNT freshly named commands, timing every insertion
+* Runs once per process: tearing down a million names leaves the allocator
+* with work that would otherwise land in the first resize of a second run
+*
+* ranges  - per range statistics
+* samples - receives the latency of every insertion, BENCH_MAP_COUNT elements
+*
+* returns - whether every insertion succeeded
+*/
+bool bench_map_fill(bench_range_t *ranges, ullong *samples) {
+    cmd_map_t map = cmd_map_make();
+    char name[16];
+    bool ok = true;
+
+    for (uint i = 1; i <= BENCH_MAP_COUNT && ok; ++i) {
+        command_t cmd = { 0 };
+        const command_t *table = map.map;
+        const bool migrating = map.old_map != NULL;
+
+        snprintf(name, sizeof(name), "cmd%u", i);
+        cmd.name = _strdup(name);
+
+        const ullong start = time_now_ns();
+        ok = cmd_map_add(&map, &cmd);
+        const ullong elapsed = time_now_ns() - start;
+
+        if (!ok) {
+            free(cmd.name);
+            break;
+        }
+
+        bench_range_t *range = ranges + bench_range_index(i);
+
+        samples[i - 1] = elapsed;
+        range->total_ns += elapsed;
+        range->count++;
+        // a resize allocates a new bucket array, the last migration step frees the old one
+        if (map.map != table) {
+            range->resize_max_ns = max(range->resize_max_ns, elapsed);
+            range->resizes++;
+        }
+        else if (migrating && !map.old_map)
+            range->finish_max_ns = max(range->finish_max_ns, elapsed);
+        else
+            range->max_ns = max(range->max_ns, elapsed);
+    }
+
+    cmd_map_destroy(&map);
+    return ok;
+}
+
+// Used by main() to sort the latencies
+int bench_compare(const void *a, const void *b) {
+    const ullong x = *(const ullong *)a, y = *(const ullong *)b;
+
+    return (x > y) - (x < y);
+}
+
+int main(void) {
+    static const double percentiles[] = { 50.0, 99.0, 99.9, 99.99 };
+    bench_range_t ranges[32] = { 0 };
+    bench_worst_t worst = { 0 };
+    ullong *samples = malloc(BENCH_MAP_COUNT * sizeof(ullong));
+
+    if (!samples || !bench_map_fill(ranges, samples)) {
+        fprintf(stderr, "out of memory\n");
+        free(samples);
+        return 1;
+    }
+
+    printf("%u inserts\n", BENCH_MAP_COUNT);
+    printf("%-20s %10s %10s %8s %12s %12s\n", "entries", "mean ns", "plain max", "resizes", "resize max", "finish max");
+    for (uint i = 0; i < 32; ++i) {
+        if (ranges[i].count == 0)
+            continue;
+
+        char label[24];
+
+        snprintf(label, sizeof(label), "%u-%u", 1u << i, min((2u << i) - 1, BENCH_MAP_COUNT));
+        printf("%-20s %10llu %10llu %8u %12llu %12llu\n", label, ranges[i].total_ns / ranges[i].count,
+            ranges[i].max_ns, ranges[i].resizes, ranges[i].resize_max_ns, ranges[i].finish_max_ns);
+        worst.plain_ns = max(worst.plain_ns, ranges[i].max_ns);
+        worst.resize_ns = max(worst.resize_ns, ranges[i].resize_max_ns);
+        worst.finish_ns = max(worst.finish_ns, ranges[i].finish_max_ns);
+    }
+
+    qsort(samples, BENCH_MAP_COUNT, sizeof(ullong), &bench_compare);
+    for (uint i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+        const uint index = (uint)(percentiles[i] / 100.0 * (BENCH_MAP_COUNT - 1));
+
+        printf("p%-6g %10llu ns\n", percentiles[i], samples[index]);
+    }
+    printf("worst plain insert:     %llu ns\n", worst.plain_ns);
+    printf("worst resizing insert:  %llu ns\n", worst.resize_ns);
+    printf("worst finishing insert: %llu ns\n", worst.finish_ns);
+
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cmd_batch.h"
+#include "cmd_cache.h"
+#include "cmd_main.h"
+#include "cmd_server.h"
+#include "sync_funcs.h"
+
+#pragma warning (disable: 5045)
+
+/*
+* Initializes an empty batcher
+* 
+* batcher - pointer to the batcher to initialize
+* 
+* returns - whether the batcher was successfully initialized
+*/
+bool batcher_init(cmd_batcher_t *batcher) {
+    memset(batcher, 0, sizeof(*batcher));
+    atomic_init(&batcher->pending, false);
+    batcher->owned_blocks = arraylist_make(&free);
+    batcher->cache_refs = arraylist_make((destroy_func_t)&cmd_cache_release);
+    batcher->responses = arraylist_make(NULL);
+
+    return mtx_init(&batcher->lock, mtx_plain) == thrd_success;
+}
+
+/*
+* Helper function of batcher_add()
+* Starts collecting a new batch for a command, the batcher lock has to be held
+* Column element sizes are taken from the layout of the first invocation's arguments
+* 
+* batcher - the batcher
+* parsed  - the first invocation
+* 
+* returns - whether the columns were allocated
+*/
+bool batcher_start(cmd_batcher_t *batcher, const cmd_parsed_t *parsed) {
+    const arg_bundle_t *args = &parsed->args;
+    cmd_batch_t *batch = &batcher->batch;
+
+    batch->column_cnt = args->args.count;
+    batch->count = 0;
+    batch->static_data = parsed->batch.static_data;
+    batch->columns = calloc(batch->column_cnt + 1, sizeof(void *));
+    batch->elem_sizes = calloc(batch->column_cnt + 1, sizeof(uint));
+    if (!batch->columns || !batch->elem_sizes)
+        return false;
+
+    void *const *offsets = arraylist_data(&args->args);
+
+    for (uint i = 0; i < batch->column_cnt; ++i) {
+        const size_t begin = (size_t)offsets[i];
+        const size_t end = (i + 1 < args->args.count) ? (size_t)offsets[i + 1] : args->data.count;
+
+        batch->elem_sizes[i] = (uint)(end - begin);
+        if (!(batch->columns[i] = malloc((size_t)parsed->batch.max_size * batch->elem_sizes[i])))
+            return false;
+    }
+
+    batcher->cmd_id = parsed->cmd_id;
+    batcher->proc = parsed->batch;
+    batcher->first_ns = time_now_ns();
+    atomic_store(&batcher->pending, true);
+    return true;
+}
+
+/*
+* Helper function of the flushing functions
+* Takes the collected batch out of the batcher, the batcher lock has to be held
+* 
+* batcher - the batcher
+* batch     - pointer to where the collected batch is to be moved
+* blocks    - pointer to where memory owned by the batch is to be moved
+* refs      - pointer to where cache entries used by the batch are to be moved
+* responses - pointer to where the responses of the batch's calls are to be moved
+*/
+void batcher_take(cmd_batcher_t *batcher, cmd_batch_t *batch, ptr_arraylist_t *blocks, ptr_arraylist_t *refs,
+    ptr_arraylist_t *responses) {
+    *batch = batcher->batch;
+    *blocks = batcher->owned_blocks;
+    *refs = batcher->cache_refs;
+    *responses = batcher->responses;
+    memset(&batcher->batch, 0, sizeof(batcher->batch));
+    batcher->owned_blocks = arraylist_make(&free);
+    batcher->cache_refs = arraylist_make((destroy_func_t)&cmd_cache_release);
+    batcher->responses = arraylist_make(NULL);
+    batcher->cmd_id = 0;
+    atomic_store(&batcher->pending, false);
+}
+
+/*
+* Helper function of the flushing functions
+* Calls the batch handler on a taken batch and frees it
+* 
+* proc      - the batch handler
+* batch     - the batch
+* blocks    - memory owned by the batch
+* refs      - cache entries used by the batch
+* responses - responses of the batch's calls, the output of the handler goes with the last one
+*/
+void batch_run(cmd_batch_proc_t proc, cmd_batch_t *batch, ptr_arraylist_t *blocks, ptr_arraylist_t *refs,
+    ptr_arraylist_t *responses) {
+    cmd_response_t **done = (cmd_response_t **)arraylist_data(responses);
+
+    if (batch->count > 0) {
+        cmd_response_t *outer = cmd_response_enter(responses->count ? done[responses->count - 1] : NULL);
+
+        (*proc.action)(batch);
+        cmd_response_leave(outer);
+    }
+    for (uint i = 0; i < responses->count; ++i)
+        cmd_response_done(done[i], true);
+
+    for (uint i = 0; batch->columns && i < batch->column_cnt; ++i)
+        free(batch->columns[i]);
+    free(batch->columns);
+    free(batch->elem_sizes);
+    arraylist_destroy(blocks);
+    arraylist_destroy(refs);
+    arraylist_destroy(responses);
+}
+
+// Helper function of batcher_add()
+// Reserves room for everything an invocation adds besides its columns, the batcher lock has to be held
+bool batcher_reserve(cmd_batcher_t *batcher, const cmd_parsed_t *parsed, const cmd_cache_entry_t *owner, bool take,
+    const cmd_response_t *response) {
+    if (response && !arraylist_reserve(&batcher->responses, 1))
+        return false;
+    if (owner)
+        return arraylist_reserve(&batcher->cache_refs, 1);
+
+    return !take || arraylist_reserve(&batcher->owned_blocks, parsed->args.dynamic_blocks.count);
+}
+
+/*
+* Appends one invocation of a command with a batch handler to the pending batch
+* A pending batch of another command is run first, a full batch is run right away
+* If there is no memory to keep the invocation, the pending batch is run and then the invocation alone
+* 
+* batcher - the batcher
+* parsed   - the invocation
+* owner    - cache entry the invocation belongs to (can be NULL),
+*            the batch takes over the caller's reference
+* take     - if owner is NULL: whether the batch takes over the dynamically allocated arguments
+*            (strings, lists) of parsed (the caller has to keep them alive until the batch has run otherwise)
+* response - response of the invocation, completed when the batch has run (can be NULL)
+*/
+void batcher_add(cmd_batcher_t *batcher, cmd_parsed_t *parsed, cmd_cache_entry_t *owner, bool take, cmd_response_t *response) {
+    cmd_batch_t full = { 0 };
+    ptr_arraylist_t blocks = { 0 }, refs = { 0 }, responses = { 0 };
+    cmd_batch_proc_t full_proc = { 0 };
+
+    mtx_lock(&batcher->lock);
+    while (batcher->cmd_id != 0 && batcher->cmd_id != parsed->cmd_id) {
+        // keep the order of commands: a pending batch of another command runs first
+        full_proc = batcher->proc;
+        batcher_take(batcher, &full, &blocks, &refs, &responses);
+        mtx_unlock(&batcher->lock);
+        batch_run(full_proc, &full, &blocks, &refs, &responses);
+        mtx_lock(&batcher->lock);
+    }
+    full_proc.action = NULL;
+
+    if ((batcher->cmd_id == 0 && !batcher_start(batcher, parsed)) || !batcher_reserve(batcher, parsed, owner, take, response)) {
+        // out of memory, run what is pending and then the action alone
+        full_proc = batcher->proc;
+        batcher_take(batcher, &full, &blocks, &refs, &responses);
+        mtx_unlock(&batcher->lock);
+        batch_run(full_proc, &full, &blocks, &refs, &responses);
+
+        cmd_response_t *outer = cmd_response_enter(response);
+
+        cmd_parsed_run(parsed);
+        cmd_response_leave(outer);
+        cmd_response_done(response, true);
+        cmd_cache_release(owner);
+        return;
+    }
+
+    cmd_batch_t *batch = &batcher->batch;
+    const arg_bundle_t *args = &parsed->args;
+    const uchar *data = byte_arraylist_data(&args->data);
+    void *const *offsets = arraylist_data(&args->args);
+
+    for (uint i = 0; i < batch->column_cnt; ++i) {
+        memcpy((uchar *)batch->columns[i] + (size_t)batch->count * batch->elem_sizes[i],
+            data + (size_t)offsets[i], batch->elem_sizes[i]);
+    }
+    batch->count++;
+    // room for these was reserved up front, so they can't fail
+    if (response)
+        arraylist_push(&batcher->responses, response);
+    if (owner)
+        arraylist_push(&batcher->cache_refs, owner);
+    else if (take) {
+        arraylist_append(&batcher->owned_blocks, arraylist_data(&parsed->args.dynamic_blocks),
+            parsed->args.dynamic_blocks.count);
+        parsed->args.dynamic_blocks.count = 0;
+    }
+
+    if (batch->count >= batcher->proc.max_size) {
+        full_proc = batcher->proc;
+        batcher_take(batcher, &full, &blocks, &refs, &responses);
+    }
+    mtx_unlock(&batcher->lock);
+
+    // the handler runs outside of the lock, so that it can execute commands itself
+    if (full_proc.action)
+        batch_run(full_proc, &full, &blocks, &refs, &responses);
+}
+
+/*
+* Helper function of the flushing functions
+* Runs the pending batch if a condition holds for it
+* 
+* batcher   - the batcher
+* other_id  - if not 0, only flush a batch of a command with a different id
+* timed_out - if true, only flush a batch older than its delay limit
+*/
+void batcher_flush_if(cmd_batcher_t *batcher, uint other_id, bool timed_out) {
+    cmd_batch_t batch;
+    ptr_arraylist_t blocks, refs, responses;
+    cmd_batch_proc_t proc;
+
+    // fast path, taken by nearly every command
+    if (!atomic_load(&batcher->pending))
+        return;
+
+    mtx_lock(&batcher->lock);
+    if (batcher->cmd_id == 0 || (other_id && batcher->cmd_id == other_id)
+        || (timed_out && time_now_ns() - batcher->first_ns < batcher->proc.max_delay_ms * 1000000ULL)) {
+        mtx_unlock(&batcher->lock);
+        return;
+    }
+    proc = batcher->proc;
+    batcher_take(batcher, &batch, &blocks, &refs, &responses);
+    mtx_unlock(&batcher->lock);
+
+    batch_run(proc, &batch, &blocks, &refs, &responses);
+}
+
+// Runs the pending batch, whatever its size
+void batcher_flush(cmd_batcher_t *batcher) {
+    batcher_flush_if(batcher, 0, false);
+}
+
+// Runs the pending batch if it belongs to a command other than the one with id cmd_id
+// Keeps the order of commands when a different one comes in
+void batcher_flush_other(cmd_batcher_t *batcher, uint cmd_id) {
+    batcher_flush_if(batcher, cmd_id, false);
+}
+
+// Runs the pending batch if its oldest invocation has waited for max_delay_ms
+void batcher_poll(cmd_batcher_t *batcher) {
+    batcher_flush_if(batcher, 0, true);
+}
+
+// Returns the ms left until the pending batch is due to be run by batcher_poll(), -1 if there is none
+int batcher_next_ms(cmd_batcher_t *batcher) {
+    int ret = -1;
+
+    if (!atomic_load(&batcher->pending))
+        return ret;
+
+    mtx_lock(&batcher->lock);
+    if (batcher->cmd_id != 0) {
+        const ullong waited_ms = (time_now_ns() - batcher->first_ns) / 1000000;
+
+        ret = waited_ms >= batcher->proc.max_delay_ms ? 0 : (int)(batcher->proc.max_delay_ms - waited_ms);
+    }
+    mtx_unlock(&batcher->lock);
+
+    return ret;
+}
+
+/*
+* Runs the pending batch and frees all resources of a batcher
+* 
+* batcher - the batcher to be deleted
+*/
+void batcher_destroy(cmd_batcher_t *batcher) {
+    batcher_flush(batcher);
+    arraylist_destroy(&batcher->owned_blocks);
+    arraylist_destroy(&batcher->cache_refs);
+    arraylist_destroy(&batcher->responses);
+    mtx_destroy(&batcher->lock);
+}
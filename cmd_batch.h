@@ -0,0 +1,10 @@
+#pragma once
+#include "struct_funcs.h"
+
+bool batcher_init(cmd_batcher_t *batcher);
+void batcher_add(cmd_batcher_t *batcher, cmd_parsed_t *parsed, cmd_cache_entry_t *owner, bool take, cmd_response_t *response);
+void batcher_flush(cmd_batcher_t *batcher);
+void batcher_flush_other(cmd_batcher_t *batcher, uint cmd_id);
+void batcher_poll(cmd_batcher_t *batcher);
+int batcher_next_ms(cmd_batcher_t *batcher);
+void batcher_destroy(cmd_batcher_t *batcher);
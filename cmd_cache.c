@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "cmd_cache.h"
+#include "cmd_main.h"
+
+#pragma warning (disable: 5045)
+
+/*
+* Returns the length of the part of a command string used as the cache key
+* The key ends at the first control character, so that "cmd\n" and "cmd" share an entry
+* 
+* cmd_str - the command string
+*/
+uint cmd_cache_key_len(const char *cmd_str) {
+    uint len = 0;
+
+    while ((uchar)cmd_str[len] >= ' ')
+        ++len;
+
+    return len;
+}
+
+/*
+* Creates a heap-allocated parse-result cache
+* 
+* capacity - maximum number of cached entries, rounded up to
+*            a power of two multiple of CMD_CACHE_WAYS
+* 
+* returns - pointer to the new cache (NULL on failure)
+*/
+cmd_cache_t *cmd_cache_create(uint capacity) {
+    cmd_cache_t *ret = calloc(1, sizeof(cmd_cache_t));
+    uint set_cnt = 1;
+
+    if (!ret)
+        return NULL;
+
+    while (set_cnt * CMD_CACHE_WAYS < capacity)
+        set_cnt *= 2;
+
+    ret->set_cnt = set_cnt;
+    ret->stats.capacity = set_cnt * CMD_CACHE_WAYS;
+    ret->slots = calloc(ret->stats.capacity, sizeof(cmd_cache_entry_t *));
+    if (!ret->slots || mtx_init(&ret->lock, mtx_plain) != thrd_success) {
+        free(ret->slots);
+        free(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+/*
+* Drops a reference to a cache entry
+* The entry and its parsed command are freed with the last reference
+* 
+* entry - the entry returned by cmd_cache_find() or cmd_cache_insert()
+*/
+void cmd_cache_release(cmd_cache_entry_t *entry) {
+    if (entry && atomic_fetch_sub(&entry->refs, 1) == 1) {
+        cmd_parsed_destroy(&entry->parsed);
+        free(entry);
+    }
+}
+
+/*
+* Helper function of cmd_cache_find() and cmd_cache_insert()
+* Removes an entry from its slot, the cache lock has to be held
+* 
+* cache - the cache the entry belongs to
+* slot  - pointer to the slot holding the entry
+*/
+void cmd_cache_evict(cmd_cache_t *cache, cmd_cache_entry_t **slot) {
+    cache->stats.entries--;
+    cache->stats.memory -= (*slot)->memory;
+    cmd_cache_release(*slot);
+    *slot = NULL;
+}
+
+/*
+* Looks a command string up in the cache
+* Entries parsed before the last change of the command tree are dropped instead of returned
+* 
+* cache      - the cache to search in
+* cmd_str    - the command string
+* generation - the current generation of the command tree
+* 
+* returns - the cached entry (NULL on a miss), release it with cmd_cache_release()
+*/
+cmd_cache_entry_t *cmd_cache_find(cmd_cache_t *cache, const char *cmd_str, uint generation) {
+    const uint key_len = cmd_cache_key_len(cmd_str);
+    const ullong key_hash = hash_bytes(cmd_str, key_len);
+    cmd_cache_entry_t **set = cache->slots + (key_hash & (cache->set_cnt - 1)) * CMD_CACHE_WAYS;
+    cmd_cache_entry_t *ret = NULL;
+
+    mtx_lock(&cache->lock);
+    for (uint i = 0; i < CMD_CACHE_WAYS; ++i) {
+        cmd_cache_entry_t *entry = set[i];
+
+        if (!entry || entry->key_hash != key_hash || entry->key_len != key_len
+            || memcmp(entry->key, cmd_str, key_len) != 0)
+            continue;
+        if (entry->parsed.generation != generation) {
+            cmd_cache_evict(cache, set + i);
+            cache->stats.invalidations++;
+            break;
+        }
+        atomic_fetch_add(&entry->refs, 1);
+        entry->last_used = ++cache->tick;
+        ret = entry;
+        break;
+    }
+    if (ret)
+        cache->stats.hits++;
+    else
+        cache->stats.misses++;
+    mtx_unlock(&cache->lock);
+
+    return ret;
+}
+
+/*
+* Creates a cache entry holding a parsed command, without storing it in any cache
+* Also used by the timer wheel to keep scheduled commands
+* 
+* cmd_str - the command string the parse result belongs to
+* parsed  - the parse result, the entry takes it over on success
+* refs    - the number of references the entry starts with
+* 
+* returns - the new entry (NULL on failure), release it with cmd_cache_release()
+*/
+cmd_cache_entry_t *cmd_cache_entry_make(const char *cmd_str, cmd_parsed_t *parsed, uint refs) {
+    const uint key_len = cmd_cache_key_len(cmd_str);
+    cmd_cache_entry_t *entry = malloc(sizeof(cmd_cache_entry_t) + key_len + 1);
+
+    if (!entry)
+        return NULL;
+
+    atomic_init(&entry->refs, refs);
+    entry->key_len = key_len;
+    entry->key_hash = hash_bytes(cmd_str, key_len);
+    entry->last_used = 0;
+    entry->parsed = *parsed;
+    // lists that still fit their inline storage are part of sizeof(cmd_cache_entry_t)
+    entry->memory = sizeof(cmd_cache_entry_t) + key_len + 1
+        + (parsed->args.data.heap ? parsed->args.data.size : 0)
+        + (parsed->args.args.heap ? parsed->args.args.size : 0) * sizeof(void *)
+        + (parsed->args.dynamic_blocks.heap ? parsed->args.dynamic_blocks.size : 0) * sizeof(void *);
+    memcpy(entry->key, cmd_str, key_len);
+    entry->key[key_len] = '\0';
+
+    return entry;
+}
+
+/*
+* Stores a parsed command in the cache, evicting the least recently used entry of its set
+* 
+* cache   - the cache to insert into
+* cmd_str - the command string the parse result belongs to
+* parsed  - the parse result, the cache takes it over on success
+* 
+* returns - the new entry (NULL on failure), release it with cmd_cache_release()
+*/
+cmd_cache_entry_t *cmd_cache_insert(cmd_cache_t *cache, const char *cmd_str, cmd_parsed_t *parsed) {
+    // one reference for the cache, one for the caller
+    cmd_cache_entry_t *entry = cmd_cache_entry_make(cmd_str, parsed, 2);
+
+    if (!entry)
+        return NULL;
+
+    const uint key_len = entry->key_len;
+    cmd_cache_entry_t **set = cache->slots + (entry->key_hash & (cache->set_cnt - 1)) * CMD_CACHE_WAYS;
+    uint victim = 0;
+
+    mtx_lock(&cache->lock);
+    for (uint i = 0; i < CMD_CACHE_WAYS; ++i) {
+        if (!set[i]) {
+            victim = i;
+            break;
+        }
+        // another thread may have inserted the same string in the meantime
+        if (set[i]->key_hash == entry->key_hash && set[i]->key_len == key_len
+            && memcmp(set[i]->key, entry->key, key_len) == 0) {
+            victim = i;
+            break;
+        }
+        if (set[i]->last_used < set[victim]->last_used)
+            victim = i;
+    }
+    if (set[victim]) {
+        cmd_cache_evict(cache, set + victim);
+        cache->stats.evictions++;
+    }
+    entry->last_used = ++cache->tick;
+    set[victim] = entry;
+    cache->stats.entries++;
+    cache->stats.insertions++;
+    cache->stats.memory += entry->memory;
+    mtx_unlock(&cache->lock);
+
+    return entry;
+}
+
+/*
+* Drops all entries of a cache
+* Entries still in use are freed once their last user releases them
+* 
+* cache - the cache to clear
+*/
+void cmd_cache_clear(cmd_cache_t *cache) {
+    mtx_lock(&cache->lock);
+    for (uint i = 0; i < cache->stats.capacity; ++i) {
+        if (cache->slots[i]) {
+            cmd_cache_evict(cache, cache->slots + i);
+            cache->stats.invalidations++;
+        }
+    }
+    mtx_unlock(&cache->lock);
+}
+
+/*
+* Returns a snapshot of a cache's counters
+* 
+* cache - the cache to get the counters of
+*/
+cmd_cache_stats_t cmd_cache_stats(cmd_cache_t *cache) {
+    cmd_cache_stats_t ret;
+
+    mtx_lock(&cache->lock);
+    ret = cache->stats;
+    mtx_unlock(&cache->lock);
+
+    return ret;
+}
+
+// Prints a cache's counters to stdout
+void cmd_cache_print_stats(cmd_cache_t *cache) {
+    const cmd_cache_stats_t stats = cmd_cache_stats(cache);
+    const ullong lookups = stats.hits + stats.misses;
+
+    printf("cache: %u/%u entries, %zu bytes, hit rate %.2f%% (%llu hits, %llu misses), "
+        "%llu insertions, %llu evictions, %llu invalidations\n",
+        stats.entries, stats.capacity, stats.memory, lookups ? 100.0 * stats.hits / lookups : 0.0,
+        stats.hits, stats.misses, stats.insertions, stats.evictions, stats.invalidations);
+}
+
+/*
+* Frees all memory allocated by cmd_cache_create()
+* 
+* cache - the cache to be deleted
+*/
+void cmd_cache_destroy(cmd_cache_t *cache) {
+    if (!cache)
+        return;
+
+    cmd_cache_clear(cache);
+    mtx_destroy(&cache->lock);
+    free(cache->slots);
+    free(cache);
+}
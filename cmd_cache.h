@@ -0,0 +1,14 @@
+#pragma once
+#include "struct_funcs.h"
+
+#define CMD_CACHE_WAYS 4
+
+cmd_cache_t *cmd_cache_create(uint capacity);
+cmd_cache_entry_t *cmd_cache_find(cmd_cache_t *cache, const char *cmd_str, uint generation);
+cmd_cache_entry_t *cmd_cache_entry_make(const char *cmd_str, cmd_parsed_t *parsed, uint refs);
+cmd_cache_entry_t *cmd_cache_insert(cmd_cache_t *cache, const char *cmd_str, cmd_parsed_t *parsed);
+void cmd_cache_release(cmd_cache_entry_t *entry);
+void cmd_cache_clear(cmd_cache_t *cache);
+cmd_cache_stats_t cmd_cache_stats(cmd_cache_t *cache);
+void cmd_cache_print_stats(cmd_cache_t *cache);
+void cmd_cache_destroy(cmd_cache_t *cache);
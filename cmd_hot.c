@@ -0,0 +1,448 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "cmd_hot.h"
+#include "cmd_main.h"
+
+#pragma warning (disable: 5045)
+
+/*
+* The parser walks the hot table instead of the command tree: deciding whether a value or
+* a subcommand comes next and finding subcommands only touches the cache line of each
+* command on the way; the tree (cold) is only read to convert values and to match a name
+* whose hash fits
+*/
+
+// Counts a command and all its subcommands
+uint hot_count(const command_t *cmd) {
+    uint ret = 1;
+
+    for (uint i = 0; i < cmd->subcommands.count; ++i)
+        ret += hot_count(arraylist_data(&cmd->subcommands)[i]);
+    return ret;
+}
+
+// Makes the hot copy of a command, except for its children
+void hot_fill(cmd_hot_t *hot, const command_t *cmd) {
+    memset(hot, 0, sizeof(*hot));
+    hot->proc = cmd->action;
+    hot->cold = cmd;
+    hot->name_hash = hash(cmd->name);
+    hot->arg_cnt = cmd->arg_cnt;
+    hot->child_cnt = cmd->subcommands.count;
+    for (uint i = 0; i < cmd->arg_cnt && i < HOT_TAGS; ++i)
+        hot->tags[i] = cmd->syntax[i]->format[0] == '>' ? HOT_TAG_SUBCOMMAND : (uchar)cmd->syntax[i]->kind;
+}
+
+// Returns the size class of the block holding count (> 0) subcommands, the block has 2^class slots
+uint hot_class(uint count) {
+    uint ret = 0;
+
+    while ((1u << ret) < count)
+        ret++;
+    return ret;
+}
+
+// Grows the slots of a table so that extra more fit (false if out of memory)
+// Moves all hot copies, pointers into the table become invalid
+bool hot_grow(cmd_hot_table_t *table, uint extra) {
+    const uint capacity = max(2 * table->capacity, table->count + extra);
+    void *block = malloc((size_t)capacity * sizeof(cmd_hot_t) + HOT_ALIGN);
+
+    if (!block)
+        return false;
+
+    cmd_hot_t *cmds = (cmd_hot_t *)(((size_t)block + HOT_ALIGN - 1) & ~(size_t)(HOT_ALIGN - 1));
+
+    if (table->count)
+        memcpy(cmds, table->cmds, (size_t)table->count * sizeof(cmd_hot_t));
+    free(table->block);
+    table->block = block;
+    table->cmds = cmds;
+    table->capacity = capacity;
+
+    return true;
+}
+
+/*
+* Takes a block of slots from a table, an unused one of the class or a new one at the end
+* The table may grow, pointers into it become invalid
+*
+* table - the table
+* cls   - size class of the block, see hot_class()
+*
+* returns - index of the block's first slot (UINT_MAX if out of memory)
+*/
+uint hot_alloc(cmd_hot_table_t *table, uint cls) {
+    const uint size = 1u << cls;
+    uint ret = table->free[cls];
+
+    if (ret) {
+        table->free[cls] = table->cmds[ret - 1].first_child;
+        return ret - 1;
+    }
+    if (table->count + size > table->capacity && !hot_grow(table, size))
+        return UINT_MAX;
+
+    ret = table->count;
+    table->count += size;
+    memset(table->cmds + ret, 0, (size_t)size * sizeof(cmd_hot_t));
+    return ret;
+}
+
+// Gives a block of 2^cls slots starting at slot back to a table
+void hot_release(cmd_hot_table_t *table, uint slot, uint cls) {
+    memset(table->cmds + slot, 0, sizeof(cmd_hot_t));
+    table->cmds[slot].first_child = table->free[cls];
+    table->free[cls] = slot + 1;
+}
+
+// Gives the blocks of all descendants of a hot copy back to its table
+void hot_release_children(cmd_hot_table_t *table, uint slot) {
+    const uint first = table->cmds[slot].first_child, count = table->cmds[slot].child_cnt;
+
+    if (count == 0)
+        return;
+    for (uint i = 0; i < count; ++i)
+        hot_release_children(table, first + i);
+    hot_release(table, first, hot_class(count));
+}
+
+// Fills a new block with the hot copies of the subcommands of the command at slot (false if out of memory)
+bool hot_add_block(cmd_hot_table_t *table, uint slot) {
+    const uint count = table->cmds[slot].child_cnt;
+
+    if (count == 0)
+        return true;
+
+    const uint first = hot_alloc(table, hot_class(count));
+
+    if (first == UINT_MAX)
+        return false;
+
+    cmd_hot_t *hot = &table->cmds[slot];
+
+    hot->first_child = first;
+    for (uint i = 0; i < count; ++i)
+        hot_fill(&table->cmds[first + i], arraylist_data(&hot->cold->subcommands)[i]);
+    return true;
+}
+
+// Adds the hot copies of all descendants of the command at slot (false if out of memory)
+bool hot_add_subtree(cmd_hot_table_t *table, uint slot) {
+    if (!hot_add_block(table, slot))
+        return false;
+
+    const uint first = table->cmds[slot].first_child, count = table->cmds[slot].child_cnt;
+
+    for (uint i = 0; i < count; ++i) {
+        if (!hot_add_subtree(table, first + i))
+            return false;
+    }
+    return true;
+}
+
+// Puts the root command at slot into the root index of a table (false if out of memory)
+// The index doubles once it would be half full
+bool hot_index_root(cmd_hot_table_t *table, uint slot) {
+    uint bucket;
+
+    if (2 * (table->root_cnt + 1) > table->root_mask + 1) {
+        const uint mask = 2 * table->root_mask + 1;
+        uint *roots = calloc((size_t)mask + 1, sizeof(uint));
+
+        if (!roots)
+            return false;
+        for (uint i = 0; i <= table->root_mask; ++i) {
+            if (!table->roots[i])
+                continue;
+            for (bucket = table->cmds[table->roots[i] - 1].name_hash & mask; roots[bucket]; bucket = (bucket + 1) & mask);
+            roots[bucket] = table->roots[i];
+        }
+        free(table->roots);
+        table->roots = roots;
+        table->root_mask = mask;
+    }
+
+    for (bucket = table->cmds[slot].name_hash & table->root_mask; table->roots[bucket]; bucket = (bucket + 1) & table->root_mask);
+    table->roots[bucket] = slot + 1;
+    table->root_cnt++;
+    return true;
+}
+
+// Finds the root index bucket of a root command (root_mask + 1 if it isn't indexed)
+uint hot_root_bucket(const cmd_hot_table_t *table, const command_t *cmd) {
+    for (uint bucket = hash(cmd->name) & table->root_mask; table->roots[bucket]; bucket = (bucket + 1) & table->root_mask) {
+        if (table->cmds[table->roots[bucket] - 1].cold == cmd)
+            return bucket;
+    }
+
+    return table->root_mask + 1;
+}
+
+// Empties a bucket of the root index, moving later entries of the probe chain back into the gap
+void hot_unindex_root(cmd_hot_table_t *table, uint bucket) {
+    const uint mask = table->root_mask;
+    uint hole = bucket;
+
+    for (uint next = (hole + 1) & mask; table->roots[next]; next = (next + 1) & mask) {
+        const uint home = table->cmds[table->roots[next] - 1].name_hash & mask;
+
+        // an entry can only move back if the hole is not before its home bucket
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table->roots[hole] = table->roots[next];
+            hole = next;
+        }
+    }
+    table->roots[hole] = 0;
+    table->root_cnt--;
+}
+
+// Used with qsort() by hot_build(), orders root sort keys (see there) ascending
+int hot_key_cmp(const void *a, const void *b) {
+    const ullong key_a = *(const ullong *)a, key_b = *(const ullong *)b;
+
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+/*
+* Builds the hot table of a command tree, keep it up to date with hot_insert(), hot_erase() and hot_moved()
+* Roots are indexed in order of their lookup hits, like cmd_map_reorder() places them,
+* so the hottest ones get their home bucket and the first slots of the table; the hits
+* are read once, parsers keep counting them meanwhile
+*
+* map - the root commands of the tree
+*
+* returns - the table (NULL if out of memory), free with hot_destroy()
+*/
+cmd_hot_table_t *hot_build(const cmd_map_t *map) {
+    cmd_hot_table_t *table = calloc(1, sizeof(cmd_hot_table_t));
+    const command_t *cmd, **roots;
+    ullong *keys;
+    uint iter = 0, count = 0, root_cnt = 0, next = 0;
+    bool ok;
+
+    if (!table)
+        return NULL;
+    while ((cmd = cmd_map_next(map, &iter)) != NULL) {
+        count += hot_count(cmd);
+        root_cnt++;
+    }
+
+    table->root_mask = 7;
+    while (table->root_mask + 1 < 2 * (root_cnt + 1))
+        table->root_mask = 2 * table->root_mask + 1;
+    table->roots = calloc((size_t)table->root_mask + 1, sizeof(uint));
+    // sort keys, then the roots they index
+    keys = malloc((size_t)root_cnt * (sizeof(ullong) + sizeof(command_t *)) + 1);
+    // blocks are rounded up to powers of two
+    ok = table->roots && keys && hot_grow(table, 2 * count + 1);
+
+    // roots first, most hit first, then the commands level by level, so that siblings are adjacent
+    roots = (const command_t **)(keys + root_cnt);
+    for (iter = 0; ok && (cmd = cmd_map_next(map, &iter)) != NULL; ++next) {
+        // fewer hits sort later, equal ones keep the map's order
+        keys[next] = (ullong)(UINT_MAX - atomic_load_explicit(&cmd->hits, memory_order_relaxed)) << 32 | next;
+        roots[next] = cmd;
+    }
+    if (ok)
+        qsort(keys, root_cnt, sizeof(ullong), &hot_key_cmp);
+    for (next = 0; ok && next < root_cnt; ++next) {
+        const uint slot = hot_alloc(table, 0);
+
+        hot_fill(&table->cmds[slot], roots[(uint)keys[next]]);
+        ok = hot_index_root(table, slot);
+    }
+    free(keys);
+    // skipping the unused slots of blocks
+    for (uint i = 0; ok && i < table->count; ++i)
+        ok = !table->cmds[i].cold || hot_add_block(table, i);
+
+    if (!ok) {
+        hot_destroy(table);
+        return NULL;
+    }
+    return table;
+}
+
+/*
+* Adds a new command and its subtree to a hot table, as the last subcommand of parent
+* The subcommands of parent lie in a block with room for the next power of two of them,
+* only a full block is moved to a larger one
+* On failure the table no longer matches the tree and has to be destroyed
+*
+* table  - the table
+* parent - hot copy of the command's parent (NULL for a root command)
+* cmd    - the command, already added to the tree
+*
+* returns - whether the command was added (false if out of memory)
+*/
+bool hot_insert(cmd_hot_table_t *table, const cmd_hot_t *parent, const command_t *cmd) {
+    uint slot;
+
+    if (!parent) {
+        if ((slot = hot_alloc(table, 0)) == UINT_MAX)
+            return false;
+        hot_fill(&table->cmds[slot], cmd);
+        return hot_index_root(table, slot) && hot_add_subtree(table, slot);
+    }
+
+    const uint parent_slot = (uint)(parent - table->cmds), count = parent->child_cnt;
+
+    // a full block holds a power of two of subcommands
+    if (count == 0 || hot_class(count + 1) != hot_class(count)) {
+        const uint first = hot_alloc(table, hot_class(count + 1));
+
+        if (first == UINT_MAX)
+            return false;
+
+        cmd_hot_t *hot = &table->cmds[parent_slot];
+
+        if (count) {
+            memcpy(table->cmds + first, table->cmds + hot->first_child, (size_t)count * sizeof(cmd_hot_t));
+            hot_release(table, hot->first_child, hot_class(count));
+        }
+        hot->first_child = first;
+    }
+
+    slot = table->cmds[parent_slot].first_child + count;
+    hot_fill(&table->cmds[slot], cmd);
+    table->cmds[parent_slot].child_cnt++;
+    return hot_add_subtree(table, slot);
+}
+
+/*
+* Removes a command and its subtree from a hot table, before it is removed from the tree
+* A block that gets less than half full gives its upper half back
+*
+* table  - the table
+* parent - hot copy of the command's parent (NULL for a root command)
+* cmd    - the command
+*/
+void hot_erase(cmd_hot_table_t *table, const cmd_hot_t *parent, const command_t *cmd) {
+    if (!parent) {
+        const uint bucket = hot_root_bucket(table, cmd);
+
+        if (bucket > table->root_mask)
+            return;
+
+        const uint slot = table->roots[bucket] - 1;
+
+        hot_unindex_root(table, bucket);
+        hot_release_children(table, slot);
+        hot_release(table, slot, 0);
+        return;
+    }
+
+    cmd_hot_t *hot = &table->cmds[parent - table->cmds];
+    const uint count = hot->child_cnt;
+    uint index = 0;
+
+    while (index < count && table->cmds[hot->first_child + index].cold != cmd)
+        index++;
+    if (index == count)
+        return;
+
+    hot_release_children(table, hot->first_child + index);
+    memmove(table->cmds + hot->first_child + index, table->cmds + hot->first_child + index + 1,
+        (size_t)(count - index - 1) * sizeof(cmd_hot_t));
+    if (count == 1)
+        hot_release(table, hot->first_child, 0);
+    else if (hot_class(count - 1) != hot_class(count))
+        hot_release(table, hot->first_child + (1u << hot_class(count - 1)), hot_class(count - 1));
+    else
+        memset(table->cmds + hot->first_child + count - 1, 0, sizeof(cmd_hot_t));
+    hot->child_cnt--;
+}
+
+// Points the hot copy of a root command that its hashmap moved to the command's new bucket
+void hot_moved(cmd_hot_table_t *table, const command_t *from, const command_t *to) {
+    const uint bucket = hot_root_bucket(table, from);
+
+    if (bucket <= table->root_mask)
+        table->cmds[table->roots[bucket] - 1].cold = to;
+}
+
+/*
+* Finds the hot copy of a command by the path leading to it
+*
+* table - the table
+* path  - the commands from the root down to the command, see cmd_locate()
+* count - number of commands on the path to follow
+*
+* returns - hot copy of the count-th command on the path (NULL if count is 0 or it isn't in the table)
+*/
+const cmd_hot_t *hot_find_path(const cmd_hot_table_t *table, const ptr_arraylist_t *path, uint count) {
+    const cmd_hot_t *ret = NULL;
+
+    for (uint i = 0; i < count && i < path->count; ++i) {
+        const command_t *cmd = arraylist_data(path)[i];
+
+        ret = i == 0 ? hot_find_root(table, cmd->name) : hot_find_child(table, ret, cmd->name);
+        if (ret == NULL)
+            return NULL;
+    }
+
+    return ret;
+}
+
+// Returns the tag of a command's argument, see cmd_hot_t
+uchar hot_tag(const cmd_hot_t *hot, uint index) {
+    if (index < HOT_TAGS)
+        return hot->tags[index];
+
+    const arg_node_t *node = hot->cold->syntax[index];
+    return node->format[0] == '>' ? HOT_TAG_SUBCOMMAND : (uchar)node->kind;
+}
+
+/*
+* Finds a root command in a hot table
+*
+* table - the table
+* name  - the command's name
+*
+* returns - the command's hot copy (NULL if there is no such command)
+*/
+const cmd_hot_t *hot_find_root(const cmd_hot_table_t *table, const char *name) {
+    const uint name_hash = hash(name);
+
+    for (uint bucket = name_hash & table->root_mask; table->roots[bucket]; bucket = (bucket + 1) & table->root_mask) {
+        const cmd_hot_t *hot = &table->cmds[table->roots[bucket] - 1];
+
+        if (hot->name_hash == name_hash && str_eq(hot->cold->name, name))
+            return hot;
+    }
+
+    return NULL;
+}
+
+/*
+* Finds a subcommand in a hot table
+*
+* table  - the table
+* parent - hot copy of the command whose subcommand is looked for
+* name   - the subcommand's name
+*
+* returns - the subcommand's hot copy (NULL if there is no such subcommand)
+*/
+const cmd_hot_t *hot_find_child(const cmd_hot_table_t *table, const cmd_hot_t *parent, const char *name) {
+    const uint name_hash = hash(name);
+    const cmd_hot_t *child = table->cmds + parent->first_child;
+
+    for (uint i = 0; i < parent->child_cnt; ++i, ++child) {
+        if (child->name_hash == name_hash && str_eq(child->cold->name, name))
+            return child;
+    }
+
+    return NULL;
+}
+
+// Frees a table made by hot_build()
+void hot_destroy(cmd_hot_table_t *table) {
+    if (!table)
+        return;
+
+    free(table->block);
+    free(table->roots);
+    free(table);
+}
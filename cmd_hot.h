@@ -0,0 +1,17 @@
+#pragma once
+#include "struct_funcs.h"
+
+// number of argument tags stored in a cmd_hot_t, the tags of later arguments are read from the tree
+#define HOT_TAGS 16
+#define HOT_TAG_SUBCOMMAND 0xFF
+#define HOT_ALIGN 64
+
+cmd_hot_table_t *hot_build(const cmd_map_t *map);
+bool hot_insert(cmd_hot_table_t *table, const cmd_hot_t *parent, const command_t *cmd);
+void hot_erase(cmd_hot_table_t *table, const cmd_hot_t *parent, const command_t *cmd);
+void hot_moved(cmd_hot_table_t *table, const command_t *from, const command_t *to);
+const cmd_hot_t *hot_find_path(const cmd_hot_table_t *table, const ptr_arraylist_t *path, uint count);
+uchar hot_tag(const cmd_hot_t *hot, uint index);
+const cmd_hot_t *hot_find_root(const cmd_hot_table_t *table, const char *name);
+const cmd_hot_t *hot_find_child(const cmd_hot_table_t *table, const cmd_hot_t *parent, const char *name);
+void hot_destroy(cmd_hot_table_t *table);
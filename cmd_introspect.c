@@ -0,0 +1,333 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "cmd_introspect.h"
+#include "cmd_main.h"
+
+#pragma warning (disable: 5045)
+
+/*
+* Machine-readable description of a command tree, streamed through a buffer to a cmd_write_t,
+* so that nothing proportional to the tree's size is built in memory
+*
+* JSON:   {"commands":[{"path":"net if","name":"if","bytes":N,"hits":N,"action":true,
+*         "batched":false,"sharded":false,"args":[{"type":"<INT 0..100>","kind":"scanf","size":4}],
+*         "subcommands":[{...}]}, ...]}
+*         only the top-level records have a "path", the name path from the root
+* binary: "CMDI", version, then the records, then a 0 (an empty name)
+*         record: path (name for subcommands), flags (1 action, 2 batched, 4 sharded), hits, bytes,
+*         argument count, per argument its kind (255 for <SUBCMD>), type and size,
+*         subcommand count and the subcommands' records
+*         numbers are LEB128 varints, strings a varint length followed by the bytes
+*
+* bytes is the memory a command owns besides its subcommands, allocator overhead not included
+*/
+
+static const char *const kind_names[] = {
+    [ARG_SCANF] = "scanf",
+    [ARG_STRING] = "string",
+    [ARG_FLOAT] = "float",
+    [ARG_DOUBLE] = "double",
+    [ARG_ENUM] = "enum",
+    [ARG_INT_LIST] = "int_list",
+    [ARG_UINT_LIST] = "uint_list",
+    [ARG_BLOB] = "blob",
+};
+
+// Memory owned by a parameterized syntax node such as <ENUM a|b> or <INT 0..9>
+size_t introspect_node_footprint(const arg_node_t *node) {
+    size_t ret = sizeof(arg_node_t) + strlen(node->key) + 1;
+
+    if (node->kind == ARG_ENUM && node->extra) {
+        const arg_enum_t *enm = node->extra;
+
+        ret += sizeof(arg_enum_t) + enm->count * (sizeof(char *) + sizeof(uint) + sizeof(int));
+        for (uint i = 0; i < enm->count; ++i)
+            ret += strlen(enm->words[i]) + 1;
+    }
+    if (node->constraint) {
+        ret += sizeof(arg_constraint_t);
+        if (node->constraint->dfa) {
+            const arg_dfa_t *dfa = node->constraint->dfa;
+
+            ret += sizeof(arg_dfa_t) + (size_t)dfa->state_cnt * (dfa->class_cnt * sizeof(ushort) + sizeof(bool));
+        }
+    }
+    return ret;
+}
+
+/*
+* Counts the memory a command owns: the command itself, its name, its syntax and the list
+* of its subcommands, but not the subcommands
+*
+* cmd - the command
+*
+* returns - the size in bytes
+*/
+size_t introspect_footprint(const command_t *cmd) {
+    size_t ret = sizeof(command_t) + strlen(cmd->name) + 1 + cmd->arg_cnt * sizeof(arg_node_t *);
+
+    if (cmd->subcommands.heap)
+        ret += cmd->subcommands.size * sizeof(void *);
+    ret += cmd->shard.data_cnt * sizeof(void *);
+    for (uint i = 0; i < cmd->arg_cnt; ++i) {
+        if (cmd->syntax[i]->is_dynamic_memory)
+            ret += introspect_node_footprint(cmd->syntax[i]);
+    }
+    return ret;
+}
+
+// Hands the buffered output to the sink
+void introspect_flush(cmd_introspect_t *it) {
+    if (it->len && !it->failed)
+        it->failed = !it->write(it->sink, it->buffer, it->len);
+    it->len = 0;
+}
+
+// Appends bytes to the output, what doesn't fit the buffer goes straight to the sink
+void introspect_put(cmd_introspect_t *it, const void *data, size_t size) {
+    if (size > INTROSPECT_BUFFER - it->len)
+        introspect_flush(it);
+    if (size >= INTROSPECT_BUFFER) {
+        it->failed = it->failed || !it->write(it->sink, data, size);
+        return;
+    }
+    memcpy(it->buffer + it->len, data, size);
+    it->len += (uint)size;
+}
+
+#define introspect_puts(it, str) introspect_put(it, str, sizeof(str) - 1)
+
+// Appends a number, in decimal for JSON and as a varint for the binary form
+void introspect_uint(cmd_introspect_t *it, ullong value) {
+    uchar digits[20];
+    uint len = 0;
+
+    if (it->format == INTROSPECT_BINARY) {
+        do {
+            digits[len++] = (uchar)(value & 0x7F) | (value > 0x7F ? 0x80 : 0);
+            value >>= 7;
+        } while (value);
+        introspect_put(it, digits, len);
+        return;
+    }
+
+    do {
+        digits[sizeof(digits) - ++len] = (uchar)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    introspect_put(it, digits + sizeof(digits) - len, len);
+}
+
+// Appends a JSON boolean
+void introspect_bool(cmd_introspect_t *it, bool value) {
+    if (value)
+        introspect_puts(it, "true");
+    else
+        introspect_puts(it, "false");
+}
+
+// Appends the body of a JSON string, escaping quotes, backslashes and control characters
+void introspect_json_body(cmd_introspect_t *it, const char *str) {
+    while (*str) {
+        size_t run = 0;
+
+        while (str[run] && str[run] != '"' && str[run] != '\\' && (uchar)str[run] >= ' ')
+            run++;
+        introspect_put(it, str, run);
+        str += run;
+        if (!*str)
+            break;
+
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), (uchar)*str < ' ' ? "\\u%04x" : "\\%c", *str);
+        introspect_put(it, escaped, strlen(escaped));
+        str++;
+    }
+}
+
+// Appends a string, quoted for JSON and length-prefixed for the binary form
+void introspect_string(cmd_introspect_t *it, const char *str) {
+    if (it->format == INTROSPECT_BINARY) {
+        const size_t len = strlen(str);
+
+        introspect_uint(it, len);
+        introspect_put(it, str, len);
+        return;
+    }
+
+    introspect_puts(it, "\"");
+    introspect_json_body(it, str);
+    introspect_puts(it, "\"");
+}
+
+// Appends the name path of a top-level record, "parent ... name"
+void introspect_path(cmd_introspect_t *it, const command_t *const *parents, uint parent_cnt, const command_t *cmd) {
+    if (it->format == INTROSPECT_BINARY) {
+        size_t len = strlen(cmd->name);
+
+        for (uint i = 0; i < parent_cnt; ++i)
+            len += strlen(parents[i]->name) + 1;
+        introspect_uint(it, len);
+    }
+    else
+        introspect_puts(it, "\"path\":\"");
+
+    for (uint i = 0; i < parent_cnt; ++i) {
+        if (it->format == INTROSPECT_BINARY)
+            introspect_put(it, parents[i]->name, strlen(parents[i]->name));
+        else
+            introspect_json_body(it, parents[i]->name);
+        introspect_puts(it, " ");
+    }
+    if (it->format == INTROSPECT_BINARY)
+        introspect_put(it, cmd->name, strlen(cmd->name));
+    else {
+        introspect_json_body(it, cmd->name);
+        introspect_puts(it, "\",");
+    }
+}
+
+/*
+* Appends the record of a command and, nested in it, those of its subcommands
+*
+* it         - the stream
+* parents    - the commands on the path to cmd, for the path of a top-level record
+* parent_cnt - length of parents
+* cmd        - the command
+* top        - whether this is a top-level record
+*/
+void introspect_record(cmd_introspect_t *it, const command_t *const *parents, uint parent_cnt, const command_t *cmd, bool top) {
+    const bool json = it->format == INTROSPECT_JSON;
+    const bool batched = cmd->batch.action != NULL, sharded = cmd->shard.data != NULL;
+    const uint child_cnt = cmd->subcommands.count;
+
+    if (json)
+        introspect_puts(it, "{");
+    if (top)
+        introspect_path(it, parents, parent_cnt, cmd);
+    if (json) {
+        introspect_puts(it, "\"name\":");
+        introspect_string(it, cmd->name);
+        introspect_puts(it, ",\"bytes\":");
+        introspect_uint(it, introspect_footprint(cmd));
+        introspect_puts(it, ",\"hits\":");
+        introspect_uint(it, atomic_load_explicit(&cmd->hits, memory_order_relaxed));
+        introspect_puts(it, ",\"action\":");
+        introspect_bool(it, cmd->action.action != NULL);
+        introspect_puts(it, ",\"batched\":");
+        introspect_bool(it, batched);
+        introspect_puts(it, ",\"sharded\":");
+        introspect_bool(it, sharded);
+        introspect_puts(it, ",\"args\":[");
+    }
+    else {
+        if (!top)
+            introspect_string(it, cmd->name);
+        introspect_uint(it, (cmd->action.action != NULL) | batched << 1 | sharded << 2);
+        introspect_uint(it, atomic_load_explicit(&cmd->hits, memory_order_relaxed));
+        introspect_uint(it, introspect_footprint(cmd));
+        introspect_uint(it, cmd->arg_cnt);
+    }
+
+    for (uint i = 0; i < cmd->arg_cnt; ++i) {
+        const arg_node_t *node = cmd->syntax[i];
+        const bool subcmd = node->format[0] == '>';
+
+        if (json) {
+            if (i)
+                introspect_puts(it, ",");
+            introspect_puts(it, "{\"type\":");
+            introspect_string(it, node->key);
+            introspect_puts(it, ",\"kind\":\"");
+            introspect_json_body(it, subcmd ? "subcommand" : kind_names[node->kind]);
+            introspect_puts(it, "\",\"size\":");
+            introspect_uint(it, node->size);
+            introspect_puts(it, "}");
+        }
+        else {
+            introspect_uint(it, subcmd ? 0xFF : node->kind);
+            introspect_string(it, node->key);
+            introspect_uint(it, node->size);
+        }
+    }
+
+    if (json)
+        introspect_puts(it, "],\"subcommands\":[");
+    else
+        introspect_uint(it, child_cnt);
+    for (uint i = 0; i < child_cnt && !it->failed; ++i) {
+        if (json && i)
+            introspect_puts(it, ",");
+        introspect_record(it, NULL, 0, arraylist_data(&cmd->subcommands)[i], false);
+    }
+    if (json)
+        introspect_puts(it, "]}");
+}
+
+/*
+* Starts an introspection stream
+*
+* it     - the stream's state
+* format - the output format
+* write  - the sink's write function, called with up to INTROSPECT_BUFFER bytes at a time
+*          (cmd_write_file() writes to a FILE *)
+* sink   - passed to write
+*/
+void introspect_begin(cmd_introspect_t *it, cmd_introspect_format_t format, cmd_write_t write, void *sink) {
+    it->write = write;
+    it->sink = sink;
+    it->format = format;
+    it->len = it->records = 0;
+    it->failed = false;
+
+    if (format == INTROSPECT_BINARY) {
+        introspect_puts(it, INTROSPECT_MAGIC);
+        introspect_uint(it, INTROSPECT_VERSION);
+    }
+    else
+        introspect_puts(it, "{\"commands\":[");
+}
+
+/*
+* Appends a top-level record to an introspection stream: a command with its whole subtree
+*
+* it         - the stream
+* parents    - the commands on the path from the root to cmd
+* parent_cnt - length of parents (0 for a root command)
+* cmd        - the command
+*/
+void introspect_command(cmd_introspect_t *it, const command_t *const *parents, uint parent_cnt, const command_t *cmd) {
+    if (it->failed)
+        return;
+
+    if (it->format == INTROSPECT_JSON) {
+        if (it->records)
+            introspect_puts(it, ",\n");
+        else
+            introspect_puts(it, "\n");
+    }
+    it->records++;
+    introspect_record(it, parents, parent_cnt, cmd, true);
+}
+
+/*
+* Ends an introspection stream and writes what is still buffered
+*
+* it - the stream
+*
+* returns - whether the sink accepted all the output
+*/
+bool introspect_end(cmd_introspect_t *it) {
+    if (it->format == INTROSPECT_BINARY)
+        introspect_uint(it, 0);
+    else
+        introspect_puts(it, "\n]}\n");
+    introspect_flush(it);
+    return !it->failed;
+}
+
+// A cmd_write_t writing to a FILE *
+bool cmd_write_file(void *file, const void *data, size_t size) {
+    return fwrite(data, 1, size, file) == size;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "struct_funcs.h"
+
+// size of cmd_introspect_t's buffer, output is written in chunks of at most this many bytes
+#define INTROSPECT_BUFFER 8192
+#define INTROSPECT_MAGIC "CMDI"
+#define INTROSPECT_VERSION 1
+
+size_t introspect_footprint(const command_t *cmd);
+void introspect_begin(cmd_introspect_t *it, cmd_introspect_format_t format, cmd_write_t write, void *sink);
+void introspect_command(cmd_introspect_t *it, const command_t *const *parents, uint parent_cnt, const command_t *cmd);
+bool introspect_end(cmd_introspect_t *it);
+
+bool cmd_write_file(void *file, const void *data, size_t size);
@@ -0,0 +1,502 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cmd_journal.h"
+#include "arg_types.h"
+#include "sync_funcs.h"
+
+#pragma warning (disable: 5045 4996)
+
+/*
+* Journal file format (native byte order):
+*
+* "CMDJRNL1"                                               - once, at the start of the file
+* u8 type=1 | u32 id | u32 len | name path                 - binds an id to a command, e.g. "set volume"
+* u8 type=2 | u32 id | u64 timestamp | u32 len | frame     - one executed command (ns since the epoch)
+*
+* A frame holds the command's arguments in order: plain values as their raw bytes,
+* strings as u32 length + bytes + NUL, lists as u32 count + raw elements
+* Each command gets its id with its first call after the journal was opened,
+* a later COMMAND record (of a later run) overrides an earlier one with the same id
+*/
+
+/*
+* Collects the argument kinds of a command from the commands on its name path
+* Each command contributes its arguments up to its subcommand, which is what the parser fills bundles with
+*
+* path - every command on the way from the root to the command
+*
+* returns - the layout (free with frame_layout_destroy())
+*/
+cmd_frame_layout_t frame_layout_make(const ptr_arraylist_t *path) {
+    cmd_frame_layout_t ret = { 0 };
+    uint total = 0;
+
+    for (uint i = 0; i < path->count; ++i)
+        total += ((const command_t *)arraylist_data(path)[i])->arg_cnt;
+
+    ret.kinds = malloc((total + 1) * sizeof(arg_kind_t));
+    ret.sizes = malloc((total + 1) * sizeof(uint));
+    if (!ret.kinds || !ret.sizes) {
+        frame_layout_destroy(&ret);
+        return ret;
+    }
+
+    for (uint i = 0; i < path->count; ++i) {
+        const command_t *cmd = arraylist_data(path)[i];
+
+        for (uint j = 0; j < cmd->arg_cnt && cmd->syntax[j]->format[0] != '>'; ++j) {
+            const arg_node_t *node = cmd->syntax[j];
+
+            ret.kinds[ret.count] = node->kind;
+            ret.sizes[ret.count++] = arg_kind_is_list(node->kind) ? node->elem_size : node->size;
+        }
+    }
+
+    return ret;
+}
+
+// Frees a layout made by frame_layout_make()
+void frame_layout_destroy(cmd_frame_layout_t *layout) {
+    free(layout->kinds);
+    free(layout->sizes);
+    memset(layout, 0, sizeof(*layout));
+}
+
+/*
+* Helper function of journal_append() and journal_add_command()
+* Finds the slot of a command in the journal's id table, the journal lock has to be held
+*
+* journal - the journal
+* cmd_id  - id of the command to look for (see command_t)
+*
+* returns - the slot holding the command, or the empty slot where it belongs
+*/
+cmd_journal_cmd_t *journal_slot(const cmd_journal_t *journal, uint cmd_id) {
+    const uint mask = journal->cmd_size - 1;
+    uint i = (cmd_id * 2654435761u) & mask;
+
+    while (journal->cmds[i].cmd_id != 0 && journal->cmds[i].cmd_id != cmd_id)
+        i = (i + 1) & mask;
+
+    return &journal->cmds[i];
+}
+
+// Used with thrd_create() by journal_open()
+// Writes the buffered records to the file every flush_ms, or sooner if the buffer fills up
+int journal_flusher(void *arg) {
+    cmd_journal_t *journal = arg;
+    byte_arraylist_t out = { 0 };
+    struct timespec deadline;
+    bool stop;
+
+    mtx_lock(&journal->lock);
+    do {
+        if (!journal->stop && journal->buffer.count < JOURNAL_FLUSH_BYTES) {
+            timespec_get(&deadline, TIME_UTC);
+            deadline.tv_sec += journal->flush_ms / 1000;
+            deadline.tv_nsec += (long)(journal->flush_ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            cnd_timedwait(&journal->wake, &journal->lock, &deadline);
+        }
+
+        // group commit: take everything appended so far and write it at once
+        const byte_arraylist_t full = journal->buffer;
+        journal->buffer = out;
+        out = full;
+        stop = journal->stop;
+        mtx_unlock(&journal->lock);
+
+        if (out.count > 0) {
+            fwrite(byte_arraylist_data(&out), 1, out.count, journal->file);
+            fflush(journal->file);
+            out.count = 0;
+        }
+
+        mtx_lock(&journal->lock);
+    } while (!stop || journal->buffer.count > 0);
+    mtx_unlock(&journal->lock);
+
+    byte_arraylist_destroy(&out);
+    return 0;
+}
+
+/*
+* Opens a journal file for appending executed commands
+*
+* path     - the journal file, created if it doesn't exist
+* flush_ms - interval in which buffered records are written to the file
+*
+* returns - pointer to the journal (NULL on failure), close with journal_close()
+*/
+cmd_journal_t *journal_open(const char *path, uint flush_ms) {
+    cmd_journal_t *ret = calloc(1, sizeof(cmd_journal_t));
+
+    if (!ret)
+        return NULL;
+
+    ret->flush_ms = flush_ms ? flush_ms : 1;
+    ret->cmd_size = 16;
+    ret->cmds = calloc(ret->cmd_size, sizeof(cmd_journal_cmd_t));
+    ret->file = fopen(path, "ab");
+    if (!ret->cmds || !ret->file) {
+        if (ret->file)
+            fclose(ret->file);
+        free(ret->cmds);
+        free(ret);
+        return NULL;
+    }
+
+    fseek(ret->file, 0, SEEK_END);
+    if (ftell(ret->file) == 0)
+        fwrite(JOURNAL_MAGIC, 1, JOURNAL_MAGIC_LEN, ret->file);
+
+    mtx_init(&ret->lock, mtx_plain);
+    cnd_init(&ret->wake);
+    if (thrd_create(&ret->flusher, &journal_flusher, ret) != thrd_success) {
+        fclose(ret->file);
+        mtx_destroy(&ret->lock);
+        cnd_destroy(&ret->wake);
+        free(ret->cmds);
+        free(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+/*
+* Appends an executed command to the journal's buffer
+*
+* journal - the journal
+* parsed  - the command with its arguments
+*
+* returns - false if the command has no id yet (see journal_add_command()), true otherwise
+*/
+bool journal_append(cmd_journal_t *journal, const cmd_parsed_t *parsed) {
+    const arg_bundle_t *args = &parsed->args;
+    const uchar type = JOURNAL_REC_CALL;
+    const ullong timestamp = time_wall_ns();
+
+    mtx_lock(&journal->lock);
+
+    const cmd_journal_cmd_t *slot = journal_slot(journal, parsed->cmd_id);
+    const cmd_frame_layout_t *layout = &slot->layout;
+
+    if (slot->cmd_id == 0) {
+        mtx_unlock(&journal->lock);
+        return false;
+    }
+    if (layout->count != args->args.count) {
+        // can't happen for a bundle made by the parser
+        mtx_unlock(&journal->lock);
+        return true;
+    }
+
+    byte_arraylist_t *buf = &journal->buffer;
+    const uint start = buf->count;
+    uint frame_len = 0;
+    bool ok = byte_arraylist_append(buf, &type, sizeof(type))
+        && byte_arraylist_append(buf, &slot->id, sizeof(slot->id))
+        && byte_arraylist_append(buf, &timestamp, sizeof(timestamp))
+        && byte_arraylist_append(buf, &frame_len, sizeof(frame_len));
+    const uint frame_start = buf->count;
+
+    for (uint i = 0; ok && i < layout->count; ++i) {
+        const uchar *value = byte_arraylist_data(&args->data) + (size_t)arraylist_data(&args->args)[i];
+
+        // bundle values aren't aligned, so pointers are copied out
+        if (layout->kinds[i] == ARG_STRING) {
+            const char *str;
+            memcpy(&str, value, sizeof(str));
+            const uint len = (uint)strlen(str);
+
+            ok = byte_arraylist_append(buf, &len, sizeof(len)) && byte_arraylist_append(buf, str, len + 1);
+        }
+        else if (arg_kind_is_list(layout->kinds[i])) {
+            arg_list_t list;
+            memcpy(&list, value, sizeof(list));
+
+            ok = byte_arraylist_append(buf, &list.count, sizeof(list.count))
+                && (list.count == 0 || byte_arraylist_append(buf, list.data, list.count * layout->sizes[i]));
+        }
+        else if (layout->kinds[i] == ARG_BLOB) {
+            arg_blob_t blob;
+            memcpy(&blob, value, sizeof(blob));
+            const uint size = (uint)blob.size;
+
+            // records are limited to 4 GiB
+            ok = size == blob.size && byte_arraylist_append(buf, &size, sizeof(size)) && (size == 0 || byte_arraylist_append(buf, blob.data, size));
+        }
+        else
+            ok = byte_arraylist_append(buf, value, layout->sizes[i]);
+    }
+
+    if (!ok) {
+        // out of memory, drop the record
+        buf->count = start;
+        mtx_unlock(&journal->lock);
+        return true;
+    }
+    // the frame length is only known now
+    frame_len = buf->count - frame_start;
+    memcpy(byte_arraylist_data(buf) + frame_start - sizeof(frame_len), &frame_len, sizeof(frame_len));
+
+    journal->records++;
+    if (buf->count >= JOURNAL_FLUSH_BYTES)
+        cnd_signal(&journal->wake);
+    mtx_unlock(&journal->lock);
+    return true;
+}
+
+/*
+* Gives a command an id and writes a record binding the id to its name path
+* Does nothing if the command already has an id
+* The caller has to hold the lock of the command's registry, the path points into its tree
+*
+* journal - the journal
+* path    - every command on the way from the root to the command
+*/
+void journal_add_command(cmd_journal_t *journal, const ptr_arraylist_t *path) {
+    const command_t *cmd = arraylist_data(path)[path->count - 1];
+
+    mtx_lock(&journal->lock);
+
+    if (journal_slot(journal, cmd->id)->cmd_id != 0) {
+        mtx_unlock(&journal->lock);
+        return;
+    }
+
+    if (2 * (journal->cmd_count + 1) > journal->cmd_size) {
+        // keep the table at most half full
+        cmd_journal_cmd_t *old = journal->cmds;
+        const uint old_size = journal->cmd_size;
+        cmd_journal_cmd_t *cmds = calloc(old_size * 2, sizeof(cmd_journal_cmd_t));
+
+        if (!cmds) {
+            mtx_unlock(&journal->lock);
+            return;
+        }
+        journal->cmds = cmds;
+        journal->cmd_size = old_size * 2;
+        for (uint i = 0; i < old_size; ++i)
+            if (old[i].cmd_id)
+                *journal_slot(journal, old[i].cmd_id) = old[i];
+        free(old);
+    }
+
+    cmd_journal_cmd_t *slot = journal_slot(journal, cmd->id);
+    const uchar type = JOURNAL_REC_COMMAND;
+    const char space = ' ';
+    uint len = 0;
+
+    slot->cmd_id = cmd->id;
+    slot->id = journal->next_id++;
+    slot->layout = frame_layout_make(path);
+    journal->cmd_count++;
+
+    for (uint i = 0; i < path->count; ++i)
+        len += (uint)strlen(((const command_t *)arraylist_data(path)[i])->name) + (i > 0);
+    // all or nothing, a partial record would break the file
+    if (!byte_arraylist_reserve(&journal->buffer, sizeof(type) + sizeof(slot->id) + sizeof(len) + len)) {
+        mtx_unlock(&journal->lock);
+        return;
+    }
+
+    byte_arraylist_append(&journal->buffer, &type, sizeof(type));
+    byte_arraylist_append(&journal->buffer, &slot->id, sizeof(slot->id));
+    byte_arraylist_append(&journal->buffer, &len, sizeof(len));
+    for (uint i = 0; i < path->count; ++i) {
+        const char *name = ((const command_t *)arraylist_data(path)[i])->name;
+
+        if (i > 0)
+            byte_arraylist_append(&journal->buffer, &space, 1);
+        byte_arraylist_append(&journal->buffer, name, (uint)strlen(name));
+    }
+
+    mtx_unlock(&journal->lock);
+}
+
+/*
+* Writes all buffered records, closes the journal file and frees the journal
+*
+* journal - the journal to be closed
+*/
+void journal_close(cmd_journal_t *journal) {
+    if (!journal)
+        return;
+
+    mtx_lock(&journal->lock);
+    journal->stop = true;
+    cnd_signal(&journal->wake);
+    mtx_unlock(&journal->lock);
+    thrd_join(journal->flusher, NULL);
+
+    fclose(journal->file);
+    for (uint i = 0; i < journal->cmd_size; ++i)
+        frame_layout_destroy(&journal->cmds[i].layout);
+    free(journal->cmds);
+    byte_arraylist_destroy(&journal->buffer);
+    mtx_destroy(&journal->lock);
+    cnd_destroy(&journal->wake);
+    free(journal);
+}
+
+/*
+* Reads a whole journal file into memory
+*
+* path - the journal file
+* size - pointer to where the number of bytes after the file header is to be stored
+*
+* returns - the records (free with free()), NULL if the file can't be read or isn't a journal
+*/
+uchar *journal_load(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    char magic[JOURNAL_MAGIC_LEN];
+    uchar *ret = NULL;
+    long end;
+
+    if (!file)
+        return NULL;
+
+    if (fread(magic, 1, JOURNAL_MAGIC_LEN, file) == JOURNAL_MAGIC_LEN
+        && memcmp(magic, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) == 0
+        && fseek(file, 0, SEEK_END) == 0 && (end = ftell(file)) >= JOURNAL_MAGIC_LEN
+        && fseek(file, JOURNAL_MAGIC_LEN, SEEK_SET) == 0) {
+        *size = (size_t)end - JOURNAL_MAGIC_LEN;
+        // one extra byte, so that an empty journal isn't a failed allocation
+        ret = malloc(*size + 1);
+        if (ret && fread(ret, 1, *size, file) != *size) {
+            free(ret);
+            ret = NULL;
+        }
+    }
+
+    fclose(file);
+    return ret;
+}
+
+/*
+* Decodes the next record of a loaded journal
+*
+* data - the records, as returned by journal_load()
+* size - number of bytes in data
+* pos  - pointer to the position of the record, moved past it
+* rec  - pointer to where the record is to be decoded
+*
+* returns - whether a whole record was decoded (false at the end or at a truncated record)
+*/
+bool journal_next(const uchar *data, size_t size, size_t *pos, cmd_journal_rec_t *rec) {
+    size_t p = *pos;
+    uchar type;
+
+    if (p + 1 + sizeof(uint) > size)
+        return false;
+
+    type = data[p++];
+    memcpy(&rec->id, data + p, sizeof(uint));
+    p += sizeof(uint);
+    rec->timestamp = 0;
+
+    if (type == JOURNAL_REC_CALL) {
+        if (p + sizeof(ullong) > size)
+            return false;
+        memcpy(&rec->timestamp, data + p, sizeof(ullong));
+        p += sizeof(ullong);
+    }
+    else if (type != JOURNAL_REC_COMMAND)
+        return false;
+
+    if (p + sizeof(uint) > size)
+        return false;
+    memcpy(&rec->len, data + p, sizeof(uint));
+    p += sizeof(uint);
+    if (rec->len > size - p)
+        return false;
+
+    rec->type = (cmd_journal_rec_type_t)type;
+    rec->data = data + p;
+    *pos = p + rec->len;
+    return true;
+}
+
+/*
+* Rebuilds the arguments of a CALL record in an arg bundle
+* Strings and blob payloads point into the record, so it has to outlive the bundle
+*
+* layout - layout of the recorded command's arguments
+* rec    - the CALL record
+* bundle - pointer to an empty bundle that receives the arguments
+*
+* returns - whether the frame matches the layout
+*/
+bool journal_frame_decode(const cmd_frame_layout_t *layout, const cmd_journal_rec_t *rec, arg_bundle_t *bundle) {
+    const uchar *data = rec->data;
+    uint pos = 0, n;
+
+    for (uint i = 0; i < layout->count; ++i) {
+        if (layout->kinds[i] == ARG_STRING || arg_kind_is_list(layout->kinds[i]) || layout->kinds[i] == ARG_BLOB) {
+            if (rec->len - pos < sizeof(uint))
+                return false;
+            memcpy(&n, data + pos, sizeof(uint));
+            pos += sizeof(uint);
+        }
+
+        if (layout->kinds[i] == ARG_STRING) {
+            const char *str = (const char *)data + pos;
+
+            // n + 1 could wrap around
+            if (n >= rec->len - pos || str[n] != '\0')
+                return false;
+            arg_bundle_add_(bundle, &str, sizeof(str), false);
+            pos += n + 1;
+        }
+        else if (arg_kind_is_list(layout->kinds[i])) {
+            // checked before anything is allocated for it
+            if (layout->sizes[i] && n > (rec->len - pos) / layout->sizes[i])
+                return false;
+
+            const size_t bytes = (size_t)n * layout->sizes[i];
+            arg_list_t list = { .data = malloc(bytes + 1), .count = n };
+
+            if (!list.data)
+                return false;
+            // lists may be modified by actions and need to be aligned, so they get their own copy
+            memcpy(list.data, data + pos, bytes);
+            arg_bundle_add_(bundle, &list, sizeof(list), true);
+            pos += (uint)bytes;
+        }
+        else if (layout->kinds[i] == ARG_BLOB) {
+            const arg_blob_t blob = { .data = (void *)(data + pos), .size = n };
+
+            if (rec->len - pos < n)
+                return false;
+            arg_bundle_add_(bundle, &blob, sizeof(blob), false);
+            pos += n;
+        }
+        else {
+            if (rec->len - pos < layout->sizes[i])
+                return false;
+            arg_bundle_add_(bundle, data + pos, layout->sizes[i], false);
+            pos += layout->sizes[i];
+        }
+    }
+
+    return pos == rec->len;
+}
+
+// Empties an arg bundle for reuse, freeing its dynamically allocated arguments
+void journal_bundle_reset(arg_bundle_t *bundle) {
+    void **blocks = arraylist_data(&bundle->dynamic_blocks);
+
+    for (uint i = 0; i < bundle->dynamic_blocks.count; ++i)
+        free(blocks[i]);
+    bundle->dynamic_blocks.count = 0;
+    bundle->args.count = 0;
+    bundle->data.count = 0;
+    bundle->index = 0;
+    bundle->empty = true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "struct_funcs.h"
+
+#define JOURNAL_MAGIC "CMDJRNL1"
+#define JOURNAL_MAGIC_LEN 8
+// buffered bytes after which the flusher is woken up before its interval ends
+#define JOURNAL_FLUSH_BYTES (1u << 16)
+
+cmd_frame_layout_t frame_layout_make(const ptr_arraylist_t *path);
+void frame_layout_destroy(cmd_frame_layout_t *layout);
+
+cmd_journal_t *journal_open(const char *path, uint flush_ms);
+bool journal_append(cmd_journal_t *journal, const cmd_parsed_t *parsed);
+void journal_add_command(cmd_journal_t *journal, const ptr_arraylist_t *path);
+void journal_close(cmd_journal_t *journal);
+
+uchar *journal_load(const char *path, size_t *size);
+bool journal_next(const uchar *data, size_t size, size_t *pos, cmd_journal_rec_t *rec);
+bool journal_frame_decode(const cmd_frame_layout_t *layout, const cmd_journal_rec_t *rec, arg_bundle_t *bundle);
+void journal_bundle_reset(arg_bundle_t *bundle);
@@ -1,16 +1,37 @@
 #include "struct_funcs.h"
 #include "cmd_main.h"
 #include "cmd_storage.h"
+#include "sync_funcs.h"
+#include "cmd_cache.h"
+#include "cmd_memo.h"
+#include "cmd_batch.h"
+#include "cmd_shard.h"
+#include "cmd_journal.h"
+#include "cmd_trace.h"
+#include "cmd_timer.h"
+#include "cmd_server.h"
+#include "cmd_hot.h"
+#include "cmd_introspect.h"
+#include "arg_types.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <stdatomic.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 #pragma warning (disable: 5045 4996)
 
-// the main command map
+// the default command registry
 // this is where cmd_register() puts its commands
 // and where cmd_execute() looks to find them
-cmd_map_t global_command_map = { 0 };
+cmd_registry_t global_command_registry;
+once_flag global_command_registry_once = ONCE_FLAG_INIT;
 
 // a struct to allow cmd_skip_existent() to return 2 values
 typedef struct cmd_tree_location_t_ {
@@ -40,6 +61,249 @@ bool str_eq(const char *s1, const char *s2) {
     return strcmp(s1, s2) == 0;
 }
 
+/*
+* Initializes an empty command registry
+* 
+* registry - pointer to the registry to initialize
+* 
+* returns - whether the registry was successfully initialized
+*/
+bool cmd_registry_init(cmd_registry_t *registry) {
+    memset(registry, 0, sizeof(*registry));
+    atomic_init(&registry->generation, 0);
+
+    return rwlock_init(&registry->lock) && batcher_init(&registry->batcher) && timers_init(&registry->timers)
+        && mtx_init(&registry->hot_lock, mtx_plain) == thrd_success;
+}
+
+// Used with call_once() by cmd_default_registry()
+void cmd_global_init(void) {
+    cmd_registry_init(&global_command_registry);
+}
+
+// Returns the registry used by the functions without a registry parameter,
+// initializing it on first use
+cmd_registry_t *cmd_default_registry(void) {
+    call_once(&global_command_registry_once, &cmd_global_init);
+    return &global_command_registry;
+}
+
+/*
+* Creates an independent command registry
+* Commands registered in it are only visible to the cmd_registry_* functions called with it,
+* so each worker or tenant can have its own set of commands without contention on the default one
+* 
+* returns - pointer to the new registry (NULL on failure), free it with cmd_registry_destroy()
+*/
+cmd_registry_t *cmd_registry_create(void) {
+    cmd_registry_t *ret = malloc(sizeof(cmd_registry_t));
+
+    if (ret && !cmd_registry_init(ret)) {
+        free(ret);
+        ret = NULL;
+    }
+
+    return ret;
+}
+
+/*
+* Frees a registry created by cmd_registry_create() with all its commands
+* Pending batches and queued sharded calls are run first, then the executor threads stop
+* Must not be called while other threads are using the registry
+* 
+* registry - the registry to be deleted
+*/
+void cmd_registry_destroy(cmd_registry_t *registry) {
+    if (!registry || registry == &global_command_registry)
+        return;
+
+    timers_destroy(&registry->timers);
+    batcher_destroy(&registry->batcher);
+    shards_stop(&registry->shards);
+    journal_close(registry->journal);
+    cmd_cache_destroy(registry->cache);
+    cmd_memo_destroy(registry->memo);
+    hot_destroy(atomic_load(&registry->hot));
+    mtx_destroy(&registry->hot_lock);
+    cmd_map_destroy(&registry->map);
+    rwlock_destroy(&registry->lock);
+    free(registry);
+}
+
+// Used by the functions that change the command tree, while holding the lock for writing
+// Makes all parse results obtained before the change invalid
+// The hot table is updated by the functions themselves, see cmd_hot_insert()
+void cmd_tree_changed(cmd_registry_t *registry) {
+    atomic_fetch_add(&registry->generation, 1);
+    if (registry->cache)
+        cmd_cache_clear(registry->cache);
+    if (registry->memo)
+        cmd_memo_clear(registry->memo);
+}
+
+/*
+* Recursive command printing function used by cmd_dumpall()
+* 
+* cmd   -  pointer to a command to be printed out
+* depth -  current depth of recursion, used to determine indent size
+* 
+* The macro cmd_print(cmd) can be used to print a single command and its subtree 
+*/
+void cmd_print_rec(const command_t *cmd, uint depth) {
+    cmd_printf("%s ", cmd->name);
+    for (uint i = 0; i < cmd->arg_cnt; ++i)
+        cmd_printf("%s ", cmd->syntax[i]->key);
+    if (cmd->action.action != NULL)
+        cmd_printf("-> calls %p(%p)", cmd->action.action, cmd->action.static_data);
+    for (uint i = 0; i < cmd->subcommands.count; ++i) {
+        const command_t *subcmd = (const command_t *)arraylist_data(&cmd->subcommands)[i];
+        cmd_printf("\n%*s", (depth + 1) * 2, "");
+        cmd_print_rec(subcmd, depth + 1);
+    }
+}
+
+// Dumps the entire command tree of a registry to stdout (or the client, see cmd_printf()) in the format:
+// COMMAND_NAME <ARGUMENT> <LIST> -> calls FUNCTION_ADDRESS(STATIC_DATA)
+void cmd_registry_dumpall(cmd_registry_t *registry) {
+    cmd_rwlock_t *lock = &registry->lock;
+    const command_t *cmd;
+    uint iter = 0;
+
+    rwlock_read_lock(lock);
+    while ((cmd = cmd_map_next(&registry->map, &iter)) != NULL) {
+        cmd_printf("\n");
+        cmd_print(cmd);
+    }
+    cmd_printf("\n");
+    rwlock_read_unlock(lock);
+}
+
+// Used by cmd_registry_loop()
+// Acts as action parameter for the 'dump' command, static_data is the registry
+void cmd_dumpall_interf(arg_bundle_t *a) {
+    cmd_registry_dumpall(a->static_data);
+}
+
+// Used by cmd_registry_loop()
+// Acts as action parameter for the 'exit' command
+void exit_func(arg_bundle_t *args) {
+    *(bool *)args->static_data = true;
+}
+
+/*
+* Helper function of cmd_registry_loop()
+* Reads a line from stdin like fgets(), running scheduled commands and passing batches that
+* become due while waiting (on Windows they only run between lines)
+* 
+* registry - the registry whose timers are run
+* reader   - input read so far but not returned yet
+* line     - buffer receiving the line
+* size     - size of the buffer
+* 
+* returns - whether a line was read (false at the end of input)
+*/
+bool cmd_loop_read_line(cmd_registry_t *registry, cmd_line_reader_t *reader, char *line, uint size) {
+#ifdef _WIN32
+    UNREF(reader);
+    cmd_registry_timers_poll(registry);
+    return fgets(line, (int)size, stdin) != NULL;
+#else
+    while (true) {
+        const char *begin = reader->buffer + reader->begin;
+        const uint avail = reader->end - reader->begin;
+        const char *newline = memchr(begin, '\n', avail);
+
+        // a whole line, one too long for the buffer or the rest of the input
+        if (newline || avail >= size - 1 || (reader->eof && avail > 0)) {
+            const uint len = min(newline ? (uint)(newline - begin) + 1 : avail, size - 1);
+
+            memcpy(line, begin, len);
+            line[len] = '\0';
+            reader->begin += len;
+            return true;
+        }
+        if (reader->eof)
+            return false;
+
+        memmove(reader->buffer, begin, avail);
+        reader->begin = 0;
+        reader->end = avail;
+
+        struct pollfd input = { .fd = STDIN_FILENO, .events = POLLIN };
+        const int ready = poll(&input, 1, cmd_registry_next_ms(registry));
+
+        if (ready == 0) {
+            batcher_poll(&registry->batcher);
+            cmd_registry_timers_poll(registry);
+        }
+        if (ready <= 0)
+            continue;
+
+        const ssize_t got = read(STDIN_FILENO, reader->buffer + reader->end, sizeof(reader->buffer) - reader->end);
+
+        if (got > 0)
+            reader->end += (uint)got;
+        else if (got == 0 || errno != EINTR)
+            reader->eof = true;
+    }
+#endif
+}
+
+// Helper function of cmd_registry_loop(), reads a <BLOB> payload from stdin (see cmd_payload_read_t)
+// What the reader has buffered is used first, the rest is read straight into dst
+bool cmd_loop_read_payload(void *source, void *dst, size_t size) {
+#ifdef _WIN32
+    UNREF(source);
+    return fread(dst, 1, size, stdin) == size;
+#else
+    cmd_line_reader_t *reader = source;
+    const size_t buffered = min(size, (size_t)(reader->end - reader->begin));
+    size_t done = buffered;
+
+    memcpy(dst, reader->buffer + reader->begin, buffered);
+    reader->begin += (uint)buffered;
+    while (done < size) {
+        const ssize_t got = read(STDIN_FILENO, (uchar *)dst + done, size - done);
+
+        if (got > 0)
+            done += (size_t)got;
+        else if (got == 0 || errno != EINTR) {
+            reader->eof = true;
+            return false;
+        }
+    }
+
+    return true;
+#endif
+}
+
+/*
+* Starts a loop of reading a command from stdin and executing it, until 'exit' or the end of input
+* Commands scheduled with cmd_registry_schedule() are run while waiting for input
+* The payload of a <BLOB> argument follows its command line, see cmd_registry_execute_stream()
+* 
+* registry     - the registry to run the commands of
+* add_defaults - whether to register the 'dump' and 'exit' commands
+*/
+void cmd_registry_loop(cmd_registry_t *registry, bool add_defaults) {
+    cmd_line_reader_t reader = { 0 };
+    bool exit = false;
+    char buffer[512];
+
+    if (add_defaults) {
+        cmd_registry_register(registry, "dump", &cmd_dumpall_interf, registry);
+        cmd_registry_register(registry, "exit", &exit_func, &exit);
+    }
+
+    while (!exit && cmd_loop_read_line(registry, &reader, buffer, 511)) {
+        cmd_registry_execute_from(registry, buffer, &cmd_loop_read_payload, &reader);
+        batcher_poll(&registry->batcher);
+        cmd_registry_timers_poll(registry);
+    }
+    batcher_flush(&registry->batcher);
+    shards_wait(&registry->shards);
+}
+
 /*
 * Changes all blank characters (including spaces) to NULs
 * 
@@ -67,15 +331,106 @@ void cmd_preprocess(char *str) {
 */
 command_t *find_subcommand(const char *key, const ptr_arraylist_t *list) {
     for (uint j = 0; j < list->count; ++j) {
-        DEBUG_ONLY(printf("[INFO] compare: %s - %s\n", key, ((command_t *)list->arr[j])->name));
-        if (str_eq(key, ((command_t *)list->arr[j])->name)) {
+        DEBUG_ONLY(printf("[INFO] compare: %s - %s\n", key, ((command_t *)arraylist_data(list)[j])->name));
+        if (str_eq(key, ((command_t *)arraylist_data(list)[j])->name)) {
             DEBUG_ONLY(puts("[INFO] equal!"));
-            return (command_t *)list->arr[j];
+            return (command_t *)arraylist_data(list)[j];
         }
     }
     return NULL;
 }
 
+// Used by cmd_registry_parse()
+// Counts a successful lookup of a command if asked to, see cmd_registry_reorder()
+const cmd_hot_t *cmd_hit(const cmd_hot_t *hot, bool count) {
+    if (hot && count)
+        atomic_fetch_add_explicit(&((command_t *)hot->cold)->hits, 1, memory_order_relaxed);
+    return hot;
+}
+
+// Used by cmd_parse_tokens() while holding the registry's lock for reading
+// Returns the hot table of the command tree, building it if the tree has changed (NULL if out of memory)
+const cmd_hot_table_t *cmd_hot_get(cmd_registry_t *registry) {
+    cmd_hot_table_t *table = atomic_load_explicit(&registry->hot, memory_order_acquire);
+
+    if (table)
+        return table;
+
+    // parsers holding the lock for reading may race to build it
+    mtx_lock(&registry->hot_lock);
+    if (!(table = atomic_load(&registry->hot)) && (table = hot_build(&registry->map)) != NULL)
+        atomic_store_explicit(&registry->hot, table, memory_order_release);
+    mtx_unlock(&registry->hot_lock);
+
+    return table;
+}
+
+// Used by the functions that change the command tree, while holding the lock for writing
+// Drops a hot table that couldn't be updated, the next parser builds a new one
+void cmd_hot_drop(cmd_registry_t *registry) {
+    hot_destroy(atomic_exchange(&registry->hot, NULL));
+}
+
+/*
+* Used by cmd_register_proc() and cmd_register_() while holding the lock for writing
+* Adds a new command and its subtree to the hot table of a registry (if it has been built),
+* only touching the slots of the command's parent and the new ones
+*
+* registry - the registry
+* path     - commands from the root down, through the new command's parent, see cmd_locate()
+* parent   - the new command's parent (NULL for a new root command)
+* cmd      - the new command (NULL if it can't be told apart from another one, the table is dropped)
+*/
+void cmd_hot_insert(cmd_registry_t *registry, const ptr_arraylist_t *path, const command_t *parent, const command_t *cmd) {
+    cmd_hot_table_t *table = atomic_load(&registry->hot);
+    uint depth = 0;
+
+    if (!table)
+        return;
+    while (parent && depth < path->count && arraylist_data(path)[depth++] != parent);
+
+    const cmd_hot_t *hot_parent = hot_find_path(table, path, depth);
+
+    if (!cmd || (parent && (!hot_parent || hot_parent->cold != parent)) || !hot_insert(table, hot_parent, cmd))
+        cmd_hot_drop(registry);
+}
+
+// Used by cmd_registry_unregister() while holding the lock for writing
+// Removes the index-th command on a path (see cmd_locate()) and its subtree from the hot table of a registry
+void cmd_hot_erase(cmd_registry_t *registry, const ptr_arraylist_t *path, uint index) {
+    cmd_hot_table_t *table = atomic_load(&registry->hot);
+
+    if (!table)
+        return;
+
+    const cmd_hot_t *parent = hot_find_path(table, path, index);
+
+    if (index && !parent)
+        cmd_hot_drop(registry);
+    else
+        hot_erase(table, parent, arraylist_data(path)[index]);
+}
+
+// Used as the move callback of a registry's hashmap
+// Follows a root command that a resize of the hashmap moved with its hot copy
+void cmd_hot_moved(const command_t *from, const command_t *to, void *registry) {
+    cmd_hot_table_t *table = atomic_load(&((cmd_registry_t *)registry)->hot);
+
+    if (table)
+        hot_moved(table, from, to);
+}
+
+// Used by the functions that add commands, while holding the lock for writing
+// Makes the hashmap of a registry on first use
+void cmd_map_ensure(cmd_registry_t *registry) {
+    if (registry->map.map != NULL)
+        return;
+
+    registry->map = cmd_map_make();
+    registry->map.moved = &cmd_hot_moved;
+    registry->map.moved_data = registry;
+}
+
 
 /*
 * Helper function of cmd_register()
@@ -119,55 +474,330 @@ cmd_tree_location_t cmd_skip_existent(const tokenized_str_t *cmd_str, const cmd_
 }
 
 /*
-* Adds a command to the registered command tree
-* This is what should be called from the main program to create new commands
+* Tokenizes a command string in the format accepted by cmd_register()
+* Argument types with parameters, such as <ENUM a|b|c> or <STRING min=1 max=64>, stay single tokens
 *
-* cmd_str     - a c-string that specifies how calls to the command should look
-* action      - pointer to a (void (arg_bundle_t *)) function that will be called when the command is run
-* static_data - a pointer that will be available under bundle->static_data inside the given function
+* cmd_str - see cmd_register() description
 *
-* returns - whether the command was properly added
+* returns - the tokenized string
 */
-bool cmd_register(const char *cmd_str, cmd_act_t action, void *static_data) {
-    if (global_command_map.map == NULL)
-        global_command_map = cmd_map_make();
+tokenized_str_t cmd_tokenize(const char *cmd_str) {
+    tokenized_str_t ret = tok_str_make(cmd_str, ' ');
+
+    if (ret.str)
+        tok_str_merge_brackets(&ret, ' ');
+
+    return ret;
+}
+
+/*
+* Helper function of cmd_register()
+* Checks that all argument types in a command string are valid and properly ordered
+* List types such as <INT...> take all remaining tokens and a <BLOB> is followed
+* by its payload, so they have to come last
+*
+* cmd_str - see cmd_register() description
+*
+* returns - whether the command string can be registered
+*/
+bool cmd_syntax_check(const char *cmd_str) {
+    tokenized_str_t tok_str = cmd_tokenize(cmd_str);
+    const char *list_token = NULL;
+    bool ret = true;
+
+    for (uint i = 0; ret && i < tok_str.parts.count; ++i) {
+        const char *token = tok_str_get(&tok_str, i);
+
+        if (token[0] == '\0')
+            continue;
+        if (list_token) {
+            INTERACTIVE_ONLY(printf("[ERROR] %s has to be the last argument of '%s'\n", list_token, cmd_str));
+            ret = false;
+        }
+        if (token[0] != '<')
+            continue;
+
+        arg_node_t *node = arg_node_make(token);
+
+        if (node == NULL) {
+            INTERACTIVE_ONLY(printf("[ERROR] Invalid argument type %s in '%s'\n", token, cmd_str));
+            ret = false;
+        }
+        else if (arg_kind_is_list(node->kind) || node->kind == ARG_BLOB)
+            list_token = token;
+        arg_node_destroy(node);
+    }
+
+    tok_str_destroy(&tok_str);
+    return ret;
+}
+
+/*
+* Helper function of cmd_register_proc(), cmd_unregister() and cmd_replace()
+* Follows the names in a command string down the command tree
+*
+* cmd_str - tokenized command string, argument types such as <INT> are skipped
+* cmd_map - the command hashmap to search in
+* path    - arraylist that receives every command on the way, starting with the root
+*
+* returns - pointer to the command named by the last name in cmd_str (NULL if it doesn't exist)
+*/
+command_t *cmd_locate(const tokenized_str_t *cmd_str, const cmd_map_t *cmd_map, ptr_arraylist_t *path) {
+    command_t *cur = NULL;
+
+    for (uint str_index = 0; str_index < cmd_str->parts.count; ++str_index) {
+        const char *token = tok_str_get(cmd_str, str_index);
+
+        if (token[0] == '<' || token[0] == '\0')
+            continue;
+        if (cur == NULL)
+            cur = (command_t *)cmd_map_find(cmd_map, token);
+        else
+            cur = find_subcommand(token, &cur->subcommands);
+        if (cur == NULL)
+            return NULL;
+        arraylist_push(path, cur);
+    }
+
+    return cur;
+}
+
+// Used by cmd_registry_register_prio() and cmd_registry_register_pure()
+// Adds a command calling proc to the command tree of a registry
+bool cmd_register_proc(cmd_registry_t *registry, const char *cmd_str, cmd_proc_t proc) {
+    cmd_rwlock_t *lock = &registry->lock;
+    TRACE_ONLY(const ullong trace_start = trace_force_begin());
+
+    if (!cmd_syntax_check(cmd_str))
+        return false;
+
+    rwlock_write_lock(lock);
+    cmd_map_ensure(registry);
 
     DEBUG_ONLY(printf("[INFO] REGISTER_ START (%s)\n", cmd_str));
 
     bool ret = false;
-    tokenized_str_t tok_str = tok_str_make(_strdup(cmd_str), ' ');
-    const cmd_tree_location_t loc = cmd_skip_existent(&tok_str, &global_command_map);
-    const cmd_proc_t proc = { .action = action, .static_data = static_data };
+    tokenized_str_t tok_str = cmd_tokenize(cmd_str);
+    const cmd_tree_location_t loc = cmd_skip_existent(&tok_str, &registry->map);
+    const command_t *added = NULL;
 
     if (loc.parent == NULL) {
-        // a completely new command - add it to the global hashmap
+        // a completely new command - add it to the registry's hashmap
         command_t cmd = cmd_make(&tok_str, proc, loc.str_index);
-        ret = cmd_map_add(&global_command_map, &cmd);
+
+        if ((ret = cmd_map_add(&registry->map, &cmd))) {
+            // an older root of the same name is found first
+            added = cmd_map_find(&registry->map, cmd.name);
+            added = added->id == cmd.id ? added : NULL;
+        }
     }
     else {
         // parts of this command already exist
         // skip them and add a new subcommand in the tree
         command_t *cmd = cmd_alloc(&tok_str, proc, loc.str_index);
         ret = arraylist_push(&loc.parent->subcommands, cmd);
+        added = cmd;
+    }
+
+    if (ret) {
+        ptr_arraylist_t path = arraylist_make(NULL);
+        command_t *cmd = cmd_locate(&tok_str, &registry->map, &path);
+
+        cmd_hot_insert(registry, &path, loc.parent, added);
+
+        // the memo keys calls by argument values, which takes the kinds of the arguments on the path
+        if (proc.pure_ttl_ms && (ret = cmd != NULL)) {
+            frame_layout_destroy(&cmd->memo_layout);
+            cmd->memo_layout = frame_layout_make(&path);
+        }
+        arraylist_destroy(&path);
     }
 
     tok_str_destroy(&tok_str);
+    cmd_tree_changed(registry);
+    rwlock_write_unlock(lock);
+    TRACE_ONLY(trace_end(TRACE_REGISTER, trace_start, cmd_str));
     DEBUG_ONLY(printf("[INFO] REGISTER FINISH (%s)\n", cmd_str));
     return ret;
 }
 
+/*
+* Adds a command to the command tree of a registry
+* This is what should be called from the main program to create new commands
+*
+* registry    - the registry to add the command to
+* cmd_str     - a c-string that specifies how calls to the command should look; bounds
+*               such as <INT 0..100> or <STRING max=64> make the parser reject other values
+* action      - pointer to a (void (arg_bundle_t *)) function that will be called when the command is run
+* static_data - a pointer that will be available under bundle->static_data inside the given function
+*
+* returns - whether the command was properly added
+*/
+bool cmd_registry_register(cmd_registry_t *registry, const char *cmd_str, cmd_act_t action, void *static_data) {
+    return cmd_registry_register_prio(registry, cmd_str, action, static_data, CMD_PRIO_NORMAL);
+}
+
+/*
+* Adds a command with a priority class to the command tree of a registry, see cmd_registry_register()
+* Queued calls of sharded commands run by class: HIGH before NORMAL before LOW, a lower class
+* still getting a turn now and then; see cmd_registry_set_queue_limit() for bounding the queues
+*
+* registry    - the registry to add the command to
+* cmd_str     - a c-string that specifies how calls to the command should look
+* action      - function called when the command is run
+* static_data - a pointer that will be available under bundle->static_data inside the given function
+* prio        - the command's priority class
+*
+* returns - whether the command was properly added
+*/
+bool cmd_registry_register_prio(cmd_registry_t *registry, const char *cmd_str, cmd_act_t action, void *static_data, cmd_prio_t prio) {
+    const cmd_proc_t proc = { .action = action, .static_data = static_data, .prio = prio };
+
+    return cmd_register_proc(registry, cmd_str, proc);
+}
+
+/*
+* Removes a command and its whole subtree from the command tree of a registry
+* Parents that are left without subcommands and without an action of their own are removed as well
+* Safe to call while other threads are executing commands
+*
+* registry - the registry to remove the command from
+* cmd_str  - the command's name path, e.g. "set volume"
+*            (argument types may be included as in cmd_register(), they are ignored)
+*
+* returns - whether the command was found and removed
+*/
+bool cmd_registry_unregister(cmd_registry_t *registry, const char *cmd_str) {
+    cmd_rwlock_t *lock = &registry->lock;
+    tokenized_str_t tok_str = cmd_tokenize(cmd_str);
+    ptr_arraylist_t path = arraylist_make(NULL);
+
+    // collected and queued calls are still passed to the old handler
+    // calls are only queued on the shards under the read lock, see cmd_shard_submit()
+    batcher_flush(&registry->batcher);
+    rwlock_write_lock(lock);
+    shards_wait(&registry->shards);
+
+    const bool ret = cmd_locate(&tok_str, &registry->map, &path) != NULL;
+    bool remove_next = ret;
+
+    // the hot table drops the topmost command going away with its subtree, see below
+    if (ret) {
+        uint top = path.count - 1;
+
+        for (; top > 0; --top) {
+            const command_t *parent = arraylist_data(&path)[top - 1];
+
+            if (parent->subcommands.count > 1 || parent->action.action != NULL)
+                break;
+        }
+        cmd_hot_erase(registry, &path, top);
+    }
+
+    // walk back up the path, removing each command from its parent's subcommands
+    while (remove_next && path.count > 1) {
+        command_t *cmd = arraylist_data(&path)[--path.count];
+        command_t *parent = arraylist_data(&path)[path.count - 1];
+
+        for (uint i = 0; i < parent->subcommands.count; ++i) {
+            if (arraylist_data(&parent->subcommands)[i] == cmd) {
+                cmd_destroy(arraylist_remove(&parent->subcommands, i));
+                break;
+            }
+        }
+        remove_next = parent->subcommands.count == 0 && parent->action.action == NULL;
+    }
+    // root commands live in the hashmap itself
+    if (remove_next)
+        cmd_map_remove(&registry->map, ((command_t *)arraylist_data(&path)[0])->name);
+    if (ret)
+        cmd_tree_changed(registry);
+
+    rwlock_write_unlock(lock);
+    arraylist_destroy(&path);
+    tok_str_destroy(&tok_str);
+    return ret;
+}
+
+/*
+* Replaces the action and static data of a registered command
+* Safe to call while other threads are executing commands,
+* calls that have already been parsed finish with the old action
+*
+* registry    - the registry containing the command
+* cmd_str     - the command's name path, e.g. "set volume"
+*               (argument types may be included as in cmd_register(), they are ignored)
+* action      - the new action, see cmd_register()
+* static_data - the new static data, see cmd_register()
+*
+* returns - whether the command was found and its action replaced
+*           (commands that only dispatch to subcommands can't be replaced)
+*/
+bool cmd_registry_replace(cmd_registry_t *registry, const char *cmd_str, cmd_act_t action, void *static_data) {
+    cmd_rwlock_t *lock = &registry->lock;
+    tokenized_str_t tok_str = cmd_tokenize(cmd_str);
+    ptr_arraylist_t path = arraylist_make(NULL);
+
+    // collected and queued calls are still passed to the old handler
+    // calls are only queued on the shards under the read lock, see cmd_shard_submit()
+    batcher_flush(&registry->batcher);
+    rwlock_write_lock(lock);
+    shards_wait(&registry->shards);
+
+    command_t *cmd = cmd_locate(&tok_str, &registry->map, &path);
+    const bool ret = cmd != NULL && cmd->subcommands.count == 0;
+
+    if (ret) {
+        const cmd_hot_table_t *table = atomic_load(&registry->hot);
+        cmd_hot_t *hot = table ? (cmd_hot_t *)hot_find_path(table, &path, path.count) : NULL;
+
+        cmd->action.action = action;
+        cmd->action.static_data = static_data;
+        if (hot)
+            hot->proc = cmd->action;
+        cmd_tree_changed(registry);
+    }
+
+    rwlock_write_unlock(lock);
+    arraylist_destroy(&path);
+    tok_str_destroy(&tok_str);
+    return ret;
+}
+
+/*
+* Adds a pure command to the command tree of a registry, see cmd_registry_register()
+* A pure command's output depends only on its arguments: while the memo is enabled
+* (see cmd_registry_memo_enable()), what its action writes with cmd_printf() is kept and
+* repeated calls with the same arguments get it written again without calling the action
+* Batched and sharded calls are not memoized
+*
+* registry    - the registry to add the command to
+* cmd_str     - a c-string that specifies how calls to the command should look
+* action      - function called when the command is run
+* static_data - a pointer that will be available under bundle->static_data inside the given function
+* ttl_ms      - time after which a memoized output is dropped (UINT_MAX for about 49 days)
+*
+* returns - whether the command was properly added
+*/
+bool cmd_registry_register_pure(cmd_registry_t *registry, const char *cmd_str, cmd_act_t action, void *static_data, uint ttl_ms) {
+    const cmd_proc_t proc = { .action = action, .static_data = static_data, .pure_ttl_ms = max(ttl_ms, 1) };
+
+    return cmd_register_proc(registry, cmd_str, proc);
+}
+
 /*
 * Helper function of cmd_register()
 * Checks if parts of the given command already exist in the tree
 * 
 * cmd_str - see cmd_register() description
 * cmd_map - a command hashmap where the existence of the command is to be checked
+* path    - arraylist that receives every existing command on the way, starting with the root
 * 
 * returns - a struct of:
 *           - a pointer to the location in cmd_str where parsing should start
 *           - a pointer to the new command's parent command (NULL if there is none)
 */
-cmd_tree_location_t cmd_skip_existent_(char *cmd_str, const cmd_map_t *cmd_map) {
+cmd_tree_location_t cmd_skip_existent_(char *cmd_str, const cmd_map_t *cmd_map, ptr_arraylist_t *path) {
     cmd_tree_location_t ret = { 0 };
 
     if (!cmd_str || !cmd_map)
@@ -180,6 +810,7 @@ cmd_tree_location_t cmd_skip_existent_(char *cmd_str, const cmd_map_t *cmd_map)
         return ret;
     }
 
+    arraylist_push(path, cur);
     for (uint i = 0; cmd_str[i] || cmd_str[i + 1]; ++i) {
         if (cmd_str[i] == '\0' && cmd_str[i + 1] != '<') {
             ret.parent = (command_t *)cur;
@@ -188,6 +819,7 @@ cmd_tree_location_t cmd_skip_existent_(char *cmd_str, const cmd_map_t *cmd_map)
                 ret.ptr = cmd_str + i + 1;
                 return ret;
             }
+            arraylist_push(path, cur);
         }
     }
 
@@ -209,48 +841,65 @@ cmd_tree_location_t cmd_skip_existent_(char *cmd_str, const cmd_map_t *cmd_map)
 *            otherwise this function will most likely crash the program
 */
 bool cmd_register_(const char *cmd_str, cmd_act_t action, void *static_data) {
-    if (global_command_map.map == NULL)
-        global_command_map = cmd_map_make();
+    cmd_registry_t *registry = cmd_default_registry();
+    cmd_rwlock_t *lock = &registry->lock;
+    bool ret;
+
+    rwlock_write_lock(lock);
+    cmd_map_ensure(registry);
 
     DEBUG_ONLY(printf("[INFO] REGISTER START (%s)\n", cmd_str));
 
     char *str = _strdup(cmd_str);
+    ptr_arraylist_t path = arraylist_make(NULL);
     cmd_preprocess(str);
-    const cmd_tree_location_t loc = cmd_skip_existent_(str, &global_command_map);
+    const cmd_tree_location_t loc = cmd_skip_existent_(str, &registry->map, &path);
     const cmd_proc_t proc = { .action = action, .static_data = static_data };
+    const command_t *added = NULL;
 
     if (loc.parent == NULL) {
-        // a completely new command - add it to the global hashmap
+        // a completely new command - add it to the registry's hashmap
         command_t cmd = cmd_make_(loc.ptr, proc);
-        free(str);
-        DEBUG_ONLY(printf("[INFO] REGISTER FINISH (%s)\n", cmd_str));
-        return cmd_map_add(&global_command_map, &cmd);
+
+        if ((ret = cmd_map_add(&registry->map, &cmd))) {
+            // an older root of the same name is found first
+            added = cmd_map_find(&registry->map, cmd.name);
+            added = added->id == cmd.id ? added : NULL;
+        }
     }
     else {
         // parts of this command already exist
         // skip them and add a new subcommand in the tree
         command_t *cmd = cmd_alloc_(loc.ptr, proc);
-        free(str);
-        DEBUG_ONLY(printf("[INFO] REGISTER FINISH (%s)\n", cmd_str));
-        return arraylist_push(&loc.parent->subcommands, cmd);
+        ret = arraylist_push(&loc.parent->subcommands, cmd);
+        added = cmd;
     }
+    if (ret)
+        cmd_hot_insert(registry, &path, loc.parent, added);
+
+    arraylist_destroy(&path);
+    free(str);
+    cmd_tree_changed(registry);
+    rwlock_write_unlock(lock);
+    DEBUG_ONLY(printf("[INFO] REGISTER FINISH (%s)\n", cmd_str));
+    return ret;
 }
 
 /*
 * Helper function of cmd_execute()
 * Determines the state machine's new state
 * 
-* cur_cmd     - pointer to the currently evaluated command
+* cur_cmd     - hot copy of the currently evaluated command
 * args_parsed - how many arguments of cur_cmd have been properly parsed
 * 
 * returns - the next state for cmd_execute's state machine
 */
-parser_state_t next_state(const command_t *cur_cmd, uint args_parsed) {
+parser_state_t next_state(const cmd_hot_t *cur_cmd, uint args_parsed) {
     if (!cur_cmd)
         // the command doesn't exist
         return ERROR;
     if (cur_cmd->arg_cnt > args_parsed) {
-        if (cur_cmd->syntax[args_parsed]->format[0] == '>')
+        if (hot_tag(cur_cmd, args_parsed) == HOT_TAG_SUBCOMMAND)
             // if the next argument is a subcommand
             return COMMAND_EXPECTED;  
         // otherwise
@@ -266,157 +915,1403 @@ parser_state_t next_state(const command_t *cur_cmd, uint args_parsed) {
 /*
 * Helper function of cmd_execute()
 * Adds a parsed argument to the arg bundle
-* Responsible for special handling of string-type arguments
+* Responsible for special handling of string- and list-type arguments
 * 
 * args - pointer to the arg bundle the argument should be added to
 * data - pointer to the argument's raw data
 * syntax_node - element from a command's syntax array that corresponds to the argument
 */
 void bundle_push(arg_bundle_t *args, const uchar *data, const arg_node_t *syntax_node) {
-    if (str_eq(syntax_node->key, "<STRING>")) {
+    if (syntax_node->kind == ARG_STRING) {
         char *str = _strdup((const char *)data);
         arg_bundle_add_(args, &str, syntax_node->size, true);
     }
+    else if (arg_kind_is_list(syntax_node->kind) || syntax_node->kind == ARG_BLOB)
+        // the data pointer of lists and blobs is their first member, so it is what gets freed with the bundle
+        arg_bundle_add_(args, data, syntax_node->size, true);
     else
         arg_bundle_add_(args, data, syntax_node->size, false);
 }
 
 /*
-* Runs a command based on a given string
-* This is what should be called to run a command from the main program
+* Helper function of cmd_parse()
+* Records why parsing failed, if the caller asked for it
 * 
-* cmd_str - c-string to be parsed and run
-* 
-* returns - whether a command was executed
+* error  - pointer to the error struct to fill (can be NULL)
+* status - reason of the failure
+* format - printf-style format of the error message, followed by its arguments
 */
-bool cmd_execute(const char *cmd_str) {
-    tokenized_str_t input = tok_str_make(cmd_str, ' ');
-    arg_bundle_t args = arg_bundle_make();
-    const char *cur_token = (const char *)tok_str_get(&input, 0), *last_search = cur_token;
-    const command_t *cur_cmd = cmd_map_find(&global_command_map, cur_token);
+void cmd_parse_fail(cmd_parse_error_t *error, cmd_parse_status_t status, const char *format, ...) {
+    va_list args;
+
+    if (!error)
+        return;
+
+    error->status = status;
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+}
+
+/*
+* Helper function of cmd_parse_tokens()
+* Records a value rejected by the constraint of its argument
+* 
+* error  - see cmd_parse_fail()
+* node   - syntax node of the argument
+* flags  - the parse's cmd_parse_flags_t values, the rejection is only counted with PARSE_COUNT_HITS
+* format - see cmd_parse_fail()
+*/
+void cmd_constraint_fail(cmd_parse_error_t *error, const arg_node_t *node, uint flags, const char *format, ...) {
+    va_list args;
+
+    if (flags & PARSE_COUNT_HITS)
+        atomic_fetch_add_explicit(&node->constraint->rejected, 1, memory_order_relaxed);
+    if (!error)
+        return;
+
+    error->status = CMD_PARSE_CONSTRAINT;
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+}
+
+/*
+* Helper function of cmd_registry_parse() and cmd_registry_parse_locked()
+* Resolves a tokenized command string, the registry's lock has to be held for reading
+* 
+* registry   - the registry to look the command up in
+* input      - the tokenized command string
+* parsed     - see cmd_registry_parse()
+* error      - see cmd_registry_parse()
+* flags      - cmd_parse_flags_t values
+* 
+* returns - whether the string is a valid call of a registered command
+*/
+bool cmd_parse_tokens(cmd_registry_t *registry, const tokenized_str_t *input, cmd_parsed_t *parsed, cmd_parse_error_t *error, uint flags) {
+    TRACE_ONLY(ullong trace_start);
+
+    const cmd_hot_table_t *table = cmd_hot_get(registry);
+
+    if (!table) {
+        cmd_parse_fail(error, CMD_PARSE_INTERNAL, "Out of memory");
+        return false;
+    }
+    parsed->args = arg_bundle_make();
+    parsed->registry = registry;
+    parsed->blob_arg = 0;
+    parsed->memo_key = NULL;
+
+    const char *cur_token = (const char *)tok_str_get(input, 0), *last_search = cur_token;
+    TRACE_ONLY(trace_start = trace_begin());
+    const cmd_hot_t *cur_cmd = cmd_hit(hot_find_root(table, cur_token), flags & PARSE_COUNT_HITS);
+    TRACE_ONLY(trace_end(TRACE_LOOKUP, trace_start, NULL));
     uint args_parsed = 0;
     parser_state_t state = next_state(cur_cmd, args_parsed);
+    const arg_node_t *node;
     uchar buffer[512];
 
     // state machine based string parsing
-    for (uint i = 1; i <= input.parts.count; ++i) {
-        if (i < input.parts.count)
-            cur_token = (const char *)tok_str_get(&input, i);
-        else if (state == COMMAND_EXPECTED || state == VALUE_EXPECTED) {
+    for (uint i = 1; i <= input->parts.count; ++i) {
+        if (i < input->parts.count)
+            cur_token = (const char *)tok_str_get(input, i);
+        else if (state == COMMAND_EXPECTED
+            || (state == VALUE_EXPECTED && !arg_kind_is_list(hot_tag(cur_cmd, args_parsed)))) {
             // the final iteration; check if the given string terminated too soon
-            INTERACTIVE_ONLY(printf("[ERROR] Missing argument %u for %s\n", args_parsed + 1, cur_cmd->name));
+            // (lists can be empty, so they are fine here)
+            cmd_parse_fail(error, CMD_PARSE_MISSING_ARGUMENT, "Missing argument %u for %s", args_parsed + 1, cur_cmd->cold->name);
             state = ERROR;
         }
 
         switch (state) {
         case COMMAND_EXPECTED:
             // check if current token is a valid subcommand
-            cur_cmd = (const command_t *)find_subcommand((last_search = cur_token), &cur_cmd->subcommands);
+            TRACE_ONLY(trace_start = trace_begin());
+            cur_cmd = cmd_hit(hot_find_child(table, cur_cmd, (last_search = cur_token)), flags & PARSE_COUNT_HITS);
+            TRACE_ONLY(trace_end(TRACE_LOOKUP, trace_start, NULL));
             args_parsed = 0;
             state = next_state(cur_cmd, args_parsed);
             break;
         case VALUE_EXPECTED:
-            // attempt to parse current token as specified type
+            node = cur_cmd->cold->syntax[args_parsed];
+            if (hot_tag(cur_cmd, args_parsed) == ARG_BLOB) {
+                // the token is the payload's length, the caller allocates the payload and reads it in
+                // once the registry is unlocked, until then the blob's data pointer is NULL
+                const arg_blob_t blob = { 0 };
+                ullong size;
 
-            // (with how it's written now, sscanf_s() doesn't work here since the argument
-            // might be a string, in which case another parameter (buffer size) is needed)
-            if (sscanf(cur_token, cur_cmd->syntax[args_parsed]->format, (void *)buffer) > 0) {
+                if (!(flags & PARSE_BLOBS)) {
+                    cmd_parse_fail(error, CMD_PARSE_BAD_VALUE, "%s payloads can only be read from a stream", node->key);
+                    state = ERROR;
+                    break;
+                }
+                if (!parse_ullong(cur_token, &size)) {
+                    cmd_parse_fail(error, CMD_PARSE_BAD_VALUE, "Non-parseable token '%s' given for argument of type %s",
+                        cur_token, node->key);
+                    state = ERROR;
+                    break;
+                }
+                if (size > CMD_BLOB_MAX) {
+                    cmd_parse_fail(error, CMD_PARSE_BAD_VALUE, "Payload of %llu bytes is over the limit of %u bytes",
+                        size, (uint)CMD_BLOB_MAX);
+                    state = ERROR;
+                    break;
+                }
+                arg_bundle_add_(&parsed->args, &blob, node->size, false);
+                parsed->blob_arg = parsed->args.args.count;
+                parsed->blob_size = (size_t)size;
+                args_parsed++;
+                state = next_state(cur_cmd, args_parsed);
+                break;
+            }
+            if (arg_kind_is_list(hot_tag(cur_cmd, args_parsed))) {
+                // a list takes all the remaining tokens at once
+                const char *const *tokens = (const char *const *)arraylist_data(&input->parts) + i;
+                const uint token_cnt = input->parts.count - i;
+                arg_list_t list;
+                TRACE_ONLY(trace_start = trace_begin());
+                const uint bad_token = arg_list_parse(node, tokens, token_cnt, &list);
+                TRACE_ONLY(trace_end(TRACE_CONVERT, trace_start, NULL));
+
+                if (bad_token != token_cnt) {
+                    cmd_parse_fail(error, CMD_PARSE_BAD_VALUE, "Non-parseable token '%s' given for argument of type %s",
+                        tokens[bad_token], node->key);
+                    state = ERROR;
+                    break;
+                }
+                const uint bad_elem = node->constraint ? arg_constraint_check_list(node->constraint, &list) : list.count;
+                if (bad_elem != list.count) {
+                    free(list.data);
+                    cmd_constraint_fail(error, node, flags, "Element %u of the list is out of the bounds of %s",
+                        bad_elem + 1, node->key);
+                    state = ERROR;
+                    break;
+                }
+                bundle_push(&parsed->args, (const uchar *)&list, node);
+                args_parsed++;
+                state = next_state(cur_cmd, args_parsed);
+                // continue with the final iteration
+                i = input->parts.count - 1;
+                break;
+            }
+            // attempt to parse current token as specified type
+            TRACE_ONLY(trace_start = trace_begin());
+            const bool converted = arg_token_parse(node, cur_token, buffer);
+            TRACE_ONLY(trace_end(TRACE_CONVERT, trace_start, NULL));
+            if (converted && node->constraint && !arg_constraint_check(node->constraint, buffer)) {
+                // rejected before anything is stored
+                cmd_constraint_fail(error, node, flags, "Value '%s' is %s %s", cur_token,
+                    node->constraint->check == CHECK_PATTERN ? "not matched by" : "out of the bounds of", node->key);
+                state = ERROR;
+            }
+            else if (converted) {
                 // if successful, store the result's raw bytes in an arg bundle
-                bundle_push(&args, buffer, cur_cmd->syntax[args_parsed++]);
+                bundle_push(&parsed->args, buffer, node);
+                args_parsed++;
                 state = next_state(cur_cmd, args_parsed);
             }
             else {
-                INTERACTIVE_ONLY(printf("[ERROR] Non-parseable token '%s' given for argument of type %s\n",
-                    cur_token, cur_cmd->syntax[args_parsed]->key));
+                cmd_parse_fail(error, CMD_PARSE_BAD_VALUE, "Non-parseable token '%s' given for argument of type %s",
+                    cur_token, node->key);
                 state = ERROR;
             }
             break;
         case READY:
-            // command is valid and all arguments provided, run it
-            args.static_data = cur_cmd->action.static_data;
-            (*cur_cmd->action.action)(&args);
-            /* FALLTHROUGH */
+            // command is valid and all arguments provided
+            parsed->cmd = cur_cmd->cold;
+            parsed->cmd_id = cur_cmd->cold->id;
+            TRACE_ONLY(trace_name_copy(parsed->trace_name, cur_cmd->cold->name));
+            parsed->proc = cur_cmd->proc;
+            parsed->batch = cur_cmd->cold->batch;
+            parsed->shard = cur_cmd->cold->shard;
+            // the key needs the command's layout, which is only safe to read under the lock
+            if (parsed->proc.pure_ttl_ms && registry->memo)
+                cmd_memo_key_make(parsed, &cur_cmd->cold->memo_layout);
+            return true;
         case ERROR:
-            INTERACTIVE_ONLY(if (!cur_cmd) printf("[ERROR] Unknown command '%s'\n", last_search));
-            // clean memory up after a command runs/an error occurs
-            tok_str_destroy(&input);
-            arg_bundle_destroy(&args);
-            return (state == READY);
+            if (!cur_cmd)
+                cmd_parse_fail(error, CMD_PARSE_UNKNOWN_COMMAND, "Unknown command '%s'", last_search);
+            // clean memory up after an error occurs
+            arg_bundle_destroy(&parsed->args);
+            return false;
         case UNKNOWN:
             // this code should never run
-            INTERACTIVE_ONLY(puts("[ERROR] UNKNOWN state detected!"));
+            cmd_parse_fail(error, CMD_PARSE_INTERNAL, "UNKNOWN state detected!");
+            arg_bundle_destroy(&parsed->args);
             return false;
         }
     }
 
     // neither should this
-    INTERACTIVE_ONLY(puts("[ERROR] How did we get here?"));
+    cmd_parse_fail(error, CMD_PARSE_INTERNAL, "How did we get here?");
+    arg_bundle_destroy(&parsed->args);
     return false;
 }
 
+// Helper function of cmd_registry_parse() and cmd_registry_execute()
+// Locks the command tree and parses a command string with cmd_parse_tokens()
+bool cmd_parse_with(cmd_registry_t *registry, const char *cmd_str, cmd_parsed_t *parsed, cmd_parse_error_t *error, uint flags) {
+    TRACE_ONLY(const ullong trace_start = trace_begin());
+    tokenized_str_t input = tok_str_make(cmd_str, ' ');
+    bool ret;
+
+    TRACE_ONLY(trace_end(TRACE_TOKENIZE, trace_start, NULL));
+    rwlock_read_lock(&registry->lock);
+    parsed->generation = atomic_load(&registry->generation);
+    ret = cmd_parse_tokens(registry, &input, parsed, error, flags);
+    rwlock_read_unlock(&registry->lock);
+    tok_str_destroy(&input);
+
+    return ret;
+}
+
 /*
-* Recursive command printing function used by cmd_dumpall()
+* Parses a command string against the command tree of a registry without running it
+* The command tree is only locked while parsing
+* Commands with a <BLOB> argument can't be parsed from a string, see cmd_registry_execute_stream()
 * 
-* cmd   -  pointer to a command to be printed out
-* depth -  current depth of recursion, used to determine indent size
+* registry - the registry to look the command up in
+* cmd_str  - c-string to be parsed
+* parsed   - pointer to a struct that receives the resolved command, a copy of
+*            its action and the parsed arguments (release with cmd_parsed_destroy())
+* error    - pointer to a struct that receives the reason of a failure (can be NULL)
 * 
-* The macro cmd_print(cmd) can be used to print a single command and its subtree 
+* returns - whether the string is a valid call of a registered command
 */
-void cmd_print_rec(const command_t *cmd, uint depth) {
-    printf("%s ", cmd->name);
-    for (uint i = 0; i < cmd->arg_cnt; ++i)
-        printf("%s ", cmd->syntax[i]->key);
-    if (cmd->action.action != NULL)
-        printf("-> calls %p(%p)", cmd->action.action, cmd->action.static_data);
-    for (uint i = 0; i < cmd->subcommands.count; ++i) {
-        const command_t *subcmd = (const command_t *)cmd->subcommands.arr[i];
-        putchar('\n');
-        for (uint j = 0; j < (depth + 1) * 2; ++j)
-            putchar(' ');
-        cmd_print_rec(subcmd, depth + 1);
+bool cmd_registry_parse(cmd_registry_t *registry, const char *cmd_str, cmd_parsed_t *parsed, cmd_parse_error_t *error) {
+    return cmd_parse_with(registry, cmd_str, parsed, error, PARSE_COUNT_HITS);
+}
+
+// Used by the file validator: cmd_registry_parse() for a caller that already holds
+// the registry's lock for reading, lookups aren't counted towards cmd_registry_reorder()
+bool cmd_registry_parse_locked(cmd_registry_t *registry, const char *cmd_str, cmd_parsed_t *parsed, cmd_parse_error_t *error) {
+    tokenized_str_t input = tok_str_make(cmd_str, ' ');
+    bool ret;
+
+    parsed->generation = atomic_load(&registry->generation);
+    ret = cmd_parse_tokens(registry, &input, parsed, error, 0);
+    tok_str_destroy(&input);
+
+    return ret;
+}
+
+/*
+* Calls the action of a parsed command
+* The action gets its own view of the parsed arguments, so the same
+* parsed command can be run any number of times (also concurrently),
+* as long as actions don't modify the argument data itself
+* 
+* parsed - pointer to a command parsed by cmd_parse()
+*/
+void cmd_parsed_run(const cmd_parsed_t *parsed) {
+    arg_bundle_t args = parsed->args;
+    TRACE_ONLY(const ullong trace_start = trace_begin());
+
+    args.static_data = parsed->proc.static_data;
+    (*parsed->proc.action)(&args);
+    // the command itself may be gone by now, the span gets the name copied while parsing
+    TRACE_ONLY(trace_end(TRACE_ACTION, trace_start, parsed->trace_name));
+}
+
+/*
+* Frees all memory allocated by cmd_parse()
+* 
+* parsed - pointer to the parsed command to be deleted
+*/
+void cmd_parsed_destroy(cmd_parsed_t *parsed) {
+    if (!parsed)
+        return;
+
+    arg_bundle_destroy(&parsed->args);
+    parsed->cmd = NULL;
+}
+
+/*
+* Queues a call of a sharded command on its shard
+* Queued calls keep the command's per-shard static data, which is freed when the command
+* is changed: the call is only queued under the registry lock, if nothing changed since it
+* was parsed, and the functions changing the tree wait for the shards under the same lock
+* 
+* registry - the registry the command was parsed in
+* parsed   - the parsed command
+* owner    - see shards_push()
+* take     - see shards_push()
+* response - see shards_push()
+* 
+* returns - whether the call was queued (or run), it is released otherwise
+*/
+bool cmd_shard_submit(cmd_registry_t *registry, const cmd_parsed_t *parsed, cmd_cache_entry_t *owner, bool take,
+    cmd_response_t *response) {
+    rwlock_read_lock(&registry->lock);
+
+    const bool ret = parsed->generation == atomic_load(&registry->generation);
+
+    if (ret)
+        shards_push(&registry->shards, parsed, owner, take, response);
+    rwlock_read_unlock(&registry->lock);
+
+    if (!ret) {
+        cmd_response_t *outer = cmd_response_enter(response);
+
+        INTERACTIVE_ONLY(cmd_printf("[ERROR] The command tree changed before a sharded call was queued, the call is dropped\n"));
+        cmd_response_leave(outer);
+        cmd_response_done(response, false);
+        cmd_cache_release(owner);
+        if (take && !owner)
+            cmd_parsed_destroy((cmd_parsed_t *)parsed);
     }
+
+    return ret;
 }
 
-// Dumps the entire command tree to stdout in the format:
-// COMMAND_NAME <ARGUMENT> <LIST> -> calls FUNCTION_ADDRESS(STATIC_DATA)
-void cmd_dumpall(void) {
-    for (uint i = 0; i < global_command_map.size; ++i) {
-        if (global_command_map.map[i].name != NULL) {
-            putchar('\n');
-            cmd_print(global_command_map.map + i);
+/*
+* Helper function of cmd_execute()
+* Runs a parsed command, or hands it over to its shard or to the batcher
+* 
+* registry - the registry the command was parsed in
+* parsed   - the parsed command
+* owner    - cache entry parsed belongs to (its reference is released),
+*            or NULL if parsed belongs to the caller (it is destroyed)
+*/
+void cmd_dispatch(cmd_registry_t *registry, cmd_parsed_t *parsed, cmd_cache_entry_t *owner) {
+    // a command server client's call that runs elsewhere is answered once it has run
+    cmd_response_t *response = cmd_response_take(parsed->shard.data != NULL || parsed->batch.action != NULL);
+
+    if (parsed->shard.data != NULL) {
+        batcher_flush_other(&registry->batcher, parsed->cmd_id);
+        cmd_shard_submit(registry, parsed, owner, true, response);
+        return;
+    }
+
+    if (parsed->batch.action != NULL)
+        batcher_add(&registry->batcher, parsed, owner, true, response);
+    else {
+        batcher_flush_other(&registry->batcher, parsed->cmd_id);
+        if (parsed->proc.pure_ttl_ms && registry->memo)
+            cmd_memo_run(registry->memo, parsed);
+        else
+            cmd_parsed_run(parsed);
+        cmd_cache_release(owner);
+    }
+
+    if (!owner)
+        cmd_parsed_destroy(parsed);
+}
+
+/*
+* Helper function of cmd_path_find()
+* Searches the subtree of a command for another command
+* 
+* cur    - root of the subtree
+* cmd_id - id of the command to look for
+* path   - arraylist that receives every command on the way to the command, starting with cur
+* 
+* returns - whether the command was found
+*/
+bool cmd_path_find_rec(const command_t *cur, uint cmd_id, ptr_arraylist_t *path) {
+    arraylist_push(path, cur);
+    if (cur->id == cmd_id)
+        return true;
+
+    for (uint i = 0; i < cur->subcommands.count; ++i)
+        if (cmd_path_find_rec(arraylist_data(&cur->subcommands)[i], cmd_id, path))
+            return true;
+
+    path->count--;
+    return false;
+}
+
+/*
+* Finds the name path of a command in the command tree of a registry
+* The registry's lock has to be held, the path is only valid until it is released
+* 
+* registry - the registry to search
+* cmd_id   - id of the command to look for
+* path     - arraylist that receives every command on the way, starting with the root
+* 
+* returns - whether the command is in the tree
+*/
+bool cmd_path_find(cmd_registry_t *registry, uint cmd_id, ptr_arraylist_t *path) {
+    const command_t *root;
+    uint iter = 0;
+    bool ret = false;
+
+    while (!ret && (root = cmd_map_next(&registry->map, &iter)) != NULL)
+        ret = cmd_path_find_rec(root, cmd_id, path);
+
+    return ret;
+}
+
+/*
+* Helper function of cmd_execute()
+* Appends a parsed command to the registry's journal, if there is one
+* The first call of each command also records the command's name path
+* 
+* registry - the registry the command was parsed in
+* parsed   - the parsed command
+*/
+void cmd_journal_record(cmd_registry_t *registry, const cmd_parsed_t *parsed) {
+    cmd_journal_t *journal = registry->journal;
+    ptr_arraylist_t path;
+    bool found;
+
+    if (!journal || journal_append(journal, parsed))
+        return;
+
+    // rare: a command not seen since the journal was opened
+    path = arraylist_make(NULL);
+    rwlock_read_lock(&registry->lock);
+    // the names on the path are only valid while the lock is held
+    if ((found = cmd_path_find(registry, parsed->cmd_id, &path)))
+        journal_add_command(journal, &path);
+    rwlock_read_unlock(&registry->lock);
+    arraylist_destroy(&path);
+
+    // a command removed meanwhile isn't recorded
+    if (found)
+        journal_append(journal, parsed);
+}
+
+/*
+* Helper function of cmd_registry_execute_from()
+* Allocates and reads the payload of a parsed command's <BLOB> argument, if it has one, then runs the command
+* The payload is allocated here rather than while parsing, so the registry isn't locked meanwhile
+* 
+* registry - the registry the command was parsed in
+* parsed   - the parsed command, it is destroyed afterwards
+* read     - function reading the payload
+* source   - the stream passed to read
+* 
+* returns - whether the command was run (false if the payload couldn't be read)
+*/
+bool cmd_dispatch_read(cmd_registry_t *registry, cmd_parsed_t *parsed, cmd_payload_read_t read, void *source) {
+    arg_bundle_t *args = &parsed->args;
+
+    if (parsed->blob_arg) {
+        arg_blob_t blob = { .data = malloc(parsed->blob_size ? parsed->blob_size : 1), .size = parsed->blob_size };
+
+        if (blob.data == NULL || !arraylist_reserve(&args->dynamic_blocks, 1)) {
+            INTERACTIVE_ONLY(cmd_printf("[ERROR] No memory for a payload of %llu bytes\n", (ullong)blob.size));
+            free(blob.data);
+            cmd_parsed_destroy(parsed);
+            return false;
+        }
+        // the payload is freed with the bundle; bundle values aren't aligned
+        arraylist_push(&args->dynamic_blocks, blob.data);
+        memcpy(byte_arraylist_data(&args->data) + (size_t)arraylist_data(&args->args)[parsed->blob_arg - 1], &blob, sizeof(blob));
+        if (!(*read)(source, blob.data, blob.size)) {
+            INTERACTIVE_ONLY(cmd_printf("[ERROR] Input ended inside a %llu byte payload\n", (ullong)blob.size));
+            cmd_parsed_destroy(parsed);
+            return false;
         }
     }
-    putchar('\n');
+    cmd_journal_record(registry, parsed);
+    cmd_dispatch(registry, parsed, NULL);
+
+    return true;
 }
 
-// Used by cmd_loop()
-// Acts as action parameter for the 'dump' command
-void cmd_dumpall_interf(arg_bundle_t *a) {
-    UNREF(a);
-    cmd_dumpall();
+/*
+* Helper function of cmd_execute()
+* Runs a command string through the parse-result cache
+* 
+* registry - the registry to run the command in
+* cache    - the cache to look the string up in and store the parse result to
+* cmd_str  - c-string to be parsed and run
+* read     - see cmd_registry_execute_from()
+* source   - see cmd_registry_execute_from()
+* 
+* returns - whether a command was executed
+*/
+bool cmd_execute_cached(cmd_registry_t *registry, cmd_cache_t *cache, const char *cmd_str, cmd_payload_read_t read, void *source) {
+    cmd_cache_entry_t *entry = cmd_cache_find(cache, cmd_str, atomic_load(&registry->generation));
+    cmd_parse_error_t error;
+    cmd_parsed_t parsed;
+
+    if (entry == NULL) {
+        if (!cmd_parse_with(registry, cmd_str, &parsed, &error, PARSE_COUNT_HITS | (read ? PARSE_BLOBS : 0))) {
+            INTERACTIVE_ONLY(cmd_printf("[ERROR] %s\n", error.message));
+            return false;
+        }
+        // payloads differ between calls, so calls with one aren't cached
+        if (parsed.blob_arg)
+            return cmd_dispatch_read(registry, &parsed, read, source);
+        cmd_journal_record(registry, &parsed);
+        // on success the cache takes over the parsed command
+        if ((entry = cmd_cache_insert(cache, cmd_str, &parsed)) == NULL) {
+            cmd_dispatch(registry, &parsed, NULL);
+            return true;
+        }
+    }
+
+    else
+        cmd_journal_record(registry, &entry->parsed);
+
+    cmd_dispatch(registry, &entry->parsed, entry);
+    return true;
 }
 
-// Used by cmd_loop()
-// Acts as action parameter for the 'exit' command
-void exit_func(arg_bundle_t *args) {
-    *(bool *)args->static_data = true;
+/*
+* Runs a command string whose <BLOB> payload, if the command has one, comes from a custom source
+* cmd_registry_execute() and cmd_registry_execute_stream() are built on this
+* 
+* registry - the registry to run the command in
+* cmd_str  - c-string to be parsed and run
+* read     - function reading the payload that follows the command string
+*            (NULL if <BLOB> arguments aren't accepted)
+* source   - the stream passed to read
+* 
+* returns - whether a command was executed
+*/
+bool cmd_registry_execute_from(cmd_registry_t *registry, const char *cmd_str, cmd_payload_read_t read, void *source) {
+    cmd_cache_t *cache = registry->cache;
+    cmd_parse_error_t error;
+    cmd_parsed_t parsed;
+    bool ret = false;
+    TRACE_ONLY(const ullong trace_start = trace_sample_begin());
+
+    batcher_poll(&registry->batcher);
+    if (cache)
+        ret = cmd_execute_cached(registry, cache, cmd_str, read, source);
+    else if (cmd_parse_with(registry, cmd_str, &parsed, &error, PARSE_COUNT_HITS | (read ? PARSE_BLOBS : 0)))
+        ret = cmd_dispatch_read(registry, &parsed, read, source);
+    else
+        INTERACTIVE_ONLY(cmd_printf("[ERROR] %s\n", error.message));
+
+    TRACE_ONLY(trace_sample_end(trace_start));
+    return ret;
 }
 
 /*
-* Starts an infinite loop of reading a command from stdin and executing it
+* Runs a command based on a given string
+* This is what should be called to run a command from the main program
+* The command tree is only locked while parsing, not while the action runs
+* 
+* registry - the registry to run the command in
+* cmd_str  - c-string to be parsed and run
 * 
+* returns - whether a command was executed
 */
-void cmd_loop(bool add_defaults) {
-    bool exit = false;
+bool cmd_registry_execute(cmd_registry_t *registry, const char *cmd_str) {
+    return cmd_registry_execute_from(registry, cmd_str, NULL, NULL);
+}
+
+// Used by cmd_registry_execute_stream() to read payloads from a FILE *
+bool cmd_file_read(void *file, void *dst, size_t size) {
+    return fread(dst, 1, size, file) == size;
+}
+
+/*
+* Reads a command line from a stream and runs it
+* The payload of a <BLOB> argument follows the line in the stream; it is read straight
+* into the block the action receives, so payloads have no size limit
+* 
+* registry - the registry to run the command in
+* stream   - the stream to read from (opened in binary mode if it carries payloads)
+* 
+* returns - whether a command was executed (feof() tells whether the stream has ended)
+*/
+bool cmd_registry_execute_stream(cmd_registry_t *registry, FILE *stream) {
     char buffer[512];
 
-    if (add_defaults) {
-        cmd_register("dump", &cmd_dumpall_interf, NULL);
-        cmd_register("exit", &exit_func, &exit);
+    if (!fgets(buffer, sizeof(buffer), stream))
+        return false;
+
+    return cmd_registry_execute_from(registry, buffer, &cmd_file_read, stream);
+}
+
+/*
+* Gives a registered command a batch handler
+* Consecutive calls of the command are then collected and passed to the handler
+* together, as one typed array per argument, instead of calling the action for each
+* Safe to call while other threads are executing commands
+*
+* registry     - the registry containing the command
+* cmd_str      - the command's name path, e.g. "set volume"
+* action       - the batch handler (NULL to call the action for each invocation again)
+* static_data  - a pointer that will be available under batch->static_data inside the handler
+* max_size     - number of calls after which the batch is passed to the handler
+* max_delay_ms - time after which a smaller batch is passed to the handler
+*                (checked by cmd_execute() and cmd_batch_poll())
+*
+* returns - whether the command was found
+*/
+bool cmd_registry_set_batch(cmd_registry_t *registry, const char *cmd_str, cmd_batch_act_t action, void *static_data, uint max_size, uint max_delay_ms) {
+    cmd_rwlock_t *lock = &registry->lock;
+    tokenized_str_t tok_str = cmd_tokenize(cmd_str);
+    ptr_arraylist_t path = arraylist_make(NULL);
+
+    rwlock_write_lock(lock);
+
+    command_t *cmd = cmd_locate(&tok_str, &registry->map, &path);
+    const bool ret = cmd != NULL && cmd->subcommands.count == 0;
+
+    if (ret) {
+        cmd->batch.action = action;
+        cmd->batch.static_data = static_data;
+        cmd->batch.max_size = max_size ? max_size : 1;
+        cmd->batch.max_delay_ms = max_delay_ms;
+        cmd_tree_changed(registry);
+    }
+
+    rwlock_write_unlock(lock);
+    arraylist_destroy(&path);
+    tok_str_destroy(&tok_str);
+    return ret;
+}
+
+/*
+* Makes a registered command sharded: its calls are routed by the value of one of its
+* arguments to one of the executor threads started by cmd_registry_shards_start()
+* Calls with equal values always run on the same thread, one after another,
+* each thread with its own instance of the command's static data, so that actions
+* don't need locking; calls with different values can run in parallel
+* cmd_execute() only queues the call and returns, see cmd_shards_wait()
+* A batch handler of the command is not used while it is sharded
+* Sharded actions must not use the registry: the functions changing the command tree
+* wait for the shards while holding its lock
+*
+* registry  - the registry containing the command
+* cmd_str   - the command's name path, e.g. "account deposit"
+* key_arg   - index of the routing argument (0 is the first one)
+* init      - makes the static data instance of a shard from the command's static data
+*             (NULL shares the command's static data); called under the registry lock
+* free_data - frees an instance made by init when the command is removed (can be NULL)
+*
+* returns - whether the command was found and the executor is running
+*/
+bool cmd_registry_set_shard(cmd_registry_t *registry, const char *cmd_str, uint key_arg, cmd_shard_init_t init, cmd_shard_free_t free_data) {
+    cmd_rwlock_t *lock = &registry->lock;
+    tokenized_str_t tok_str = cmd_tokenize(cmd_str);
+    ptr_arraylist_t path = arraylist_make(NULL);
+
+    // queued calls still use the old instances
+    rwlock_write_lock(lock);
+    shards_wait(&registry->shards);
+
+    command_t *cmd = cmd_locate(&tok_str, &registry->map, &path);
+    bool ret = cmd != NULL && cmd->subcommands.count == 0 && key_arg < cmd->arg_cnt
+        && registry->shards.count > 0;
+
+    if (ret) {
+        const arg_node_t *key = cmd->syntax[key_arg];
+
+        shard_data_destroy(&cmd->shard);
+        cmd->shard.free_data = free_data;
+        cmd->shard.key_arg = key_arg;
+        cmd->shard.key_kind = key->kind;
+        cmd->shard.key_size = arg_kind_is_list(key->kind) ? key->elem_size : key->size;
+        ret = shard_data_make(&cmd->shard, registry->shards.count, init, cmd->action.static_data);
+        cmd_tree_changed(registry);
+    }
+
+    rwlock_write_unlock(lock);
+    arraylist_destroy(&path);
+    tok_str_destroy(&tok_str);
+    return ret;
+}
+
+/*
+* Reads how many parses were rejected by the constraints of a command's arguments,
+* such as <INT 0..100> or <STRING max=64>
+* Rejections are counted like lookup hits: by cmd_registry_parse() and executed commands, not by the validator
+*
+* registry - the registry containing the command
+* cmd_str  - the command's name path, e.g. "set volume"
+* rejected - array that receives the count of each argument (0 for arguments without a constraint)
+* count    - length of rejected
+*
+* returns - the command's number of arguments (0 if it wasn't found), at most count of them are written
+*/
+uint cmd_registry_rejections(cmd_registry_t *registry, const char *cmd_str, ullong *rejected, uint count) {
+    cmd_rwlock_t *lock = &registry->lock;
+    tokenized_str_t tok_str = cmd_tokenize(cmd_str);
+    ptr_arraylist_t path = arraylist_make(NULL);
+    uint ret = 0;
+
+    rwlock_read_lock(lock);
+
+    const command_t *cmd = cmd_locate(&tok_str, &registry->map, &path);
+
+    if (cmd) {
+        ret = cmd->arg_cnt;
+        for (uint i = 0; i < ret && i < count; ++i) {
+            const arg_constraint_t *constraint = cmd->syntax[i]->constraint;
+
+            rejected[i] = constraint ? atomic_load_explicit(&constraint->rejected, memory_order_relaxed) : 0;
+        }
+    }
+
+    rwlock_read_unlock(lock);
+    arraylist_destroy(&path);
+    tok_str_destroy(&tok_str);
+    return ret;
+}
+
+/*
+* Streams a machine-readable description of a registry's commands: their paths, syntax types,
+* memory footprint, hits and whether they are batched or sharded (see cmd_introspect.c for the formats)
+* Only the subtrees matching the prefix are visited: all but its last word name a command
+* exactly and the last word is a prefix of the names of that command's subcommands
+* (or of the root commands), e.g. "net i" lists "net if" and "net ip" with their subcommands
+*
+* registry - the registry
+* prefix   - the prefix ("" or NULL for all commands)
+* format   - INTROSPECT_JSON or INTROSPECT_BINARY
+* write    - the sink's write function, e.g. cmd_write_file() with a FILE * as sink
+* sink     - passed to write
+*
+* returns - whether the sink accepted all the output
+*/
+bool cmd_registry_introspect(cmd_registry_t *registry, const char *prefix, cmd_introspect_format_t format, cmd_write_t write, void *sink) {
+    cmd_rwlock_t *lock = &registry->lock;
+    tokenized_str_t tok_str = cmd_tokenize(prefix ? prefix : "");
+    ptr_arraylist_t path = arraylist_make(NULL);
+    cmd_introspect_t *it = malloc(sizeof(cmd_introspect_t));
+    const uint word_cnt = tok_str.parts.count;
+    const command_t *parent = NULL;
+    bool ret, found = true;
+
+    if (!it) {
+        arraylist_destroy(&path);
+        tok_str_destroy(&tok_str);
+        return false;
+    }
+
+    rwlock_read_lock(lock);
+    introspect_begin(it, format, write, sink);
+    for (uint i = 0; found && i + 1 < word_cnt; ++i) {
+        const char *word = tok_str_get(&tok_str, i);
+
+        parent = parent ? find_subcommand(word, &parent->subcommands) : cmd_map_find(&registry->map, word);
+        found = parent != NULL && arraylist_push(&path, parent);
+    }
+
+    if (found) {
+        const char *name_prefix = word_cnt ? tok_str_get(&tok_str, word_cnt - 1) : "";
+        const size_t prefix_len = strlen(name_prefix);
+        const command_t *const *parents = (const command_t *const *)arraylist_data(&path);
+        const command_t *cmd;
+        uint iter = 0;
+
+        if (parent) {
+            for (uint i = 0; i < parent->subcommands.count; ++i) {
+                cmd = arraylist_data(&parent->subcommands)[i];
+                if (!strncmp(cmd->name, name_prefix, prefix_len))
+                    introspect_command(it, parents, path.count, cmd);
+            }
+        }
+        else {
+            while ((cmd = cmd_map_next(&registry->map, &iter)) != NULL) {
+                if (!strncmp(cmd->name, name_prefix, prefix_len))
+                    introspect_command(it, parents, 0, cmd);
+            }
+        }
+    }
+    ret = introspect_end(it);
+
+    rwlock_read_unlock(lock);
+    free(it);
+    arraylist_destroy(&path);
+    tok_str_destroy(&tok_str);
+    return ret;
+}
+
+/*
+* Starts the executor threads of the sharded commands of a registry
+* Should be called once, before any cmd_registry_set_shard()
+*
+* registry - the registry
+* count    - number of threads, usually the number of cores
+*
+* returns - whether the threads were started
+*/
+bool cmd_registry_shards_start(cmd_registry_t *registry, uint count) {
+    rwlock_write_lock(&registry->lock);
+
+    const bool ret = shards_start(&registry->shards, count);
+
+    rwlock_write_unlock(&registry->lock);
+    return ret;
+}
+
+/*
+* Bounds the queued calls of a priority class on each shard of a registry
+* Can be called before or after the executor threads are started
+*
+* registry - the registry
+* prio     - the priority class
+* limit    - most queued calls of the class per shard, 0 for no limit
+* policy   - QUEUE_BLOCK makes the thread submitting a call wait for room, so it stops reading
+*            its input meanwhile (executor threads never wait); QUEUE_SHED drops the call
+*/
+void cmd_registry_set_queue_limit(cmd_registry_t *registry, cmd_prio_t prio, uint limit, cmd_queue_policy_t policy) {
+    if (prio < CMD_PRIO_CNT)
+        shards_set_limit(&registry->shards, prio, limit, policy);
+}
+
+// Returns the per-class queue counters of the sharded commands of a registry
+cmd_queue_stats_t cmd_registry_queue_stats(cmd_registry_t *registry) {
+    return shards_stats(&registry->shards);
+}
+
+// Waits until all queued calls of sharded commands of a registry have run
+void cmd_registry_shards_wait(cmd_registry_t *registry) {
+    shards_wait(&registry->shards);
+}
+
+// Runs the queued calls of sharded commands and stops the executor threads of a registry
+// Sharded commands are run right away by the calling thread afterwards
+void cmd_registry_shards_stop(cmd_registry_t *registry) {
+    // no call is being queued meanwhile
+    rwlock_write_lock(&registry->lock);
+    shards_stop(&registry->shards);
+    rwlock_write_unlock(&registry->lock);
+}
+
+// Used by cmd_script_run(): runs a call like cmd_dispatch() does without handing parsed over,
+// it has to stay alive until its shards are waited for and its batch is flushed
+void cmd_parsed_replay(cmd_parsed_t *parsed) {
+    cmd_registry_t *registry = parsed->registry;
+
+    if (parsed->batch.action != NULL) {
+        batcher_add(&registry->batcher, parsed, NULL, false, NULL);
+        return;
+    }
+
+    batcher_flush_other(&registry->batcher, parsed->cmd_id);
+    if (parsed->shard.data != NULL)
+        cmd_shard_submit(registry, parsed, NULL, false, NULL);
+    else if (parsed->proc.pure_ttl_ms && registry->memo)
+        cmd_memo_run(registry->memo, parsed);
+    else
+        cmd_parsed_run(parsed);
+}
+
+// Passes the calls collected so far in a registry to their batch handler
+void cmd_registry_batch_flush(cmd_registry_t *registry) {
+    batcher_flush(&registry->batcher);
+}
+
+// Passes the collected calls to their batch handler if the oldest one has waited for too long
+void cmd_registry_batch_poll(cmd_registry_t *registry) {
+    batcher_poll(&registry->batcher);
+}
+
+// Returns how long a loop can wait for input without delaying scheduled commands
+// or the pending batch (-1 for no limit), see cmd_registry_timers_poll() and cmd_registry_batch_poll()
+int cmd_registry_next_ms(cmd_registry_t *registry) {
+    const int timers = timers_next_ms(&registry->timers), batch = batcher_next_ms(&registry->batcher);
+
+    return timers < 0 ? batch : batch < 0 ? timers : min(timers, batch);
+}
+
+/*
+* Schedules a command string to run after a delay, once or periodically
+* The string is parsed now; it is only parsed again if the command tree changes before a run
+* Due commands are run by cmd_registry_timers_poll(), which cmd_registry_loop() calls
+* while waiting for input
+* 
+* registry  - the registry to run the command in
+* cmd_str   - c-string to be parsed and run
+* delay_ms  - time until the first run
+* period_ms - time between runs, 0 to run only once
+* 
+* returns - id of the timer for cmd_registry_unschedule() (0 if the string couldn't be parsed)
+*/
+ullong cmd_registry_schedule(cmd_registry_t *registry, const char *cmd_str, uint delay_ms, uint period_ms) {
+    cmd_cache_entry_t *entry;
+    cmd_parse_error_t error;
+    cmd_parsed_t parsed;
+    ullong ret;
+
+    if (!cmd_registry_parse(registry, cmd_str, &parsed, &error)) {
+        INTERACTIVE_ONLY(cmd_printf("[ERROR] %s\n", error.message));
+        return 0;
+    }
+    if ((entry = cmd_cache_entry_make(cmd_str, &parsed, 1)) == NULL) {
+        cmd_parsed_destroy(&parsed);
+        return 0;
+    }
+    if ((ret = timers_add(&registry->timers, entry, delay_ms, period_ms)) == 0)
+        cmd_cache_release(entry);
+
+    return ret;
+}
+
+/*
+* Cancels a command scheduled with cmd_registry_schedule()
+* 
+* registry - the registry the command was scheduled in
+* id       - id of the timer
+* 
+* returns - whether the command was still scheduled
+*/
+bool cmd_registry_unschedule(cmd_registry_t *registry, ullong id) {
+    return timers_cancel(&registry->timers, id);
+}
+
+/*
+* Runs the scheduled commands of a registry that have become due
+* Commands whose tree has changed since scheduling are parsed again,
+* timers of commands that don't exist anymore are cancelled
+* 
+* registry - the registry
+* 
+* returns - the number of commands run
+*/
+uint cmd_registry_timers_poll(cmd_registry_t *registry) {
+    uint count, ret = 0;
+    cmd_timer_fired_t *fired = timers_advance(&registry->timers, &count);
+
+    for (uint i = 0; i < count; ++i) {
+        cmd_cache_entry_t *entry = fired[i].entry;
+
+        if (entry->parsed.generation != atomic_load(&registry->generation)) {
+            cmd_cache_entry_t *fresh = NULL;
+            cmd_parse_error_t error;
+            cmd_parsed_t parsed;
+
+            if (!cmd_registry_parse(registry, entry->key, &parsed, &error)) {
+                INTERACTIVE_ONLY(printf("[ERROR] Scheduled '%s': %s\n", entry->key, error.message));
+                timers_cancel(&registry->timers, fired[i].id);
+                cmd_cache_release(entry);
+                continue;
+            }
+            // one reference for the timer, one for this run
+            if ((fresh = cmd_cache_entry_make(entry->key, &parsed, 2)) == NULL) {
+                cmd_journal_record(registry, &parsed);
+                cmd_dispatch(registry, &parsed, NULL);
+                cmd_cache_release(entry);
+                ++ret;
+                continue;
+            }
+            timers_swap_entry(&registry->timers, fired[i].id, fresh);
+            cmd_cache_release(entry);
+            entry = fresh;
+        }
+
+        cmd_journal_record(registry, &entry->parsed);
+        cmd_dispatch(registry, &entry->parsed, entry);
+        ++ret;
     }
+    free(fired);
 
-    while (!exit) {
-        fgets(buffer, 511, stdin);
-        cmd_execute(buffer);
+    return ret;
+}
+
+// Helper function of cmd_registry_reorder()
+// Stable-sorts the subcommands of a command and all its descendants by lookup hits,
+// then halves the hits so that the order follows recent use
+void cmd_subcommands_reorder(command_t *cmd) {
+    void **arr = arraylist_data(&cmd->subcommands);
+
+    for (uint i = 1; i < cmd->subcommands.count; ++i) {
+        void *const cur = arr[i];
+        const uint hits = atomic_load_explicit(&((command_t *)cur)->hits, memory_order_relaxed);
+        uint j = i;
+
+        for (; j > 0 && atomic_load_explicit(&((command_t *)arr[j - 1])->hits, memory_order_relaxed) < hits; --j)
+            arr[j] = arr[j - 1];
+        arr[j] = cur;
     }
+    for (uint i = 0; i < cmd->subcommands.count; ++i)
+        cmd_subcommands_reorder(arr[i]);
+    atomic_store_explicit(&cmd->hits, atomic_load_explicit(&cmd->hits, memory_order_relaxed) / 2, memory_order_relaxed);
+}
+
+/*
+* Reorders the command tree of a registry by how often its commands were looked up,
+* so that the most used ones are found first:
+* - subcommands are sorted so the linear search meets the hot ones first
+* - the root hashmap is rebuilt with hot commands at the start of their probe chains
+* Only done on request: it holds the write lock while sorting, so it is meant to be
+* called from a maintenance thread or between commands, never by the library itself
+* The commands' ids don't change, so parse results, memoized calls and journal ids stay
+* valid (they don't point to the commands outside of the lock); only the parser's hot
+* table is rebuilt
+*
+* registry - the registry to reorder
+*/
+void cmd_registry_reorder(cmd_registry_t *registry) {
+    command_t *cmd;
+    uint iter = 0;
+
+    // root commands move within the map, nothing refers to them outside of the lock
+    rwlock_write_lock(&registry->lock);
+    cmd_map_reorder(&registry->map);
+    while ((cmd = (command_t *)cmd_map_next(&registry->map, &iter)) != NULL)
+        cmd_subcommands_reorder(cmd);
+    // no parser is running, the next one builds the table in the new order
+    cmd_hot_drop(registry);
+    rwlock_write_unlock(&registry->lock);
+}
+
+/*
+* Enables caching of parse results in cmd_registry_execute()
+* Repeated command strings skip parsing and go straight to the action
+* Actions must not modify their string arguments while the cache is enabled
+* Should not be called while other threads are executing commands
+*
+* registry - the registry to cache the commands of
+* capacity - maximum number of cached command strings
+*
+* returns - whether the cache was created
+*/
+bool cmd_registry_cache_enable(cmd_registry_t *registry, uint capacity) {
+    cmd_registry_cache_disable(registry);
+    registry->cache = cmd_cache_create(capacity);
+    return registry->cache != NULL;
+}
+
+// Disables and frees the cache created by cmd_registry_cache_enable()
+void cmd_registry_cache_disable(cmd_registry_t *registry) {
+    cmd_cache_t *cache = registry->cache;
+
+    registry->cache = NULL;
+    cmd_cache_destroy(cache);
+}
+
+/*
+* Returns statistics of the cache created by cmd_registry_cache_enable()
+* All counters are zero if the cache is disabled
+*/
+cmd_cache_stats_t cmd_registry_cache_get_stats(cmd_registry_t *registry) {
+    cmd_cache_stats_t ret = { 0 };
+
+    if (registry->cache)
+        ret = cmd_cache_stats(registry->cache);
+
+    return ret;
+}
+
+/*
+* Enables memoizing the output of pure commands, see cmd_registry_register_pure()
+* Should not be called while other threads are executing commands
+*
+* registry - the registry to memoize the commands of
+* capacity - maximum number of memoized outputs
+*
+* returns - whether the memo was created
+*/
+bool cmd_registry_memo_enable(cmd_registry_t *registry, uint capacity) {
+    cmd_registry_memo_disable(registry);
+    registry->memo = cmd_memo_create(capacity);
+    return registry->memo != NULL;
+}
+
+// Disables and frees the memo created by cmd_registry_memo_enable()
+void cmd_registry_memo_disable(cmd_registry_t *registry) {
+    cmd_memo_t *memo = registry->memo;
+
+    registry->memo = NULL;
+    cmd_memo_destroy(memo);
+}
+
+/*
+* Returns statistics of the memo created by cmd_registry_memo_enable(), such as its hits and evictions
+* All counters are zero if the memo is disabled
+*/
+cmd_memo_stats_t cmd_registry_memo_get_stats(cmd_registry_t *registry) {
+    cmd_memo_stats_t ret = { 0 };
+
+    if (registry->memo)
+        ret = cmd_memo_stats(registry->memo);
+
+    return ret;
+}
+
+/*
+* Starts recording every command executed in a registry to a journal file
+* Records are buffered and written in groups every flush_ms by a background thread,
+* so cmd_execute() only pays for serializing the arguments
+* Should not be called while other threads are executing commands
+* 
+* registry - the registry to record the commands of
+* path     - the journal file, new records are appended to an existing one
+* flush_ms - interval of writing the buffered records to the file
+* 
+* returns - whether the journal was opened
+*/
+bool cmd_registry_journal_open(cmd_registry_t *registry, const char *path, uint flush_ms) {
+    cmd_registry_journal_close(registry);
+    registry->journal = journal_open(path, flush_ms);
+    return registry->journal != NULL;
+}
+
+// Writes the buffered records and stops recording commands of a registry
+void cmd_registry_journal_close(cmd_registry_t *registry) {
+    cmd_journal_t *journal = registry->journal;
+
+    registry->journal = NULL;
+    journal_close(journal);
+}
+
+/*
+* Helper function of cmd_registry_journal_replay()
+* Resolves the name path of a COMMAND record in the replaying registry
+* 
+* registry - the replaying registry
+* rec      - the COMMAND record
+* dst      - pointer to where the resolved command is to be stored (cmd_id is 0 if it doesn't exist)
+*/
+void cmd_replay_resolve(cmd_registry_t *registry, const cmd_journal_rec_t *rec, cmd_replay_cmd_t *dst) {
+    char *name_path = malloc(rec->len + 1);
+    ptr_arraylist_t path = arraylist_make(NULL);
+    tokenized_str_t tok_str;
+    const command_t *cmd;
+
+    frame_layout_destroy(&dst->layout);
+    memset(dst, 0, sizeof(*dst));
+    if (!name_path)
+        return;
+    memcpy(name_path, rec->data, rec->len);
+    name_path[rec->len] = '\0';
+    tok_str = cmd_tokenize(name_path);
+
+    rwlock_read_lock(&registry->lock);
+    if ((cmd = cmd_locate(&tok_str, &registry->map, &path)) != NULL) {
+        dst->parsed.registry = registry;
+        dst->parsed.cmd = cmd;
+        dst->parsed.cmd_id = cmd->id;
+        TRACE_ONLY(trace_name_copy(dst->parsed.trace_name, cmd->name));
+        dst->parsed.proc = cmd->action;
+        dst->parsed.batch = cmd->batch;
+        dst->parsed.shard = cmd->shard;
+        dst->parsed.generation = atomic_load(&registry->generation);
+        dst->layout = frame_layout_make(&path);
+    }
+    else
+        INTERACTIVE_ONLY(cmd_printf("[ERROR] Journal command '%s' is not registered, its calls are skipped\n", name_path));
+    rwlock_read_unlock(&registry->lock);
+
+    arraylist_destroy(&path);
+    tok_str_destroy(&tok_str);
+    free(name_path);
+}
+
+/*
+* Runs all commands recorded in a journal file, in the recorded order
+* Arguments are rebuilt from their binary form, without tokenizing or parsing any text,
+* and passed to the actions currently registered under the recorded names
+* Replayed commands aren't recorded again
+* The command tree must not change while the journal is being replayed
+* 
+* registry - the registry to run the commands in
+* path     - the journal file
+* 
+* returns - number of commands run
+*/
+ullong cmd_registry_journal_replay(cmd_registry_t *registry, const char *path) {
+    size_t size, pos = 0;
+    uchar *data = journal_load(path, &size);
+    cmd_replay_cmd_t *cmds = NULL;
+    uint cmd_size = 0, defs = 0;
+    arg_bundle_t bundle = arg_bundle_make();
+    cmd_journal_rec_t rec;
+    ullong ret = 0;
+
+    if (!data) {
+        INTERACTIVE_ONLY(cmd_printf("[ERROR] Can't read journal %s\n", path));
+        arg_bundle_destroy(&bundle);
+        return 0;
+    }
+
+    while (journal_next(data, size, &pos, &rec)) {
+        if (rec.type == JOURNAL_REC_COMMAND) {
+            // every run of the journal numbers its commands from 0, so an id
+            // can't exceed the number of COMMAND records before it
+            if (rec.id > defs++) {
+                INTERACTIVE_ONLY(cmd_printf("[ERROR] Journal %s has an invalid command id %u\n", path, rec.id));
+                break;
+            }
+            if (rec.id >= cmd_size) {
+                const uint new_size = max(rec.id + 1, min(cmd_size, UINT_MAX / 4) * 2);
+                cmd_replay_cmd_t *new_cmds = realloc(cmds, new_size * sizeof(cmd_replay_cmd_t));
+
+                if (!new_cmds)
+                    break;
+                memset(new_cmds + cmd_size, 0, (new_size - cmd_size) * sizeof(cmd_replay_cmd_t));
+                cmds = new_cmds;
+                cmd_size = new_size;
+            }
+            cmd_replay_resolve(registry, &rec, &cmds[rec.id]);
+            continue;
+        }
+        if (rec.id >= cmd_size || cmds[rec.id].parsed.cmd_id == 0)
+            continue;
+
+        const cmd_replay_cmd_t *cmd = &cmds[rec.id];
+        cmd_parsed_t parsed = cmd->parsed;
+
+        if (parsed.shard.data || parsed.batch.action) {
+            // batched and sharded calls keep their arguments, so they get their own bundle
+            parsed.args = arg_bundle_make();
+            if (journal_frame_decode(&cmd->layout, &rec, &parsed.args)) {
+                cmd_dispatch(registry, &parsed, NULL);
+                ++ret;
+            }
+            else
+                cmd_parsed_destroy(&parsed);
+            continue;
+        }
+
+        journal_bundle_reset(&bundle);
+        if (journal_frame_decode(&cmd->layout, &rec, &bundle)) {
+            parsed.args = bundle;
+            cmd_parsed_run(&parsed);
+            ++ret;
+        }
+    }
+    if (pos != size)
+        INTERACTIVE_ONLY(cmd_printf("[ERROR] Journal %s is damaged after %zu bytes\n", path, pos));
+
+    // string arguments of pending calls point into data
+    batcher_flush(&registry->batcher);
+    shards_wait(&registry->shards);
+
+    for (uint i = 0; i < cmd_size; ++i)
+        frame_layout_destroy(&cmds[i].layout);
+    free(cmds);
+    arg_bundle_destroy(&bundle);
+    free(data);
+    return ret;
+}
+
+// The functions below work on the default registry, see their cmd_registry_* versions
+
+void cmd_dumpall(void) {
+    cmd_registry_dumpall(cmd_default_registry());
+}
+
+void cmd_loop(bool add_defaults) {
+    cmd_registry_loop(cmd_default_registry(), add_defaults);
+}
+
+bool cmd_register(const char *cmd_str, cmd_act_t action, void *static_data) {
+    return cmd_registry_register(cmd_default_registry(), cmd_str, action, static_data);
+}
+
+bool cmd_register_prio(const char *cmd_str, cmd_act_t action, void *static_data, cmd_prio_t prio) {
+    return cmd_registry_register_prio(cmd_default_registry(), cmd_str, action, static_data, prio);
+}
+
+bool cmd_unregister(const char *cmd_str) {
+    return cmd_registry_unregister(cmd_default_registry(), cmd_str);
+}
+
+bool cmd_replace(const char *cmd_str, cmd_act_t action, void *static_data) {
+    return cmd_registry_replace(cmd_default_registry(), cmd_str, action, static_data);
+}
+
+bool cmd_parse(const char *cmd_str, cmd_parsed_t *parsed, cmd_parse_error_t *error) {
+    return cmd_registry_parse(cmd_default_registry(), cmd_str, parsed, error);
+}
+
+bool cmd_execute(const char *cmd_str) {
+    return cmd_registry_execute(cmd_default_registry(), cmd_str);
+}
+
+bool cmd_execute_stream(FILE *stream) {
+    return cmd_registry_execute_stream(cmd_default_registry(), stream);
+}
+
+bool cmd_set_batch(const char *cmd_str, cmd_batch_act_t action, void *static_data, uint max_size, uint max_delay_ms) {
+    return cmd_registry_set_batch(cmd_default_registry(), cmd_str, action, static_data, max_size, max_delay_ms);
+}
+
+void cmd_batch_flush(void) {
+    cmd_registry_batch_flush(cmd_default_registry());
+}
+
+void cmd_batch_poll(void) {
+    cmd_registry_batch_poll(cmd_default_registry());
+}
+
+bool cmd_set_shard(const char *cmd_str, uint key_arg, cmd_shard_init_t init, cmd_shard_free_t free_data) {
+    return cmd_registry_set_shard(cmd_default_registry(), cmd_str, key_arg, init, free_data);
+}
+
+bool cmd_shards_start(uint count) {
+    return cmd_registry_shards_start(cmd_default_registry(), count);
+}
+
+void cmd_shards_wait(void) {
+    cmd_registry_shards_wait(cmd_default_registry());
+}
+
+void cmd_shards_stop(void) {
+    cmd_registry_shards_stop(cmd_default_registry());
+}
+
+void cmd_set_queue_limit(cmd_prio_t prio, uint limit, cmd_queue_policy_t policy) {
+    cmd_registry_set_queue_limit(cmd_default_registry(), prio, limit, policy);
+}
+
+cmd_queue_stats_t cmd_queue_stats(void) {
+    return cmd_registry_queue_stats(cmd_default_registry());
+}
+
+ullong cmd_schedule(const char *cmd_str, uint delay_ms, uint period_ms) {
+    return cmd_registry_schedule(cmd_default_registry(), cmd_str, delay_ms, period_ms);
+}
+
+bool cmd_unschedule(ullong id) {
+    return cmd_registry_unschedule(cmd_default_registry(), id);
+}
+
+uint cmd_timers_poll(void) {
+    return cmd_registry_timers_poll(cmd_default_registry());
+}
+
+void cmd_reorder(void) {
+    cmd_registry_reorder(cmd_default_registry());
+}
+
+uint cmd_rejections(const char *cmd_str, ullong *rejected, uint count) {
+    return cmd_registry_rejections(cmd_default_registry(), cmd_str, rejected, count);
+}
+
+bool cmd_introspect(const char *prefix, cmd_introspect_format_t format, cmd_write_t write, void *sink) {
+    return cmd_registry_introspect(cmd_default_registry(), prefix, format, write, sink);
+}
+
+bool cmd_cache_enable(uint capacity) {
+    return cmd_registry_cache_enable(cmd_default_registry(), capacity);
+}
+
+void cmd_cache_disable(void) {
+    cmd_registry_cache_disable(cmd_default_registry());
+}
+
+cmd_cache_stats_t cmd_cache_get_stats(void) {
+    return cmd_registry_cache_get_stats(cmd_default_registry());
+}
+
+bool cmd_register_pure(const char *cmd_str, cmd_act_t action, void *static_data, uint ttl_ms) {
+    return cmd_registry_register_pure(cmd_default_registry(), cmd_str, action, static_data, ttl_ms);
+}
+
+bool cmd_memo_enable(uint capacity) {
+    return cmd_registry_memo_enable(cmd_default_registry(), capacity);
+}
+
+void cmd_memo_disable(void) {
+    cmd_registry_memo_disable(cmd_default_registry());
+}
+
+cmd_memo_stats_t cmd_memo_get_stats(void) {
+    return cmd_registry_memo_get_stats(cmd_default_registry());
+}
+
+bool cmd_journal_open(const char *path, uint flush_ms) {
+    return cmd_registry_journal_open(cmd_default_registry(), path, flush_ms);
+}
+
+void cmd_journal_close(void) {
+    cmd_registry_journal_close(cmd_default_registry());
+}
+
+ullong cmd_journal_replay(const char *path) {
+    return cmd_registry_journal_replay(cmd_default_registry(), path);
 }
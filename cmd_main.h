@@ -2,6 +2,7 @@
 
 #define INTERACTIVE
 #define DEBUG
+#define TRACE
 
 #ifdef DEBUG
 #define DEBUG_ONLY(expr) expr
@@ -15,12 +16,74 @@
 #define INTERACTIVE_ONLY(expr)
 #endif // INTERACTIVE
 
+// span instrumentation of cmd_execute() and cmd_register(), see cmd_trace.h
+#ifdef TRACE
+#define TRACE_ONLY(expr) expr
+#else
+#define TRACE_ONLY(expr)
+#endif // TRACE
+
 #include "struct_funcs.h"
 
+// largest <BLOB> payload accepted, larger ones are rejected while parsing
+#define CMD_BLOB_MAX (64u << 20)
+
 bool str_eq(const char *s1, const char *s2);
 
+cmd_registry_t *cmd_registry_create(void);
+void cmd_registry_destroy(cmd_registry_t *registry);
+cmd_registry_t *cmd_default_registry(void);
+
+bool cmd_registry_register(cmd_registry_t *registry, const char *cmd_str, cmd_act_t action, void *static_data);
+bool cmd_registry_register_prio(cmd_registry_t *registry, const char *cmd_str, cmd_act_t action, void *static_data, cmd_prio_t prio);
+bool cmd_registry_unregister(cmd_registry_t *registry, const char *cmd_str);
+bool cmd_registry_replace(cmd_registry_t *registry, const char *cmd_str, cmd_act_t action, void *static_data);
+bool cmd_registry_register_pure(cmd_registry_t *registry, const char *cmd_str, cmd_act_t action, void *static_data, uint ttl_ms);
+bool cmd_registry_parse(cmd_registry_t *registry, const char *cmd_str, cmd_parsed_t *parsed, cmd_parse_error_t *error);
+bool cmd_registry_parse_locked(cmd_registry_t *registry, const char *cmd_str, cmd_parsed_t *parsed, cmd_parse_error_t *error);
+bool cmd_registry_execute(cmd_registry_t *registry, const char *cmd_str);
+bool cmd_registry_execute_from(cmd_registry_t *registry, const char *cmd_str, cmd_payload_read_t read, void *source);
+bool cmd_registry_execute_stream(cmd_registry_t *registry, FILE *stream);
+void cmd_registry_dumpall(cmd_registry_t *registry);
+uint cmd_registry_rejections(cmd_registry_t *registry, const char *cmd_str, ullong *rejected, uint count);
+bool cmd_registry_introspect(cmd_registry_t *registry, const char *prefix, cmd_introspect_format_t format, cmd_write_t write, void *sink);
+void cmd_registry_loop(cmd_registry_t *registry, bool add_defaults);
+void cmd_registry_reorder(cmd_registry_t *registry);
+
+ullong cmd_registry_schedule(cmd_registry_t *registry, const char *cmd_str, uint delay_ms, uint period_ms);
+bool cmd_registry_unschedule(cmd_registry_t *registry, ullong id);
+uint cmd_registry_timers_poll(cmd_registry_t *registry);
+
+bool cmd_registry_set_batch(cmd_registry_t *registry, const char *cmd_str, cmd_batch_act_t action, void *static_data, uint max_size, uint max_delay_ms);
+void cmd_registry_batch_flush(cmd_registry_t *registry);
+void cmd_registry_batch_poll(cmd_registry_t *registry);
+int cmd_registry_next_ms(cmd_registry_t *registry);
+
+bool cmd_registry_set_shard(cmd_registry_t *registry, const char *cmd_str, uint key_arg, cmd_shard_init_t init, cmd_shard_free_t free_data);
+bool cmd_registry_shards_start(cmd_registry_t *registry, uint count);
+void cmd_registry_shards_wait(cmd_registry_t *registry);
+void cmd_registry_shards_stop(cmd_registry_t *registry);
+void cmd_registry_set_queue_limit(cmd_registry_t *registry, cmd_prio_t prio, uint limit, cmd_queue_policy_t policy);
+cmd_queue_stats_t cmd_registry_queue_stats(cmd_registry_t *registry);
+
+bool cmd_registry_cache_enable(cmd_registry_t *registry, uint capacity);
+void cmd_registry_cache_disable(cmd_registry_t *registry);
+cmd_cache_stats_t cmd_registry_cache_get_stats(cmd_registry_t *registry);
+
+bool cmd_registry_memo_enable(cmd_registry_t *registry, uint capacity);
+void cmd_registry_memo_disable(cmd_registry_t *registry);
+cmd_memo_stats_t cmd_registry_memo_get_stats(cmd_registry_t *registry);
+
+bool cmd_registry_journal_open(cmd_registry_t *registry, const char *path, uint flush_ms);
+void cmd_registry_journal_close(cmd_registry_t *registry);
+ullong cmd_registry_journal_replay(cmd_registry_t *registry, const char *path);
+
 bool cmd_register_(const char *cmd_str, cmd_act_t action, void *static_data);
 bool cmd_execute(const char *cmd_str);
+bool cmd_execute_stream(FILE *stream);
+bool cmd_parse(const char *cmd_str, cmd_parsed_t *parsed, cmd_parse_error_t *error);
+void cmd_parsed_run(const cmd_parsed_t *parsed);
+void cmd_parsed_destroy(cmd_parsed_t *parsed);
 void cmd_loop(bool add_defaults);
 
 void cmd_print_rec(const command_t *cmd, uint depth);
@@ -28,3 +91,38 @@ void cmd_print_rec(const command_t *cmd, uint depth);
 
 void cmd_dumpall(void);
 bool cmd_register(const char *cmd_str, cmd_act_t action, void *static_data);
+bool cmd_register_prio(const char *cmd_str, cmd_act_t action, void *static_data, cmd_prio_t prio);
+bool cmd_unregister(const char *cmd_str);
+bool cmd_replace(const char *cmd_str, cmd_act_t action, void *static_data);
+void cmd_reorder(void);
+uint cmd_rejections(const char *cmd_str, ullong *rejected, uint count);
+bool cmd_introspect(const char *prefix, cmd_introspect_format_t format, cmd_write_t write, void *sink);
+
+ullong cmd_schedule(const char *cmd_str, uint delay_ms, uint period_ms);
+bool cmd_unschedule(ullong id);
+uint cmd_timers_poll(void);
+
+bool cmd_set_batch(const char *cmd_str, cmd_batch_act_t action, void *static_data, uint max_size, uint max_delay_ms);
+void cmd_batch_flush(void);
+void cmd_batch_poll(void);
+
+bool cmd_set_shard(const char *cmd_str, uint key_arg, cmd_shard_init_t init, cmd_shard_free_t free_data);
+bool cmd_shards_start(uint count);
+void cmd_shards_wait(void);
+void cmd_shards_stop(void);
+void cmd_set_queue_limit(cmd_prio_t prio, uint limit, cmd_queue_policy_t policy);
+cmd_queue_stats_t cmd_queue_stats(void);
+void cmd_parsed_replay(cmd_parsed_t *parsed);
+
+bool cmd_cache_enable(uint capacity);
+void cmd_cache_disable(void);
+cmd_cache_stats_t cmd_cache_get_stats(void);
+
+bool cmd_register_pure(const char *cmd_str, cmd_act_t action, void *static_data, uint ttl_ms);
+bool cmd_memo_enable(uint capacity);
+void cmd_memo_disable(void);
+cmd_memo_stats_t cmd_memo_get_stats(void);
+
+bool cmd_journal_open(const char *path, uint flush_ms);
+void cmd_journal_close(void);
+ullong cmd_journal_replay(const char *path);
@@ -0,0 +1,415 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "cmd_memo.h"
+#include "cmd_main.h"
+#include "cmd_server.h"
+#include "arg_types.h"
+#include "sync_funcs.h"
+
+#pragma warning (disable: 5045)
+
+/*
+* Pure commands (see cmd_registry_register_pure()) produce the same output for the same
+* arguments, so the output their action writes with cmd_printf() is kept, keyed by the command
+* and its arguments, and written again by later calls instead of running the action
+* The memo is split into MEMO_SHARDS shards, each an LRU list with its own lock
+*/
+
+// Returns the shard a key hash belongs to, the high bits of FNV-1a are mixed in first as they barely
+// change between keys differing in their last bytes
+cmd_memo_shard_t *memo_shard(cmd_memo_t *memo, ullong key_hash) {
+    return &memo->shards[(key_hash ^ key_hash >> 32) * 0x9E3779B97F4A7C15ULL >> 60 & (MEMO_SHARDS - 1)];
+}
+
+/*
+* Creates a heap-allocated memo of command outputs
+*
+* capacity - maximum number of memoized outputs, rounded up to a multiple of MEMO_SHARDS
+*
+* returns - pointer to the new memo (NULL on failure)
+*/
+cmd_memo_t *cmd_memo_create(uint capacity) {
+    cmd_memo_t *ret = calloc(1, sizeof(cmd_memo_t));
+    const uint shard_capacity = capacity / MEMO_SHARDS + (capacity % MEMO_SHARDS != 0) + (capacity == 0);
+    uint bucket_cnt = 1, ready = 0;
+
+    if (!ret)
+        return NULL;
+
+    while (bucket_cnt < 2 * shard_capacity)
+        bucket_cnt *= 2;
+    for (; ready < MEMO_SHARDS; ++ready) {
+        cmd_memo_shard_t *shard = &ret->shards[ready];
+
+        shard->bucket_mask = bucket_cnt - 1;
+        shard->stats.capacity = shard_capacity;
+        shard->buckets = calloc(bucket_cnt, sizeof(cmd_memo_entry_t *));
+        if (!shard->buckets || mtx_init(&shard->lock, mtx_plain) != thrd_success) {
+            free(shard->buckets);
+            break;
+        }
+    }
+
+    if (ready < MEMO_SHARDS) {
+        for (uint i = 0; i < ready; ++i) {
+            mtx_destroy(&ret->shards[i].lock);
+            free(ret->shards[i].buckets);
+        }
+        free(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+/*
+* Makes the memo key of a parsed call of a pure command, the registry has to be locked
+* as the argument kinds are taken from the command's memo layout
+* The key is the command's id followed by the argument values; strings, lists and blobs are
+* encoded by value, with their length in front; a <BLOB> payload isn't read yet, so
+* cmd_memo_run() appends it
+*
+* parsed - the call, its memo_key is set (left NULL without memory or without the command's
+*          layout), the key is freed with its arguments
+* layout - the command's memo layout
+*/
+void cmd_memo_key_make(cmd_parsed_t *parsed, const cmd_frame_layout_t *layout) {
+    arg_bundle_t *args = &parsed->args;
+    byte_arraylist_t key = byte_arraylist_make();
+    bool ok = layout->kinds != NULL && layout->count == args->args.count
+        && byte_arraylist_append(&key, &parsed->cmd_id, sizeof(parsed->cmd_id));
+
+    for (uint i = 0; ok && i < layout->count; ++i) {
+        const uchar *value = byte_arraylist_data(&args->data) + (size_t)arraylist_data(&args->args)[i];
+
+        // bundle values aren't aligned, so pointers are copied out
+        if (layout->kinds[i] == ARG_STRING) {
+            const char *str;
+            memcpy(&str, value, sizeof(str));
+            const uint len = (uint)strlen(str);
+
+            ok = byte_arraylist_append(&key, &len, sizeof(len)) && byte_arraylist_append(&key, str, len);
+        }
+        else if (arg_kind_is_list(layout->kinds[i])) {
+            arg_list_t list;
+            memcpy(&list, value, sizeof(list));
+
+            ok = byte_arraylist_append(&key, &list.count, sizeof(list.count))
+                && (list.count == 0 || byte_arraylist_append(&key, list.data, list.count * layout->sizes[i]));
+        }
+        else if (layout->kinds[i] != ARG_BLOB)
+            ok = byte_arraylist_append(&key, value, layout->sizes[i]);
+    }
+
+    uchar *copy = ok ? malloc(key.count) : NULL;
+
+    if (copy && arraylist_push(&args->dynamic_blocks, copy)) {
+        memcpy(copy, byte_arraylist_data(&key), key.count);
+        parsed->memo_key = copy;
+        parsed->memo_key_len = key.count;
+    }
+    else
+        free(copy);
+    byte_arraylist_destroy(&key);
+}
+
+// Helper function of cmd_memo_run(), completes a call's key with its <BLOB> payload
+bool memo_key_add_blob(const cmd_parsed_t *parsed, byte_arraylist_t *key) {
+    const arg_bundle_t *args = &parsed->args;
+    arg_blob_t blob;
+
+    memcpy(&blob, byte_arraylist_data(&args->data) + (size_t)arraylist_data(&args->args)[parsed->blob_arg - 1], sizeof(blob));
+
+    const uint size = (uint)blob.size;
+
+    return size == blob.size && byte_arraylist_append(key, parsed->memo_key, parsed->memo_key_len)
+        && byte_arraylist_append(key, &size, sizeof(size)) && (size == 0 || byte_arraylist_append(key, blob.data, size));
+}
+
+/*
+* Drops a reference to a memo entry
+* The entry is freed with the last reference
+*
+* entry - the entry
+*/
+void cmd_memo_release(cmd_memo_entry_t *entry) {
+    if (entry && atomic_fetch_sub(&entry->refs, 1) == 1)
+        free(entry);
+}
+
+/*
+* Removes an entry from its shard, the shard's lock has to be held
+*
+* shard - the shard holding the entry
+* link  - pointer to the bucket or chain link pointing to the entry
+*/
+void memo_unlink(cmd_memo_shard_t *shard, cmd_memo_entry_t **link) {
+    cmd_memo_entry_t *entry = *link;
+
+    *link = entry->chain;
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        shard->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        shard->tail = entry->prev;
+
+    shard->stats.entries--;
+    shard->stats.memory -= sizeof(cmd_memo_entry_t) + entry->key_len + entry->out_len;
+    cmd_memo_release(entry);
+}
+
+// Finds the link pointing to an entry with the given key, or to the end of its chain
+cmd_memo_entry_t **memo_link(cmd_memo_shard_t *shard, const uchar *key, uint key_len, ullong key_hash) {
+    cmd_memo_entry_t **link = &shard->buckets[key_hash & shard->bucket_mask];
+
+    for (; *link; link = &(*link)->chain) {
+        if ((*link)->key_hash == key_hash && (*link)->key_len == key_len && !memcmp((*link)->data, key, key_len))
+            break;
+    }
+    return link;
+}
+
+// Moves an entry to the front of its shard's LRU list, the shard's lock has to be held
+void memo_touch(cmd_memo_shard_t *shard, cmd_memo_entry_t *entry) {
+    if (shard->head == entry)
+        return;
+
+    entry->prev->next = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        shard->tail = entry->prev;
+    entry->prev = NULL;
+    entry->next = shard->head;
+    shard->head->prev = entry;
+    shard->head = entry;
+}
+
+/*
+* Helper function of cmd_memo_run()
+* Looks a key up, dropping the entry instead if it has expired or belongs to an older command tree
+*
+* memo       - the memo
+* key        - the key
+* key_len    - length of the key
+* key_hash   - hash of the key
+* generation - generation of the command tree the call was parsed in
+*
+* returns - the entry (NULL on a miss), release it with cmd_memo_release()
+*/
+cmd_memo_entry_t *memo_find(cmd_memo_t *memo, const uchar *key, uint key_len, ullong key_hash, uint generation) {
+    cmd_memo_shard_t *shard = memo_shard(memo, key_hash);
+    cmd_memo_entry_t *ret = NULL;
+
+    mtx_lock(&shard->lock);
+
+    cmd_memo_entry_t **link = memo_link(shard, key, key_len, key_hash);
+
+    if (*link && (*link)->generation != generation) {
+        memo_unlink(shard, link);
+        shard->stats.invalidations++;
+    }
+    else if (*link && (*link)->expires_ns <= time_now_ns()) {
+        memo_unlink(shard, link);
+        shard->stats.expirations++;
+    }
+    else if (*link) {
+        ret = *link;
+        atomic_fetch_add(&ret->refs, 1);
+        memo_touch(shard, ret);
+    }
+    if (ret)
+        shard->stats.hits++;
+    else
+        shard->stats.misses++;
+
+    mtx_unlock(&shard->lock);
+    return ret;
+}
+
+/*
+* Helper function of cmd_memo_run()
+* Stores an output, replacing an entry with the same key and evicting the least recently
+* used entry of the shard if it is full
+*
+* memo       - the memo
+* key        - the key
+* key_len    - length of the key
+* key_hash   - hash of the key
+* generation - generation of the command tree the call was parsed in
+* ttl_ms     - time after which the output expires
+* out        - the output
+* out_len    - length of the output
+*/
+void memo_insert(cmd_memo_t *memo, const uchar *key, uint key_len, ullong key_hash, uint generation,
+    uint ttl_ms, const uchar *out, uint out_len) {
+    cmd_memo_shard_t *shard = memo_shard(memo, key_hash);
+    cmd_memo_entry_t *entry = malloc(sizeof(cmd_memo_entry_t) + key_len + out_len);
+
+    if (!entry)
+        return;
+
+    atomic_init(&entry->refs, 1);
+    entry->key_len = key_len;
+    entry->out_len = out_len;
+    entry->generation = generation;
+    entry->key_hash = key_hash;
+    entry->expires_ns = time_now_ns() + ttl_ms * 1000000ull;
+    entry->prev = NULL;
+    memcpy(entry->data, key, key_len);
+    memcpy(entry->data + key_len, out, out_len);
+
+    mtx_lock(&shard->lock);
+
+    cmd_memo_entry_t **link = memo_link(shard, key, key_len, key_hash);
+
+    // another thread may have run the same call in the meantime
+    if (*link)
+        memo_unlink(shard, link);
+    else if (shard->stats.entries == shard->stats.capacity) {
+        const cmd_memo_entry_t *victim = shard->tail;
+
+        memo_unlink(shard, memo_link(shard, victim->data, victim->key_len, victim->key_hash));
+        shard->stats.evictions++;
+        link = memo_link(shard, key, key_len, key_hash);
+    }
+    entry->chain = *link;
+    *link = entry;
+    entry->next = shard->head;
+    if (shard->head)
+        shard->head->prev = entry;
+    else
+        shard->tail = entry;
+    shard->head = entry;
+
+    shard->stats.entries++;
+    shard->stats.insertions++;
+    shard->stats.memory += sizeof(cmd_memo_entry_t) + key_len + out_len;
+    mtx_unlock(&shard->lock);
+}
+
+/*
+* Runs a parsed call of a pure command through the memo
+* A memoized output of the same call is written with cmd_write() without calling the action;
+* otherwise the action runs and what it writes with cmd_printf() is memoized for
+* the command's pure_ttl_ms
+*
+* memo   - the memo
+* parsed - the call
+*/
+void cmd_memo_run(cmd_memo_t *memo, const cmd_parsed_t *parsed) {
+    byte_arraylist_t key = byte_arraylist_make();
+
+    // calls without a key (see cmd_memo_key_make()) aren't memoized
+    if (!parsed->memo_key || (parsed->blob_arg && !memo_key_add_blob(parsed, &key))) {
+        byte_arraylist_destroy(&key);
+        cmd_parsed_run(parsed);
+        return;
+    }
+
+    const uchar *key_data = parsed->blob_arg ? byte_arraylist_data(&key) : parsed->memo_key;
+    const uint key_len = parsed->blob_arg ? key.count : parsed->memo_key_len;
+    const ullong key_hash = hash_bytes(key_data, key_len);
+    cmd_memo_entry_t *entry = memo_find(memo, key_data, key_len, key_hash, parsed->generation);
+
+    if (entry) {
+        cmd_write(entry->data + entry->key_len, entry->out_len);
+        cmd_memo_release(entry);
+    }
+    else {
+        cmd_capture_t capture;
+
+        cmd_capture_begin(&capture);
+        cmd_parsed_run(parsed);
+        cmd_capture_end(&capture);
+        if (!capture.lost && capture.out.count <= MEMO_MAX_OUTPUT)
+            memo_insert(memo, key_data, key_len, key_hash, parsed->generation, parsed->proc.pure_ttl_ms,
+                byte_arraylist_data(&capture.out), capture.out.count);
+        byte_arraylist_destroy(&capture.out);
+    }
+
+    byte_arraylist_destroy(&key);
+}
+
+/*
+* Drops all entries of a memo
+* Entries still being written are freed once their last user releases them
+*
+* memo - the memo to clear
+*/
+void cmd_memo_clear(cmd_memo_t *memo) {
+    for (uint i = 0; i < MEMO_SHARDS; ++i) {
+        cmd_memo_shard_t *shard = &memo->shards[i];
+
+        mtx_lock(&shard->lock);
+        for (cmd_memo_entry_t *entry = shard->head, *next; entry; entry = next) {
+            next = entry->next;
+            cmd_memo_release(entry);
+        }
+        memset(shard->buckets, 0, (shard->bucket_mask + 1) * sizeof(cmd_memo_entry_t *));
+        shard->head = shard->tail = NULL;
+        shard->stats.invalidations += shard->stats.entries;
+        shard->stats.entries = 0;
+        shard->stats.memory = 0;
+        mtx_unlock(&shard->lock);
+    }
+}
+
+/*
+* Returns a snapshot of a memo's counters, summed over its shards
+*
+* memo - the memo to get the counters of
+*/
+cmd_memo_stats_t cmd_memo_stats(cmd_memo_t *memo) {
+    cmd_memo_stats_t ret = { 0 };
+
+    for (uint i = 0; i < MEMO_SHARDS; ++i) {
+        cmd_memo_shard_t *shard = &memo->shards[i];
+
+        mtx_lock(&shard->lock);
+        ret.hits += shard->stats.hits;
+        ret.misses += shard->stats.misses;
+        ret.insertions += shard->stats.insertions;
+        ret.evictions += shard->stats.evictions;
+        ret.expirations += shard->stats.expirations;
+        ret.invalidations += shard->stats.invalidations;
+        ret.entries += shard->stats.entries;
+        ret.capacity += shard->stats.capacity;
+        ret.memory += shard->stats.memory;
+        mtx_unlock(&shard->lock);
+    }
+
+    return ret;
+}
+
+// Prints a memo's counters to stdout
+void cmd_memo_print_stats(cmd_memo_t *memo) {
+    const cmd_memo_stats_t stats = cmd_memo_stats(memo);
+    const ullong lookups = stats.hits + stats.misses;
+
+    printf("memo: %u/%u entries, %zu bytes, hit rate %.2f%% (%llu hits, %llu misses), "
+        "%llu insertions, %llu evictions, %llu expirations, %llu invalidations\n",
+        stats.entries, stats.capacity, stats.memory, lookups ? 100.0 * stats.hits / lookups : 0.0,
+        stats.hits, stats.misses, stats.insertions, stats.evictions, stats.expirations, stats.invalidations);
+}
+
+/*
+* Frees all memory allocated by cmd_memo_create()
+*
+* memo - the memo to be deleted
+*/
+void cmd_memo_destroy(cmd_memo_t *memo) {
+    if (!memo)
+        return;
+
+    cmd_memo_clear(memo);
+    for (uint i = 0; i < MEMO_SHARDS; ++i) {
+        mtx_destroy(&memo->shards[i].lock);
+        free(memo->shards[i].buckets);
+    }
+    free(memo);
+}
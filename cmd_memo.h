@@ -0,0 +1,15 @@
+#pragma once
+#include "struct_funcs.h"
+
+#define MEMO_SHARDS 16
+// longest output that is memoized, pure commands printing more are always run
+#define MEMO_MAX_OUTPUT (64u << 10)
+
+cmd_memo_t *cmd_memo_create(uint capacity);
+void cmd_memo_key_make(cmd_parsed_t *parsed, const cmd_frame_layout_t *layout);
+void cmd_memo_run(cmd_memo_t *memo, const cmd_parsed_t *parsed);
+void cmd_memo_release(cmd_memo_entry_t *entry);
+void cmd_memo_clear(cmd_memo_t *memo);
+cmd_memo_stats_t cmd_memo_stats(cmd_memo_t *memo);
+void cmd_memo_print_stats(cmd_memo_t *memo);
+void cmd_memo_destroy(cmd_memo_t *memo);
@@ -0,0 +1,550 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include "cmd_ring.h"
+#include "sync_funcs.h"
+
+#pragma warning (disable: 5045 4996)
+
+/*
+* A ring is a named shared-memory object (shm_open() name such as "/cmds") holding a
+* cmd_ring_shared_t header and a power-of-two data area of framed commands
+* Any number of producer processes append frames without locks: a frame is reserved
+* by a compare-and-swap on head, marked busy and committed by storing its length last
+* One processor consumes the committed frames in order, in batches, zeroes them and moves tail;
+* a busy frame carries the pid of its producer and is only skipped once that process has exited,
+* so a producer that dies while writing one doesn't stall the ring and a slow one never has its
+* frame handed to someone else; producers therefore have to see the processor's pids (the same
+* machine and pid namespace); a frame not even marked busy yet is always waited for, its size
+* isn't known, so a producer dying in the few instructions between the reservation and the
+* mark would stall the ring
+* The processor only sleeps (on a futex on Linux) when the ring is empty, and producers
+* only make the wake-up call when it does
+*/
+
+// Rounds a frame size up to the frame alignment
+uint ring_align(uint size) {
+    return (size + RING_ALIGN - 1) & ~(uint)(RING_ALIGN - 1);
+}
+
+// Returns the header of the frame at a byte position of the ring
+cmd_ring_frame_t *ring_frame(const cmd_ring_t *ring, ullong pos) {
+    return (cmd_ring_frame_t *)(ring->data + (pos & (ring->shared->capacity - 1)));
+}
+
+// Blocks while *word equals value, for at most timeout_ms (-1 waits without a limit)
+// Returns early for no reason sometimes, callers have to recheck what they wait for
+void ring_futex_wait(atomic_uint *word, uint value, int timeout_ms) {
+#ifdef __linux__
+    struct timespec timeout = { .tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L };
+
+    // not FUTEX_PRIVATE_FLAG, the word is shared between processes
+    syscall(SYS_futex, (uint *)word, FUTEX_WAIT, value, timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+#else
+    // no cross-process wait-on-address, so poll
+    const struct timespec step = { .tv_nsec = 1000000L };
+
+    for (int waited = 0; atomic_load(word) == value && (timeout_ms < 0 || waited < timeout_ms); ++waited)
+        thrd_sleep(&step, NULL);
+#endif
+}
+
+// Wakes everyone blocked in ring_futex_wait() on word
+void ring_futex_wake(atomic_uint *word) {
+#ifdef __linux__
+    syscall(SYS_futex, (uint *)word, FUTEX_WAKE, 0x7FFFFFFF, NULL, NULL, 0);
+#else
+    UNREF(word);
+#endif
+}
+
+/*
+* Maps a ring's shared memory object
+*
+* name     - name of the object
+* capacity - size of the data area when making a new object, 0 to open an existing one
+*
+* returns - the mapping (NULL on failure), with name, shared and map_size set
+*/
+cmd_ring_t *ring_map(const char *name, size_t capacity) {
+    cmd_ring_t *ring = calloc(1, sizeof(cmd_ring_t));
+    size_t size = capacity ? sizeof(cmd_ring_shared_t) + capacity : 0;
+    void *view = NULL;
+
+    if (!ring || !(ring->name = _strdup(name))) {
+        free(ring);
+        return NULL;
+    }
+#ifdef _WIN32
+    HANDLE mapping = capacity
+        ? CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((ullong)size >> 32), (DWORD)size, name)
+        : OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+
+    if (mapping && !(capacity && GetLastError() == ERROR_ALREADY_EXISTS))
+        view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (mapping)
+        CloseHandle(mapping);
+    if (view && !capacity) {
+        MEMORY_BASIC_INFORMATION info;
+
+        VirtualQuery(view, &info, sizeof(info));
+        size = info.RegionSize;
+    }
+#else
+    int fd;
+    struct stat info;
+
+    if (capacity) {
+        // a ring left behind by a processor that crashed is replaced
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0 && ftruncate(fd, (off_t)size) != 0) {
+            close(fd);
+            shm_unlink(name);
+            fd = -1;
+        }
+    }
+    else {
+        fd = shm_open(name, O_RDWR, 0);
+        if (fd >= 0 && fstat(fd, &info) == 0)
+            size = (size_t)info.st_size;
+    }
+
+    if (fd >= 0 && size >= sizeof(cmd_ring_shared_t)) {
+        view = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (view == MAP_FAILED)
+            view = NULL;
+    }
+    if (fd >= 0)
+        close(fd);
+    if (!view && capacity)
+        shm_unlink(name);
+#endif
+
+    if (!view) {
+        free(ring->name);
+        free(ring);
+        return NULL;
+    }
+
+    ring->shared = view;
+    ring->data = (uchar *)view + sizeof(cmd_ring_shared_t);
+    ring->map_size = size;
+    ring->owner = capacity != 0;
+    return ring;
+}
+
+/*
+* Makes a new command ring and maps it for the processor
+* An existing ring of the same name is replaced
+*
+* name     - name of the shared memory object, e.g. "/cmds" (on Windows a file mapping name)
+* capacity - size of the data area in bytes, rounded up to a power of two between
+*            RING_MIN_CAPACITY and RING_MAX_CAPACITY; a frame can use at most half of it
+*
+* returns - the ring (NULL on failure), free with cmd_ring_destroy()
+*/
+cmd_ring_t *cmd_ring_create(const char *name, size_t capacity) {
+    size_t size = RING_MIN_CAPACITY;
+    cmd_ring_t *ring;
+
+    while (size < capacity && size < RING_MAX_CAPACITY)
+        size *= 2;
+    if (!(ring = ring_map(name, size))) {
+        INTERACTIVE_ONLY(printf("[ERROR] Could not create the command ring '%s'\n", name));
+        return NULL;
+    }
+
+    // the new object is zeroed, so every frame reads as not committed
+    ring->shared->capacity = size;
+    atomic_thread_fence(memory_order_release);
+    ring->shared->magic = RING_MAGIC;
+    return ring;
+}
+
+/*
+* Maps an existing command ring for a producer
+*
+* name - name the processor gave to cmd_ring_create()
+*
+* returns - the ring (NULL if there is no such ring), free with cmd_ring_destroy()
+*/
+cmd_ring_t *cmd_ring_connect(const char *name) {
+    cmd_ring_t *ring = ring_map(name, 0);
+
+    if (!ring)
+        return NULL;
+
+    const ullong capacity = ring->shared->capacity;
+
+    if (ring->shared->magic != RING_MAGIC || capacity < RING_MIN_CAPACITY || (capacity & (capacity - 1))
+        || ring->map_size < sizeof(cmd_ring_shared_t) + capacity) {
+        INTERACTIVE_ONLY(printf("[ERROR] '%s' is not a command ring\n", name));
+        cmd_ring_destroy(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+// Returns the id of the calling process, stored in the frames it writes
+uint ring_pid(void) {
+#ifdef _WIN32
+    return (uint)GetCurrentProcessId();
+#else
+    return (uint)getpid();
+#endif
+}
+
+/*
+* Appends a command with a <BLOB> payload to a ring
+* Safe to call from any number of threads and processes at once; doesn't block
+*
+* ring    - the ring, from cmd_ring_connect() or cmd_ring_create()
+* cmd_str - the command, its <BLOB> argument giving the payload size
+* payload - the payload bytes (can be NULL if size is 0)
+* size    - size of the payload
+*
+* returns - whether the command was queued (false if the ring is full, stopped, the command
+*           is longer than RING_LINE_MAX or the frame is larger than half the ring)
+*/
+bool cmd_ring_send_blob(cmd_ring_t *ring, const char *cmd_str, const void *payload, size_t size) {
+    cmd_ring_shared_t *shared = ring->shared;
+    const ullong capacity = shared->capacity;
+    const size_t cmd_len = strlen(cmd_str);
+    const size_t length = sizeof(cmd_ring_frame_t) + cmd_len + 1 + size;
+    ullong head, pad;
+
+    if (cmd_len >= RING_LINE_MAX || length > capacity / 2 || atomic_load_explicit(&shared->stopped, memory_order_relaxed))
+        return false;
+
+    const uint frame_size = ring_align((uint)length);
+
+    head = atomic_load_explicit(&shared->head, memory_order_relaxed);
+    do {
+        const ullong offset = head & (capacity - 1);
+        const ullong tail = atomic_load_explicit(&shared->tail, memory_order_acquire);
+
+        // frames don't wrap around, the rest of the area is skipped with a filler frame
+        pad = offset + frame_size > capacity ? capacity - offset : 0;
+        if (head + pad + frame_size - tail > capacity)
+            return false;
+    } while (!atomic_compare_exchange_weak_explicit(&shared->head, &head, head + pad + frame_size,
+        memory_order_relaxed, memory_order_relaxed));
+
+    if (pad)
+        atomic_store_explicit(&ring_frame(ring, head)->length, RING_PAD | (uint)pad, memory_order_release);
+
+    cmd_ring_frame_t *frame = ring_frame(ring, head + pad);
+    uchar *body = (uchar *)(frame + 1);
+    uint busy = RING_BUSY | frame_size;
+
+    // tells the processor who to check on and how much to skip if this process dies before the commit
+    frame->pid = ring_pid();
+    atomic_store_explicit(&frame->length, busy, memory_order_release);
+    frame->cmd_len = (uint)cmd_len;
+    memcpy(body, cmd_str, cmd_len + 1);
+    if (size)
+        memcpy(body + cmd_len + 1, payload, size);
+    // fails only if the processor took this process for an exited one
+    if (!atomic_compare_exchange_strong_explicit(&frame->length, &busy, (uint)length,
+        memory_order_release, memory_order_relaxed))
+        return false;
+
+    // pairs with the store of sleeping and the check of the ring in cmd_ring_wait()
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&shared->sleeping, memory_order_relaxed)) {
+        atomic_fetch_add(&shared->wake_seq, 1);
+        ring_futex_wake(&shared->wake_seq);
+    }
+
+    return true;
+}
+
+/*
+* Appends a command to a ring, see cmd_ring_send_blob()
+*
+* ring    - the ring
+* cmd_str - the command
+*
+* returns - whether the command was queued (false if the ring is full or stopped)
+*/
+bool cmd_ring_send(cmd_ring_t *ring, const char *cmd_str) {
+    return cmd_ring_send_blob(ring, cmd_str, NULL, 0);
+}
+
+// Helper function of cmd_ring_wait(), whether the frame at pos is ready to be consumed
+bool ring_committed(const cmd_ring_t *ring, ullong pos) {
+    const uint length = atomic_load(&ring_frame(ring, pos)->length);
+
+    return length && !(length & RING_BUSY);
+}
+
+/*
+* Puts the processor to sleep until a command is queued, the ring is stopped or the time runs out
+*
+* ring       - the ring
+* timeout_ms - longest time to wait in ms, -1 for no limit
+*
+* returns - whether the ring has a command or was stopped
+*/
+bool cmd_ring_wait(cmd_ring_t *ring, int timeout_ms) {
+    cmd_ring_shared_t *shared = ring->shared;
+    const uint seq = atomic_load(&shared->wake_seq);
+    const ullong tail = atomic_load_explicit(&shared->tail, memory_order_relaxed);
+    bool ready;
+
+    // an unfinished frame is rechecked in time to skip it if its producer died
+    if (ring->stall_ns && (timeout_ms < 0 || timeout_ms > RING_ABANDON_MS))
+        timeout_ms = RING_ABANDON_MS;
+
+    atomic_store(&shared->sleeping, 1);
+    if (!(ready = ring_committed(ring, tail) || atomic_load(&shared->stopped))) {
+        ring->sleeps++;
+        ring_futex_wait(&shared->wake_seq, seq, timeout_ms);
+        ready = ring_committed(ring, tail) || atomic_load(&shared->stopped);
+    }
+    atomic_store(&shared->sleeping, 0);
+
+    return ready;
+}
+
+/*
+* Stops a ring: further sends fail and cmd_ring_serve() returns once the queued commands have run
+* Can be called by the processor or a producer
+*
+* ring - the ring
+*/
+void cmd_ring_stop(cmd_ring_t *ring) {
+    atomic_store(&ring->shared->stopped, 1);
+    atomic_fetch_add(&ring->shared->wake_seq, 1);
+    ring_futex_wake(&ring->shared->wake_seq);
+}
+
+/*
+* Unmaps a ring; the processor's mapping also removes the name, so no new producers can connect
+*
+* ring - the ring to unmap
+*/
+void cmd_ring_destroy(cmd_ring_t *ring) {
+    if (!ring)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(ring->shared);
+#else
+    munmap(ring->shared, ring->map_size);
+    if (ring->owner)
+        shm_unlink(ring->name);
+#endif
+    free(ring->name);
+    free(ring);
+}
+
+// Used by cmd_registry_ring_drain() to read <BLOB> payloads from a frame (see cmd_payload_read_t)
+bool ring_read_payload(void *source, void *dst, size_t size) {
+    cmd_ring_payload_t *payload = source;
+
+    if (size > payload->left)
+        return false;
+
+    memcpy(dst, payload->data, size);
+    payload->data += size;
+    payload->left -= size;
+    return true;
+}
+
+// Helper function of cmd_registry_ring_drain()
+// Zeroes the consumed frames between tail and end and hands their space back to the producers
+void ring_release(cmd_ring_t *ring, ullong tail, ullong end) {
+    const ullong capacity = ring->shared->capacity;
+    const ullong offset = tail & (capacity - 1);
+    const ullong first = min(end - tail, capacity - offset);
+
+    memset(ring->data + offset, 0, first);
+    memset(ring->data, 0, end - tail - first);
+    atomic_store_explicit(&ring->shared->tail, end, memory_order_release);
+}
+
+// Helper function of ring_abandoned(), whether a process exists
+bool ring_process_alive(uint pid) {
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+    bool ret;
+
+    if (!process)
+        return GetLastError() == ERROR_ACCESS_DENIED;
+    ret = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return ret;
+#else
+    // EPERM means it runs as another user
+    return kill((pid_t)pid, 0) == 0 || errno != ESRCH;
+#endif
+}
+
+/*
+* Helper function of cmd_registry_ring_drain()
+* Decides whether an unfinished frame was abandoned by its producer: the frame has to stay
+* unfinished for RING_ABANDON_MS and its producer must have exited; a producer that is
+* only slow is checked again every RING_ABANDON_MS for as long as it takes
+*
+* ring - the processor's ring
+* pos  - position of the frame
+* pid  - the frame's producer
+*
+* returns - whether the frame can be skipped
+*/
+bool ring_abandoned(cmd_ring_t *ring, ullong pos, uint pid) {
+    const ullong now = time_now_ns();
+
+    if (ring->stall_ns == 0 || ring->stall_pos != pos) {
+        ring->stall_pos = pos;
+        ring->stall_ns = now;
+        return false;
+    }
+    if (now - ring->stall_ns < (ullong)RING_ABANDON_MS * 1000000)
+        return false;
+    if (ring_process_alive(pid)) {
+        ring->stall_ns = now;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+* Runs the commands queued in a ring, without waiting for more
+* Only one thread may consume a ring
+*
+* registry - the registry to run the commands in
+* ring     - the processor's ring, from cmd_ring_create()
+* max      - most commands to run
+*
+* returns - the number of commands taken from the ring
+*/
+uint cmd_registry_ring_drain(cmd_registry_t *registry, cmd_ring_t *ring, uint max) {
+    const ullong capacity = ring->shared->capacity;
+    const ullong tail = atomic_load_explicit(&ring->shared->tail, memory_order_relaxed);
+    ullong pos = tail, freed = tail;
+    uint count = 0;
+
+    while (count < max) {
+        cmd_ring_frame_t *frame = ring_frame(ring, pos);
+        const uint length = atomic_load_explicit(&frame->length, memory_order_acquire);
+        const ullong room = capacity - (pos & (capacity - 1));
+
+        // the ring is empty, or a producer has just reserved the frame and is about to mark it busy
+        if (length == 0)
+            break;
+        if (length & RING_BUSY) {
+            if (!ring_abandoned(ring, pos, frame->pid))
+                break;
+
+            const uint skip = length & ~RING_BUSY;
+
+            if ((length & RING_PAD) || skip > room || skip < sizeof(cmd_ring_frame_t)) {
+                INTERACTIVE_ONLY(printf("[ERROR] Corrupt frame in the command ring '%s', stopping it\n", ring->name));
+                cmd_ring_stop(ring);
+                break;
+            }
+            INTERACTIVE_ONLY(printf("[ERROR] Skipped a frame of the command ring '%s' left unfinished by process %u, which has exited\n",
+                ring->name, frame->pid));
+            ring->stall_ns = 0;
+            pos += skip;
+            continue;
+        }
+        ring->stall_ns = 0;
+        if (length == (RING_PAD | (uint)room)) {
+            pos += room;
+            continue;
+        }
+
+        const uint cmd_len = frame->cmd_len;
+        char cmd_str[RING_LINE_MAX];
+
+        // a frame that lies about its size could make the processor read past the ring
+        if ((length & RING_PAD) || length > room || length < sizeof(cmd_ring_frame_t) + 1
+            || cmd_len >= RING_LINE_MAX || cmd_len > length - sizeof(cmd_ring_frame_t) - 1) {
+            INTERACTIVE_ONLY(printf("[ERROR] Corrupt frame in the command ring '%s', stopping it\n", ring->name));
+            cmd_ring_stop(ring);
+            break;
+        }
+
+        // the command is parsed from a private copy, producers can write the shared one at any time
+        memcpy(cmd_str, frame + 1, cmd_len);
+        cmd_str[cmd_len] = '\0';
+
+        cmd_ring_payload_t payload = {
+            .data = (const uchar *)(frame + 1) + cmd_len + 1,
+            .left = length - sizeof(cmd_ring_frame_t) - cmd_len - 1,
+        };
+
+        cmd_registry_execute_from(registry, cmd_str, &ring_read_payload, &payload);
+        pos += ring_align(length);
+        count++;
+
+        // producers shouldn't wait for a whole batch when the ring fills up
+        if (pos - freed >= capacity / 4) {
+            ring_release(ring, freed, pos);
+            freed = pos;
+        }
+    }
+
+    if (pos != freed)
+        ring_release(ring, freed, pos);
+    if (count) {
+        ring->commands += count;
+        ring->batches++;
+    }
+    return count;
+}
+
+/*
+* Runs commands from a ring as they come until the ring is stopped with cmd_ring_stop()
+* Sleeps while the ring is empty; commands scheduled with cmd_registry_schedule() and batches
+* that have waited for max_delay_ms are run meanwhile
+*
+* registry - the registry to run the commands in
+* ring     - the processor's ring, from cmd_ring_create()
+*/
+void cmd_registry_ring_serve(cmd_registry_t *registry, cmd_ring_t *ring) {
+    while (!atomic_load(&ring->shared->stopped)) {
+        if (cmd_registry_ring_drain(registry, ring, RING_BATCH) == 0)
+            cmd_ring_wait(ring, cmd_registry_next_ms(registry));
+        cmd_registry_batch_poll(registry);
+        cmd_registry_timers_poll(registry);
+    }
+
+    // what was queued before the stop still runs
+    while (cmd_registry_ring_drain(registry, ring, RING_BATCH));
+    cmd_registry_batch_flush(registry);
+    cmd_registry_shards_wait(registry);
+    INTERACTIVE_ONLY(printf("Ring '%s' stopped: %llu commands in %llu batches, slept %llu times\n",
+        ring->name, ring->commands, ring->batches, ring->sleeps));
+}
+
+uint cmd_ring_drain(cmd_ring_t *ring, uint max) {
+    return cmd_registry_ring_drain(cmd_default_registry(), ring, max);
+}
+
+void cmd_ring_serve(cmd_ring_t *ring) {
+    cmd_registry_ring_serve(cmd_default_registry(), ring);
+}
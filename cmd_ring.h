@@ -0,0 +1,32 @@
+#pragma once
+#include "cmd_main.h"
+
+// "CMDRING1" as stored by a little-endian machine
+#define RING_MAGIC 0x31474E4952444D43ULL
+#define RING_MIN_CAPACITY (1u << 12)
+#define RING_MAX_CAPACITY (1u << 30)
+// set in the length of filler frames that skip the rest of the data area
+#define RING_PAD 0x80000000u
+// set in the length of reserved frames that their producer is still writing
+#define RING_BUSY 0x40000000u
+// how often the producer of an unfinished frame is checked, the frame is skipped once it has exited
+#define RING_ABANDON_MS 1000
+// longest command string of a frame, with its NUL
+#define RING_LINE_MAX 4096
+// frames are 8-byte aligned so that their headers can be written atomically
+#define RING_ALIGN 8
+// most commands run by cmd_ring_serve() before the consumed frames are freed
+#define RING_BATCH 256
+
+cmd_ring_t *cmd_ring_create(const char *name, size_t capacity);
+cmd_ring_t *cmd_ring_connect(const char *name);
+bool cmd_ring_send(cmd_ring_t *ring, const char *cmd_str);
+bool cmd_ring_send_blob(cmd_ring_t *ring, const char *cmd_str, const void *payload, size_t size);
+bool cmd_ring_wait(cmd_ring_t *ring, int timeout_ms);
+void cmd_ring_stop(cmd_ring_t *ring);
+void cmd_ring_destroy(cmd_ring_t *ring);
+
+uint cmd_registry_ring_drain(cmd_registry_t *registry, cmd_ring_t *ring, uint max);
+void cmd_registry_ring_serve(cmd_registry_t *registry, cmd_ring_t *ring);
+uint cmd_ring_drain(cmd_ring_t *ring, uint max);
+void cmd_ring_serve(cmd_ring_t *ring);
@@ -0,0 +1,254 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "cmd_script.h"
+
+#pragma warning (disable: 5045 4996)
+
+/*
+* Creates a stack-allocated empty script
+* 
+* registry - the registry whose command tree the script's lines are parsed against
+* 
+* returns - the newly created script
+*/
+cmd_script_t cmd_registry_script_make(cmd_registry_t *registry) {
+    cmd_script_t ret = { .registry = registry };
+
+    return ret;
+}
+
+/*
+* Helper function of cmd_script_add_line()
+* Makes room for one more element in one of a script's arrays
+* 
+* arr       - pointer to the array
+* size      - pointer to the array's capacity
+* count     - number of used elements
+* elem_size - size of one element
+* 
+* returns - whether there is room for another element
+*/
+bool cmd_script_reserve(void **arr, uint *size, uint count, uint elem_size) {
+    if (count < *size)
+        return true;
+
+    const uint new_size = *size ? 2 * *size : CONTAINER_INIT_SIZE;
+    void *new_arr = realloc(*arr, (size_t)new_size * elem_size);
+
+    if (!new_arr)
+        return false;
+    *arr = new_arr;
+    *size = new_size;
+
+    return true;
+}
+
+/*
+* Parses one command string and appends the result to a script
+* Blank lines and lines starting with '#' are skipped
+* 
+* script  - the script to append to
+* cmd_str - the command string
+* line    - line number reported with a parse error
+* 
+* returns - whether the line was parsed (or skipped) without errors
+*/
+bool cmd_script_add_line(cmd_script_t *script, const char *cmd_str, uint line) {
+    cmd_script_record_t record = { .line = line };
+    cmd_script_error_t error = { .line = line };
+    uint i = 0;
+
+    while (cmd_str[i] == ' ' || cmd_str[i] == '\t')
+        ++i;
+    if ((uchar)cmd_str[i] < ' ' || cmd_str[i] == '#')
+        return true;
+
+    if (cmd_registry_parse(script->registry, cmd_str + i, &record.parsed, &error.error)) {
+        if ((record.source = _strdup(cmd_str + i)) == NULL
+            || !cmd_script_reserve((void **)&script->records, &script->size, script->count, sizeof(record))) {
+            free(record.source);
+            cmd_parsed_destroy(&record.parsed);
+            return false;
+        }
+        script->records[script->count++] = record;
+        return true;
+    }
+
+    if (cmd_script_reserve((void **)&script->errors, &script->error_size, script->error_cnt, sizeof(error)))
+        script->errors[script->error_cnt++] = error;
+    return false;
+}
+
+/*
+* Parses every line of a command file against the command tree of a registry
+* Parsing doesn't stop at errors, all of them are collected in the script
+* 
+* registry - the registry to look the commands up in
+* file     - the file to read from
+* 
+* returns - the compiled script
+*/
+cmd_script_t cmd_registry_script_compile(cmd_registry_t *registry, FILE *file) {
+    cmd_script_t ret = cmd_registry_script_make(registry);
+    char buffer[512];
+    uint line = 0;
+
+    while (fgets(buffer, sizeof(buffer), file)) {
+        const size_t len = strlen(buffer);
+
+        ++line;
+        if (len == sizeof(buffer) - 1 && buffer[len - 1] != '\n' && !feof(file)) {
+            cmd_script_error_t error = { .line = line, .error.status = CMD_PARSE_INTERNAL };
+            int c;
+
+            snprintf(error.error.message, sizeof(error.error.message), "Line longer than %u characters", (uint)len);
+            if (cmd_script_reserve((void **)&ret.errors, &ret.error_size, ret.error_cnt, sizeof(error)))
+                ret.errors[ret.error_cnt++] = error;
+            while ((c = fgetc(file)) != EOF && c != '\n');
+            continue;
+        }
+        cmd_script_add_line(&ret, buffer, line);
+    }
+
+    return ret;
+}
+
+/*
+* Opens a command file and compiles it with cmd_registry_script_compile()
+* 
+* registry - the registry to look the commands up in
+* path     - path of the file
+* 
+* returns - the compiled script (with a single error if the file couldn't be opened)
+*/
+cmd_script_t cmd_registry_script_compile_file(cmd_registry_t *registry, const char *path) {
+    FILE *file = fopen(path, "r");
+    cmd_script_t ret;
+
+    if (!file) {
+        cmd_script_error_t error = { .line = 0, .error.status = CMD_PARSE_INTERNAL };
+
+        ret = cmd_registry_script_make(registry);
+        snprintf(error.error.message, sizeof(error.error.message), "Can't open '%s'", path);
+        if (cmd_script_reserve((void **)&ret.errors, &ret.error_size, 0, sizeof(error)))
+            ret.errors[ret.error_cnt++] = error;
+        return ret;
+    }
+
+    ret = cmd_registry_script_compile(registry, file);
+    fclose(file);
+    return ret;
+}
+
+// Prints all errors found while compiling a script to stdout
+void cmd_script_print_errors(const cmd_script_t *script) {
+    for (uint i = 0; i < script->error_cnt; ++i)
+        printf("[ERROR] line %u: %s\n", script->errors[i].line, script->errors[i].error.message);
+}
+
+/*
+* Helper function of cmd_script_run()
+* Parses the lines of a script again whose command tree has changed since they were parsed
+* Lines that aren't valid anymore are reported as errors of the script
+* 
+* script - the script to update
+* 
+* returns - whether every line is still valid
+*/
+bool cmd_script_refresh(cmd_script_t *script) {
+    bool waited = false;
+
+    for (uint i = 0; i < script->count; ++i) {
+        cmd_script_record_t *record = script->records + i;
+        cmd_script_error_t error = { .line = record->line };
+        cmd_parsed_t parsed;
+
+        if (record->parsed.generation == atomic_load(&script->registry->generation))
+            continue;
+        if (!cmd_registry_parse(script->registry, record->source, &parsed, &error.error)) {
+            if (cmd_script_reserve((void **)&script->errors, &script->error_size, script->error_cnt, sizeof(error)))
+                script->errors[script->error_cnt++] = error;
+            continue;
+        }
+        // executor threads and the batcher may still use the record from the previous repetition
+        if (!waited) {
+            cmd_registry_batch_flush(script->registry);
+            cmd_registry_shards_wait(script->registry);
+            waited = true;
+        }
+        cmd_parsed_destroy(&record->parsed);
+        record->parsed = parsed;
+    }
+
+    return script->error_cnt == 0;
+}
+
+/*
+* Runs all commands of a compiled script in order
+* Actions are called as they were resolved at compile time, without any parsing;
+* lines are only parsed again if the command tree has changed since
+* Sharded, batched and pure commands are run as they are when entered, pending calls are
+* run before returning
+* 
+* script - the script to run
+* repeat - how many times to run the whole script
+* 
+* returns - whether the script was run (scripts with errors are not, this includes
+*           lines whose command doesn't exist anymore)
+*/
+bool cmd_script_run(cmd_script_t *script, uint repeat) {
+    if (!script || script->error_cnt > 0)
+        return false;
+
+    bool pending = false;
+
+    while (repeat-- > 0) {
+        if (!cmd_script_refresh(script))
+            break;
+        for (uint i = 0; i < script->count; ++i) {
+            cmd_parsed_t *parsed = &script->records[i].parsed;
+
+            cmd_parsed_replay(parsed);
+            if (parsed->shard.data || parsed->batch.action)
+                pending = true;
+        }
+    }
+    // the records of sharded and batched commands are used until their shards and batch have run
+    if (pending) {
+        cmd_registry_batch_flush(script->registry);
+        cmd_registry_shards_wait(script->registry);
+    }
+
+    return script->error_cnt == 0;
+}
+
+/*
+* Frees all memory allocated by cmd_script_compile()
+* 
+* script - the script to be deleted
+*/
+void cmd_script_destroy(cmd_script_t *script) {
+    if (!script)
+        return;
+
+    for (uint i = 0; i < script->count; ++i) {
+        cmd_parsed_destroy(&script->records[i].parsed);
+        free(script->records[i].source);
+    }
+    free(script->records);
+    free(script->errors);
+    memset(script, 0, sizeof(*script));
+}
+
+cmd_script_t cmd_script_make(void) {
+    return cmd_registry_script_make(cmd_default_registry());
+}
+
+cmd_script_t cmd_script_compile(FILE *file) {
+    return cmd_registry_script_compile(cmd_default_registry(), file);
+}
+
+cmd_script_t cmd_script_compile_file(const char *path) {
+    return cmd_registry_script_compile_file(cmd_default_registry(), path);
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "cmd_main.h"
+#include <stdio.h>
+
+cmd_script_t cmd_registry_script_make(cmd_registry_t *registry);
+bool cmd_script_reserve(void **arr, uint *size, uint count, uint elem_size);
+bool cmd_script_add_line(cmd_script_t *script, const char *cmd_str, uint line);
+cmd_script_t cmd_registry_script_compile(cmd_registry_t *registry, FILE *file);
+cmd_script_t cmd_registry_script_compile_file(cmd_registry_t *registry, const char *path);
+void cmd_script_print_errors(const cmd_script_t *script);
+bool cmd_script_run(cmd_script_t *script, uint repeat);
+void cmd_script_destroy(cmd_script_t *script);
+
+cmd_script_t cmd_script_make(void);
+cmd_script_t cmd_script_compile(FILE *file);
+cmd_script_t cmd_script_compile_file(const char *path);
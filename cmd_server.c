@@ -0,0 +1,735 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include "cmd_server.h"
+
+#pragma warning (disable: 5045 4996)
+
+/*
+* Clients send command lines (each followed by its <BLOB> payload, if any) and may send
+* many of them without waiting; every command gets one response, in order:
+*
+*     OK <length>\n<output>      the command ran, output is what it passed to cmd_printf()
+*     ERR <length>\n<output>     it didn't, output holds the error message
+*
+* Commands run on the server's thread with their session set as cmd_current_session();
+* sharded and batched calls run elsewhere, their response is sent once their job or batch
+* has run and holds what the action wrote (a batch's output goes with its last call)
+*/
+
+// the session whose command the calling thread is running
+thread_local cmd_session_t *server_session = NULL;
+// the session command the calling thread is dispatching, until cmd_response_take() is called for it
+thread_local cmd_session_t *server_deferrable = NULL;
+// the response the output of the calling thread goes to, see cmd_response_enter()
+thread_local cmd_response_t *server_response = NULL;
+
+/*
+* Returns the client connection whose command is being run, so that actions can keep
+* per-client state in its data
+*
+* returns - the session, NULL if the command doesn't come from the command server
+*/
+cmd_session_t *cmd_current_session(void) {
+    const cmd_response_t *response = server_response;
+
+    return response ? response->session : server_session;
+}
+
+// the innermost capture of the calling thread's output, see cmd_capture_begin()
+thread_local cmd_capture_t *server_capture = NULL;
+
+// Helper function of cmd_printf(), formats at the end of a list, returns the length (negative on failure)
+int server_vprintf(byte_arraylist_t *out, const char *format, va_list args) {
+    va_list retry;
+    int len = -1;
+
+    va_copy(retry, args);
+    if (byte_arraylist_reserve(out, 256)) {
+        len = vsnprintf((char *)byte_arraylist_data(out) + out->count, out->size - out->count, format, args);
+        // didn't fit, now the size is known
+        if (len >= 0 && (uint)len >= out->size - out->count)
+            len = byte_arraylist_reserve(out, (uint)len + 1)
+                ? vsnprintf((char *)byte_arraylist_data(out) + out->count, out->size - out->count, format, retry) : -1;
+        if (len > 0)
+            out->count += (uint)len;
+    }
+    va_end(retry);
+
+    return len;
+}
+
+// Helper function of cmd_printf() and cmd_write(), returns the list the output of the calling
+// thread goes to: its response or its session's output, NULL for stdout
+byte_arraylist_t *server_output(void) {
+    cmd_response_t *response = server_response;
+    cmd_session_t *session = server_session;
+
+    return response ? &response->out : session ? &session->out : NULL;
+}
+
+// Helper function of cmd_printf() and cmd_write(), passes output on to the client or stdout
+bool server_emit(const void *data, size_t size) {
+    byte_arraylist_t *out = server_output();
+
+    if (!out)
+        return fwrite(data, 1, size, stdout) == size;
+    return size == (uint)size && byte_arraylist_append(out, data, (uint)size);
+}
+
+/*
+* printf() for actions: the output goes to the client whose command is being run,
+* or to stdout outside of the command server
+* While a pure command runs, it is also captured for the memo, see cmd_capture_begin()
+*
+* format - the printf() format
+*
+* returns - the number of characters written, negative on failure
+*/
+int cmd_printf(const char *format, ...) {
+    byte_arraylist_t *out = server_output();
+    cmd_capture_t *capture = server_capture;
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    if (capture) {
+        const uint start = capture->out.count;
+
+        len = server_vprintf(&capture->out, format, args);
+        if (len < 0)
+            capture->lost = true;
+        else if (!server_emit(byte_arraylist_data(&capture->out) + start, (uint)len))
+            len = -1;
+    }
+    else if (!out)
+        len = vprintf(format, args);
+    else
+        len = server_vprintf(out, format, args);
+    va_end(args);
+
+    return len;
+}
+
+/*
+* Writes raw bytes where cmd_printf() would write its output (and captures them the same way)
+*
+* data - the bytes
+* size - their number
+*
+* returns - whether all bytes were written
+*/
+bool cmd_write(const void *data, size_t size) {
+    cmd_capture_t *capture = server_capture;
+
+    if (capture && (size != (uint)size || !byte_arraylist_append(&capture->out, data, (uint)size)))
+        capture->lost = true;
+    return server_emit(data, size);
+}
+
+/*
+* Starts collecting the output the calling thread writes with cmd_printf() and cmd_write()
+* The output still reaches its destination; captures nest, an inner one is passed on to
+* the outer one when it ends
+*
+* capture - the capture to collect into, its list is made here
+*/
+void cmd_capture_begin(cmd_capture_t *capture) {
+    capture->out = byte_arraylist_make();
+    capture->outer = server_capture;
+    capture->lost = false;
+    server_capture = capture;
+}
+
+/*
+* Stops a capture started by cmd_capture_begin(), the collected output stays in capture->out
+* (free it with byte_arraylist_destroy())
+*
+* capture - the innermost capture of the calling thread
+*/
+void cmd_capture_end(cmd_capture_t *capture) {
+    cmd_capture_t *outer = capture->outer;
+
+    server_capture = outer;
+    if (outer && (capture->lost
+        || !byte_arraylist_append(&outer->out, byte_arraylist_data(&capture->out), capture->out.count)))
+        outer->lost = true;
+}
+
+// Helper function of cmd_response_take() and server_execute(), adds a response to the end of a session's queue
+void server_response_append(cmd_session_t *session, cmd_response_t *response) {
+    if (session->responses_last)
+        session->responses_last->next = response;
+    else
+        session->responses = response;
+    session->responses_last = response;
+    session->response_cnt++;
+}
+
+/*
+* Called for every call that is dispatched: the response of a session's command can be deferred
+* by its call to when it has run on a shard or in a batch; calls made by actions are answered
+* together with the command that made them
+*
+* defer - whether the call is sharded or batched
+*
+* returns - the response to pass to cmd_response_enter() and cmd_response_done(); NULL if the call
+*           isn't the command of a session (or there's no memory), it is answered when it returns then
+*/
+cmd_response_t *cmd_response_take(bool defer) {
+    cmd_session_t *session = server_deferrable;
+    cmd_response_t *response;
+
+    server_deferrable = NULL;
+    if (!session || !defer || !(response = calloc(1, sizeof(cmd_response_t))))
+        return NULL;
+
+    response->session = session;
+    response->out = byte_arraylist_make();
+    response->wake_fd = session->wake_fd;
+    atomic_init(&response->done, false);
+    server_response_append(session, response);
+    session->deferred = response;
+    return response;
+}
+
+/*
+* Makes the output of the calling thread go to a response until cmd_response_leave() is called
+* 
+* response - the response, if NULL the output keeps going where it goes
+* 
+* returns - the previous destination, to be passed to cmd_response_leave()
+*/
+cmd_response_t *cmd_response_enter(cmd_response_t *response) {
+    cmd_response_t *ret = server_response;
+
+    if (response)
+        server_response = response;
+    return ret;
+}
+
+// Ends a cmd_response_enter(), outer is what it returned
+void cmd_response_leave(cmd_response_t *outer) {
+    server_response = outer;
+}
+
+/*
+* Completes a response taken by cmd_response_take(), it is sent to the client after the ones
+* before it; the response mustn't be used afterwards
+* 
+* response - the response (can be NULL)
+* ok       - whether the call ran
+*/
+void cmd_response_done(cmd_response_t *response, bool ok) {
+    if (!response)
+        return;
+
+    const int wake_fd = response->wake_fd;
+
+    response->ok = ok;
+    atomic_store_explicit(&response->done, true, memory_order_release);
+#ifdef __linux__
+    const ullong value = 1;
+
+    // wakes the server's loop to send the response
+    UNREF(write(wake_fd, &value, sizeof(value)));
+#else
+    UNREF(wake_fd);
+#endif
+}
+
+#ifdef __linux__
+
+/*
+* Opens a Unix domain socket for clients to send commands to, see cmd_server_run()
+* A socket file left behind at path is replaced
+*
+* path - path of the socket file
+*
+* returns - the server (NULL on failure), free with cmd_server_close()
+*/
+cmd_server_t *cmd_server_open(const char *path) {
+    cmd_server_t *server = calloc(1, sizeof(cmd_server_t));
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct epoll_event listen_event = { .events = EPOLLIN }, wake_event = { .events = EPOLLIN };
+
+    if (!server)
+        return NULL;
+    server->listen_fd = server->epoll_fd = server->wake_fd = -1;
+    if (strlen(path) >= sizeof(addr.sun_path) || !(server->path = _strdup(path))) {
+        INTERACTIVE_ONLY(printf("[ERROR] Invalid socket path '%s'\n", path));
+        free(server);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    listen_event.data.ptr = &server->listen_fd;
+    wake_event.data.ptr = &server->wake_fd;
+    if ((server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0
+        || bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(server->listen_fd, SOMAXCONN) != 0
+        || (server->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0
+        || (server->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+        || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &listen_event) != 0
+        || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->wake_fd, &wake_event) != 0) {
+        INTERACTIVE_ONLY(printf("[ERROR] Could not listen on '%s'\n", path));
+        cmd_server_close(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+// Helper function of cmd_registry_server_run(), starts sessions for the waiting connections
+void server_accept(cmd_server_t *server) {
+    int fd;
+
+    while ((fd = accept(server->listen_fd, NULL, NULL)) >= 0) {
+        cmd_session_t *session = calloc(1, sizeof(cmd_session_t));
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = session };
+
+        if (!session || fcntl(fd, F_SETFL, O_NONBLOCK) != 0
+            || fcntl(fd, F_SETFD, FD_CLOEXEC) != 0 || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            free(session);
+            close(fd);
+            continue;
+        }
+
+        session->fd = fd;
+        session->wake_fd = server->wake_fd;
+        session->events = EPOLLIN;
+        session->id = ++server->next_id;
+        session->next = server->sessions;
+        if (server->sessions)
+            server->sessions->prev = session;
+        server->sessions = session;
+        server->session_cnt++;
+    }
+}
+
+// Ends a session, dropping what wasn't sent to the client yet
+// Its responses have to be done, their jobs and batches may use the session otherwise
+void server_session_close(cmd_server_t *server, cmd_session_t *session) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+    if (server->free_data && session->data)
+        (*server->free_data)(session->data);
+
+    if (session->prev)
+        session->prev->next = session->next;
+    else
+        server->sessions = session->next;
+    if (session->next)
+        session->next->prev = session->prev;
+    server->session_cnt--;
+
+    for (cmd_response_t *response = session->responses, *next; response; response = next) {
+        next = response->next;
+        byte_arraylist_destroy(&response->out);
+        free(response);
+    }
+    byte_arraylist_destroy(&session->in);
+    byte_arraylist_destroy(&session->out);
+    free(session);
+}
+
+// Marks a session as broken, it is closed without sending the rest of its responses
+void server_session_fail(cmd_session_t *session) {
+    session->closing = true;
+    session->pending = false;
+    session->in_begin = session->in.count;
+    session->out_begin = session->out.count = 0;
+}
+
+// Whether a session takes input: not once the client is done sending, nor while its responses
+// aren't read or its commands pile up
+bool server_reading(const cmd_session_t *session) {
+    return !session->closing && session->out.count - session->out_begin < SERVER_OUT_LIMIT
+        && session->in.count - session->in_begin < max(SERVER_IN_LIMIT, session->need);
+}
+
+// Helper function of cmd_registry_server_run(), reads what the client has sent
+void server_read(cmd_session_t *session) {
+    byte_arraylist_t *in = &session->in;
+
+    if (session->in_begin) {
+        uchar *data = byte_arraylist_data(in);
+
+        memmove(data, data + session->in_begin, in->count - session->in_begin);
+        in->count -= session->in_begin;
+        session->in_begin = 0;
+    }
+
+    while (server_reading(session)) {
+        if (!byte_arraylist_reserve(in, 4096)) {
+            server_session_fail(session);
+            return;
+        }
+
+        const ssize_t got = recv(session->fd, byte_arraylist_data(in) + in->count, in->size - in->count, 0);
+
+        if (got > 0) {
+            in->count += (uint)got;
+            session->pending = true;
+        }
+        // the client is done sending, its remaining commands still run (a command waiting for its payload fails)
+        else if (got == 0)
+            session->closing = session->pending = true;
+        else if (errno != EINTR) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                server_session_fail(session);
+            return;
+        }
+    }
+}
+
+// Helper function of cmd_registry_server_run(), sends as much of a session's responses as the socket takes
+void server_flush(cmd_session_t *session) {
+    byte_arraylist_t *out = &session->out;
+
+    while (session->out_begin < out->count) {
+        const ssize_t sent = send(session->fd, byte_arraylist_data(out) + session->out_begin, out->count - session->out_begin, MSG_NOSIGNAL);
+
+        if (sent > 0)
+            session->out_begin += (uint)sent;
+        else if (sent < 0 && errno == EINTR)
+            continue;
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else {
+            server_session_fail(session);
+            return;
+        }
+    }
+    if (session->out_begin == out->count)
+        session->out_begin = out->count = 0;
+}
+
+// Helper function of cmd_registry_server_run()
+// Watches a session's socket for input while it takes some (see server_reading()), and for room while responses are left
+void server_watch(cmd_server_t *server, cmd_session_t *session) {
+    const uint events = (server_reading(session) ? EPOLLIN : 0) | (session->out_begin < session->out.count ? EPOLLOUT : 0);
+
+    if (events != session->events) {
+        struct epoll_event event = { .events = events, .data.ptr = session };
+
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+        session->events = events;
+    }
+}
+
+// Used by server_execute() to read <BLOB> payloads from the client (see cmd_payload_read_t)
+// Only buffered bytes are taken: while the payload isn't all there, the command fails and
+// waits for the rest in need to run again (see server_session_run()), unless the client is done sending
+bool server_read_payload(void *source, void *dst, size_t size) {
+    cmd_session_t *session = source;
+
+    if (size > session->in.count - session->in_begin) {
+        if (!session->closing)
+            session->need = (uint)size;
+        return false;
+    }
+
+    memcpy(dst, byte_arraylist_data(&session->in) + session->in_begin, size);
+    session->in_begin += (uint)size;
+    return true;
+}
+
+// Adds a finished response to the end of a session's queue, where it waits for the deferred responses before it
+void server_response_queue(cmd_session_t *session, bool ok, const void *body, uint size) {
+    cmd_response_t *response = calloc(1, sizeof(cmd_response_t));
+
+    if (!response) {
+        server_session_fail(session);
+        return;
+    }
+    response->out = byte_arraylist_make();
+    response->ok = ok;
+    atomic_init(&response->done, true);
+    server_response_append(session, response);
+    if (!byte_arraylist_append(&response->out, body, size))
+        server_session_fail(session);
+}
+
+// Runs one command line of a session and adds its response to the session's output
+// The response waits in the session's queue if it has to wait for a job or batch, or for earlier such responses
+void server_execute(cmd_registry_t *registry, cmd_session_t *session, char *line) {
+    byte_arraylist_t *out = &session->out;
+    char header[SERVER_HEADER_MAX];
+
+    if (!byte_arraylist_reserve(out, SERVER_HEADER_MAX)) {
+        server_session_fail(session);
+        return;
+    }
+
+    // the output goes after room for the header, which is moved next to it afterwards
+    const uint start = out->count;
+    out->count += SERVER_HEADER_MAX;
+
+    session->deferred = NULL;
+    server_session = server_deferrable = session;
+    const bool ok = cmd_registry_execute_from(registry, line, &server_read_payload, session);
+    server_session = server_deferrable = NULL;
+
+    if (out->count < start + SERVER_HEADER_MAX)
+        return;
+    // the command runs again once its payload is there
+    if (session->need) {
+        out->count = start;
+        return;
+    }
+
+    const uint body = out->count - start - SERVER_HEADER_MAX;
+    uchar *const response = byte_arraylist_data(out) + start;
+
+    session->commands++;
+    if (session->deferred) {
+        // its call's job or batch gives the response
+        out->count = start;
+        return;
+    }
+    if (session->responses) {
+        server_response_queue(session, ok, response + SERVER_HEADER_MAX, body);
+        out->count = start;
+        return;
+    }
+
+    const uint header_len = (uint)snprintf(header, sizeof(header), "%s %u\n", ok ? "OK" : "ERR", body);
+
+    memmove(response + header_len, response + SERVER_HEADER_MAX, body);
+    memcpy(response, header, header_len);
+    out->count = start + header_len + body;
+    if (!ok)
+        session->errors++;
+}
+
+// Helper function of cmd_registry_server_run()
+// Moves the finished responses at the front of a session's queue to its output
+void server_deliver(cmd_session_t *session) {
+    cmd_response_t *response;
+    char header[SERVER_HEADER_MAX];
+
+    while ((response = session->responses) && atomic_load_explicit(&response->done, memory_order_acquire)) {
+        const uint header_len = (uint)snprintf(header, sizeof(header), "%s %u\n", response->ok ? "OK" : "ERR", response->out.count);
+
+        if (!byte_arraylist_append(&session->out, header, header_len)
+            || !byte_arraylist_append(&session->out, byte_arraylist_data(&response->out), response->out.count))
+            server_session_fail(session);
+        if (!response->ok)
+            session->errors++;
+
+        if (!(session->responses = response->next))
+            session->responses_last = NULL;
+        session->response_cnt--;
+        byte_arraylist_destroy(&response->out);
+        free(response);
+    }
+}
+
+// Helper function of cmd_registry_server_run()
+// Runs the complete command lines a session has received, at most SERVER_PIPELINE of them
+void server_session_run(cmd_registry_t *registry, cmd_session_t *session) {
+    session->pending = false;
+
+    for (uint i = 0; !session->closing || session->in_begin < session->in.count; ++i) {
+        char *begin = (char *)byte_arraylist_data(&session->in) + session->in_begin;
+        const uint avail = session->in.count - session->in_begin;
+        char *newline = memchr(begin, '\n', avail);
+        const uint line_begin = session->in_begin;
+
+        if (i == SERVER_PIPELINE || session->out.count - session->out_begin >= SERVER_OUT_LIMIT
+            || session->response_cnt >= SERVER_RESPONSES_MAX) {
+            session->pending = true;
+            return;
+        }
+        // a command waiting for its payload, it fails on what there is once the client is done sending
+        if (avail < session->need && !session->closing)
+            return;
+        session->need = 0;
+        if (!newline && avail >= SERVER_LINE_MAX) {
+            static const char message[] = "[ERROR] Command line too long\n";
+
+            if (session->responses)
+                server_response_queue(session, false, message, (uint)sizeof(message) - 1);
+            else {
+                server_session = session;
+                cmd_printf("ERR %u\n%s", (uint)sizeof(message) - 1, message);
+                server_session = NULL;
+            }
+            session->closing = true;
+            session->in_begin = session->in.count;
+            return;
+        }
+        // a client that is done sending may leave out the last newline
+        if (!newline && !(session->closing && avail))
+            return;
+
+        if (newline)
+            *newline = '\0';
+        else {
+            if (!byte_arraylist_reserve(&session->in, 1)) {
+                server_session_fail(session);
+                return;
+            }
+            begin = (char *)byte_arraylist_data(&session->in) + session->in_begin;
+            begin[avail] = '\0';
+        }
+        session->in_begin += newline ? (uint)(newline - begin) + 1 : avail;
+        server_execute(registry, session, begin);
+
+        if (session->need) {
+            // the payload isn't all there, the line stays to run again with it
+            if (newline)
+                *newline = '\n';
+            session->need += session->in_begin - line_begin;
+            session->in_begin = line_begin;
+            return;
+        }
+    }
+}
+
+// Whether a session has commands left that can run without waiting for the socket
+bool server_session_runnable(const cmd_session_t *session) {
+    return session->pending && session->out.count - session->out_begin < SERVER_OUT_LIMIT
+        && session->response_cnt < SERVER_RESPONSES_MAX;
+}
+
+/*
+* Runs the commands of the server's clients until cmd_server_stop() is called
+* Connections are served on one epoll loop; each client's commands run in the order they
+* were sent and the next ones don't wait for the responses of the previous ones to be read
+* Commands scheduled with cmd_registry_schedule() are run meanwhile
+*
+* registry - the registry to run the commands in
+* server   - the server, from cmd_server_open()
+*/
+void cmd_registry_server_run(cmd_registry_t *registry, cmd_server_t *server) {
+    struct epoll_event events[SERVER_EVENTS];
+
+    while (!atomic_load(&server->stop)) {
+        bool runnable = false;
+
+        for (cmd_session_t *session = server->sessions; session && !runnable; session = session->next)
+            runnable = server_session_runnable(session);
+
+        const int count = epoll_wait(server->epoll_fd, events, SERVER_EVENTS, runnable ? 0 : cmd_registry_next_ms(registry));
+
+        for (int i = 0; i < count; ++i) {
+            void *source = events[i].data.ptr;
+
+            if (source == &server->listen_fd)
+                server_accept(server);
+            else if (source == &server->wake_fd) {
+                ullong value;
+                UNREF(read(server->wake_fd, &value, sizeof(value)));
+            }
+            else {
+                cmd_session_t *session = source;
+
+                if ((events[i].events & EPOLLIN) && !session->closing)
+                    server_read(session);
+                // a hung up socket fails the send, which ends the session
+                if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+                    server_flush(session);
+            }
+        }
+
+        for (cmd_session_t *session = server->sessions, *next; session; session = next) {
+            next = session->next;
+            server_deliver(session);
+            if (server_session_runnable(session))
+                server_session_run(registry, session);
+            server_flush(session);
+            if (session->closing && !session->pending && !session->responses && session->out_begin == session->out.count)
+                server_session_close(server, session);
+            else
+                server_watch(server, session);
+        }
+
+        cmd_registry_batch_poll(registry);
+        cmd_registry_timers_poll(registry);
+    }
+
+    cmd_registry_batch_flush(registry);
+    cmd_registry_shards_wait(registry);
+    for (cmd_session_t *session = server->sessions; session; session = session->next) {
+        server_deliver(session);
+        server_flush(session);
+    }
+}
+
+/*
+* Makes cmd_server_run() return after the commands it is running
+* Can be called from any thread, including from an action
+*
+* server - the server to stop
+*/
+void cmd_server_stop(cmd_server_t *server) {
+    const ullong value = 1;
+
+    atomic_store(&server->stop, true);
+    UNREF(write(server->wake_fd, &value, sizeof(value)));
+}
+
+/*
+* Disconnects all clients, removes the socket file and frees the server
+*
+* server - the server to close
+*/
+void cmd_server_close(cmd_server_t *server) {
+    if (!server)
+        return;
+
+    while (server->sessions)
+        server_session_close(server, server->sessions);
+    if (server->wake_fd >= 0)
+        close(server->wake_fd);
+    if (server->epoll_fd >= 0)
+        close(server->epoll_fd);
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+        unlink(server->path);
+    }
+    free(server->path);
+    free(server);
+}
+
+#else
+
+cmd_server_t *cmd_server_open(const char *path) {
+    INTERACTIVE_ONLY(printf("[ERROR] The command server needs epoll, it can't listen on '%s'\n", path));
+    return NULL;
+}
+
+void cmd_registry_server_run(cmd_registry_t *registry, cmd_server_t *server) {
+    UNREF(registry);
+    UNREF(server);
+}
+
+void cmd_server_stop(cmd_server_t *server) {
+    UNREF(server);
+}
+
+void cmd_server_close(cmd_server_t *server) {
+    UNREF(server);
+}
+
+#endif // __linux__
+
+void cmd_server_run(cmd_server_t *server) {
+    cmd_registry_server_run(cmd_default_registry(), server);
+}
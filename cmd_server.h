@@ -0,0 +1,33 @@
+#pragma once
+#include "cmd_main.h"
+
+// longest command line a client can send
+#define SERVER_LINE_MAX 4096
+// most commands of one session run before the other sessions get their turn
+#define SERVER_PIPELINE 64
+// unsent response bytes after which a session's commands wait for the client to read
+#define SERVER_OUT_LIMIT (1u << 20)
+// unexecuted input bytes after which a session isn't read from (a command waiting for its
+// <BLOB> payload can buffer more)
+#define SERVER_IN_LIMIT (1u << 20)
+// responses waiting for their jobs or batches after which a session's commands wait for them
+#define SERVER_RESPONSES_MAX 1024
+#define SERVER_EVENTS 64
+// room left for the "OK <length>" header line in front of a response
+#define SERVER_HEADER_MAX 24
+
+cmd_session_t *cmd_current_session(void);
+int cmd_printf(const char *format, ...);
+bool cmd_write(const void *data, size_t size);
+void cmd_capture_begin(cmd_capture_t *capture);
+void cmd_capture_end(cmd_capture_t *capture);
+cmd_response_t *cmd_response_take(bool defer);
+cmd_response_t *cmd_response_enter(cmd_response_t *response);
+void cmd_response_leave(cmd_response_t *outer);
+void cmd_response_done(cmd_response_t *response, bool ok);
+
+cmd_server_t *cmd_server_open(const char *path);
+void cmd_registry_server_run(cmd_registry_t *registry, cmd_server_t *server);
+void cmd_server_run(cmd_server_t *server);
+void cmd_server_stop(cmd_server_t *server);
+void cmd_server_close(cmd_server_t *server);
@@ -0,0 +1,429 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cmd_shard.h"
+#include "cmd_cache.h"
+#include "cmd_main.h"
+#include "cmd_server.h"
+#include "arg_types.h"
+
+#pragma warning (disable: 5045)
+
+#define SHARD_QUEUE_INIT_SIZE 64
+// jobs a priority class runs in a row while a lower class is waiting
+#define SHARD_STARVATION_LIMIT 8
+
+// the order priority classes are served in
+const cmd_prio_t shard_prio_order[CMD_PRIO_CNT] = { CMD_PRIO_HIGH, CMD_PRIO_NORMAL, CMD_PRIO_LOW };
+
+// whether the calling thread is an executor thread, those never wait for room in a queue
+thread_local bool shard_is_executor = false;
+
+/*
+* Helper function of shards_push()
+* Adds a job to the end of a queue, the shard lock has to be held
+*
+* queue - the queue
+* job   - the job to be copied into the queue
+*
+* returns - whether the job was queued (the queue couldn't grow otherwise)
+*/
+bool shard_enqueue(cmd_shard_queue_t *queue, const cmd_shard_job_t *job) {
+    if (queue->count == queue->size) {
+        const uint new_size = queue->size ? queue->size * 2 : SHARD_QUEUE_INIT_SIZE;
+        cmd_shard_job_t *jobs = malloc(new_size * sizeof(cmd_shard_job_t));
+
+        if (!jobs)
+            return false;
+        // unwrap the ring while copying it
+        for (uint i = 0; i < queue->count; ++i)
+            jobs[i] = queue->jobs[(queue->head + i) % queue->size];
+        free(queue->jobs);
+        queue->jobs = jobs;
+        queue->size = new_size;
+        queue->head = 0;
+    }
+
+    queue->jobs[(queue->head + queue->count) % queue->size] = *job;
+    queue->count++;
+    return true;
+}
+
+/*
+* Helper function of shard_thread()
+* Picks the priority class whose job runs next, the shard lock has to be held
+* The highest waiting class goes first, but after SHARD_STARVATION_LIMIT jobs in a row
+* while a lower class waits, the next lower waiting class gets one turn
+*
+* shard - the shard, with at least one queued job
+*
+* returns - the class to take a job of
+*/
+cmd_prio_t shard_pick(cmd_shard_t *shard) {
+    cmd_prio_t ret = CMD_PRIO_NORMAL;
+
+    for (uint i = 0; i < CMD_PRIO_CNT; ++i) {
+        const cmd_prio_t prio = shard_prio_order[i];
+        bool lower_waiting = false;
+
+        if (shard->queues[prio].count == 0)
+            continue;
+        for (uint j = i + 1; j < CMD_PRIO_CNT && !lower_waiting; ++j)
+            lower_waiting = shard->queues[shard_prio_order[j]].count > 0;
+
+        ret = prio;
+        if (!lower_waiting) {
+            shard->passed[prio] = 0;
+            break;
+        }
+        if (shard->passed[prio] < SHARD_STARVATION_LIMIT) {
+            shard->passed[prio]++;
+            break;
+        }
+        shard->passed[prio] = 0;
+    }
+
+    return ret;
+}
+
+// Runs a job, with its output going to its response, and frees what it owns
+void shard_job_run(cmd_shard_job_t *job) {
+    cmd_response_t *outer = cmd_response_enter(job->response);
+
+    cmd_parsed_run(&job->parsed);
+    cmd_response_leave(outer);
+    cmd_response_done(job->response, true);
+
+    if (job->owner)
+        cmd_cache_release(job->owner);
+    else if (job->owned)
+        cmd_parsed_destroy(&job->parsed);
+}
+
+// Frees what a shed job owns without running it, its response is an error
+void shard_job_drop(cmd_shard_job_t *job) {
+    if (job->response) {
+        cmd_response_t *outer = cmd_response_enter(job->response);
+
+        INTERACTIVE_ONLY(cmd_printf("[ERROR] The queue of the call is full, the call is dropped\n"));
+        cmd_response_leave(outer);
+        cmd_response_done(job->response, false);
+    }
+    if (job->owner)
+        cmd_cache_release(job->owner);
+    else if (job->owned)
+        cmd_parsed_destroy(&job->parsed);
+}
+
+/*
+* Executor thread of a shard
+* Runs the shard's jobs one after another, by priority class (see shard_pick()),
+* until it is stopped and its queues are empty
+*
+* arg - pointer to the shard
+*/
+int shard_thread(void *arg) {
+    cmd_shard_t *shard = arg;
+    cmd_shard_job_t job;
+
+    shard_is_executor = true;
+    mtx_lock(&shard->lock);
+    while (true) {
+        while ((shard->count == 0 && !shard->stop) || shard->busy)
+            cnd_wait(&shard->ready, &shard->lock);
+        if (shard->count == 0)
+            break;
+
+        const cmd_prio_t prio = shard_pick(shard);
+        cmd_shard_queue_t *queue = &shard->queues[prio];
+
+        job = queue->jobs[queue->head];
+        queue->head = (queue->head + 1) % queue->size;
+        queue->count--;
+        shard->count--;
+        shard->stats.classes[prio].run++;
+        shard->busy = true;
+        cnd_broadcast(&shard->room);
+        mtx_unlock(&shard->lock);
+
+        shard_job_run(&job);
+
+        mtx_lock(&shard->lock);
+        shard->busy = false;
+        if (shard->count == 0)
+            cnd_broadcast(&shard->idle);
+    }
+    mtx_unlock(&shard->lock);
+
+    return 0;
+}
+
+/*
+* Starts count executor threads, each with its own queue
+*
+* shards - pointer to an unstarted (zeroed) executor
+* count  - number of shards, usually the number of cores
+*
+* returns - whether all shards were started (none are left running otherwise)
+*/
+bool shards_start(cmd_shards_t *shards, uint count) {
+    if (shards->count > 0 || count == 0)
+        return false;
+    if (!(shards->shards = calloc(count, sizeof(cmd_shard_t))))
+        return false;
+
+    for (uint i = 0; i < count; ++i) {
+        cmd_shard_t *shard = &shards->shards[i];
+
+        if (mtx_init(&shard->lock, mtx_plain) != thrd_success
+            || cnd_init(&shard->ready) != thrd_success
+            || cnd_init(&shard->idle) != thrd_success
+            || cnd_init(&shard->room) != thrd_success
+            || thrd_create(&shard->thread, &shard_thread, shard) != thrd_success) {
+            // the started threads stop right away as their queues are empty
+            shards->count = i;
+            shards_stop(shards);
+            return false;
+        }
+    }
+
+    shards->count = count;
+    return true;
+}
+
+/*
+* Picks the per-shard static data instance of an invocation of a sharded command
+* Invocations with equal routing keys always get the same instance
+* String and blob keys are hashed by content, list keys by their elements
+*
+* parsed - the invocation
+*
+* returns - index into parsed->shard.data
+*/
+uint shards_route(const cmd_parsed_t *parsed) {
+    const cmd_shard_proc_t *proc = &parsed->shard;
+    const arg_bundle_t *args = &parsed->args;
+    const uchar *value = byte_arraylist_data(&args->data) + (size_t)arraylist_data(&args->args)[proc->key_arg];
+    ullong h;
+
+    // bundle values aren't aligned, so pointers are copied out
+    if (proc->key_kind == ARG_STRING) {
+        const char *str;
+        memcpy(&str, value, sizeof(str));
+        h = hash_bytes(str, (uint)strlen(str));
+    }
+    else if (arg_kind_is_list(proc->key_kind)) {
+        arg_list_t list;
+        memcpy(&list, value, sizeof(list));
+        h = hash_bytes(list.data, list.count * proc->key_size);
+    }
+    else if (proc->key_kind == ARG_BLOB) {
+        arg_blob_t blob;
+        memcpy(&blob, value, sizeof(blob));
+        h = hash_bytes(blob.data, (uint)blob.size);
+    }
+    else
+        h = hash_bytes(value, proc->key_size);
+
+    return (uint)(h % proc->data_cnt);
+}
+
+/*
+* Queues an invocation of a sharded command on the shard owning its routing key
+* The action is then called on that shard's thread with the shard's static data
+* Runs the invocation right away if the executor isn't started, is being stopped
+* or its queue can't grow
+* If the queue of the command's priority class is at its limit, the calling thread waits
+* for room or the invocation is dropped, see shards_set_limit()
+*
+* shards   - the executor
+* parsed   - the invocation
+* owner    - cache entry parsed belongs to (can be NULL), the job takes over the caller's reference
+* take     - if owner is NULL: whether the job takes over parsed (the caller has to keep
+*            it alive until shards_wait() otherwise)
+* response - response of the invocation, completed when it has run (can be NULL)
+*/
+void shards_push(cmd_shards_t *shards, const cmd_parsed_t *parsed, cmd_cache_entry_t *owner, bool take, cmd_response_t *response) {
+    const uint index = shards_route(parsed);
+    cmd_shard_job_t job = { .parsed = *parsed, .owner = owner, .response = response, .owned = take && !owner };
+
+    job.parsed.proc.static_data = parsed->shard.data[index];
+    if (shards->count == 0) {
+        shard_job_run(&job);
+        return;
+    }
+
+    cmd_shard_t *shard = &shards->shards[index % shards->count];
+    const cmd_prio_t prio = job.parsed.proc.prio < CMD_PRIO_CNT ? job.parsed.proc.prio : CMD_PRIO_NORMAL;
+    cmd_shard_queue_t *queue = &shard->queues[prio];
+    cmd_queue_class_stats_t *stats = &shard->stats.classes[prio];
+
+    mtx_lock(&shard->lock);
+
+    const uint limit = shards->limits[prio];
+
+    if (limit && queue->count >= limit) {
+        if (shards->policies[prio] == QUEUE_SHED) {
+            stats->shed++;
+            mtx_unlock(&shard->lock);
+            shard_job_drop(&job);
+            return;
+        }
+        // an executor waiting for room could be waiting for itself
+        if (!shard_is_executor) {
+            stats->blocked++;
+            while (queue->count >= limit && !shard->stop)
+                cnd_wait(&shard->room, &shard->lock);
+        }
+    }
+
+    stats->queued++;
+    // a stopped shard's thread may already be gone, so nothing is queued on it anymore
+    if (shard->stop || !shard_enqueue(queue, &job)) {
+        // run it here once the shard is idle to keep it serialized (also when out of memory)
+        while (shard->count > 0 || shard->busy)
+            cnd_wait(&shard->idle, &shard->lock);
+        shard->busy = true;
+        mtx_unlock(&shard->lock);
+
+        shard_job_run(&job);
+
+        mtx_lock(&shard->lock);
+        shard->busy = false;
+        cnd_broadcast(&shard->idle);
+    }
+    else
+        shard->count++;
+    cnd_signal(&shard->ready);
+    mtx_unlock(&shard->lock);
+}
+
+/*
+* Waits until all queued invocations have been run
+*
+* shards - the executor
+*/
+void shards_wait(cmd_shards_t *shards) {
+    for (uint i = 0; i < shards->count; ++i) {
+        cmd_shard_t *shard = &shards->shards[i];
+
+        mtx_lock(&shard->lock);
+        while (shard->count > 0 || shard->busy)
+            cnd_wait(&shard->idle, &shard->lock);
+        mtx_unlock(&shard->lock);
+    }
+}
+
+/*
+* Runs all queued invocations, then stops and frees the executor threads
+* All shards are stopped before the first one is joined, so invocations pushed
+* meanwhile are run by the pushing thread instead of being queued on a finished shard
+* Must not run concurrently with shards_push(), the registry ensures that with its lock
+*
+* shards - the executor
+*/
+void shards_stop(cmd_shards_t *shards) {
+    for (uint i = 0; i < shards->count; ++i) {
+        cmd_shard_t *shard = &shards->shards[i];
+
+        mtx_lock(&shard->lock);
+        shard->stop = true;
+        cnd_signal(&shard->ready);
+        cnd_broadcast(&shard->room);
+        mtx_unlock(&shard->lock);
+    }
+    for (uint i = 0; i < shards->count; ++i)
+        thrd_join(shards->shards[i].thread, NULL);
+
+    for (uint i = 0; i < shards->count; ++i) {
+        cmd_shard_t *shard = &shards->shards[i];
+
+        mtx_destroy(&shard->lock);
+        cnd_destroy(&shard->ready);
+        cnd_destroy(&shard->idle);
+        cnd_destroy(&shard->room);
+        for (uint prio = 0; prio < CMD_PRIO_CNT; ++prio)
+            free(shard->queues[prio].jobs);
+    }
+
+    // the queue limits outlive the threads
+    free(shards->shards);
+    shards->shards = NULL;
+    shards->count = 0;
+}
+
+/*
+* Limits the number of queued calls of a priority class on each shard
+*
+* shards - the executor
+* prio   - the priority class
+* limit  - most queued calls per shard, 0 for no limit
+* policy - what happens to calls beyond the limit
+*/
+void shards_set_limit(cmd_shards_t *shards, cmd_prio_t prio, uint limit, cmd_queue_policy_t policy) {
+    // the limits are read under the shard locks
+    for (uint i = 0; i < shards->count; ++i)
+        mtx_lock(&shards->shards[i].lock);
+    shards->limits[prio] = limit;
+    shards->policies[prio] = policy;
+    for (uint i = 0; i < shards->count; ++i) {
+        cnd_broadcast(&shards->shards[i].room);
+        mtx_unlock(&shards->shards[i].lock);
+    }
+}
+
+// Sums up the queue counters of all shards
+cmd_queue_stats_t shards_stats(cmd_shards_t *shards) {
+    cmd_queue_stats_t ret = { 0 };
+
+    for (uint i = 0; i < shards->count; ++i) {
+        cmd_shard_t *shard = &shards->shards[i];
+
+        mtx_lock(&shard->lock);
+        for (uint prio = 0; prio < CMD_PRIO_CNT; ++prio) {
+            const cmd_queue_class_stats_t *src = &shard->stats.classes[prio];
+            cmd_queue_class_stats_t *dst = &ret.classes[prio];
+
+            dst->queued += src->queued;
+            dst->run += src->run;
+            dst->shed += src->shed;
+            dst->blocked += src->blocked;
+            dst->depth += shard->queues[prio].count;
+        }
+        mtx_unlock(&shard->lock);
+    }
+
+    return ret;
+}
+
+/*
+* Makes one static data instance per shard for a sharded command
+*
+* proc        - the command's routing info, its data array is filled
+* count       - number of instances
+* init        - called once per instance with the shard's index and static_data
+*               (if NULL, every shard gets static_data itself)
+* static_data - the command's static data
+*
+* returns - whether the array was allocated
+*/
+bool shard_data_make(cmd_shard_proc_t *proc, uint count, cmd_shard_init_t init, void *static_data) {
+    if (!(proc->data = malloc(count * sizeof(void *))))
+        return false;
+
+    for (uint i = 0; i < count; ++i)
+        proc->data[i] = init ? (*init)(i, static_data) : static_data;
+    proc->data_cnt = count;
+    return true;
+}
+
+// Frees the per-shard static data of a command
+void shard_data_destroy(cmd_shard_proc_t *proc) {
+    if (!proc->data)
+        return;
+
+    for (uint i = 0; proc->free_data && i < proc->data_cnt; ++i)
+        (*proc->free_data)(proc->data[i]);
+    free(proc->data);
+    proc->data = NULL;
+    proc->data_cnt = 0;
+}
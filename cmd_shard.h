@@ -0,0 +1,12 @@
+#pragma once
+#include "struct_funcs.h"
+
+bool shards_start(cmd_shards_t *shards, uint count);
+uint shards_route(const cmd_parsed_t *parsed);
+void shards_push(cmd_shards_t *shards, const cmd_parsed_t *parsed, cmd_cache_entry_t *owner, bool take, cmd_response_t *response);
+void shards_wait(cmd_shards_t *shards);
+void shards_stop(cmd_shards_t *shards);
+void shards_set_limit(cmd_shards_t *shards, cmd_prio_t prio, uint limit, cmd_queue_policy_t policy);
+cmd_queue_stats_t shards_stats(cmd_shards_t *shards);
+bool shard_data_make(cmd_shard_proc_t *proc, uint count, cmd_shard_init_t init, void *static_data);
+void shard_data_destroy(cmd_shard_proc_t *proc);
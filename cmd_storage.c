@@ -2,37 +2,53 @@
 #include <stdio.h>
 #include <string.h>
 #include "cmd_storage.h"
+#include "arg_types.h"
+#include "cmd_shard.h"
+#include "cmd_journal.h"
 
 #pragma warning (disable: 5045)
 
+// the next command id, ids are never reused (0 means no command)
+atomic_uint cmd_next_id = 1;
+
 /*
 * Provides size and format for sscanf() for a given argument type
 * 
-* key - argument type, such as <INT> or <STRING>
+* key - argument type, such as <INT>, <STRING> or <INT...>
 * 
 * returns - pointer to a struct containing the argument's format and size
 */
 const arg_node_t *size_node_get(const char *key) {
     static const arg_node_t nodes[] = {
-        { "<SUBCMD>",  ">",      0              },
-     // { "<VOID>",    "$null",  0              },
-        { "<CHAR>",    "%c",     sizeof(char)   },
-        { "<UCHAR>",   "%hhu",   sizeof(uchar)  },
-        { "<BYTE>",    "%hhd",   sizeof(char)   },
-        { "<UBYTE>",   "%hhu",   sizeof(uchar)  },
-        { "<SHORT>",   "%hd",    sizeof(short)  },
-        { "<USHORT>",  "%hu",    sizeof(ushort) },
-        { "<INT>",     "%d",     sizeof(int)    },
-        { "<UINT>",    "%u",     sizeof(uint)   },
-        { "<LONG>",    "%ld",    sizeof(long)   },
-        { "<ULONG>",   "%lu",    sizeof(ulong)  },
-        { "<LLONG>",   "%lld",   sizeof(llong)  },
-        { "<ULLONG>",  "%llu",   sizeof(ullong) },
-        { "<STRING>",  "%511s",  sizeof(char *) },
-        { "<PTR>",     "%p",     sizeof(void *) },
-     // { "<CMD>",     "$cmd",   sizeof(void *) },
+        { .key = "<SUBCMD>",    .format = ">",     .size = 0,                  .kind = ARG_SCANF },
+     // { .key = "<VOID>",      .format = "$null", .size = 0 },
+        { .key = "<CHAR>",      .format = "%c",    .size = sizeof(char),       .kind = ARG_SCANF },
+        { .key = "<UCHAR>",     .format = "%hhu",  .size = sizeof(uchar),      .kind = ARG_SCANF },
+        { .key = "<BYTE>",      .format = "%hhd",  .size = sizeof(char),       .kind = ARG_SCANF },
+        { .key = "<UBYTE>",     .format = "%hhu",  .size = sizeof(uchar),      .kind = ARG_SCANF },
+        { .key = "<SHORT>",     .format = "%hd",   .size = sizeof(short),      .kind = ARG_SCANF },
+        { .key = "<USHORT>",    .format = "%hu",   .size = sizeof(ushort),     .kind = ARG_SCANF },
+        { .key = "<INT>",       .format = "%d",    .size = sizeof(int),        .kind = ARG_SCANF },
+        { .key = "<UINT>",      .format = "%u",    .size = sizeof(uint),       .kind = ARG_SCANF },
+        { .key = "<LONG>",      .format = "%ld",   .size = sizeof(long),       .kind = ARG_SCANF },
+        { .key = "<ULONG>",     .format = "%lu",   .size = sizeof(ulong),      .kind = ARG_SCANF },
+        { .key = "<LLONG>",     .format = "%lld",  .size = sizeof(llong),      .kind = ARG_SCANF },
+        { .key = "<ULLONG>",    .format = "%llu",  .size = sizeof(ullong),     .kind = ARG_SCANF },
+        { .key = "<FLOAT>",     .format = "%f",    .size = sizeof(float),      .kind = ARG_FLOAT },
+        { .key = "<DOUBLE>",    .format = "%lf",   .size = sizeof(double),     .kind = ARG_DOUBLE },
+        { .key = "<STRING>",    .format = "%511s", .size = sizeof(char *),     .kind = ARG_STRING },
+        { .key = "<MATCH>",     .format = "%511s", .size = sizeof(char *),     .kind = ARG_STRING },
+        { .key = "<GLOB>",      .format = "%511s", .size = sizeof(char *),     .kind = ARG_STRING },
+        { .key = "<PTR>",       .format = "%p",    .size = sizeof(void *),     .kind = ARG_SCANF },
+        { .key = "<ENUM>",      .format = "$enum", .size = sizeof(uint),       .kind = ARG_ENUM },
+        { .key = "<INT...>",    .format = "%d",    .size = sizeof(arg_list_t), .kind = ARG_INT_LIST,  .elem_size = sizeof(int) },
+        { .key = "<UINT...>",   .format = "%u",    .size = sizeof(arg_list_t), .kind = ARG_UINT_LIST, .elem_size = sizeof(uint) },
+        { .key = "<LLONG...>",  .format = "%lld",  .size = sizeof(arg_list_t), .kind = ARG_INT_LIST,  .elem_size = sizeof(llong) },
+        { .key = "<ULLONG...>", .format = "%llu",  .size = sizeof(arg_list_t), .kind = ARG_UINT_LIST, .elem_size = sizeof(ullong) },
+        { .key = "<BLOB>",      .format = "$blob", .size = sizeof(arg_blob_t), .kind = ARG_BLOB },
+     // { .key = "<CMD>",       .format = "$cmd",  .size = sizeof(void *) },
     };
-    static const arg_node_t err = { "<ERROR>", "$unknown", 0 };
+    static const arg_node_t err = { .key = "<ERROR>", .format = "$unknown", .size = 0 };
 
 
 
@@ -52,6 +68,90 @@ const arg_node_t *size_node_get(const char *key) {
     return &err;
 }
 
+/*
+* Provides the syntax node for an argument type of a command string
+* Plain types come from size_node_get(), parameterized ones such as
+* <ENUM a|b|c>, bounded ones such as <INT 0..100> and patterns such as <MATCH /[a-z]+/>
+* get a heap-allocated node of their own
+*
+* key - argument type, such as <INT>, <ENUM on|off>, <STRING max=64> or <GLOB *.txt>
+*
+* returns - pointer to the node (NULL if the type's parameters are invalid)
+*/
+arg_node_t *arg_node_make(const char *key) {
+    const char *params = strchr(key, ' ');
+
+    if (key[0] != '<' || params == NULL) {
+        const arg_node_t *node = size_node_get(key);
+        // types that can't work without parameters
+        return node->kind == ARG_ENUM || str_eq(key, "<MATCH>") || str_eq(key, "<GLOB>") ? NULL : (arg_node_t *)node;
+    }
+
+    if (key[strlen(key) - 1] != '>')
+        return NULL;
+
+    // "<ENUM a|b>" -> "<ENUM>" and "a|b"
+    char base_key[32];
+    char *param_str = _strdup(params + 1);
+    arg_node_t *ret = malloc(sizeof(arg_node_t));
+
+    if (!param_str || !ret) {
+        free(param_str);
+        free(ret);
+        return NULL;
+    }
+
+    snprintf(base_key, sizeof(base_key), "%.*s>", (int)(params - key), key);
+    param_str[strlen(param_str) - 1] = '\0';
+
+    *ret = *size_node_get(base_key);
+    ret->key = _strdup(key);
+    ret->extra = NULL;
+    ret->constraint = NULL;
+    ret->is_dynamic_memory = true;
+
+    switch (ret->kind) {
+    case ARG_ENUM:
+        ret->extra = arg_enum_make(param_str);
+        break;
+    default:
+        // the parameters of other types are bounds or patterns of their values
+        ret->constraint = arg_constraint_make(size_node_get(base_key), param_str);
+        break;
+    }
+
+    free(param_str);
+    if (ret->extra == NULL && ret->constraint == NULL) {
+        arg_node_destroy(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+/*
+* Frees a node created by arg_node_make()
+* Nodes of plain types are shared and left alone
+*
+* node - pointer to the node to be deleted
+*/
+void arg_node_destroy(arg_node_t *node) {
+    if (!node || !node->is_dynamic_memory)
+        return;
+
+    switch (node->kind) {
+    case ARG_ENUM:
+        arg_enum_destroy((arg_enum_t *)node->extra);
+        break;
+    default:
+        break;
+    }
+
+    arg_constraint_destroy(node->constraint);
+    free((char *)node->key);
+    free(node);
+}
+
 /*
 * Creates a heap-allocated command struct
 *
@@ -80,7 +180,9 @@ command_t *cmd_alloc(const tokenized_str_t *str, cmd_proc_t proc, uint str_index
 */
 void cmd_syntax_parse(const tokenized_str_t *str, command_t *cmd, uint str_index) {
     for (uint i = 0; i < cmd->arg_cnt; ++i) {
-        cmd->syntax[i] = (arg_node_t *)size_node_get(tok_str_get(str, str_index));
+        // cmd_register() has checked the syntax before, so this only fails without memory
+        if ((cmd->syntax[i] = arg_node_make(tok_str_get(str, str_index))) == NULL)
+            cmd->syntax[i] = (arg_node_t *)size_node_get("<ERROR>");
         if (cmd->syntax[i]->format[0] == '>') {
             cmd_proc_t action = cmd->action;
 
@@ -108,6 +210,7 @@ command_t cmd_make(const tokenized_str_t *str, cmd_proc_t proc, uint str_index)
         return ret;
 
     ret.name = _strdup(tok_str_get(str, str_index));
+    ret.id = atomic_fetch_add(&cmd_next_id, 1);
 
     while (str_index + ret.arg_cnt + 1 < str->parts.count) {
         char *token = tok_str_get(str, str_index + ++ret.arg_cnt);
@@ -141,8 +244,13 @@ void cmd_destroy(command_t *cmd) {
         return;
     if (cmd->name)
         free(cmd->name);
-    if (cmd->syntax)
+    if (cmd->syntax) {
+        for (uint i = 0; i < cmd->arg_cnt; ++i)
+            arg_node_destroy(cmd->syntax[i]);
         free(cmd->syntax);
+    }
+    shard_data_destroy(&cmd->shard);
+    frame_layout_destroy(&cmd->memo_layout);
     arraylist_destroy(&cmd->subcommands);
     if (cmd->is_dynamic_memory)
         free(cmd);
@@ -212,6 +320,7 @@ command_t cmd_make_(const char *str, cmd_proc_t proc) {
     }
 
     ret.name = _strdup(str);
+    ret.id = atomic_fetch_add(&cmd_next_id, 1);
     ret.syntax = ret.arg_cnt ? malloc(ret.arg_cnt * sizeof(arg_node_t *)) : NULL;
     ret.action = proc;
     ret.subcommands = arraylist_make(&cmd_destroy);
@@ -1,6 +1,10 @@
 #pragma once
 #include "cmd_main.h"
 
+const arg_node_t *size_node_get(const char *key);
+arg_node_t *arg_node_make(const char *key);
+void arg_node_destroy(arg_node_t *node);
+
 command_t *cmd_alloc_(const char *input, cmd_proc_t proc);
 command_t cmd_make_(const char *str, cmd_proc_t proc);
 void cmd_destroy(command_t *cmd);
@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cmd_timer.h"
+#include "cmd_cache.h"
+#include "sync_funcs.h"
+
+#pragma warning (disable: 5045)
+
+/*
+* Initializes an empty timer wheel
+* A timer is kept on the lowest level whose range covers its delay and moved down
+* a level ("cascaded") when the wheel reaches its slot, so adding, cancelling
+* and firing a timer take constant time however many timers are pending
+*
+* wheel - pointer to the wheel to initialize
+*
+* returns - whether the wheel was successfully initialized
+*/
+bool timers_init(cmd_timer_wheel_t *wheel) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->free_head = TIMER_NONE;
+    wheel->start_ns = time_now_ns();
+    if (!(wheel->slots = malloc(TIMER_LEVELS * TIMER_SLOTS * sizeof(uint))))
+        return false;
+    memset(wheel->slots, 0xFF, TIMER_LEVELS * TIMER_SLOTS * sizeof(uint));
+
+    if (mtx_init(&wheel->lock, mtx_plain) != thrd_success) {
+        free(wheel->slots);
+        wheel->slots = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+// Returns the current time in wheel ticks
+ullong timers_tick(const cmd_timer_wheel_t *wheel) {
+    return (time_now_ns() - wheel->start_ns) / 1000000;
+}
+
+/*
+* Helper function of timers_add() and timers_advance()
+* Links a timer into the slot its due time falls into, the wheel lock has to be held
+* The due time has to be after the wheel's current tick
+*
+* wheel - the wheel
+* index - index of the timer
+*/
+void timers_link(cmd_timer_wheel_t *wheel, uint index) {
+    cmd_timer_t *timer = &wheel->timers[index];
+    const ullong delta = timer->due - wheel->now;
+    uint level = 0;
+
+    // timers beyond the top level's range wait there for another revolution
+    while (level + 1 < TIMER_LEVELS && delta >= 1ULL << (TIMER_SLOT_BITS * (level + 1)))
+        ++level;
+
+    const uint slot = (uint)(timer->due >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+    uint *head = &wheel->slots[level * TIMER_SLOTS + slot];
+
+    if (*head == TIMER_NONE) {
+        timer->next = timer->prev = index;
+        *head = index;
+    }
+    else {
+        // append, so timers due at the same tick fire in the order they were added
+        const uint tail = wheel->timers[*head].prev;
+
+        timer->next = *head;
+        timer->prev = tail;
+        wheel->timers[tail].next = index;
+        wheel->timers[*head].prev = index;
+    }
+    timer->level = (ushort)level;
+    timer->slot = (ushort)slot;
+    wheel->level_count[level]++;
+}
+
+// Helper function of timers_cancel()
+// Removes a timer from its slot, the wheel lock has to be held
+void timers_unlink(cmd_timer_wheel_t *wheel, uint index) {
+    cmd_timer_t *timer = &wheel->timers[index];
+    uint *head = &wheel->slots[timer->level * TIMER_SLOTS + timer->slot];
+
+    if (timer->next == index)
+        *head = TIMER_NONE;
+    else {
+        wheel->timers[timer->prev].next = timer->next;
+        wheel->timers[timer->next].prev = timer->prev;
+        if (*head == index)
+            *head = timer->next;
+    }
+    wheel->level_count[timer->level]--;
+}
+
+// Puts an unlinked timer on the free list, invalidating its id; the wheel lock has to be held
+void timers_free(cmd_timer_wheel_t *wheel, uint index) {
+    cmd_timer_t *timer = &wheel->timers[index];
+
+    timer->entry = NULL;
+    if (++timer->generation == 0)
+        timer->generation = 1;
+    timer->next = wheel->free_head;
+    wheel->free_head = index;
+    wheel->count--;
+}
+
+/*
+* Schedules a parsed command
+*
+* wheel     - the wheel
+* entry     - the parsed command, the wheel takes over one reference on success
+* delay_ms  - time until the timer fires
+* period_ms - time between firings, 0 to fire once
+*
+* returns - id of the timer, never 0 (0 if out of memory)
+*/
+ullong timers_add(cmd_timer_wheel_t *wheel, cmd_cache_entry_t *entry, uint delay_ms, uint period_ms) {
+    mtx_lock(&wheel->lock);
+    if (wheel->free_head == TIMER_NONE) {
+        const uint new_size = wheel->size ? 2 * wheel->size : TIMER_INIT_SIZE;
+        cmd_timer_t *new_timers = realloc(wheel->timers, new_size * sizeof(cmd_timer_t));
+
+        if (!new_timers) {
+            mtx_unlock(&wheel->lock);
+            return 0;
+        }
+        for (uint i = wheel->size; i < new_size; ++i) {
+            new_timers[i].entry = NULL;
+            new_timers[i].generation = 1;
+            new_timers[i].next = i + 1 < new_size ? i + 1 : TIMER_NONE;
+        }
+        wheel->free_head = wheel->size;
+        wheel->timers = new_timers;
+        wheel->size = new_size;
+    }
+
+    const uint index = wheel->free_head;
+    cmd_timer_t *timer = &wheel->timers[index];
+    // the wheel lags behind the clock when it isn't advanced often
+    const ullong due = timers_tick(wheel) + delay_ms;
+
+    wheel->free_head = timer->next;
+    wheel->count++;
+    timer->entry = entry;
+    timer->period = period_ms;
+    timer->due = max(due, wheel->now + 1);
+    timers_link(wheel, index);
+
+    const ullong id = (ullong)timer->generation << 32 | index;
+    mtx_unlock(&wheel->lock);
+
+    return id;
+}
+
+// Returns the live timer with an id, the wheel lock has to be held (NULL if there is none)
+cmd_timer_t *timers_find(cmd_timer_wheel_t *wheel, ullong id) {
+    const uint index = (uint)id;
+
+    if (index >= wheel->size || wheel->timers[index].entry == NULL || wheel->timers[index].generation != (uint)(id >> 32))
+        return NULL;
+
+    return &wheel->timers[index];
+}
+
+/*
+* Removes a timer before it fires (again)
+*
+* wheel - the wheel
+* id    - id returned by timers_add()
+*
+* returns - whether the timer was pending
+*/
+bool timers_cancel(cmd_timer_wheel_t *wheel, ullong id) {
+    cmd_cache_entry_t *entry = NULL;
+
+    mtx_lock(&wheel->lock);
+    if (timers_find(wheel, id)) {
+        entry = wheel->timers[(uint)id].entry;
+        timers_unlink(wheel, (uint)id);
+        timers_free(wheel, (uint)id);
+    }
+    mtx_unlock(&wheel->lock);
+    cmd_cache_release(entry);
+
+    return entry != NULL;
+}
+
+/*
+* Replaces the parsed command of a timer, used when the command tree has changed since it was parsed
+*
+* wheel - the wheel
+* id    - id of the timer
+* entry - the new parsed command, one of its references is taken over
+*         (and dropped right away if the timer isn't pending anymore)
+*/
+void timers_swap_entry(cmd_timer_wheel_t *wheel, ullong id, cmd_cache_entry_t *entry) {
+    cmd_timer_t *timer;
+
+    mtx_lock(&wheel->lock);
+    if ((timer = timers_find(wheel, id)) != NULL) {
+        cmd_cache_entry_t *old = timer->entry;
+
+        timer->entry = entry;
+        entry = old;
+    }
+    mtx_unlock(&wheel->lock);
+    cmd_cache_release(entry);
+}
+
+// Helper function of timers_advance()
+// Moves all timers of a slot of a higher level down to where they belong now
+void timers_cascade(cmd_timer_wheel_t *wheel, uint level, uint slot) {
+    const uint head = wheel->slots[level * TIMER_SLOTS + slot];
+    uint index = head;
+
+    if (head == TIMER_NONE)
+        return;
+
+    wheel->slots[level * TIMER_SLOTS + slot] = TIMER_NONE;
+    do {
+        const uint next = wheel->timers[index].next;
+
+        wheel->level_count[level]--;
+        timers_link(wheel, index);
+        index = next;
+    } while (index != head);
+}
+
+/*
+* Advances a wheel to the current time and takes out the timers that became due
+* Periodic timers are scheduled again, missed periods are skipped rather than fired in a burst
+*
+* wheel - the wheel
+* count - pointer to where the number of due timers is to be stored
+*
+* returns - array of the due timers in the order they are to be run, each holding a reference
+*           to its parsed command (NULL if there are none), free it with free()
+*/
+cmd_timer_fired_t *timers_advance(cmd_timer_wheel_t *wheel, uint *count) {
+    cmd_timer_fired_t *fired = NULL;
+    uint fired_size = 0;
+
+    *count = 0;
+    mtx_lock(&wheel->lock);
+
+    const ullong target = timers_tick(wheel);
+
+    while (wheel->now < target) {
+        uint level = 0;
+
+        if (wheel->count == 0) {
+            wheel->now = target;
+            break;
+        }
+
+        // nothing can fire or cascade before the next boundary of the lowest non-empty level
+        while (level + 1 < TIMER_LEVELS && wheel->level_count[level] == 0)
+            ++level;
+        if (level > 0) {
+            const ullong skip_to = wheel->now | ((1ULL << (TIMER_SLOT_BITS * level)) - 1);
+
+            if (skip_to >= target) {
+                wheel->now = target;
+                break;
+            }
+            wheel->now = skip_to;
+        }
+
+        const ullong now = ++wheel->now;
+
+        for (uint i = 1; i < TIMER_LEVELS && (now & ((1ULL << (TIMER_SLOT_BITS * i)) - 1)) == 0; ++i)
+            timers_cascade(wheel, i, (uint)(now >> (TIMER_SLOT_BITS * i)) & (TIMER_SLOTS - 1));
+
+        const uint head = wheel->slots[now & (TIMER_SLOTS - 1)];
+        uint index = head;
+
+        if (head == TIMER_NONE)
+            continue;
+
+        wheel->slots[now & (TIMER_SLOTS - 1)] = TIMER_NONE;
+        do {
+            cmd_timer_t *timer = &wheel->timers[index];
+            const uint next = timer->next;
+
+            wheel->level_count[0]--;
+            if (*count == fired_size) {
+                const uint new_size = fired_size ? 2 * fired_size : CONTAINER_INIT_SIZE;
+                cmd_timer_fired_t *new_fired = realloc(fired, new_size * sizeof(cmd_timer_fired_t));
+
+                if (new_fired) {
+                    fired = new_fired;
+                    fired_size = new_size;
+                }
+            }
+
+            if (*count < fired_size) {
+                fired[*count].id = (ullong)timer->generation << 32 | index;
+                fired[*count].entry = timer->entry;
+                if (timer->period > 0)
+                    atomic_fetch_add(&timer->entry->refs, 1);
+                ++*count;
+            }
+            // out of memory, this firing is lost
+            else if (timer->period == 0)
+                cmd_cache_release(timer->entry);
+
+            if (timer->period > 0) {
+                timer->due += timer->period;
+                if (timer->due <= target)
+                    timer->due += ((target - timer->due) / timer->period + 1) * timer->period;
+                timers_link(wheel, index);
+            }
+            else
+                timers_free(wheel, index);
+            index = next;
+        } while (index != head);
+    }
+
+    mtx_unlock(&wheel->lock);
+    return fired;
+}
+
+/*
+* Returns how long the caller can wait before a timer might become due
+* Exact for timers on the lowest level, timers above it are waited for until their next cascade
+*
+* wheel - the wheel
+*
+* returns - time in ms, -1 if there are no timers
+*/
+int timers_next_ms(cmd_timer_wheel_t *wheel) {
+    ullong due = ~0ULL;
+    uint level = 1;
+
+    mtx_lock(&wheel->lock);
+    if (wheel->count == 0) {
+        mtx_unlock(&wheel->lock);
+        return -1;
+    }
+
+    if (wheel->level_count[0] > 0)
+        for (uint i = 1; i <= TIMER_SLOTS && due == ~0ULL; ++i)
+            if (wheel->slots[(wheel->now + i) & (TIMER_SLOTS - 1)] != TIMER_NONE)
+                due = wheel->now + i;
+    // timers on higher levels can't be due before their level's next boundary
+    while (level < TIMER_LEVELS && wheel->level_count[level] == 0)
+        ++level;
+    if (level < TIMER_LEVELS)
+        due = min(due, (wheel->now | ((1ULL << (TIMER_SLOT_BITS * level)) - 1)) + 1);
+
+    const ullong tick = timers_tick(wheel);
+    mtx_unlock(&wheel->lock);
+
+    return due <= tick ? 0 : (int)min(due - tick, 0x7FFFFFFFULL);
+}
+
+/*
+* Frees all memory allocated by a wheel, pending timers are dropped
+*
+* wheel - the wheel to be deleted
+*/
+void timers_destroy(cmd_timer_wheel_t *wheel) {
+    if (!wheel->slots)
+        return;
+
+    for (uint i = 0; i < wheel->size; ++i)
+        cmd_cache_release(wheel->timers[i].entry);
+    free(wheel->timers);
+    free(wheel->slots);
+    mtx_destroy(&wheel->lock);
+    memset(wheel, 0, sizeof(*wheel));
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "struct_funcs.h"
+
+// a wheel tick is 1 ms; level l has TIMER_SLOTS slots of TIMER_SLOTS^l ticks each
+#define TIMER_SLOT_BITS 8
+#define TIMER_SLOTS (1u << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 4
+#define TIMER_NONE 0xFFFFFFFFu
+// size of the timer array when the first timer is added
+#define TIMER_INIT_SIZE 64
+
+bool timers_init(cmd_timer_wheel_t *wheel);
+ullong timers_add(cmd_timer_wheel_t *wheel, cmd_cache_entry_t *entry, uint delay_ms, uint period_ms);
+bool timers_cancel(cmd_timer_wheel_t *wheel, ullong id);
+void timers_swap_entry(cmd_timer_wheel_t *wheel, ullong id, cmd_cache_entry_t *entry);
+cmd_timer_fired_t *timers_advance(cmd_timer_wheel_t *wheel, uint *count);
+int timers_next_ms(cmd_timer_wheel_t *wheel);
+void timers_destroy(cmd_timer_wheel_t *wheel);
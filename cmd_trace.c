@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "cmd_trace.h"
+#include "sync_funcs.h"
+
+#pragma warning (disable: 5045 4996)
+
+// 1 in how many cmd_execute() calls is traced, 0 if tracing is off
+atomic_uint trace_sample_every = 0;
+
+// all rings ever made, newest first; rings live until the program ends
+_Atomic(cmd_trace_ring_t *) trace_rings = NULL;
+atomic_uint trace_next_tid = 1;
+
+// the calling thread's ring, made on its first span
+thread_local cmd_trace_ring_t *trace_ring = NULL;
+// calls left until the thread traces the next one
+thread_local uint trace_countdown = 0;
+// whether the thread is inside a sampled cmd_execute() call
+thread_local bool trace_sampled = false;
+
+const char *const trace_stage_names[TRACE_STAGE_CNT] = {
+    [TRACE_EXECUTE] = "execute",
+    [TRACE_TOKENIZE] = "tokenize",
+    [TRACE_LOOKUP] = "lookup",
+    [TRACE_CONVERT] = "convert",
+    [TRACE_ACTION] = "action",
+    [TRACE_REGISTER] = "register",
+};
+
+/*
+* Turns on span tracing of cmd_execute() and cmd_register() stages:
+* tokenizing, command lookup, argument conversion and the action
+* Each thread traces its first call and then every sample_every-th one,
+* untraced calls only pay for a counter check
+* Spans are kept in a fixed-size ring per thread, see cmd_trace_export()
+*
+* sample_every - 1 traces every call, 0 turns tracing off
+*/
+void cmd_trace_enable(uint sample_every) {
+    atomic_store(&trace_sample_every, sample_every);
+}
+
+/*
+* Decides whether the starting cmd_execute() call is traced
+* Has to be paired with trace_sample_end()
+*
+* returns - start time of the call's span, 0 if it isn't traced
+*/
+ullong trace_sample_begin(void) {
+    const uint every = atomic_load_explicit(&trace_sample_every, memory_order_relaxed);
+
+    if (every == 0 || trace_sampled)
+        return 0;
+    if (trace_countdown > 0) {
+        trace_countdown--;
+        return 0;
+    }
+
+    trace_countdown = every - 1;
+    trace_sampled = true;
+    return time_now_ns();
+}
+
+// Starts a span inside a sampled call, returns 0 outside of one
+ullong trace_begin(void) {
+    return trace_sampled ? time_now_ns() : 0;
+}
+
+// Starts a span whenever tracing is on, used for rare operations such as registration
+ullong trace_force_begin(void) {
+    return atomic_load_explicit(&trace_sample_every, memory_order_relaxed) ? time_now_ns() : 0;
+}
+
+// Copies a command name for a span that ends after the command tree is unlocked
+// Only done while tracing is on, dst is left empty otherwise
+void trace_name_copy(char *dst, const char *name) {
+    dst[0] = '\0';
+    if (atomic_load_explicit(&trace_sample_every, memory_order_relaxed) && name) {
+        strncpy(dst, name, TRACE_NAME_LEN - 1);
+        dst[TRACE_NAME_LEN - 1] = '\0';
+    }
+}
+
+// Returns the calling thread's ring, making it on first use (NULL if out of memory)
+cmd_trace_ring_t *trace_thread_ring(void) {
+    cmd_trace_ring_t *ring = trace_ring;
+
+    if (ring)
+        return ring;
+    if (!(ring = calloc(1, sizeof(cmd_trace_ring_t))))
+        return NULL;
+    if (!(ring->events = calloc(TRACE_RING_SIZE, sizeof(cmd_trace_event_t)))) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->tid = atomic_fetch_add(&trace_next_tid, 1);
+    ring->next = atomic_load(&trace_rings);
+    while (!atomic_compare_exchange_weak(&trace_rings, &ring->next, ring));
+
+    return trace_ring = ring;
+}
+
+/*
+* Finishes a span and stores it in the calling thread's ring
+* Nothing is stored if the span wasn't started (start_ns is 0)
+*
+* stage    - what the span measured
+* start_ns - value returned by the trace_*begin() function that started the span
+* name     - command name shown with the span (can be NULL)
+*/
+void trace_end(cmd_trace_stage_t stage, ullong start_ns, const char *name) {
+    if (start_ns == 0)
+        return;
+
+    const ullong end_ns = time_now_ns();
+    cmd_trace_ring_t *ring = trace_thread_ring();
+
+    if (!ring)
+        return;
+
+    // only this thread writes head, the exporter skips events whose seq doesn't match
+    const uint index = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    cmd_trace_event_t *event = &ring->events[index % TRACE_RING_SIZE];
+
+    atomic_store_explicit(&event->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    event->start_ns = start_ns;
+    event->dur_ns = (uint)min(end_ns - start_ns, 0xFFFFFFFFULL);
+    event->stage = stage;
+    event->name[0] = '\0';
+    if (name) {
+        strncpy(event->name, name, TRACE_NAME_LEN - 1);
+        event->name[TRACE_NAME_LEN - 1] = '\0';
+    }
+    atomic_store_explicit(&event->seq, index + 1, memory_order_release);
+    atomic_store_explicit(&ring->head, index + 1, memory_order_release);
+}
+
+// Finishes the span of a sampled cmd_execute() call started by trace_sample_begin()
+void trace_sample_end(ullong start_ns) {
+    if (start_ns == 0)
+        return;
+
+    trace_end(TRACE_EXECUTE, start_ns, NULL);
+    trace_sampled = false;
+}
+
+// Helper function of cmd_trace_export()
+// Writes a command name as a JSON string body, escaping what has to be escaped
+void trace_write_name(FILE *file, const char *name) {
+    for (; *name; ++name) {
+        if (*name == '"' || *name == '\\')
+            fputc('\\', file);
+        if ((uchar)*name >= ' ')
+            fputc(*name, file);
+    }
+}
+
+/*
+* Writes the spans of all threads as a Chrome trace-event JSON file
+* (loadable in chrome://tracing or Perfetto)
+* Can be called while other threads are tracing; spans being overwritten at that moment are left out
+*
+* path - the file to write
+*
+* returns - whether the file was written
+*/
+bool cmd_trace_export(const char *path) {
+    FILE *file = fopen(path, "w");
+    bool first = true;
+
+    if (!file)
+        return false;
+
+    fputs("{\"traceEvents\":[", file);
+    for (cmd_trace_ring_t *ring = atomic_load(&trace_rings); ring; ring = ring->next) {
+        const uint head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        const uint begin = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+        for (uint i = begin; i < head; ++i) {
+            cmd_trace_event_t *src = &ring->events[i % TRACE_RING_SIZE];
+            ullong start_ns;
+            uint dur_ns;
+            cmd_trace_stage_t stage;
+            char name[sizeof(src->name)];
+
+            if (atomic_load_explicit(&src->seq, memory_order_acquire) != i + 1)
+                continue;
+            start_ns = src->start_ns;
+            dur_ns = src->dur_ns;
+            stage = src->stage;
+            memcpy(name, src->name, sizeof(name));
+            atomic_thread_fence(memory_order_acquire);
+            // overwritten while being copied
+            if (atomic_load_explicit(&src->seq, memory_order_relaxed) != i + 1 || stage >= TRACE_STAGE_CNT)
+                continue;
+            name[sizeof(name) - 1] = '\0';
+
+            fprintf(file, "%s\n{\"name\":\"%s", first ? "" : ",", trace_stage_names[stage]);
+            if (name[0]) {
+                fputc(' ', file);
+                trace_write_name(file, name);
+            }
+            fprintf(file, "\",\"cat\":\"cmd\",\"ph\":\"X\",\"ts\":%llu.%03llu,\"dur\":%u.%03u,\"pid\":1,\"tid\":%u}",
+                start_ns / 1000, start_ns % 1000, dur_ns / 1000, dur_ns % 1000, ring->tid);
+            first = false;
+        }
+    }
+    fputs("\n],\"displayTimeUnit\":\"ns\"}\n", file);
+
+    return fclose(file) == 0;
+}
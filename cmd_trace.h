@@ -0,0 +1,14 @@
+#pragma once
+#include "struct_funcs.h"
+
+// number of spans kept per thread, older ones are overwritten
+#define TRACE_RING_SIZE 4096
+
+void cmd_trace_enable(uint sample_every);
+ullong trace_sample_begin(void);
+ullong trace_begin(void);
+ullong trace_force_begin(void);
+void trace_name_copy(char *dst, const char *name);
+void trace_end(cmd_trace_stage_t stage, ullong start_ns, const char *name);
+void trace_sample_end(ullong start_ns);
+bool cmd_trace_export(const char *path);
@@ -0,0 +1,449 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "cmd_validate.h"
+#include "cmd_script.h"
+#include "sync_funcs.h"
+
+#pragma warning (disable: 5045 4996)
+
+// Returns the number of cores of the machine (at least 1)
+uint validate_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? (uint)info.dwNumberOfProcessors : 1;
+#else
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 ? (uint)count : 1;
+#endif
+}
+
+/*
+* Maps a whole file into memory for reading
+*
+* path - path of the file
+* size - pointer to where the size of the file is to be stored
+*
+* returns - pointer to the contents of the file (NULL if it couldn't be mapped),
+*           release with validate_unmap()
+*/
+const char *validate_map(const char *path, size_t *size) {
+    static const char empty[1] = { 0 };
+    const char *ret = NULL;
+
+    *size = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER file_size;
+
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    if (!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return NULL;
+    }
+    if (file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return empty;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    CloseHandle(file);
+    if (!mapping)
+        return NULL;
+    // the view keeps the mapping alive
+    ret = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (ret)
+        *size = (size_t)file_size.QuadPart;
+#else
+    const int fd = open(path, O_RDONLY);
+    struct stat info;
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        return empty;
+    }
+
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+    madvise(data, (size_t)info.st_size, MADV_WILLNEED);
+    ret = data;
+    *size = (size_t)info.st_size;
+#endif
+
+    return ret;
+}
+
+// Releases a file mapped by validate_map()
+void validate_unmap(const char *data, size_t size) {
+    if (size == 0)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap((void *)data, size);
+#endif
+}
+
+/*
+* Adds to the number of lines calling a command in a chunk's statistics
+*
+* chunk - the chunk
+* cmd   - the called command
+* count - the number of lines to add
+*
+* returns - whether the statistics could be updated
+*/
+bool validate_stat_add(cmd_validate_chunk_t *chunk, const command_t *cmd, ullong count) {
+    if (2 * (chunk->stat_cnt + 1) > chunk->stat_size) {
+        const uint new_size = chunk->stat_size ? 2 * chunk->stat_size : 16;
+        cmd_validate_stat_t *new_stats = calloc(new_size, sizeof(cmd_validate_stat_t));
+        cmd_validate_chunk_t moved = { .stats = new_stats, .stat_size = new_size };
+
+        if (!new_stats)
+            return false;
+        for (uint i = 0; i < chunk->stat_size; ++i)
+            if (chunk->stats[i].cmd)
+                validate_stat_add(&moved, chunk->stats[i].cmd, chunk->stats[i].count);
+        free(chunk->stats);
+        chunk->stats = new_stats;
+        chunk->stat_size = new_size;
+    }
+
+    const uint mask = chunk->stat_size - 1;
+    uint i = (uint)(((size_t)cmd >> 4) * 2654435761u) & mask;
+
+    while (chunk->stats[i].cmd != NULL && chunk->stats[i].cmd != cmd)
+        i = (i + 1) & mask;
+    if (chunk->stats[i].cmd == NULL) {
+        chunk->stats[i].cmd = cmd;
+        chunk->stat_cnt++;
+    }
+    chunk->stats[i].count += count;
+
+    return true;
+}
+
+// Helper function of validate_line()
+// Counts a failed line and keeps its error if the chunk hasn't collected enough of them yet
+void validate_fail(cmd_validate_chunk_t *chunk, const cmd_parse_error_t *error, uint line) {
+    const cmd_script_error_t script_error = { .line = line, .error = *error };
+
+    chunk->invalid[error->status]++;
+    if (chunk->error_cnt < chunk->max_errors
+        && cmd_script_reserve((void **)&chunk->errors, &chunk->error_size, chunk->error_cnt, sizeof(script_error)))
+        chunk->errors[chunk->error_cnt++] = script_error;
+}
+
+/*
+* Helper function of validate_thread()
+* Parses a single line of a command file without running it
+* Blank lines and lines starting with '#' are skipped, like in cmd_script_compile()
+*
+* chunk - the chunk the line belongs to
+* str   - the line (not null-terminated)
+* len   - length of the line without the newline
+* line  - number of the line within the chunk
+*/
+void validate_line(cmd_validate_chunk_t *chunk, const char *str, size_t len, uint line) {
+    cmd_parse_error_t error = { .status = CMD_PARSE_INTERNAL };
+    cmd_parsed_t parsed;
+    char buffer[512];
+    uint i = 0;
+
+    if (len >= sizeof(buffer)) {
+        snprintf(error.message, sizeof(error.message), "Line longer than %u characters", (uint)sizeof(buffer) - 1);
+        validate_fail(chunk, &error, line);
+        return;
+    }
+    memcpy(buffer, str, len);
+    buffer[len] = '\0';
+
+    while (buffer[i] == ' ' || buffer[i] == '\t')
+        ++i;
+    if ((uchar)buffer[i] < ' ' || buffer[i] == '#') {
+        chunk->skipped++;
+        return;
+    }
+
+    if (!cmd_registry_parse_locked(chunk->registry, buffer + i, &parsed, &error)) {
+        validate_fail(chunk, &error, line);
+        return;
+    }
+    if (!validate_stat_add(chunk, parsed.cmd, 1)) {
+        error.status = CMD_PARSE_INTERNAL;
+        snprintf(error.message, sizeof(error.message), "Out of memory");
+        validate_fail(chunk, &error, line);
+    }
+    cmd_parsed_destroy(&parsed);
+}
+
+// Thread function of cmd_registry_validate_file(), validates every line of a chunk
+// Line numbers are relative to the chunk until the results are merged
+int validate_thread(void *arg) {
+    cmd_validate_chunk_t *chunk = arg;
+    const char *cur = chunk->begin;
+
+    while (cur < chunk->end) {
+        const char *newline = memchr(cur, '\n', (size_t)(chunk->end - cur));
+        const char *line_end = newline ? newline : chunk->end;
+
+        validate_line(chunk, cur, (size_t)(line_end - cur), ++chunk->lines);
+        cur = line_end + 1;
+    }
+
+    return 0;
+}
+
+/*
+* Helper function of cmd_registry_validate_file()
+* Walks the command tree and names every command found in the statistics
+*
+* stats - the merged statistics
+* cmd   - current command
+* name  - buffer with the names of the commands above cmd
+* len   - length of the name in the buffer
+*/
+void validate_name_rec(cmd_validate_chunk_t *stats, const command_t *cmd, char *name, size_t len) {
+    const size_t cmd_len = strlen(cmd->name);
+
+    if (len + cmd_len + 2 > VALIDATE_NAME_MAX)
+        return;
+    if (len > 0)
+        name[len++] = ' ';
+    memcpy(name + len, cmd->name, cmd_len + 1);
+    len += cmd_len;
+
+    const uint mask = stats->stat_size - 1;
+    uint i = (uint)(((size_t)cmd >> 4) * 2654435761u) & mask;
+
+    while (stats->stats[i].cmd != NULL && stats->stats[i].cmd != cmd)
+        i = (i + 1) & mask;
+    if (stats->stats[i].cmd == cmd)
+        stats->stats[i].name = _strdup(name);
+
+    for (uint j = 0; j < cmd->subcommands.count; ++j)
+        validate_name_rec(stats, arraylist_data(&cmd->subcommands)[j], name, len);
+}
+
+// Used with qsort() by cmd_registry_validate_file()
+// Orders statistics by the number of lines, most called command first
+int validate_stat_cmp(const void *a, const void *b) {
+    const ullong count_a = ((const cmd_validate_stat_t *)a)->count, count_b = ((const cmd_validate_stat_t *)b)->count;
+
+    return (count_a < count_b) - (count_a > count_b);
+}
+
+/*
+* Checks that every line of a command file parses against the command tree of a registry,
+* without running any action (a dry run of the file)
+* The file is memory-mapped and split at line boundaries into chunks that are
+* validated in parallel; the command tree is locked for reading the whole time
+* Blank lines and lines starting with '#' are skipped, like in cmd_script_compile()
+*
+* registry   - the registry to validate against
+* path       - path of the command file
+* threads    - number of threads to use, 0 for one per core
+* max_errors - maximum number of errors kept (all of them are still counted)
+*
+* returns - the result of the validation, opened is false if the file couldn't be read,
+*           release with cmd_validation_destroy()
+*/
+cmd_validation_t cmd_registry_validate_file(cmd_registry_t *registry, const char *path, uint threads, uint max_errors) {
+    const ullong start_ns = time_now_ns();
+    cmd_validation_t ret = { 0 };
+    size_t size;
+    const char *data = validate_map(path, &size);
+
+    if (!data)
+        return ret;
+    ret.opened = true;
+
+    // small chunks aren't worth a thread
+    if (threads == 0)
+        threads = validate_cpu_count();
+    threads = (uint)min((size_t)threads, size / VALIDATE_MIN_CHUNK + 1);
+
+    cmd_validate_chunk_t *chunks = calloc(threads, sizeof(cmd_validate_chunk_t));
+    thrd_t *handles = calloc(threads, sizeof(thrd_t));
+    bool *started = calloc(threads, sizeof(bool));
+    const char *const end = data + size;
+    cmd_validate_chunk_t merged = { 0 };
+
+    if (!chunks || !handles || !started) {
+        free(chunks);
+        free(handles);
+        free(started);
+        validate_unmap(data, size);
+        ret.opened = false;
+        return ret;
+    }
+
+    // every chunk but the first starts right after a newline
+    for (uint i = 0; i < threads; ++i) {
+        const char *begin = i == 0 ? data : chunks[i - 1].end;
+        const char *split = data + (size_t)((double)size * (i + 1) / threads);
+
+        if (split < begin)
+            split = begin;
+        if (i + 1 == threads)
+            split = end;
+        else if (split > data && split < end && split[-1] != '\n') {
+            const char *newline = memchr(split, '\n', (size_t)(end - split));
+            split = newline ? newline + 1 : end;
+        }
+
+        chunks[i].registry = registry;
+        chunks[i].begin = begin;
+        chunks[i].end = split;
+        chunks[i].max_errors = max_errors;
+    }
+
+    rwlock_read_lock(&registry->lock);
+    for (uint i = 1; i < threads; ++i)
+        started[i] = thrd_create(&handles[i], &validate_thread, &chunks[i]) == thrd_success;
+    validate_thread(&chunks[0]);
+    for (uint i = 1; i < threads; ++i) {
+        if (started[i])
+            thrd_join(handles[i], NULL);
+        else
+            validate_thread(&chunks[i]);
+    }
+
+    // line numbers become absolute by adding the lines of all preceding chunks
+    for (uint i = 0; i < threads; ++i) {
+        const cmd_validate_chunk_t *chunk = &chunks[i];
+
+        for (uint j = 0; j < chunk->error_cnt && merged.error_cnt < max_errors; ++j) {
+            cmd_script_error_t error = chunk->errors[j];
+
+            error.line += (uint)ret.lines;
+            if (cmd_script_reserve((void **)&merged.errors, &merged.error_size, merged.error_cnt, sizeof(error)))
+                merged.errors[merged.error_cnt++] = error;
+        }
+        for (uint j = 0; j < chunk->stat_size; ++j)
+            if (chunk->stats[j].cmd)
+                validate_stat_add(&merged, chunk->stats[j].cmd, chunk->stats[j].count);
+
+        ret.lines += chunk->lines;
+        ret.skipped += chunk->skipped;
+        for (uint j = 0; j < CMD_PARSE_STATUS_CNT; ++j)
+            ret.invalid[j] += chunk->invalid[j];
+        free(chunk->errors);
+        free(chunk->stats);
+    }
+
+    // name the commands while the tree still can't change
+    if (merged.stat_cnt > 0) {
+        const command_t *root;
+        char name[VALIDATE_NAME_MAX];
+        uint iter = 0;
+
+        while ((root = cmd_map_next(&registry->map, &iter)) != NULL)
+            validate_name_rec(&merged, root, name, 0);
+    }
+    rwlock_read_unlock(&registry->lock);
+    validate_unmap(data, size);
+
+    ret.valid = ret.lines - ret.skipped;
+    for (uint j = 0; j < CMD_PARSE_STATUS_CNT; ++j)
+        ret.valid -= ret.invalid[j];
+    ret.errors = merged.errors;
+    ret.error_cnt = merged.error_cnt;
+
+    // compact the statistics table into an array, commands aren't valid after unlocking
+    for (uint j = 0; j < merged.stat_size; ++j) {
+        if (!merged.stats[j].cmd)
+            continue;
+        merged.stats[ret.stat_cnt] = merged.stats[j];
+        merged.stats[ret.stat_cnt++].cmd = NULL;
+    }
+    ret.stats = merged.stats;
+    if (ret.stats)
+        qsort(ret.stats, ret.stat_cnt, sizeof(cmd_validate_stat_t), &validate_stat_cmp);
+
+    free(chunks);
+    free(handles);
+    free(started);
+    ret.elapsed_ns = time_now_ns() - start_ns;
+
+    return ret;
+}
+
+/*
+* Prints the result of a validation to stdout: a summary,
+* the kept errors with their line numbers and the number of lines per command
+*
+* validation - the result to print
+*/
+void cmd_validation_print(const cmd_validation_t *validation) {
+    static const char *const status_names[CMD_PARSE_STATUS_CNT] = {
+        [CMD_PARSE_OK] = "ok",
+        [CMD_PARSE_UNKNOWN_COMMAND] = "unknown command",
+        [CMD_PARSE_MISSING_ARGUMENT] = "missing argument",
+        [CMD_PARSE_BAD_VALUE] = "bad value",
+        [CMD_PARSE_CONSTRAINT] = "out of bounds or unmatched",
+        [CMD_PARSE_INTERNAL] = "other",
+    };
+
+    if (!validation->opened) {
+        puts("[ERROR] The file couldn't be read");
+        return;
+    }
+
+    printf("%llu lines: %llu valid, %llu skipped, %llu invalid in %.3f ms\n", validation->lines, validation->valid,
+        validation->skipped, validation->lines - validation->valid - validation->skipped, validation->elapsed_ns / 1e6);
+    for (uint i = 0; i < CMD_PARSE_STATUS_CNT; ++i)
+        if (validation->invalid[i] > 0)
+            printf("  %s: %llu\n", status_names[i], validation->invalid[i]);
+    for (uint i = 0; i < validation->error_cnt; ++i)
+        printf("[ERROR] line %u: %s\n", validation->errors[i].line, validation->errors[i].error.message);
+    for (uint i = 0; i < validation->stat_cnt; ++i)
+        printf("%12llu  %s\n", validation->stats[i].count, validation->stats[i].name ? validation->stats[i].name : "?");
+}
+
+/*
+* Frees all memory allocated by cmd_registry_validate_file()
+*
+* validation - the result to be deleted
+*/
+void cmd_validation_destroy(cmd_validation_t *validation) {
+    if (!validation)
+        return;
+
+    for (uint i = 0; i < validation->stat_cnt; ++i)
+        free(validation->stats[i].name);
+    free(validation->stats);
+    free(validation->errors);
+    memset(validation, 0, sizeof(*validation));
+}
+
+// Validates a command file against the default registry, see cmd_registry_validate_file()
+cmd_validation_t cmd_validate_file(const char *path, uint threads, uint max_errors) {
+    return cmd_registry_validate_file(cmd_default_registry(), path, threads, max_errors);
+}
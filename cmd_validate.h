@@ -0,0 +1,12 @@
+#pragma once
+#include "cmd_main.h"
+
+// smallest part of a file worth validating on a separate thread
+#define VALIDATE_MIN_CHUNK (1u << 16)
+// longest command name path reported in the statistics
+#define VALIDATE_NAME_MAX 256
+
+cmd_validation_t cmd_registry_validate_file(cmd_registry_t *registry, const char *path, uint threads, uint max_errors);
+cmd_validation_t cmd_validate_file(const char *path, uint threads, uint max_errors);
+void cmd_validation_print(const cmd_validation_t *validation);
+void cmd_validation_destroy(cmd_validation_t *validation);
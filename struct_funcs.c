@@ -2,6 +2,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <stdint.h>
 #include "struct_funcs.h"
 #include "cmd_storage.h"
 
@@ -38,6 +40,25 @@ uint hash(const char *str) {
     return hash;
 }
 
+/*
+* Calculates a 64-bit FNV-1a hash of a sequence of bytes
+* 
+* data - pointer to the bytes to be hashed
+* size - number of bytes
+* 
+* returns - calculated hash value
+*/
+ullong hash_bytes(const void *data, uint size) {
+    ullong hash = 0xCBF29CE484222325ULL;
+
+    for (uint i = 0; i < size; ++i) {
+        hash ^= ((const uchar *)data)[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
 // Likely temporary
 // Returns the hash of cmd's name
 uint cmd_hash(const command_t *cmd) {
@@ -66,6 +87,15 @@ bool cmd_eq(const command_t *cmd1, const command_t *cmd2) {
     return true;
 }
 
+// name of removed map entries
+// a tombstone keeps the probe chains running through its bucket intact
+char cmd_map_tombstone[] = "";
+
+// Returns whether a map bucket holds a command (is neither empty nor a tombstone)
+bool cmd_slot_live(const command_t *slot) {
+    return slot->name != NULL && slot->name != cmd_map_tombstone;
+}
+
 /*
 * Returns a stack-allocated command hashmap struct
 */
@@ -73,7 +103,10 @@ cmd_map_t cmd_map_make(void) {
     cmd_map_t ret = {
         .size = CONTAINER_INIT_SIZE,
         .count = 0,
+        .tombstones = 0,
         .map = calloc(CONTAINER_INIT_SIZE, sizeof(command_t)),
+        .old_map = NULL,
+        .moved = NULL,
     };
 
     return ret;
@@ -88,17 +121,103 @@ void cmd_map_destroy(cmd_map_t *map) {
     if (!map || !map->map)
         return;
 
-    for (uint i = 0; i < map->size; ++i) {
-        if ((map->map + i) != NULL)
-            cmd_destroy(map->map + i);
-    }
+    const command_t *cmd;
+    uint iter = 0;
+
+    while ((cmd = cmd_map_next(map, &iter)) != NULL)
+        cmd_destroy((command_t *)cmd);
 
     free(map->map);
+    free(map->old_map);
     memset(map, 0, sizeof(*map));
 }
 
+/*
+* Puts a command into the first free bucket or tombstone of its probe chain
+* Does not check for duplicates or update any counters
+* 
+* table - bucket array to insert into
+* size  - number of buckets in table
+* cmd   - pointer to the inserted command
+* 
+* returns - whether a tombstone was overwritten
+*/
+bool cmd_table_place(command_t *table, uint size, const command_t *cmd) {
+    uint map_index = cmd_hash(cmd) % size;
+
+    while (cmd_slot_live(table + map_index))
+        map_index = (map_index + 1) % size;
+
+    const bool reused = (table[map_index].name == cmd_map_tombstone);
+    table[map_index] = *cmd;
+
+    return reused;
+}
+
+/*
+* Searches a single bucket array for a command with given name
+* Tombstones are skipped, the search only stops at an empty bucket
+* 
+* table - bucket array to search in
+* size  - number of buckets in table
+* key   - the name to look for
+* 
+* returns - index of the found bucket (size if there is none)
+*/
+uint cmd_table_find(const command_t *table, uint size, const char *key) {
+    const uint base_index = hash(key) % size;
+    uint map_index = base_index;
+
+    while (table[map_index].name != NULL) {
+        if (table[map_index].name != cmd_map_tombstone && str_eq(table[map_index].name, key))
+            return map_index;
+        map_index++;
+        if ((map_index %= size) == base_index)
+            break;
+    }
+
+    return size;
+}
+
+/*
+* Moves a bounded number of buckets from the old table of a resizing map to the new one
+* Frees the old table once all of its buckets have been moved, map->moved is told about each moved command
+* Does nothing if the map is not being resized
+* 
+* map   - pointer to the resizing map
+* steps - maximum number of buckets to move
+*/
+void cmd_map_migrate(cmd_map_t *map, uint steps) {
+    if (!map || !map->old_map)
+        return;
+
+    for (; steps > 0 && map->migrate_index < map->old_size; --steps, ++map->migrate_index) {
+        const command_t *cmd = map->old_map + map->migrate_index;
+
+        // the old copy is left in place so that probe chains of
+        // not yet migrated entries stay intact for cmd_map_find()
+        if (!cmd_slot_live(cmd))
+            continue;
+        if (cmd_table_place(map->map, map->size, cmd))
+            map->tombstones--;
+        if (map->moved)
+            map->moved(cmd, map->map + cmd_table_find(map->map, map->size, cmd->name), map->moved_data);
+    }
+
+    if (map->migrate_index == map->old_size) {
+        free(map->old_map);
+        map->old_map = NULL;
+        map->old_size = map->migrate_index = 0;
+    }
+}
+
 /*
 * Adds a command to a hashmap
+* Growing the map is done incrementally: a new table is allocated
+* and every following insertion moves CMD_MAP_MIGRATE_STEP buckets into it,
+* so no single call has to rehash the whole map
+* If most of the used buckets are tombstones, the new table has the same size
+* and the migration only compacts the map
 * 
 * map - pointer to the map where the command is to be added
 * cmd - pointer to the addedd command
@@ -106,30 +225,31 @@ void cmd_map_destroy(cmd_map_t *map) {
 * returns - whether the command was successfully added
 */
 bool cmd_map_add(cmd_map_t *map, const command_t *cmd) {
-    uint map_index = cmd_hash(cmd) % map->size;
-
     if (!map || !map->map || !cmd)
         return false;
 
-    if (map->count == map->size) {
-        command_t *prev_map = map->map;
-        if (!(map->map = calloc(2 * map->size, sizeof(command_t))))
-            return false;
-        map->count = 0;
-        map->size *= 2;
-
-        for (uint i = 0; i < map->size / 2; ++i) {
-            if (prev_map[i].name != NULL)
-                cmd_map_add(map, prev_map + i);
-        }
+    // keep the load factor (tombstones included) under 3/4 so probe chains stay short
+    if (4 * (map->count + map->tombstones + 1) > 3 * map->size) {
+        const uint new_size = (8 * (map->count + 1) > 3 * map->size) ? 2 * map->size : map->size;
+        command_t *new_map = calloc(new_size, sizeof(command_t));
 
-        free(prev_map);
+        if (!new_map)
+            return false;
+        // the step size guarantees the previous resize is already done by now,
+        // this only matters if cmd_map_migrate() was called with a tiny step count
+        cmd_map_migrate(map, map->old_size);
+
+        map->old_map = map->map;
+        map->old_size = map->size;
+        map->migrate_index = 0;
+        map->map = new_map;
+        map->size = new_size;
+        map->tombstones = 0;
     }
 
-    while (map->map[map_index].name != NULL)
-        map_index = (map_index + 1) % map->size;
-
-    map->map[map_index] = *cmd;
+    cmd_map_migrate(map, CMD_MAP_MIGRATE_STEP);
+    if (cmd_table_place(map->map, map->size, cmd))
+        map->tombstones--;
     map->count++;
 
     return true;
@@ -137,6 +257,7 @@ bool cmd_map_add(cmd_map_t *map, const command_t *cmd) {
 
 /*
 * Searches a hashmap for a command with given name
+* During a resize, both the new and the old table are searched
 * 
 * map - pointer to the hashmap to search in
 * key - the name to look for
@@ -147,20 +268,224 @@ const command_t *cmd_map_find(const cmd_map_t *map, const char *key) {
     if (!map->map || map->count == 0)
         return NULL;
 
-    const uint base_index = hash(key) % map->size;
-    uint map_index = base_index;
+    uint map_index = cmd_table_find(map->map, map->size, key);
 
-    while (map->map[map_index].name != NULL && !str_eq(map->map[map_index].name, key)) {
-        map_index++;
-        if ((map_index %= map->size) == base_index)
-            return NULL;
+    if (map_index != map->size)
+        return map->map + map_index;
+    if (!map->old_map)
+        return NULL;
+
+    // buckets below migrate_index are stale copies of already moved entries
+    map_index = cmd_table_find(map->old_map, map->old_size, key);
+    if (map_index != map->old_size && map_index >= map->migrate_index)
+        return map->old_map + map_index;
+
+    return NULL;
+}
+
+/*
+* Removes a command from a hashmap and frees it
+* Its bucket becomes a tombstone, which is dropped by the next resize
+* 
+* map - pointer to the hashmap to remove from
+* key - name of the command to remove
+* 
+* returns - whether a command was removed
+*/
+bool cmd_map_remove(cmd_map_t *map, const char *key) {
+    command_t *cmd = (command_t *)cmd_map_find(map, key);
+
+    if (!cmd)
+        return false;
+
+    // a stale copy left behind by the migration would keep the freed name in a probe chain
+    if (map->old_map) {
+        const uint old_index = cmd_table_find(map->old_map, map->old_size, key);
+
+        if (old_index < map->migrate_index)
+            map->old_map[old_index].name = cmd_map_tombstone;
+    }
+    cmd_destroy(cmd);
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->name = cmd_map_tombstone;
+    map->count--;
+    // tombstones in the old table disappear along with it
+    if (cmd >= map->map && cmd < map->map + map->size)
+        map->tombstones++;
+
+    return true;
+}
+
+// Used with qsort() by cmd_map_reorder()
+// Orders commands by lookup hits, most hit first
+int cmd_hits_cmp(const void *a, const void *b) {
+    const uint hits_a = atomic_load_explicit(&(*(command_t *const *)a)->hits, memory_order_relaxed);
+    const uint hits_b = atomic_load_explicit(&(*(command_t *const *)b)->hits, memory_order_relaxed);
+
+    return (hits_a < hits_b) - (hits_a > hits_b);
+}
+
+/*
+* Rebuilds a hashmap so that the most hit commands come first in their probe chains
+* Commands are inserted into a fresh table in order of their hits, so the hottest ones
+* get their home bucket and colder ones are pushed further along the chain
+* Finishes a pending resize and drops all tombstones
+* All commands move, so pointers to them become invalid; map->moved is told about each of them
+* 
+* map - pointer to the hashmap to rebuild
+* 
+* returns - whether the map was rebuilt
+*/
+bool cmd_map_reorder(cmd_map_t *map) {
+    if (!map || !map->map)
+        return false;
+
+    command_t **order = malloc((map->count + 1) * sizeof(command_t *));
+    command_t *table = calloc(map->size, sizeof(command_t));
+    const command_t *cmd;
+    uint iter = 0, count = 0;
+
+    if (!order || !table) {
+        free(order);
+        free(table);
+        return false;
+    }
+
+    while ((cmd = cmd_map_next(map, &iter)) != NULL)
+        order[count++] = (command_t *)cmd;
+    qsort(order, count, sizeof(command_t *), &cmd_hits_cmp);
+    for (uint i = 0; i < count; ++i) {
+        cmd_table_place(table, map->size, order[i]);
+        if (map->moved)
+            map->moved(order[i], table + cmd_table_find(table, map->size, order[i]->name), map->moved_data);
+    }
+
+    free(order);
+    free(map->map);
+    free(map->old_map);
+    map->map = table;
+    map->old_map = NULL;
+    map->old_size = map->migrate_index = 0;
+    map->tombstones = 0;
+
+    return true;
+}
+
+/*
+* Iterates over all commands stored in a hashmap, including the not yet
+* migrated part of the old table during a resize
+* 
+* map  - pointer to the hashmap to iterate over
+* iter - pointer to the iteration state, should be 0 before the first call
+* 
+* returns - pointer to the next command (NULL once all have been visited)
+*/
+const command_t *cmd_map_next(const cmd_map_t *map, uint *iter) {
+    for (; *iter < map->size; ++*iter) {
+        if (cmd_slot_live(map->map + *iter))
+            return map->map + (*iter)++;
+    }
+    for (; map->old_map && *iter < map->size + map->old_size; ++*iter) {
+        const uint old_index = *iter - map->size;
+
+        if (old_index >= map->migrate_index && cmd_slot_live(map->old_map + old_index))
+            return map->old_map + ((*iter)++ - map->size);
+    }
+
+    return NULL;
+}
+
+// Allocates, resizes (block != NULL) or frees (size == 0) a container's heap block
+void *container_resize(const allocator_t *allocator, void *block, size_t size) {
+    if (size == 0) {
+        if (allocator)
+            allocator->release(allocator->ctx, block);
+        else
+            free(block);
+        return NULL;
+    }
+
+    return allocator ? allocator->resize(allocator->ctx, block, size) : realloc(block, size);
+}
+
+/*
+* Makes room for need elements in a container with inline storage
+* The elements move to the heap once they don't fit the inline storage anymore
+* Shared by the pointer and byte arraylists
+* 
+* heap       - pointer to the container's heap block (NULL while it uses the inline storage)
+* inline_buf - the inline storage
+* inline_cnt - number of elements the inline storage can hold
+* size       - pointer to the container's capacity
+* count      - number of elements in the container
+* need       - number of elements there should be room for
+* elem_size  - size of one element
+* allocator  - the container's allocator (NULL for realloc() and free())
+* 
+* returns - whether there is room now, the container is unchanged if there isn't
+*/
+bool container_reserve(void **heap, void *inline_buf, uint inline_cnt, uint *size,
+    uint count, uint need, uint elem_size, const allocator_t *allocator) {
+    if (need <= *size)
+        return true;
+    if (!*heap && need <= inline_cnt) {
+        // a zeroed or destroyed container starts out with its inline storage
+        *size = inline_cnt;
+        return true;
+    }
+
+    uint new_size = max(*size, inline_cnt);
+
+    while (new_size < need)
+        new_size = (new_size > UINT_MAX / 2) ? need : 2 * new_size;
+    if (new_size > SIZE_MAX / elem_size)
+        return false;
+
+    void *block = container_resize(allocator, *heap, (size_t)new_size * elem_size);
+
+    if (!block)
+        return false;
+    if (!*heap)
+        memcpy(block, inline_buf, (size_t)count * elem_size);
+    *heap = block;
+    *size = new_size;
+
+    return true;
+}
+
+/*
+* Releases the unused capacity of a container with inline storage,
+* moving its elements back to the inline storage if they fit
+* 
+* see container_reserve()
+* 
+* returns - whether the capacity was released (the container is unchanged if not)
+*/
+bool container_shrink(void **heap, void *inline_buf, uint inline_cnt, uint *size,
+    uint count, uint elem_size, const allocator_t *allocator) {
+    if (!*heap || count == *size)
+        return true;
+    if (count <= inline_cnt) {
+        memcpy(inline_buf, *heap, (size_t)count * elem_size);
+        container_resize(allocator, *heap, 0);
+        *heap = NULL;
+        *size = inline_cnt;
+        return true;
     }
 
-    return map->map[map_index].name ? map->map + map_index : NULL;
+    void *block = container_resize(allocator, *heap, (size_t)count * elem_size);
+
+    if (!block)
+        return false;
+    *heap = block;
+    *size = count;
+
+    return true;
 }
 
 /*
 * Creates a stack-allocated arraylist of pointers
+* The first ARRAYLIST_INLINE_CNT pointers are stored in the list itself
 * 
 * elem_destr_func - a (void (void *)) function to be applied to each
 *                   element of the arraylist when it is destroyed
@@ -168,89 +493,226 @@ const command_t *cmd_map_find(const cmd_map_t *map, const char *key) {
 * returns - the newly created arraylist
 */
 ptr_arraylist_t arraylist_make(destroy_func_t elem_destr_func) {
+    return arraylist_make_alloc(elem_destr_func, NULL);
+}
+
+/*
+* Creates a stack-allocated arraylist of pointers that gets its memory from an allocator
+* 
+* elem_destr_func - see arraylist_make()
+* allocator       - the allocator, has to outlive the list (NULL for realloc() and free())
+* 
+* returns - the newly created arraylist
+*/
+ptr_arraylist_t arraylist_make_alloc(destroy_func_t elem_destr_func, const allocator_t *allocator) {
     ptr_arraylist_t ret = {
-        .arr = calloc(CONTAINER_INIT_SIZE, sizeof(void *)),
+        .heap = NULL,
         .count = 0,
-        .size = CONTAINER_INIT_SIZE,
+        .size = ARRAYLIST_INLINE_CNT,
         .elem_destr_func = elem_destr_func,
+        .allocator = allocator,
     };
 
     return ret;
 }
 
+/*
+* Makes room for more pointers in an arraylist, so that adding them can't fail
+* 
+* list  - the list to grow
+* extra - number of pointers to be added
+* 
+* returns - whether there is room for them
+*/
+bool arraylist_reserve(ptr_arraylist_t *list, uint extra) {
+    if (extra > UINT_MAX - list->count)
+        return false;
+
+    return container_reserve((void **)&list->heap, list->inline_arr, ARRAYLIST_INLINE_CNT, &list->size,
+        list->count, list->count + extra, sizeof(void *), list->allocator);
+}
+
+/*
+* Frees the unused room of an arraylist
+* 
+* list - the list to shrink
+* 
+* returns - whether the room was freed
+*/
+bool arraylist_shrink(ptr_arraylist_t *list) {
+    return container_shrink((void **)&list->heap, list->inline_arr, ARRAYLIST_INLINE_CNT, &list->size,
+        list->count, sizeof(void *), list->allocator);
+}
+
 /*
 * Adds a pointer to an arraylist
 * 
 * list - the list where the pointer is to be added
 * item - the pointer to add
 * 
-* returns - whether the pointer was successfully added
+* returns - whether the pointer was successfully added (the list is unchanged if not)
 */
-bool arraylist_push(ptr_arraylist_t *list, void *item) {
-    if (list->count == list->size) {
-        list->size *= 2;
-        void **new_arr = realloc(list->arr, list->size * sizeof(void *));
-        if (list->size == 0 || !new_arr)
-            return false;
-        list->arr = new_arr;
-    }
+bool arraylist_push(ptr_arraylist_t *list, const void *item) {
+    if (list->count == list->size && !arraylist_reserve(list, 1))
+        return false;
 
-    list->arr[list->count++] = item;
+    arraylist_data(list)[list->count++] = (void *)item;
 
     return true;
 }
 
+/*
+* Adds a sequence of pointers to an arraylist at once
+* 
+* list  - the list where the pointers are to be added
+* items - the pointers to add
+* count - number of pointers
+* 
+* returns - whether the pointers were successfully added (the list is unchanged if not)
+*/
+bool arraylist_append(ptr_arraylist_t *list, void *const *items, uint count) {
+    if (!arraylist_reserve(list, count))
+        return false;
+
+    if (count > 0)
+        memcpy(arraylist_data(list) + list->count, items, count * sizeof(void *));
+    list->count += count;
+
+    return true;
+}
+
+/*
+* Removes a pointer from an arraylist, shifting the following ones down
+* The element destructor is not called, the caller takes ownership of the pointer
+* 
+* list  - the list to remove from
+* index - position of the pointer to remove
+* 
+* returns - the removed pointer (NULL if index is out of bounds)
+*/
+void *arraylist_remove(ptr_arraylist_t *list, uint index) {
+    if (!list || index >= list->count)
+        return NULL;
+
+    void **arr = arraylist_data(list);
+    void *ret = arr[index];
+
+    memmove(arr + index, arr + index + 1, (list->count - index - 1) * sizeof(void *));
+    list->count--;
+
+    return ret;
+}
+
 /*
 * Frees all memory allocated by arraylist_make()
 *
 * list - the arraylist to be deleted
 */
 void arraylist_destroy(ptr_arraylist_t *list) {
-    if (!list || !list->arr)
+    if (!list)
         return;
 
     if (list->elem_destr_func != NULL) {
+        void **arr = arraylist_data(list);
+
         for (uint i = 0; i < list->count; ++i)
-            (*list->elem_destr_func)(list->arr[i]);
+            (*list->elem_destr_func)(arr[i]);
     }
 
-    free(list->arr);
+    container_resize(list->allocator, list->heap, 0);
+    list->heap = NULL;
     list->count = list->size = 0;
 }
 
 /*
 * Creates a stack-allocated arraylist of bytes
+* The first BYTE_ARRAYLIST_INLINE_CNT bytes are stored in the list itself
 *
 * returns - the newly created arraylist
 */
 byte_arraylist_t byte_arraylist_make(void) {
+    return byte_arraylist_make_alloc(NULL);
+}
+
+/*
+* Creates a stack-allocated arraylist of bytes that gets its memory from an allocator
+* 
+* allocator - the allocator, has to outlive the list (NULL for realloc() and free())
+* 
+* returns - the newly created arraylist
+*/
+byte_arraylist_t byte_arraylist_make_alloc(const allocator_t *allocator) {
     byte_arraylist_t ret = {
-        .arr = calloc(CONTAINER_INIT_SIZE, sizeof(uchar)),
+        .heap = NULL,
         .count = 0,
-        .size = CONTAINER_INIT_SIZE,
+        .size = BYTE_ARRAYLIST_INLINE_CNT,
+        .allocator = allocator,
     };
 
     return ret;
 }
 
+/*
+* Makes room for more bytes in an arraylist, so that adding them can't fail
+* 
+* list  - the list to grow
+* extra - number of bytes to be added
+* 
+* returns - whether there is room for them
+*/
+bool byte_arraylist_reserve(byte_arraylist_t *list, uint extra) {
+    if (extra > UINT_MAX - list->count)
+        return false;
+
+    return container_reserve((void **)&list->heap, list->inline_arr, BYTE_ARRAYLIST_INLINE_CNT, &list->size,
+        list->count, list->count + extra, sizeof(uchar), list->allocator);
+}
+
+/*
+* Frees the unused room of an arraylist
+* 
+* list - the list to shrink
+* 
+* returns - whether the room was freed
+*/
+bool byte_arraylist_shrink(byte_arraylist_t *list) {
+    return container_shrink((void **)&list->heap, list->inline_arr, BYTE_ARRAYLIST_INLINE_CNT, &list->size,
+        list->count, sizeof(uchar), list->allocator);
+}
+
 /*
 * Adds a byte to an arraylist
 *
 * list - the list where the byte is to be added
 * item - the byte to add
 *
-* returns - whether the byte was successfully added
+* returns - whether the byte was successfully added (the list is unchanged if not)
 */
 bool byte_arraylist_push(byte_arraylist_t *list, uchar item) {
-    if (list->count == list->size) {
-        list->size *= 2;
-        uchar *new_arr = realloc(list->arr, list->size * sizeof(uchar));
-        if (list->size == 0 || !new_arr)
-            return false;
-        list->arr = new_arr;
-    }
+    if (list->count == list->size && !byte_arraylist_reserve(list, 1))
+        return false;
 
-    list->arr[list->count++] = item;
+    byte_arraylist_data(list)[list->count++] = item;
+
+    return true;
+}
+
+/*
+* Adds a sequence of bytes to an arraylist at once
+*
+* list - the list where the bytes are to be added
+* src  - the bytes to add
+* size - number of bytes
+*
+* returns - whether the bytes were successfully added (the list is unchanged if not)
+*/
+bool byte_arraylist_append(byte_arraylist_t *list, const void *src, uint size) {
+    if (!byte_arraylist_reserve(list, size))
+        return false;
+
+    if (size > 0)
+        memcpy(byte_arraylist_data(list) + list->count, src, size);
+    list->count += size;
 
     return true;
 }
@@ -261,10 +723,11 @@ bool byte_arraylist_push(byte_arraylist_t *list, uchar item) {
 * list - the arraylist to be deleted
 */
 void byte_arraylist_destroy(byte_arraylist_t *list) {
-    if (!list || !list->arr)
+    if (!list)
         return;
 
-    free(list->arr);
+    container_resize(list->allocator, list->heap, 0);
+    list->heap = NULL;
     list->count = list->size = 0;
 }
 
@@ -282,9 +745,20 @@ tokenized_str_t tok_str_make(const char *str, char delim) {
         .parts = arraylist_make(NULL),
     };
 
+    uint token_cnt = 1;
+
     if (!ret.str)
         return ret;
 
+    // room for all tokens at once, short strings don't allocate at all
+    for (uint i = 0; ret.str[i]; ++i)
+        token_cnt += ret.str[i] == delim;
+    if (!arraylist_reserve(&ret.parts, token_cnt)) {
+        free(ret.str);
+        ret.str = NULL;
+        return ret;
+    }
+
     arraylist_push(&ret.parts, ret.str);
     for (uint i = 0; ret.str[i]; ++i) {
         if (ret.str[i] == delim) {
@@ -298,6 +772,34 @@ tokenized_str_t tok_str_make(const char *str, char delim) {
     return ret;
 }
 
+/*
+* Joins tokens that are parts of one bracketed argument type, such as <ENUM a|b>,
+* back into a single token (the delimiters between them are restored)
+* 
+* tok_str - pointer to the tokenized string to modify
+* delim   - the delimiter the string was cut on
+*/
+void tok_str_merge_brackets(tokenized_str_t *tok_str, char delim) {
+    uint dst = 0;
+
+    void **parts = arraylist_data(&tok_str->parts);
+
+    for (uint src = 0; src < tok_str->parts.count; ++src) {
+        char *token = parts[src];
+
+        parts[dst++] = token;
+        if (token[0] != '<')
+            continue;
+        // the token ends right where the next one starts
+        while (token[strlen(token) - 1] != '>' && src + 1 < tok_str->parts.count) {
+            char *next = parts[++src];
+            next[-1] = delim;
+        }
+    }
+
+    tok_str->parts.count = dst;
+}
+
 /*
 * Returns a token from a tokenized string
 * 
@@ -310,7 +812,7 @@ char *tok_str_get(const tokenized_str_t *tok_str, uint index) {
     if (!tok_str || index >= tok_str->parts.count)
         return NULL;
 
-    return (char *)(tok_str->parts.arr[index]);
+    return (char *)(arraylist_data(&tok_str->parts)[index]);
 }
 
 /*
@@ -327,7 +829,7 @@ void tok_str_destroy(tokenized_str_t *tok_str) {
 }
 
 char *tok_str_reassemble(const tokenized_str_t *tok_str) {
-    const char *end_ptr = tok_str->parts.arr[tok_str->parts.count - 1];
+    const char *end_ptr = arraylist_data(&tok_str->parts)[tok_str->parts.count - 1];
     end_ptr += strlen(end_ptr);
     const uint size = (uint)(end_ptr - tok_str->str);
     char *ret = malloc(size + 1);
@@ -371,19 +873,22 @@ arg_bundle_t arg_bundle_make(void) {
 * size    - number of bytes to push
 * dynamic - if the data should be free()'d along with the bundle
 * 
-* returns - whether the push was successful
+* returns - whether the push was successful (the bundle is unchanged if not)
 */
 bool arg_bundle_add_(arg_bundle_t *bundle, const void *src, uint size, bool dynamic) {
     if (!bundle || !src || size == 0)
         return false;
+    // once there is room everywhere, none of the pushes below can fail
+    if (!arraylist_reserve(&bundle->args, 1)
+        || (dynamic && !arraylist_reserve(&bundle->dynamic_blocks, 1))
+        || !byte_arraylist_reserve(&bundle->data, size))
+        return false;
 
     arraylist_push(&bundle->args, (void *)bundle->data.count);
     if (dynamic) {
         arraylist_push(&bundle->dynamic_blocks, *(void **)src);
     }
-    for (uint i = 0; i < size; ++i) {
-        byte_arraylist_push(&bundle->data, ((uchar *)src)[i]);
-    }
+    byte_arraylist_append(&bundle->data, src, size);
     bundle->empty = false;
 
     return true;
@@ -410,8 +915,9 @@ uint arg_bundle_get_(arg_bundle_t *bundle, void *dst, uint size) {
         return 0;
     }
 
-    const uchar *src = bundle->data.arr + (uint)bundle->args.arr[bundle->index++];
-    const uint iter_limit = (bundle->data.arr + bundle->data.count) - src;
+    const uchar *data = byte_arraylist_data(&bundle->data);
+    const uchar *src = data + (uint)arraylist_data(&bundle->args)[bundle->index++];
+    const uint iter_limit = (data + bundle->data.count) - src;
 
     for (uint i = 0; i < size && i < iter_limit; ++i) {
         ((uchar *)dst)[i] = src[i];
@@ -440,7 +946,7 @@ void *arg_bundle_get_raw_(arg_bundle_t *bundle) {
         return (void *)&out_of_args;
     }
 
-    return bundle->data.arr + (uint)bundle->args.arr[bundle->index++];
+    return byte_arraylist_data(&bundle->data) + (uint)arraylist_data(&bundle->args)[bundle->index++];
 }
 
 /*
@@ -462,14 +968,15 @@ bool arg_bundle_unpack_one(arg_bundle_t *bundle, void *dst_) {
         bundle->empty = true;
         return false;
     }
-    const uchar *end_ptr;
-    const uchar *src = bundle->data.arr + (uint)bundle->args.arr[bundle->index++];
+    const uchar *end_ptr, *data = byte_arraylist_data(&bundle->data);
+    void *const *offsets = arraylist_data(&bundle->args);
+    const uchar *src = data + (uint)offsets[bundle->index++];
     uchar *dst = (uchar *)dst_;
 
     if (bundle->index != bundle->args.count)
-        end_ptr = bundle->data.arr + (uint)bundle->args.arr[bundle->index];
+        end_ptr = data + (uint)offsets[bundle->index];
     else
-        end_ptr = bundle->data.arr + bundle->data.count;
+        end_ptr = data + bundle->data.count;
 
     while (src != end_ptr)
         *dst++ = *src++;
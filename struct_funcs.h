@@ -2,22 +2,44 @@
 #include "typedefs.h"
 
 #define CONTAINER_INIT_SIZE 2
+#define CMD_MAP_MIGRATE_STEP 4
 #define UNREF(expr) (void)(expr)
 
+uint hash(const char *str);
+ullong hash_bytes(const void *data, uint size);
+
 cmd_map_t cmd_map_make(void);
 bool cmd_map_add(cmd_map_t *map, const command_t *cmd);
 const command_t *cmd_map_find(const cmd_map_t *map, const char *key);
+const command_t *cmd_map_next(const cmd_map_t *map, uint *iter);
+bool cmd_map_remove(cmd_map_t *map, const char *key);
+void cmd_map_migrate(cmd_map_t *map, uint steps);
+bool cmd_map_reorder(cmd_map_t *map);
 void cmd_map_destroy(cmd_map_t *map);
 
 ptr_arraylist_t arraylist_make(destroy_func_t elem_destr_func);
+ptr_arraylist_t arraylist_make_alloc(destroy_func_t elem_destr_func, const allocator_t *allocator);
+bool arraylist_reserve(ptr_arraylist_t *list, uint extra);
+bool arraylist_shrink(ptr_arraylist_t *list);
 bool arraylist_push(ptr_arraylist_t *list, const void *item);
+bool arraylist_append(ptr_arraylist_t *list, void *const *items, uint count);
+void *arraylist_remove(ptr_arraylist_t *list, uint index);
 void arraylist_destroy(ptr_arraylist_t *list);
 
 byte_arraylist_t byte_arraylist_make(void);
+byte_arraylist_t byte_arraylist_make_alloc(const allocator_t *allocator);
+bool byte_arraylist_reserve(byte_arraylist_t *list, uint extra);
+bool byte_arraylist_shrink(byte_arraylist_t *list);
 bool byte_arraylist_push(byte_arraylist_t *list, uchar item);
+bool byte_arraylist_append(byte_arraylist_t *list, const void *src, uint size);
 void byte_arraylist_destroy(byte_arraylist_t *list);
 
+// the elements of a list, valid until the list grows, shrinks or is moved
+#define arraylist_data(list) ((list)->heap ? (list)->heap : (list)->inline_arr)
+#define byte_arraylist_data(list) ((list)->heap ? (list)->heap : (list)->inline_arr)
+
 tokenized_str_t tok_str_make(const char *str, char delim);
+void tok_str_merge_brackets(tokenized_str_t *tok_str, char delim);
 char *tok_str_get(const tokenized_str_t *tok_str, uint index);
 void tok_str_destroy(tokenized_str_t *tok_str);
 char *tok_str_reassemble(const tokenized_str_t *tok_str);
@@ -0,0 +1,144 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "sync_funcs.h"
+
+#pragma warning (disable: 5045)
+
+/*
+* Initializes a readers-writer lock
+* Writers are preferred: once a writer is waiting, new readers have to wait for it
+* 
+* lock - pointer to the lock to initialize
+* 
+* returns - whether the lock was successfully initialized
+*/
+bool rwlock_init(cmd_rwlock_t *lock) {
+    if (!lock)
+        return false;
+
+    lock->readers = lock->writers_waiting = 0;
+    lock->writing = false;
+
+    if (mtx_init(&lock->mutex, mtx_plain) != thrd_success)
+        return false;
+    if (cnd_init(&lock->readers_done) != thrd_success) {
+        mtx_destroy(&lock->mutex);
+        return false;
+    }
+    if (cnd_init(&lock->writer_done) != thrd_success) {
+        cnd_destroy(&lock->readers_done);
+        mtx_destroy(&lock->mutex);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+* Acquires a lock for reading
+* Any number of readers can hold the lock at the same time
+* 
+* lock - pointer to the lock
+*/
+void rwlock_read_lock(cmd_rwlock_t *lock) {
+    mtx_lock(&lock->mutex);
+    while (lock->writing || lock->writers_waiting > 0)
+        cnd_wait(&lock->writer_done, &lock->mutex);
+    lock->readers++;
+    mtx_unlock(&lock->mutex);
+}
+
+/*
+* Releases a lock acquired with rwlock_read_lock()
+* 
+* lock - pointer to the lock
+*/
+void rwlock_read_unlock(cmd_rwlock_t *lock) {
+    mtx_lock(&lock->mutex);
+    if (--lock->readers == 0)
+        cnd_signal(&lock->readers_done);
+    mtx_unlock(&lock->mutex);
+}
+
+/*
+* Acquires a lock for writing
+* Waits until all readers and the previous writer are done
+* 
+* lock - pointer to the lock
+*/
+void rwlock_write_lock(cmd_rwlock_t *lock) {
+    mtx_lock(&lock->mutex);
+    lock->writers_waiting++;
+    while (lock->writing || lock->readers > 0)
+        cnd_wait(&lock->readers_done, &lock->mutex);
+    lock->writers_waiting--;
+    lock->writing = true;
+    mtx_unlock(&lock->mutex);
+}
+
+/*
+* Releases a lock acquired with rwlock_write_lock()
+* 
+* lock - pointer to the lock
+*/
+void rwlock_write_unlock(cmd_rwlock_t *lock) {
+    mtx_lock(&lock->mutex);
+    lock->writing = false;
+    // wake both waiting readers and the next writer
+    cnd_broadcast(&lock->writer_done);
+    cnd_signal(&lock->readers_done);
+    mtx_unlock(&lock->mutex);
+}
+
+/*
+* Frees all resources of a lock initialized by rwlock_init()
+* The lock must not be held by anyone
+* 
+* lock - pointer to the lock to be deleted
+*/
+void rwlock_destroy(cmd_rwlock_t *lock) {
+    if (!lock)
+        return;
+
+    cnd_destroy(&lock->writer_done);
+    cnd_destroy(&lock->readers_done);
+    mtx_destroy(&lock->mutex);
+}
+
+/*
+* Returns the current time of a monotonic clock in nanoseconds
+* Only differences between two calls are meaningful; the clock isn't
+* affected by changes of the system time, so it is safe for deadlines
+*/
+ullong time_now_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    // benign race: every thread computes the same value
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    // split up so that the multiplication doesn't overflow
+    return (ullong)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL
+        + (ullong)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / (ullong)frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ullong)ts.tv_sec * 1000000000ULL + (ullong)ts.tv_nsec;
+#endif
+}
+
+// Returns the current calendar time in nanoseconds since the epoch, for timestamps that are stored
+ullong time_wall_ns(void) {
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (ullong)ts.tv_sec * 1000000000ULL + (ullong)ts.tv_nsec;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "typedefs.h"
+
+bool rwlock_init(cmd_rwlock_t *lock);
+void rwlock_read_lock(cmd_rwlock_t *lock);
+void rwlock_read_unlock(cmd_rwlock_t *lock);
+void rwlock_write_lock(cmd_rwlock_t *lock);
+void rwlock_write_unlock(cmd_rwlock_t *lock);
+void rwlock_destroy(cmd_rwlock_t *lock);
+ullong time_now_ns(void);
+ullong time_wall_ns(void);
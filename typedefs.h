@@ -1,5 +1,8 @@
 #pragma once
 #include <stdbool.h>
+#include <stdio.h>
+#include <threads.h>
+#include <stdatomic.h>
 
 #pragma warning (disable: 4820)
 
@@ -17,20 +20,132 @@ typedef void (*destroy_func_t)(void *);
 //    uchar flags[2];
 //} obj_data_t;
 
+// how an argument's token is turned into its stored value
+typedef enum arg_kind_t_ {
+    ARG_SCANF,      // sscanf() with the node's format
+    ARG_STRING,     // sscanf(), the result is stored as a heap copy
+    ARG_FLOAT,      // parse_float()
+    ARG_DOUBLE,     // parse_double()
+    ARG_ENUM,       // one of the node's words, stored as its uint index
+    ARG_INT_LIST,   // all remaining tokens, as an arg_list_t of signed integers
+    ARG_UINT_LIST,  // all remaining tokens, as an arg_list_t of unsigned integers
+    ARG_BLOB,       // a length, followed by that many raw bytes read from the input stream, as an arg_blob_t
+} arg_kind_t;
+
+// how a constrained argument's value is checked, see arg_constraint_make()
+typedef enum arg_check_t_ {
+    CHECK_SIGNED,   // a signed integer (or each list element) within a range
+    CHECK_UNSIGNED, // an unsigned integer (or each list element) within a range
+    CHECK_REAL,     // a <FLOAT> or <DOUBLE> within a range
+    CHECK_LENGTH,   // the length of a <STRING>
+    CHECK_PATTERN,  // a <MATCH /regex/> or <GLOB pattern> run through its DFA
+} arg_check_t;
+
+// one state of the NFA a pattern is parsed into, see arg_pattern.c
+// a state either consumes one byte of set and moves to out[0],
+// or moves to out[0] and out[1] (if not -1) without consuming anything
+typedef struct pattern_state_t_ {
+    uchar set[32];
+    int out[2];
+    bool is_set;
+} pattern_state_t;
+
+// part of an NFA under construction, end is an epsilon state with no way out yet
+typedef struct pattern_frag_t_ {
+    int start, end;
+} pattern_frag_t;
+
+typedef struct pattern_parser_t_ {
+    pattern_state_t *states;
+    uint count, size, depth;
+    const char *pos, *end;
+    bool glob, ok;
+} pattern_parser_t;
+
+// table-driven DFA of a pattern: bytes map to classes that no pattern state tells apart,
+// next holds class_cnt successors per state; state 0 is the dead state and 1 is the start
+typedef struct arg_dfa_t_ {
+    uchar classes[256];
+    uint class_cnt, state_cnt;
+    ushort *next;
+    bool *accept;
+} arg_dfa_t;
+
+// bounds of an argument such as <INT 0..100> or <STRING max=64>
+// integers and lengths pass if (value - min) <= span in unsigned arithmetic,
+// so every check is a single comparison
+typedef struct arg_constraint_t_ {
+    arg_check_t check;
+    uint size;
+    ullong min, span;
+    double real_min, real_max;
+    arg_dfa_t *dfa;
+    // parses rejected by this constraint, see cmd_registry_rejections()
+    atomic_ullong rejected;
+} arg_constraint_t;
+
+// nodes of parameterized types such as <ENUM a|b> or <INT 0..9> are created
+// for each command; they are the only ones with is_dynamic_memory set
 typedef struct arg_node_t_ {
     const char *key, *format;
     uint size;
+    arg_kind_t kind;
+    uint elem_size;
+    void *extra;
+    bool is_dynamic_memory;
+    arg_constraint_t *constraint;
 } arg_node_t;
 
+// the words of an <ENUM> argument placed by a minimal perfect hash
+// a word's bucket holds either its slot (encoded as -slot - 1)
+// or a seed that maps all words of the bucket to distinct free slots
+typedef struct arg_enum_t_ {
+    char **words;
+    uint *values;
+    int *buckets;
+    uint count;
+} arg_enum_t;
+
+// value of a list-type argument such as <INT...>
+// data points to count elements of the list's element type
+typedef struct arg_list_t_ {
+    void *data;
+    uint count;
+} arg_list_t;
+
+// value of a <BLOB> argument: the raw payload that followed the command line
+typedef struct arg_blob_t_ {
+    void *data;
+    size_t size;
+} arg_blob_t;
+
+// memory source of a container, NULL stands for realloc() and free()
+typedef struct allocator_t_ {
+    // resizes a block, NULL means a new one; returns NULL on failure, leaving the block as it was
+    void *(*resize)(void *ctx, void *block, size_t size);
+    void (*release)(void *ctx, void *block);
+    void *ctx;
+} allocator_t;
+
+// elements stored in the list itself before it allocates anything
+#define ARRAYLIST_INLINE_CNT 4
+#define BYTE_ARRAYLIST_INLINE_CNT 32
+
+// Elements are reached through arraylist_data(), they are only on the heap once they outgrow inline_arr
 typedef struct ptr_arraylist_t_ {
-    void **arr;
+    void **heap;
     uint size, count;
     destroy_func_t elem_destr_func;
+    const allocator_t *allocator;
+    void *inline_arr[ARRAYLIST_INLINE_CNT];
 } ptr_arraylist_t;
 
+// Bytes are reached through byte_arraylist_data(), see ptr_arraylist_t
 typedef struct byte_arraylist_t_ {
-    uchar *arr;
+    uchar *heap;
     uint size, count;
+    const allocator_t *allocator;
+    uchar inline_arr[BYTE_ARRAYLIST_INLINE_CNT];
 } byte_arraylist_t;
 
 typedef struct arg_bundle_t_ {
@@ -43,23 +158,120 @@ typedef struct arg_bundle_t_ {
 
 typedef void (*cmd_act_t)(arg_bundle_t *);
 
+// priority class of a command, see cmd_registry_register_prio()
+// NORMAL is 0 so that zeroed procs get it; the order classes are served in is in cmd_shard.c
+typedef enum cmd_prio_t_ {
+    CMD_PRIO_NORMAL,
+    CMD_PRIO_HIGH,
+    CMD_PRIO_LOW,
+    CMD_PRIO_CNT,
+} cmd_prio_t;
+
+// what happens to a call of a priority class whose shard queue is full
+typedef enum cmd_queue_policy_t_ {
+    QUEUE_BLOCK,    // the submitting thread waits, so its input source isn't read meanwhile
+    QUEUE_SHED,     // the call is dropped and counted
+} cmd_queue_policy_t;
+
+// pure_ttl_ms is how long the output of a pure command is memoized, 0 if the command isn't pure
 typedef struct cmd_proc_t_ {
     cmd_act_t action;
     void *static_data;
+    cmd_prio_t prio;
+    uint pure_ttl_ms;
 } cmd_proc_t;
 
+// many invocations of one command at once, as one column per argument
+// column i holds count values of the i-th argument's type
+typedef struct cmd_batch_t_ {
+    void *static_data;
+    void **columns;
+    uint *elem_sizes;
+    uint count, column_cnt;
+} cmd_batch_t;
+
+typedef void (*cmd_batch_act_t)(cmd_batch_t *);
+
+// a command's batch handler, called when max_size invocations are collected
+// or the oldest collected invocation is max_delay_ms old
+typedef struct cmd_batch_proc_t_ {
+    cmd_batch_act_t action;
+    void *static_data;
+    uint max_size, max_delay_ms;
+} cmd_batch_proc_t;
+
+typedef void *(*cmd_shard_init_t)(uint shard, void *static_data);
+typedef void (*cmd_shard_free_t)(void *shard_data);
+
+// routes invocations of a command to executor shards by the value of its key_arg-th argument
+// data holds one static_data instance per shard, made by a cmd_shard_init_t
+typedef struct cmd_shard_proc_t_ {
+    void **data;
+    cmd_shard_free_t free_data;
+    uint data_cnt, key_arg, key_size;
+    arg_kind_t key_kind;
+} cmd_shard_proc_t;
+
+// how the arguments of a command lie in its bundles, one entry per argument
+// sizes hold the value size, or the element size of lists
+typedef struct cmd_frame_layout_t_ {
+    arg_kind_t *kinds;
+    uint *sizes;
+    uint count;
+} cmd_frame_layout_t;
+
+// id is unique for the lifetime of the process, it identifies a command without pointing to it
 typedef struct command_t_ {
     char *name;
-    uint arg_size, arg_cnt;
+    uint id, arg_size, arg_cnt;
     cmd_proc_t action;
+    cmd_batch_proc_t batch;
+    cmd_shard_proc_t shard;
+    cmd_frame_layout_t memo_layout;
     arg_node_t **syntax;
     ptr_arraylist_t subcommands;
+    atomic_uint hits;
     bool is_dynamic_memory;
 } command_t;
 
+// hot copy of a command for the parser, one cache line with the tags of up to 16 (HOT_TAGS) arguments
+// tags hold each argument's arg_kind_t, or HOT_TAG_SUBCOMMAND for the position of a subcommand;
+// the name, syntax nodes and batch and shard info are only in cold, the command in the tree
+typedef struct cmd_hot_t_ {
+    cmd_proc_t proc;
+    const command_t *cold;
+    uint name_hash, arg_cnt;
+    uint first_child, child_cnt;
+    uchar tags[16];
+} cmd_hot_t;
+
+// hot copies of all commands of a registry, built on first use and updated by each change of the tree
+// the subcommands of a command lie next to each other from its first_child on, in a block of slots
+// sized to the next power of two; free[c] links the unused blocks of 2^c slots through their
+// first_child (slot index + 1, 0 ends the list); count slots are in use or linked, capacity allocated;
+// roots is an open addressing index of the root commands holding their slot index + 1 (0 if empty)
+typedef struct cmd_hot_table_t_ {
+    cmd_hot_t *cmds;
+    void *block;
+    uint count, capacity;
+    uint free[32];
+    uint *roots;
+    uint root_mask, root_cnt;
+} cmd_hot_table_t;
+
+// called when a command moves from one bucket of a hashmap to another
+typedef void (*cmd_move_t)(const command_t *from, const command_t *to, void *data);
+
+// while a resize is in progress both tables coexist:
+// old_map buckets below migrate_index have already been moved to map
+// removed entries leave tombstones behind, counted in tombstones
+// moved (can be NULL) is told about every command a resize or reorder moves, with moved_data
 typedef struct cmd_map_t_ {
-    command_t *map;
-    uint size, count;
+    command_t *map, *old_map;
+    uint size, count, tombstones;
+    uint old_size, migrate_index;
+    cmd_move_t moved;
+    void *moved_data;
 } cmd_map_t;
 
 typedef struct tokenized_str_t_ {
@@ -67,3 +279,439 @@ typedef struct tokenized_str_t_ {
     ptr_arraylist_t parts;
 } tokenized_str_t;
 
+
+typedef struct cmd_rwlock_t_ {
+    mtx_t mutex;
+    cnd_t readers_done, writer_done;
+    uint readers, writers_waiting;
+    bool writing;
+} cmd_rwlock_t;
+
+// longest command name kept for a trace span, including the NUL
+#define TRACE_NAME_LEN 20
+
+// a command string resolved against the command tree of a registry, ready to be run
+// cmd may only be dereferenced while the registry is locked, everything else is a copy;
+// trace_name is only filled in while tracing is on; blob_arg is the position of the <BLOB>
+// argument plus one (0 if there is none), its payload is allocated once blob_size bytes are read;
+// memo_key is made for calls of pure commands while the memo is on and is freed with args
+typedef struct cmd_parsed_t_ {
+    struct cmd_registry_t_ *registry;
+    const command_t *cmd;
+    cmd_proc_t proc;
+    cmd_batch_proc_t batch;
+    cmd_shard_proc_t shard;
+    arg_bundle_t args;
+    size_t blob_size;
+    const uchar *memo_key;
+    uint cmd_id, generation, blob_arg, memo_key_len;
+    char trace_name[TRACE_NAME_LEN];
+} cmd_parsed_t;
+
+typedef enum cmd_parse_status_t_ {
+    CMD_PARSE_OK,
+    CMD_PARSE_UNKNOWN_COMMAND,
+    CMD_PARSE_MISSING_ARGUMENT,
+    CMD_PARSE_BAD_VALUE,
+    CMD_PARSE_CONSTRAINT,
+    CMD_PARSE_INTERNAL,
+    CMD_PARSE_STATUS_CNT
+} cmd_parse_status_t;
+
+// what cmd_parse_tokens() is allowed to do besides parsing
+typedef enum cmd_parse_flags_t_ {
+    PARSE_COUNT_HITS = 1,   // count the lookups towards cmd_registry_reorder() and the constraint rejections
+    PARSE_BLOBS = 2,        // accept <BLOB> arguments, the caller reads their payload
+} cmd_parse_flags_t;
+
+// reads exactly size bytes of a <BLOB> payload from source into dst, returns whether it could
+typedef bool (*cmd_payload_read_t)(void *source, void *dst, size_t size);
+
+// writes size bytes of introspection output to sink, returns whether it could
+typedef bool (*cmd_write_t)(void *sink, const void *data, size_t size);
+
+typedef enum cmd_introspect_format_t_ {
+    INTROSPECT_JSON,    // one JSON document
+    INTROSPECT_BINARY,  // varint-encoded records, see cmd_introspect.c
+} cmd_introspect_format_t;
+
+// state of one introspection stream, output is passed to write in chunks of up to 8 KiB
+typedef struct cmd_introspect_t_ {
+    cmd_write_t write;
+    void *sink;
+    cmd_introspect_format_t format;
+    uint len, records;
+    bool failed;
+    uchar buffer[8192];
+} cmd_introspect_t;
+
+typedef struct cmd_parse_error_t_ {
+    cmd_parse_status_t status;
+    char message[128];
+} cmd_parse_error_t;
+
+typedef struct cmd_cache_entry_t_ {
+    atomic_uint refs;
+    uint key_len, last_used;
+    ullong key_hash;
+    size_t memory;
+    cmd_parsed_t parsed;
+    char key[];
+} cmd_cache_entry_t;
+
+typedef struct cmd_cache_stats_t_ {
+    ullong hits, misses, insertions, evictions, invalidations;
+    uint entries, capacity;
+    size_t memory;
+} cmd_cache_stats_t;
+
+// memoized output of a pure command, key holds the command's address and its encoded arguments
+// the entries of a shard form a hash chain per bucket and one LRU list, most recently used first
+typedef struct cmd_memo_entry_t_ {
+    struct cmd_memo_entry_t_ *chain, *prev, *next;
+    atomic_uint refs;
+    uint key_len, out_len, generation;
+    ullong key_hash, expires_ns;
+    uchar data[];   // key_len bytes of the key, then out_len bytes of output
+} cmd_memo_entry_t;
+
+typedef struct cmd_memo_stats_t_ {
+    ullong hits, misses, insertions, evictions, expirations, invalidations;
+    uint entries, capacity;
+    size_t memory;
+} cmd_memo_stats_t;
+
+typedef struct cmd_memo_shard_t_ {
+    mtx_t lock;
+    cmd_memo_entry_t **buckets;
+    cmd_memo_entry_t *head, *tail;
+    uint bucket_mask;
+    cmd_memo_stats_t stats;
+} cmd_memo_shard_t;
+
+// output cache of pure commands, split into independently locked LRU shards by key hash
+typedef struct cmd_memo_t_ {
+    cmd_memo_shard_t shards[16];
+} cmd_memo_t;
+
+// output of cmd_printf() collected while a pure command runs, see cmd_capture_begin()
+typedef struct cmd_capture_t_ {
+    byte_arraylist_t out;
+    struct cmd_capture_t_ *outer;
+    bool lost;
+} cmd_capture_t;
+
+// set-associative cache of parse results, keyed by the raw command string
+typedef struct cmd_cache_t_ {
+    cmd_cache_entry_t **slots;
+    uint set_cnt, tick;
+    mtx_t lock;
+    cmd_cache_stats_t stats;
+} cmd_cache_t;
+
+// source is kept to parse the line again once the command tree changes
+typedef struct cmd_script_record_t_ {
+    cmd_parsed_t parsed;
+    char *source;
+    uint line;
+} cmd_script_record_t;
+
+typedef struct cmd_script_error_t_ {
+    uint line;
+    cmd_parse_error_t error;
+} cmd_script_error_t;
+
+// a command file parsed once against the command tree of a registry
+// only scripts without errors can be run
+typedef struct cmd_script_t_ {
+    struct cmd_registry_t_ *registry;
+    cmd_script_record_t *records;
+    cmd_script_error_t *errors;
+    uint count, size, error_cnt, error_size;
+} cmd_script_t;
+
+// number of valid lines calling one command, found by the file validator
+typedef struct cmd_validate_stat_t_ {
+    const command_t *cmd;
+    char *name;
+    ullong count;
+} cmd_validate_stat_t;
+
+// the part of a command file checked by one validator thread
+typedef struct cmd_validate_chunk_t_ {
+    struct cmd_registry_t_ *registry;
+    const char *begin, *end;
+    uint lines, max_errors;
+    ullong skipped, invalid[CMD_PARSE_STATUS_CNT];
+    cmd_script_error_t *errors;
+    uint error_cnt, error_size;
+    cmd_validate_stat_t *stats;
+    uint stat_cnt, stat_size;
+} cmd_validate_chunk_t;
+
+// result of a dry run of a command file, see cmd_validate_file()
+typedef struct cmd_validation_t_ {
+    bool opened;
+    ullong lines, valid, skipped, invalid[CMD_PARSE_STATUS_CNT];
+    ullong elapsed_ns;
+    cmd_script_error_t *errors;
+    uint error_cnt;
+    cmd_validate_stat_t *stats;
+    uint stat_cnt;
+} cmd_validation_t;
+
+// collects consecutive invocations of a command with a batch handler
+typedef struct cmd_batcher_t_ {
+    mtx_t lock;
+    atomic_bool pending;
+    uint cmd_id;
+    cmd_batch_proc_t proc;
+    cmd_batch_t batch;
+    ptr_arraylist_t owned_blocks, cache_refs, responses;
+    ullong first_ns;
+} cmd_batcher_t;
+
+// the answer to a command server client's call that is sent once the call's job or batch has run
+// out holds the output of the run, done is set last by the thread that ran it (see cmd_response_take())
+typedef struct cmd_response_t_ {
+    struct cmd_session_t_ *session;
+    byte_arraylist_t out;
+    atomic_bool done;
+    bool ok;
+    int wake_fd;
+    struct cmd_response_t_ *next;
+} cmd_response_t;
+
+// an invocation queued on a shard
+// owner is the cache entry parsed belongs to, if any; owned tells whether the job frees parsed;
+// response receives the output of the call (can be NULL)
+typedef struct cmd_shard_job_t_ {
+    cmd_parsed_t parsed;
+    cmd_cache_entry_t *owner;
+    cmd_response_t *response;
+    bool owned;
+} cmd_shard_job_t;
+
+// a ring buffer of size jobs
+typedef struct cmd_shard_queue_t_ {
+    cmd_shard_job_t *jobs;
+    uint head, count, size;
+} cmd_shard_queue_t;
+
+// counters of the calls of one priority class
+typedef struct cmd_queue_class_stats_t_ {
+    ullong queued, run, shed, blocked;
+    uint depth;
+} cmd_queue_class_stats_t;
+
+typedef struct cmd_queue_stats_t_ {
+    cmd_queue_class_stats_t classes[CMD_PRIO_CNT];
+} cmd_queue_stats_t;
+
+// one executor thread with a queue per priority class
+// count is the number of jobs in all queues; passed counts the jobs a class
+// has had in a row while a lower class was waiting
+typedef struct cmd_shard_t_ {
+    mtx_t lock;
+    cnd_t ready, idle, room;
+    cmd_shard_queue_t queues[CMD_PRIO_CNT];
+    uint count;
+    uint passed[CMD_PRIO_CNT];
+    cmd_queue_stats_t stats;
+    bool busy, stop;
+    thrd_t thread;
+} cmd_shard_t;
+
+// limits hold the most queued jobs of each class per shard, 0 for no limit
+typedef struct cmd_shards_t_ {
+    cmd_shard_t *shards;
+    uint count;
+    uint limits[CMD_PRIO_CNT];
+    cmd_queue_policy_t policies[CMD_PRIO_CNT];
+} cmd_shards_t;
+
+typedef struct cmd_journal_cmd_t_ {
+    uint cmd_id, id;
+    cmd_frame_layout_t layout;
+} cmd_journal_cmd_t;
+
+// append-only log of executed commands
+// records are serialized into buffer and written to file by the flusher thread
+// cmds is an open addressing table of the commands that already have a journal id, keyed by command id
+typedef struct cmd_journal_t_ {
+    FILE *file;
+    mtx_t lock;
+    cnd_t wake;
+    thrd_t flusher;
+    byte_arraylist_t buffer;
+    cmd_journal_cmd_t *cmds;
+    uint cmd_size, cmd_count, next_id, flush_ms;
+    bool stop;
+    ullong records;
+} cmd_journal_t;
+
+typedef enum cmd_journal_rec_type_t_ {
+    JOURNAL_REC_COMMAND = 1,
+    JOURNAL_REC_CALL = 2,
+} cmd_journal_rec_type_t;
+
+// one decoded journal record, data points into the journal's bytes
+// COMMAND: id and the command's name path in data; CALL: id, timestamp and the argument frame in data
+typedef struct cmd_journal_rec_t_ {
+    cmd_journal_rec_type_t type;
+    uint id, len;
+    ullong timestamp;
+    const uchar *data;
+} cmd_journal_rec_t;
+
+// a command of a journal being replayed, resolved in the replaying registry
+typedef struct cmd_replay_cmd_t_ {
+    cmd_parsed_t parsed;
+    cmd_frame_layout_t layout;
+} cmd_replay_cmd_t;
+
+// a scheduled command; timers live in one array and are linked by index
+// into circular lists, one per wheel slot (or into the free list)
+typedef struct cmd_timer_t_ {
+    cmd_cache_entry_t *entry;
+    ullong due;
+    uint period, generation;
+    uint next, prev;
+    ushort level, slot;
+} cmd_timer_t;
+
+// hierarchical timer wheel, see cmd_timer.c
+typedef struct cmd_timer_wheel_t_ {
+    cmd_timer_t *timers;
+    uint size, count, free_head;
+    uint *slots;
+    uint level_count[4]; // TIMER_LEVELS
+    ullong now, start_ns;
+    mtx_t lock;
+} cmd_timer_wheel_t;
+
+// a timer that is due, handed from the wheel to the caller of cmd_timers_poll()
+typedef struct cmd_timer_fired_t_ {
+    ullong id;
+    cmd_cache_entry_t *entry;
+} cmd_timer_fired_t;
+
+// input of cmd_loop(), read in blocks so that waiting for it can time out
+typedef struct cmd_line_reader_t_ {
+    char buffer[4096];
+    uint begin, end;
+    bool eof;
+} cmd_line_reader_t;
+
+// header of a shared-memory command ring, followed by its data area of capacity bytes
+// head and tail are byte positions that only grow: producers reserve frames by moving head,
+// the processor frees consumed ones by moving tail; the pads keep them on separate cache lines
+typedef struct cmd_ring_shared_t_ {
+    ullong magic, capacity;
+    uchar pad0[48];
+    atomic_ullong head;
+    uchar pad1[56];
+    atomic_ullong tail;
+    atomic_uint sleeping, wake_seq, stopped;
+    uchar pad2[44];
+} cmd_ring_shared_t;
+
+// a frame in a ring's data area, followed by the command string with its NUL and the <BLOB> payload
+// length is the unaligned frame size and is written last; 0 means the frame isn't reserved yet,
+// RING_BUSY with the aligned frame size means it is reserved but still being written by process pid
+typedef struct cmd_ring_frame_t_ {
+    atomic_uint length;
+    uint cmd_len, pid;
+} cmd_ring_frame_t;
+
+// a process's mapping of a command ring, either the processor's or a producer's
+typedef struct cmd_ring_t_ {
+    cmd_ring_shared_t *shared;
+    uchar *data;
+    size_t map_size;
+    char *name;
+    bool owner;
+    ullong commands, batches, sleeps;
+    // the position the processor found an unfinished frame at and when it last checked
+    // whether the frame's producer still runs (stall_ns is 0 if none)
+    ullong stall_pos, stall_ns;
+} cmd_ring_t;
+
+// the unread part of a frame's payload, see cmd_payload_read_t
+typedef struct cmd_ring_payload_t_ {
+    const uchar *data;
+    size_t left;
+} cmd_ring_payload_t;
+
+// a client connection of the command server, see cmd_current_session()
+// in holds received bytes from in_begin on that haven't been executed yet,
+// out holds responses from out_begin on that haven't been sent yet
+// events are the epoll events the socket is watched for
+// need is the number of bytes from in_begin on the next command waits for (its line and payload),
+// responses are the answers that wait for a job or batch, in order, and the ones queued behind them
+typedef struct cmd_session_t_ {
+    int fd, wake_fd;
+    uint id, events;
+    byte_arraylist_t in, out;
+    uint in_begin, out_begin, need;
+    ullong commands, errors;
+    void *data;
+    cmd_response_t *responses, *responses_last, *deferred;
+    uint response_cnt;
+    bool closing, pending;
+    struct cmd_session_t_ *next, *prev;
+} cmd_session_t;
+
+// a Unix domain socket server running commands for many clients on one epoll loop
+// free_data is called with the data of each session that ends (can be NULL)
+typedef struct cmd_server_t_ {
+    int listen_fd, epoll_fd, wake_fd;
+    char *path;
+    cmd_session_t *sessions;
+    uint session_cnt, next_id;
+    destroy_func_t free_data;
+    atomic_bool stop;
+} cmd_server_t;
+
+// an independent set of commands with everything needed to run them
+// the default one is used by the functions without a registry parameter
+typedef struct cmd_registry_t_ {
+    cmd_map_t map;
+    cmd_rwlock_t lock;
+    atomic_uint generation;
+    cmd_cache_t *cache;
+    cmd_memo_t *memo;
+    cmd_batcher_t batcher;
+    cmd_shards_t shards;
+    cmd_journal_t *journal;
+    cmd_timer_wheel_t timers;
+    _Atomic(cmd_hot_table_t *) hot;
+    mtx_t hot_lock;
+} cmd_registry_t;
+
+typedef enum cmd_trace_stage_t_ {
+    TRACE_EXECUTE,
+    TRACE_TOKENIZE,
+    TRACE_LOOKUP,
+    TRACE_CONVERT,
+    TRACE_ACTION,
+    TRACE_REGISTER,
+    TRACE_STAGE_CNT,
+} cmd_trace_stage_t;
+
+// one finished span; seq is the event's index in its ring + 1, or 0 while it is being written
+typedef struct cmd_trace_event_t_ {
+    atomic_uint seq;
+    uint dur_ns;
+    ullong start_ns;
+    cmd_trace_stage_t stage;
+    char name[TRACE_NAME_LEN];
+} cmd_trace_event_t;
+
+// spans of one thread, written only by that thread and read by the exporter
+typedef struct cmd_trace_ring_t_ {
+    cmd_trace_event_t *events;
+    atomic_uint head;
+    uint tid;
+    struct cmd_trace_ring_t_ *next;
+} cmd_trace_ring_t;